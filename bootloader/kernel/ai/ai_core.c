@@ -3,16 +3,18 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "../core/smp.h"
+#include "gemv.h"
 
 // Neural Network Layer
 typedef struct {
-    float* weights;
+    float* weights;          // output_size rows of input_size (row j feeds output j)
     float* biases;
     int input_size;
     int output_size;
     
-    // Activation function
-    float (*activation)(float);
+    // Applied by the dense kernel as each output is produced
+    gemv_act_t activation;
 } nn_layer_t;
 
 // Neural Network
@@ -26,6 +28,12 @@ typedef struct {
     float* training_inputs;
     float* training_outputs;
     int training_samples;
+    
+    // Inference scratch: two activation buffers of max_width floats,
+    // sized once at creation so predictions never allocate
+    float* scratch[2];
+    int max_width;
+    spinlock_t lock;
 } neural_network_t;
 
 // AI Prediction Context
@@ -80,6 +88,7 @@ void ai_core_init(void);
 neural_network_t* ai_create_network(int* layer_sizes, int num_layers);
 void ai_train_network(neural_network_t* nn, float* inputs, float* outputs, int epochs);
 float* ai_predict(neural_network_t* nn, float* inputs);
+void ai_predict_into(neural_network_t* nn, const float* inputs, float* outputs);
 void ai_destroy_network(neural_network_t* nn);
 
 // System Predictions
@@ -0,0 +1,143 @@
+// AION OS Dense Layer Kernels (SSE2 / AVX2)
+#include "gemv.h"
+#include "../core/fpu.h"
+#include <immintrin.h>
+
+// The kernel is built without SSE; each kernel enables what it needs
+// with a target attribute and gemv_init picks one from cpu_features
+
+__attribute__((target("sse2")))
+static inline float hsum_sse(__m128 v) {
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+// expf for the activations, good to a few ulp over the range that
+// matters: x = n ln2 + r, e^r from a degree-5 polynomial, 2^n via the
+// exponent field
+__attribute__((target("sse2")))
+static inline float gemv_expf(float x) {
+    if (x > 88.0f) {
+        x = 88.0f;
+    } else if (x < -87.0f) {
+        x = -87.0f;
+    }
+
+    float n = (float)(int)(x * 1.44269504f + (x < 0 ? -0.5f : 0.5f));
+    float r = x - n * 0.693359375f + n * 2.12194440e-4f;
+    float p = 1.0f + r * (1.0f + r * (0.5f + r * (0.166666671f +
+              r * (0.0416666418f + r * 0.00833333377f))));
+
+    union { uint32_t i; float f; } scale = { .i = (uint32_t)((int)n + 127) << 23 };
+    return p * scale.f;
+}
+
+__attribute__((target("sse2")))
+static inline float gemv_activate(float v, gemv_act_t act) {
+    switch (act) {
+        case GEMV_ACT_RELU:
+            return v > 0.0f ? v : 0.0f;
+        case GEMV_ACT_SIGMOID:
+            return 1.0f / (1.0f + gemv_expf(-v));
+        case GEMV_ACT_TANH:
+            return 2.0f / (1.0f + gemv_expf(-2.0f * v)) - 1.0f;
+        default:
+            return v;
+    }
+}
+
+__attribute__((target("sse2")))
+static void gemv_sse2(const float *w, const float *x, const float *b,
+                      float *y, uint32_t rows, uint32_t cols, gemv_act_t act) {
+    for (uint32_t r = 0; r < rows; r++) {
+        const float *row = w + (uint64_t)r * cols;
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        uint32_t k = 0;
+
+        for (; k + 8 <= cols; k += 8) {
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(row + k),
+                                               _mm_loadu_ps(x + k)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(row + k + 4),
+                                               _mm_loadu_ps(x + k + 4)));
+        }
+
+        float sum = b[r] + hsum_sse(_mm_add_ps(acc0, acc1));
+        for (; k < cols; k++) {
+            sum += row[k] * x[k];
+        }
+        y[r] = gemv_activate(sum, act);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void gemv_avx2(const float *w, const float *x, const float *b,
+                      float *y, uint32_t rows, uint32_t cols, gemv_act_t act) {
+    for (uint32_t r = 0; r < rows; r++) {
+        const float *row = w + (uint64_t)r * cols;
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        uint32_t k = 0;
+
+        for (; k + 16 <= cols; k += 16) {
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(row + k),
+                                   _mm256_loadu_ps(x + k), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(row + k + 8),
+                                   _mm256_loadu_ps(x + k + 8), acc1);
+        }
+        if (k + 8 <= cols) {
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(row + k),
+                                   _mm256_loadu_ps(x + k), acc0);
+            k += 8;
+        }
+
+        __m256 acc = _mm256_add_ps(acc0, acc1);
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc),
+                                 _mm256_extractf128_ps(acc, 1));
+        float sum = b[r] + hsum_sse(half);
+        for (; k < cols; k++) {
+            sum += row[k] * x[k];
+        }
+        y[r] = gemv_activate(sum, act);
+    }
+}
+
+// SSE2 is architectural on x86-64, so it is the baseline
+gemv_fn_t gemv = gemv_sse2;
+static const char *gemv_name = "sse2";
+
+// AVX instructions fault unless the OS turned on XSAVE (CR4.OSXSAVE,
+// mirrored in CPUID.1:ECX.OSXSAVE) and enabled the SSE and AVX state
+// components in XCR0, whatever CPUID says about the instructions
+static bool ymm_state_enabled(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!((ecx >> 27) & 1)) {
+        return false;
+    }
+
+    uint32_t lo, hi;
+    asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    uint64_t xcr0 = ((uint64_t)hi << 32) | lo;
+    return (xcr0 & (XSTATE_SSE | XSTATE_AVX)) == (XSTATE_SSE | XSTATE_AVX);
+}
+
+// Pick the widest kernel the boot CPU supports. Runs after fpu_init.
+void gemv_init(const cpu_features_t *features) {
+    if (features->has_avx2 && features->has_fma && ymm_state_enabled()) {
+        gemv = gemv_avx2;
+        gemv_name = "avx2";
+    } else {
+        gemv = gemv_sse2;
+        gemv_name = "sse2";
+    }
+
+    kprintf("[AI] Dense layer kernel: %s\n", gemv_name);
+}
+
+const char* gemv_kernel_name(void) {
+    return gemv_name;
+}
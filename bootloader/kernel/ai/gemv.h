@@ -0,0 +1,29 @@
+#ifndef GEMV_H
+#define GEMV_H
+
+#include <stdint.h>
+#include "../core/kernel.h"
+
+// Activation applied to each output as it is produced
+typedef enum {
+    GEMV_ACT_NONE,
+    GEMV_ACT_RELU,
+    GEMV_ACT_SIGMOID,
+    GEMV_ACT_TANH
+} gemv_act_t;
+
+// y = act(W x + b) for a row-major W of rows x cols, each row holding
+// the weights into one output so dot products read contiguous memory.
+// All float math stays inside the kernels, which are the only code built
+// with SSE enabled. Must be called between kernel_fpu_begin and
+// kernel_fpu_end.
+typedef void (*gemv_fn_t)(const float *w, const float *x, const float *b,
+                          float *y, uint32_t rows, uint32_t cols, gemv_act_t act);
+
+extern gemv_fn_t gemv;
+
+// Function prototypes
+void gemv_init(const cpu_features_t *features);
+const char* gemv_kernel_name(void);
+
+#endif // GEMV_H
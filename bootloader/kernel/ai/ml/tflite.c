@@ -1,9 +1,19 @@
 #include "tflite.h"
+#include "../../memory/slab.h"
+#include "../../memory/vmm.h"
+#include "../../core/printk.h"
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
 
+// Interpreters are created per model load and per CV pipeline
+static kmem_cache_t* interpreter_cache;
+
 void tflite_init(void) {
+    interpreter_cache = kmem_cache_create("tflite_interpreter",
+                                          sizeof(tflite_interpreter_t), 0,
+                                          SLAB_HWCACHE_ALIGN, NULL);
+    
     kprintf("[TFLite] TensorFlow Lite runtime initialized\n");
     kprintf("[TFLite] Supported operators: Conv2D, DepthwiseConv2D, FC, Softmax\n");
 }
@@ -13,7 +23,7 @@ tflite_model_t* tflite_load_model(const char* model_path) {
     kprintf("[TFLite] Loading model: %s\n", model_path);
     
     // Open model file
-    int fd = vfs_open(model_path, O_RDONLY);
+    int fd = vfs_open(model_path, O_RDONLY, 0);
     if (fd < 0) {
         kprintf("[TFLite] Error: Cannot open model file\n");
         return NULL;
@@ -24,29 +34,28 @@ tflite_model_t* tflite_load_model(const char* model_path) {
     vfs_fstat(fd, &st);
     size_t file_size = st.st_size;
     
-    // Read entire model into memory
-    void* model_data = kmalloc(file_size);
-    if (!model_data) {
-        vfs_close(fd);
-        return NULL;
-    }
-    
-    ssize_t read_bytes = vfs_read(fd, model_data, file_size);
+    // Use the file in place: its page cache pages are pinned and mapped
+    // into kernel space, shared with every other load of the same model
+    void* model_data = vfs_vmap(fd, 0, file_size);
     vfs_close(fd);
     
-    if (read_bytes != file_size) {
-        kfree(model_data);
-        kprintf("[TFLite] Error: Failed to read model file\n");
+    if (!model_data) {
+        kprintf("[TFLite] Error: Failed to map model file\n");
         return NULL;
     }
     
     // Parse FlatBuffer format (simplified - real implementation needs FlatBuffers parser)
     tflite_model_t* model = kmalloc(sizeof(tflite_model_t));
+    if (!model) {
+        vfs_vunmap(model_data, file_size);
+        return NULL;
+    }
     memset(model, 0, sizeof(tflite_model_t));
     
     strncpy(model->model_path, model_path, 255);
     model->version = 3; // TFLite schema version
     model->total_size = file_size;
+    model->file_data = model_data;
     
     // For this demonstration, create a simple model structure
     // Real implementation would parse the FlatBuffer
@@ -110,8 +119,6 @@ tflite_model_t* tflite_load_model(const char* model_path) {
     kprintf("[TFLite] Output shape: [%d, %d]\n",
             output->dims[0], output->dims[1]);
     
-    kfree(model_data); // In real implementation, keep this for weights
-    
     return model;
 }
 
@@ -121,7 +128,10 @@ tflite_interpreter_t* tflite_create_interpreter(tflite_model_t* model) {
         return NULL;
     }
     
-    tflite_interpreter_t* interpreter = kmalloc(sizeof(tflite_interpreter_t));
+    tflite_interpreter_t* interpreter = kmem_cache_alloc(interpreter_cache);
+    if (!interpreter) {
+        return NULL;
+    }
     memset(interpreter, 0, sizeof(tflite_interpreter_t));
     
     interpreter->model = model;
@@ -130,9 +140,9 @@ tflite_interpreter_t* tflite_create_interpreter(tflite_model_t* model) {
     interpreter->use_gpu = false;
     interpreter->allow_fp16 = true;
     
-    // Allocate memory arena for intermediate tensors
+    // Allocate memory arena for intermediate tensors on 2MB pages
     interpreter->arena_size = 64 * 1024 * 1024; // 64 MB
-    interpreter->arena = kmalloc(interpreter->arena_size);
+    interpreter->arena = vmm_alloc_huge(interpreter->arena_size);
     interpreter->arena_used = 0;
     
     spinlock_init(&interpreter->lock);
@@ -142,6 +152,16 @@ tflite_interpreter_t* tflite_create_interpreter(tflite_model_t* model) {
     return interpreter;
 }
 
+// Destroy interpreter
+void tflite_destroy_interpreter(tflite_interpreter_t* interpreter) {
+    if (!interpreter) return;
+    
+    kfree(interpreter->input_tensors);
+    kfree(interpreter->output_tensors);
+    vmm_free_huge(interpreter->arena, interpreter->arena_size);
+    kmem_cache_free(interpreter_cache, interpreter);
+}
+
 // Allocate tensors
 int tflite_allocate_tensors(tflite_interpreter_t* interpreter) {
     if (!interpreter) return -1;
@@ -304,7 +324,7 @@ int tflite_invoke(tflite_interpreter_t* interpreter) {
     
     spinlock_release(&interpreter->lock);
     
-    kprintf("[TFLite] Inference complete in %u us\n", elapsed_us);
+    kprintf_ratelimited(KERN_DEBUG "[TFLite] Inference complete in %u us\n", elapsed_us);
     
     return 0;
 }
@@ -87,6 +87,7 @@ typedef struct {
     
     bool loaded;
     size_t total_size;
+    void* file_data;        // Kernel mapping of the file's cached pages
 } tflite_model_t;
 
 // Interpreter (Execution Engine)
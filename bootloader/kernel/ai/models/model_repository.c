@@ -8,6 +8,9 @@
  #include <stdlib.h>
  #include <string.h>
  #include <sys/stat.h>
+ #include <sys/mman.h>
+ #include <fcntl.h>
+ #include <unistd.h>
  
  // Built-in model registry
  static const model_info_t BUILTIN_MODELS[] = {
@@ -181,7 +184,8 @@
      return 0;
  }
  
- // Load model into memory
+ // Map model into memory. Pages are read on first touch and shared with
+ // every other process that loads the same model; nothing is copied.
  uint8_t* model_repo_load(model_repo_t* repo, const char* model_name, size_t* size) {
      if (!repo || !model_name || !size) return NULL;
      
@@ -194,37 +198,40 @@
      }
      
      // Open file
-     FILE* fp = fopen(model->local_path, "rb");
-     if (!fp) {
+     int fd = open(model->local_path, O_RDONLY);
+     if (fd < 0) {
          fprintf(stderr, "[ModelRepo] Failed to open: %s\n", model->local_path);
          return NULL;
      }
      
      // Get file size
-     fseek(fp, 0, SEEK_END);
-     *size = ftell(fp);
-     fseek(fp, 0, SEEK_SET);
-     
-     // Allocate buffer
-     uint8_t* buffer = malloc(*size);
-     if (!buffer) {
-         fclose(fp);
+     struct stat st;
+     if (fstat(fd, &st) != 0 || st.st_size == 0) {
+         fprintf(stderr, "[ModelRepo] Empty or unreadable model: %s\n", model->local_path);
+         close(fd);
          return NULL;
      }
+     *size = st.st_size;
      
-     // Read file
-     if (fread(buffer, 1, *size, fp) != *size) {
-         fprintf(stderr, "[ModelRepo] Failed to read model\n");
-         free(buffer);
-         fclose(fp);
+     // The mapping keeps the file open on its own
+     void* data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+     close(fd);
+     
+     if (data == MAP_FAILED) {
+         fprintf(stderr, "[ModelRepo] Failed to map model\n");
          return NULL;
      }
      
-     fclose(fp);
-     
      printf("[ModelRepo] Loaded %s (%zu bytes)\n", model_name, *size);
      
-     return buffer;
+     return data;
+ }
+ 
+ // Release a model from model_repo_load
+ void model_repo_unload(uint8_t* data, size_t size) {
+     if (data) {
+         munmap(data, size);
+     }
  }
  
  // Check if model exists
@@ -67,8 +67,9 @@
  // Download model
  int model_repo_download(model_repo_t* repo, const char* model_name);
  
- // Load model into memory
+ // Map model into memory, read-only; release with model_repo_unload
  uint8_t* model_repo_load(model_repo_t* repo, const char* model_name, size_t* size);
+ void model_repo_unload(uint8_t* data, size_t size);
  
  // Check if model exists locally
  bool model_repo_exists(model_repo_t* repo, const char* model_name);
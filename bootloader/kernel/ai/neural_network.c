@@ -1,24 +1,15 @@
 #include "ai_core.h"
+#include "gemv.h"
+#include "../core/fpu.h"
 #include <math.h>
 #include <string.h>
 
-// Activation Functions
-static float relu(float x) {
-    return (x > 0) ? x : 0;
-}
-
-static float sigmoid(float x) {
-    return 1.0f / (1.0f + expf(-x));
-}
-
-static float tanh_activation(float x) {
-    return tanhf(x);
-}
-
 // Create neural network
 neural_network_t* ai_create_network(int* layer_sizes, int num_layers) {
-    neural_network_t* nn = kmalloc(sizeof(neural_network_t));
-    memset(nn, 0, sizeof(neural_network_t));
+    neural_network_t* nn = kzalloc(sizeof(neural_network_t));
+    if (!nn) {
+        return NULL;
+    }
     
     nn->num_layers = num_layers - 1; // Exclude input layer
     nn->learning_rate = 0.01f;
@@ -28,10 +19,14 @@ neural_network_t* ai_create_network(int* layer_sizes, int num_layers) {
         layer->input_size = layer_sizes[i];
         layer->output_size = layer_sizes[i + 1];
         
-        // Allocate weights and biases
+        // Allocate weights (output-major for contiguous dot products) and biases
         int weight_count = layer->input_size * layer->output_size;
         layer->weights = kmalloc(weight_count * sizeof(float));
         layer->biases = kmalloc(layer->output_size * sizeof(float));
+        if (!layer->weights || !layer->biases) {
+            ai_destroy_network(nn);
+            return NULL;
+        }
         
         // Initialize with random values (Xavier initialization)
         float scale = sqrtf(2.0f / layer->input_size);
@@ -44,38 +39,71 @@ neural_network_t* ai_create_network(int* layer_sizes, int num_layers) {
         
         // Set activation function
         if (i < nn->num_layers - 1) {
-            layer->activation = relu;
+            layer->activation = GEMV_ACT_RELU;
         } else {
-            layer->activation = sigmoid; // Output layer
+            layer->activation = GEMV_ACT_SIGMOID; // Output layer
+        }
+        
+        if (layer->output_size > nn->max_width) {
+            nn->max_width = layer->output_size;
         }
     }
     
+    // Ping-pong activation buffers for the hidden layers
+    nn->scratch[0] = kmalloc(2 * nn->max_width * sizeof(float));
+    if (!nn->scratch[0]) {
+        ai_destroy_network(nn);
+        return NULL;
+    }
+    nn->scratch[1] = nn->scratch[0] + nn->max_width;
+    spinlock_init(&nn->lock);
+    
     return nn;
 }
 
-// Forward pass
-float* ai_predict(neural_network_t* nn, float* inputs) {
-    float* current = inputs;
-    float* output = NULL;
+// Destroy neural network
+void ai_destroy_network(neural_network_t* nn) {
+    if (!nn) return;
+    
+    for (int i = 0; i < nn->num_layers; i++) {
+        kfree(nn->layers[i].weights);
+        kfree(nn->layers[i].biases);
+    }
+    kfree(nn->scratch[0]);
+    kfree(nn);
+}
+
+// Forward pass into a caller buffer of the output layer's size.
+// Hidden activations alternate between the two scratch buffers and the
+// last layer writes straight into outputs, so nothing is allocated.
+void ai_predict_into(neural_network_t* nn, const float* inputs, float* outputs) {
+    uint64_t flags = kernel_fpu_begin();
+    spinlock_acquire(&nn->lock);
+    
+    const float* current = inputs;
     
     for (int i = 0; i < nn->num_layers; i++) {
         nn_layer_t* layer = &nn->layers[i];
+        float* output = (i == nn->num_layers - 1) ? outputs : nn->scratch[i & 1];
         
-        output = kmalloc(layer->output_size * sizeof(float));
-        
-        // Matrix multiplication + bias
-        for (int j = 0; j < layer->output_size; j++) {
-            float sum = layer->biases[j];
-            for (int k = 0; k < layer->input_size; k++) {
-                sum += current[k] * layer->weights[k * layer->output_size + j];
-            }
-            output[j] = layer->activation(sum);
-        }
+        // Matrix-vector product + bias + activation in one kernel
+        gemv(layer->weights, current, layer->biases, output,
+             layer->output_size, layer->input_size, layer->activation);
         
-        if (i > 0) kfree(current);
         current = output;
     }
     
+    spinlock_release(&nn->lock);
+    kernel_fpu_end(flags);
+}
+
+// Forward pass returning a kmalloc'd result the caller frees.
+// Hot paths should use ai_predict_into with a stack buffer instead.
+float* ai_predict(neural_network_t* nn, float* inputs) {
+    float* output = kmalloc(nn->layers[nn->num_layers - 1].output_size * sizeof(float));
+    if (output) {
+        ai_predict_into(nn, inputs, output);
+    }
     return output;
 }
 
@@ -100,13 +128,15 @@ uint64_t ai_predict_memory_allocation(process_t* proc) {
         int layers[] = {8, 16, 8, 1};
         mem_model = ai_create_network(layers, 4);
         // In real implementation, load pre-trained weights
+        if (!mem_model) {
+            return 4096;
+        }
     }
     
-    float* prediction = ai_predict(mem_model, features);
+    float prediction[1];
+    ai_predict_into(mem_model, features, prediction);
     uint64_t predicted_size = (uint64_t)(prediction[0] * 1024 * 1024); // Convert to bytes
     
-    kfree(prediction);
-    
     // Clamp to reasonable range
     if (predicted_size < 4096) predicted_size = 4096;
     if (predicted_size > 1024 * 1024 * 1024) predicted_size = 1024 * 1024 * 1024; // Max 1GB
@@ -1,6 +1,8 @@
 // AION OS AI Predictor Engine
 #include "predictor.h"
 #include "../memory/memory.h"
+#include "../core/fpu.h"
+#include "gemv.h"
 
 // Neural network for predictions
 typedef struct {
@@ -8,6 +10,14 @@ typedef struct {
     float *biases;
     uint32_t layers[4];  // 4-layer network
     float learning_rate;
+    
+    // Offsets of each transition's weights and biases
+    uint32_t weight_offset[3];
+    uint32_t bias_offset[3];
+    
+    // Ping-pong activation buffers sized to the widest hidden layer
+    float *scratch[2];
+    spinlock_t lock;
 } neural_network_t;
 
 // AI predictor state
@@ -23,6 +33,9 @@ static struct {
 void ai_predictor_init(void) {
     kprintf("[AI] Initializing AI Predictor Engine...\n");
     
+    // Select dense layer kernels for this CPU
+    gemv_init(&cpu_features);
+    
     // Initialize neural networks
     ai_state.memory_net = create_neural_network(
         (uint32_t[]){16, 32, 24, 8}, 4, 0.001);
@@ -30,6 +43,9 @@ void ai_predictor_init(void) {
         (uint32_t[]){12, 24, 16, 4}, 4, 0.001);
     ai_state.io_net = create_neural_network(
         (uint32_t[]){8, 16, 12, 4}, 4, 0.001);
+    if (!ai_state.memory_net || !ai_state.cpu_net || !ai_state.io_net) {
+        kernel_panic("AI predictor: out of memory for networks");
+    }
     
     // Load pre-trained weights if available
     load_pretrained_weights();
@@ -40,6 +56,48 @@ void ai_predictor_init(void) {
     kprintf("[AI] AI Predictor Engine initialized\n");
 }
 
+// Create a 4-layer network with all inference buffers preallocated
+neural_network_t* create_neural_network(uint32_t *layers, uint32_t num_layers,
+                                        float learning_rate) {
+    neural_network_t *net = kzalloc(sizeof(neural_network_t));
+    if (!net) {
+        return NULL;
+    }
+    
+    uint32_t weights = 0;
+    uint32_t biases = 0;
+    uint32_t max_width = 0;
+    for (uint32_t l = 0; l < num_layers; l++) {
+        net->layers[l] = layers[l];
+        if (l + 1 < num_layers) {
+            net->weight_offset[l] = weights;
+            net->bias_offset[l] = biases;
+            weights += layers[l] * layers[l + 1];
+            biases += layers[l + 1];
+        }
+        if (l > 0 && layers[l] > max_width) {
+            max_width = layers[l];
+        }
+    }
+    
+    net->weights = kzalloc(weights * sizeof(float));
+    net->biases = kzalloc(biases * sizeof(float));
+    net->learning_rate = learning_rate;
+    
+    net->scratch[0] = kmalloc(2 * max_width * sizeof(float));
+    if (!net->weights || !net->biases || !net->scratch[0]) {
+        kfree(net->weights);
+        kfree(net->biases);
+        kfree(net->scratch[0]);
+        kfree(net);
+        return NULL;
+    }
+    net->scratch[1] = net->scratch[0] + max_width;
+    spinlock_init(&net->lock);
+    
+    return net;
+}
+
 // Create AI memory predictor
 ai_memory_predictor_t* ai_memory_predictor_create(void) {
     ai_memory_predictor_t *predictor = kmalloc(sizeof(ai_memory_predictor_t));
@@ -125,41 +183,29 @@ void ai_optimize_cpu_state(void) {
     }
 }
 
-// Neural network forward propagation
+// Neural network forward propagation, allocation free: hidden layers
+// alternate between the scratch buffers, the last writes into output
 void neural_network_forward(neural_network_t *net, float *input, float *output) {
+    uint64_t flags = kernel_fpu_begin();
+    spinlock_acquire(&net->lock);
+    
     float *layer_input = input;
-    float *layer_output;
     
     for (int l = 0; l < 3; l++) {  // 3 transitions for 4-layer network
-        uint32_t input_size = (l == 0) ? net->layers[0] : net->layers[l];
+        uint32_t input_size = net->layers[l];
         uint32_t output_size = net->layers[l + 1];
+        float *weights = net->weights + net->weight_offset[l];
+        float *biases = net->biases + net->bias_offset[l];
+        float *layer_output = (l == 2) ? output : net->scratch[l & 1];
         
-        layer_output = kmalloc(output_size * sizeof(float));
-        
-        // Compute layer output
-        for (int i = 0; i < output_size; i++) {
-            float sum = net->biases[l * output_size + i];
-            
-            for (int j = 0; j < input_size; j++) {
-                sum += layer_input[j] * 
-                       net->weights[l * input_size * output_size + 
-                                   i * input_size + j];
-            }
-            
-            // ReLU activation (except last layer)
-            layer_output[i] = (l < 2) ? fmax(0, sum) : sigmoid(sum);
-        }
+        // Compute layer output (weights are output-major), ReLU on the
+        // hidden layers and sigmoid on the last
+        gemv(weights, layer_input, biases, layer_output, output_size, input_size,
+             (l < 2) ? GEMV_ACT_RELU : GEMV_ACT_SIGMOID);
         
-        if (l > 0) kfree(layer_input);
         layer_input = layer_output;
     }
     
-    // Copy final output
-    memcpy(output, layer_output, net->layers[3] * sizeof(float));
-    kfree(layer_output);
+    spinlock_release(&net->lock);
+    kernel_fpu_end(flags);
 }
-
-// Sigmoid activation function
-float sigmoid(float x) {
-    return 1.0 / (1.0 + exp(-x));
-}
\ No newline at end of file
@@ -1,14 +1,23 @@
 #include "cv_engine.h"
 #include "../ml/tflite.h"
+#include "../../memory/slab.h"
+#include "../../core/printk.h"
 #include <math.h>
 #include <string.h>
 
 static cv_engine_t global_cv_engine = {0};
 
+// One result per cv_detect_objects call
+static kmem_cache_t* detection_result_cache;
+
 void cv_init(void) {
     memset(&global_cv_engine, 0, sizeof(global_cv_engine));
     spinlock_init(&global_cv_engine.lock);
     
+    detection_result_cache = kmem_cache_create("cv_detection_result",
+                                               sizeof(cv_detection_result_t), 0,
+                                               0, NULL);
+    
     // Load object detection model (YOLO or MobileNet-SSD)
     tflite_model_t* detection_model = tflite_load_model("/usr/share/ai-vision/models/ssd_mobilenet.tflite");
     if (detection_model) {
@@ -91,7 +100,7 @@ cv_image_t* cv_resize(cv_image_t* src, int new_width, int new_height) {
 // Object Detection using SSD MobileNet
 cv_detection_result_t* cv_detect_objects(cv_image_t* image) {
     if (!global_cv_engine.object_detection_model) {
-        kprintf("[CV] Error: No object detection model loaded\n");
+        kprintf_ratelimited(KERN_ERR "[CV] Error: No object detection model loaded\n");
         return NULL;
     }
     
@@ -135,7 +144,7 @@ cv_detection_result_t* cv_detect_objects(cv_image_t* image) {
     int num_detections = (int)((float*)num_tensor->data)[0];
     
     // Filter by confidence threshold (0.5)
-    cv_detection_result_t* result = kmalloc(sizeof(cv_detection_result_t));
+    cv_detection_result_t* result = kmem_cache_alloc(detection_result_cache);
     result->boxes = kmalloc(num_detections * sizeof(cv_bbox_t));
     result->num_boxes = 0;
     
@@ -185,12 +194,19 @@ cv_detection_result_t* cv_detect_objects(cv_image_t* image) {
     
     spinlock_release(&global_cv_engine.lock);
     
-    kprintf("[CV] Detected %d objects in %llu us\n", 
-            result->num_boxes, result->inference_time_us);
+    kprintf_ratelimited(KERN_DEBUG "[CV] Detected %d objects in %llu us\n",
+                        result->num_boxes, result->inference_time_us);
     
     return result;
 }
 
+void cv_free_detection_result(cv_detection_result_t* result) {
+    if (!result) return;
+    
+    kfree(result->boxes);
+    kmem_cache_free(detection_result_cache, result);
+}
+
 // Simple OCR using template matching (for demonstration)
 cv_ocr_result_t* cv_recognize_text(cv_image_t* image) {
     kprintf("[CV] Running OCR on image %dx%d...\n", image->width, image->height);
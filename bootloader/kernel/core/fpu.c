@@ -0,0 +1,264 @@
+// AION OS FPU/SIMD State Management
+#include "fpu.h"
+#include "smp.h"
+#include "../memory/slab.h"
+
+// FPU state is switched lazily. Each CPU remembers whose state its
+// registers hold (fpu_owner). A task that is not the owner runs with
+// CR0.TS set, so its first FPU/SIMD instruction traps with #NM and loads
+// its state. Tasks that never touch the FPU never save or restore anything.
+//
+// Invariant: with TS clear the registers belong to fpu_owner, to a
+// kernel_fpu_begin section, or to boot code running before any task.
+// An owner's state is written back when it is switched out after using
+// the FPU, so the memory copy is valid whenever the task is not running.
+static process_t *fpu_owner[MAX_CPUS];
+static bool fpu_ts_set[MAX_CPUS];
+static fpu_stats_t fpu_stats[MAX_CPUS];
+
+static kmem_cache_t *fpu_state_cache;
+
+static uint64_t xstate_mask;
+static uint32_t xstate_size = 512;    // FXSAVE layout without XSAVE
+
+static inline void xsetbv(uint32_t index, uint64_t value) {
+    asm volatile("xsetbv" : : "c"(index), "a"((uint32_t)value),
+                 "d"((uint32_t)(value >> 32)));
+}
+
+static inline void clts(void) {
+    asm volatile("clts");
+}
+
+static inline void stts(void) {
+    uint64_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_TS));
+}
+
+// Enable SSE (and AVX where present) for the current CPU
+void fpu_init(void) {
+    uint64_t cr0, cr4;
+
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    asm volatile("mov %0, %%cr0" : : "r"(cr0));
+
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (cpu_features.has_xsave) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    asm volatile("mov %0, %%cr4" : : "r"(cr4));
+
+    asm volatile("fninit");
+
+    if (cpu_features.has_xsave) {
+        xstate_mask = XSTATE_X87 | XSTATE_SSE;
+        if (cpu_features.has_avx) {
+            xstate_mask |= XSTATE_AVX;
+        }
+        xsetbv(0, xstate_mask);
+
+        // EBX of leaf 0xD reports the save area size for enabled features
+        uint32_t eax, ebx, ecx, edx;
+        asm volatile("cpuid"
+                     : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(0xD), "c"(0));
+        xstate_size = ebx;
+    }
+
+    if (xstate_size > FPU_AREA_MAX) {
+        kernel_panic("FPU save area too large");
+    }
+
+    kprintf("[FPU] %s, %d byte save area\n",
+            !cpu_features.has_xsave ? "FXSAVE" :
+            cpu_features.has_xsaveopt ? "XSAVEOPT" : "XSAVE", xstate_size);
+}
+
+// Per-task save areas; needs the slab allocator
+void fpu_state_cache_init(void) {
+    fpu_state_cache = kmem_cache_create("fpu_state", xstate_size, 64, 0, NULL);
+}
+
+uint32_t fpu_state_size(void) {
+    return xstate_size;
+}
+
+// Save the live FPU/SIMD state into a 64-byte aligned area
+void fpu_save(void *area) {
+    if (xstate_mask) {
+        asm volatile("xsave64 (%0)" : : "r"(area),
+                     "a"((uint32_t)xstate_mask), "d"((uint32_t)(xstate_mask >> 32))
+                     : "memory");
+    } else {
+        asm volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+// Like fpu_save, but XSAVEOPT skips components unchanged since the last
+// XRSTOR from the same area. Only valid for areas restored with fpu_restore.
+static void fpu_save_opt(void *area) {
+    if (xstate_mask && cpu_features.has_xsaveopt) {
+        asm volatile("xsaveopt64 (%0)" : : "r"(area),
+                     "a"((uint32_t)xstate_mask), "d"((uint32_t)(xstate_mask >> 32))
+                     : "memory");
+    } else {
+        fpu_save(area);
+    }
+}
+
+void fpu_restore(void *area) {
+    if (xstate_mask) {
+        asm volatile("xrstor64 (%0)" : : "r"(area),
+                     "a"((uint32_t)xstate_mask), "d"((uint32_t)(xstate_mask >> 32))
+                     : "memory");
+    } else {
+        asm volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+// A zeroed XSAVE header restores every component to its init state;
+// the control words still come from the legacy area
+static void *fpu_alloc_state(void) {
+    uint8_t *area = kmem_cache_alloc(fpu_state_cache);
+    if (!area) {
+        return NULL;
+    }
+    memset(area, 0, xstate_size);
+    *(uint16_t*)area = FPU_FCW_DEFAULT;
+    *(uint32_t*)(area + FPU_MXCSR_OFFSET) = FPU_MXCSR_DEFAULT;
+    return area;
+}
+
+static inline void fpu_set_ts(uint32_t cpu, bool set) {
+    if (fpu_ts_set[cpu] == set) {
+        return;
+    }
+    if (set) {
+        stts();
+    } else {
+        clts();
+    }
+    fpu_ts_set[cpu] = set;
+}
+
+// Context switch hook, interrupts disabled. Writes back prev's state if
+// it used the FPU this slice and arms the trap for next unless its state
+// is still live in this CPU's registers.
+void fpu_switch(process_t *prev, process_t *next) {
+    uint32_t cpu = smp_processor_id();
+
+    if (prev && fpu_owner[cpu] == prev && !fpu_ts_set[cpu]) {
+        fpu_save_opt(prev->fpu_state);
+        fpu_stats[cpu].saves++;
+    }
+
+    if (fpu_owner[cpu] == next && next->fpu_cpu == (int32_t)cpu) {
+        fpu_stats[cpu].cached++;
+        fpu_set_ts(cpu, false);
+    } else {
+        fpu_set_ts(cpu, true);
+    }
+}
+
+// #NM: the running task touched the FPU with TS set. Load its state.
+void fpu_handle_nm(void) {
+    uint32_t cpu = smp_processor_id();
+    process_t *curr = current_process;
+
+    fpu_set_ts(cpu, false);
+    fpu_stats[cpu].nm_faults++;
+
+    if (!curr || fpu_owner[cpu] == curr) {
+        return;
+    }
+
+    if (!curr->fpu_state) {
+        curr->fpu_state = fpu_alloc_state();
+        if (!curr->fpu_state) {
+            kernel_panic("Out of memory for FPU state");
+        }
+        fpu_stats[cpu].first_use++;
+    }
+
+    fpu_restore(curr->fpu_state);
+    fpu_owner[cpu] = curr;
+    curr->fpu_cpu = cpu;
+    fpu_stats[cpu].restores++;
+}
+
+// Give a forked child a copy of the parent's state
+int fpu_copy(process_t *child, process_t *parent) {
+    child->fpu_state = NULL;
+    child->fpu_cpu = -1;
+
+    if (!parent->fpu_state) {
+        return 0;
+    }
+
+    uint64_t flags = local_irq_save();
+    uint32_t cpu = smp_processor_id();
+    if (fpu_owner[cpu] == parent && !fpu_ts_set[cpu]) {
+        fpu_save_opt(parent->fpu_state);
+    }
+    local_irq_restore(flags);
+
+    child->fpu_state = kmem_cache_alloc(fpu_state_cache);
+    if (!child->fpu_state) {
+        return -ENOMEM;
+    }
+    memcpy(child->fpu_state, parent->fpu_state, xstate_size);
+    return 0;
+}
+
+// Drop a dead task's state and any CPU's claim on it
+void fpu_release(process_t *proc) {
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        process_t *expected = proc;
+        __atomic_compare_exchange_n(&fpu_owner[cpu], &expected, NULL,
+                                    false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+
+    if (proc->fpu_state) {
+        kmem_cache_free(fpu_state_cache, proc->fpu_state);
+        proc->fpu_state = NULL;
+    }
+}
+
+void fpu_get_stats(uint32_t cpu, fpu_stats_t *stats) {
+    *stats = fpu_stats[cpu];
+}
+
+// Claim the vector registers on this CPU. The owner's live state is
+// written back first and the registers handed back through the #NM path
+// afterwards. Interrupts stay disabled until kernel_fpu_end, so sections
+// must be short and cannot nest.
+uint64_t kernel_fpu_begin(void) {
+    uint64_t flags = local_irq_save();
+    uint32_t cpu = smp_processor_id();
+    process_t *owner = fpu_owner[cpu];
+
+    if (owner) {
+        if (!fpu_ts_set[cpu]) {
+            fpu_save_opt(owner->fpu_state);
+            fpu_stats[cpu].saves++;
+        }
+        fpu_owner[cpu] = NULL;
+    }
+    fpu_set_ts(cpu, false);
+
+    return flags;
+}
+
+void kernel_fpu_end(uint64_t flags) {
+    uint32_t cpu = smp_processor_id();
+
+    // Before the first task there is nobody to trap for
+    if (current_process) {
+        fpu_set_ts(cpu, true);
+    }
+    local_irq_restore(flags);
+}
@@ -0,0 +1,55 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel.h"
+#include "../process/process.h"
+
+// Control register bits
+#define CR0_MP         (1ULL << 1)
+#define CR0_EM         (1ULL << 2)
+#define CR0_TS         (1ULL << 3)
+#define CR0_NE         (1ULL << 5)
+#define CR4_OSFXSR     (1ULL << 9)
+#define CR4_OSXMMEXCPT (1ULL << 10)
+#define CR4_OSXSAVE    (1ULL << 18)
+
+// XCR0 state components
+#define XSTATE_X87 0x1
+#define XSTATE_SSE 0x2
+#define XSTATE_AVX 0x4
+
+#define FPU_AREA_MAX 4096     // Largest save area we accept
+
+// Reset values for a task's first use of the FPU
+#define FPU_FCW_DEFAULT 0x037F
+#define FPU_MXCSR_DEFAULT 0x1F80
+#define FPU_MXCSR_OFFSET 24
+
+// Lazy switching statistics, per CPU
+typedef struct {
+    uint64_t nm_faults;       // #NM traps taken
+    uint64_t saves;           // Task state written back on switch-out
+    uint64_t restores;        // Task state loaded on first use in a slice
+    uint64_t cached;          // Switch-ins that found their state still live
+    uint64_t first_use;       // Tasks given a fresh state
+} __attribute__((aligned(64))) fpu_stats_t;
+
+// Function prototypes
+void fpu_init(void);
+void fpu_state_cache_init(void);
+uint32_t fpu_state_size(void);
+void fpu_save(void *area);
+void fpu_restore(void *area);
+uint64_t kernel_fpu_begin(void);
+void kernel_fpu_end(uint64_t flags);
+
+// Lazy per-task state
+void fpu_switch(process_t *prev, process_t *next);
+void fpu_handle_nm(void);
+int fpu_copy(process_t *child, process_t *parent);
+void fpu_release(process_t *proc);
+void fpu_get_stats(uint32_t cpu, fpu_stats_t *stats);
+
+#endif // FPU_H
@@ -2,19 +2,50 @@
 #include "interrupts.h"
 #include "../drivers/pic.h"
 #include "../drivers/apic.h"
-#include "../ai/predictor.h"
+#include "../process/runqueue.h"
+#include "../memory/vmm.h"
+#include "fpu.h"
+#include "softirq.h"
+#include "../fs/procfs.h"
+#include "../drivers/vclock.h"
 
 // Interrupt descriptor table
 static idt_entry_t idt[256] __attribute__((aligned(16)));
 static idt_ptr_t idt_ptr;
 
-// Interrupt statistics for AI optimization
+// Top-half time per vector, in cycles
 static interrupt_stats_t interrupt_stats[256] = {0};
-static ai_interrupt_predictor_t *int_predictor;
+
+static size_t interrupts_show(char *buf, size_t size);
 
 // Interrupt handler registry
 static interrupt_handler_t interrupt_handlers[256] = {0};
 
+// Device vectors: entry stubs from irq_vectors.asm, and which are in use
+extern const uint64_t irq_vector_stubs[IRQ_VECTOR_END - IRQ_VECTOR_BASE];
+extern void syscall_int80_entry(void);
+static uint64_t vector_bitmap[256 / 64];
+static spinlock_t vector_lock;
+
+// Queues waiting to be polled, per CPU and softirq. Only touched on their
+// own CPU with interrupts off.
+typedef struct {
+    irq_poll_t *head[NR_SOFTIRQS];
+    irq_poll_t *tail[NR_SOFTIRQS];
+} irq_poll_list_t;
+
+static irq_poll_list_t irq_poll_lists[MAX_CPUS];
+static irq_poll_t *irq_poll_all;
+static spinlock_t irq_poll_lock;
+
+// Applies coalescing changes, which softirqs may not wait for
+static process_t *irq_tune_task;
+static volatile bool irq_tune_pending;
+
+static void net_rx_softirq(void);
+static void block_softirq(void);
+static size_t irq_poll_show(char *buf, size_t size);
+
 // Initialize interrupt system
 void interrupts_init(void) {
     kprintf("[INTERRUPTS] Initializing interrupt system...\n");
@@ -31,14 +62,27 @@ void interrupts_init(void) {
                      KERNEL_CS, IDT_INTERRUPT_GATE, 0);
     }
     
+    // FPU state is loaded lazily on the first use in a time slice
+    set_idt_gate(7, (uint64_t)device_not_available_handler,
+                 KERNEL_CS, IDT_INTERRUPT_GATE, 0);
+    
     // Set up IRQ handlers (32-47)
     for (int i = 32; i < 48; i++) {
         set_idt_gate(i, (uint64_t)irq_handlers[i - 32],
                      KERNEL_CS, IDT_INTERRUPT_GATE, 0);
     }
     
+    // Device vectors (48-239), allocated on demand
+    for (int i = IRQ_VECTOR_BASE; i < IRQ_VECTOR_END; i++) {
+        set_idt_gate(i, irq_vector_stubs[i - IRQ_VECTOR_BASE],
+                     KERNEL_CS, IDT_INTERRUPT_GATE, 0);
+    }
+    spinlock_init(&vector_lock);
+    spinlock_init(&irq_poll_lock);
+    vector_bitmap[IRQ_VECTOR_SYSCALL / 64] |= 1ULL << (IRQ_VECTOR_SYSCALL % 64);
+    
     // Set up system calls (128)
-    set_idt_gate(128, (uint64_t)syscall_handler,
+    set_idt_gate(128, (uint64_t)syscall_int80_entry,
                  KERNEL_CS, IDT_INTERRUPT_GATE, 3);  // Ring 3 accessible
     
     // Set up IPI handlers for SMP (240-255)
@@ -61,8 +105,10 @@ void interrupts_init(void) {
         kprintf("[INTERRUPTS] Using legacy PIC\n");
     }
     
-    // Initialize AI interrupt predictor
-    int_predictor = ai_interrupt_predictor_create();
+    procfs_register("interrupts", interrupts_show);
+    procfs_register("irqpoll", irq_poll_show);
+    open_softirq(SOFTIRQ_NET_RX, net_rx_softirq);
+    open_softirq(SOFTIRQ_BLOCK, block_softirq);
     
     // Enable interrupts
     asm volatile("sti");
@@ -90,21 +136,224 @@ void register_interrupt_handler(uint8_t num, interrupt_handler_t handler) {
     }
 }
 
-// Common interrupt dispatcher
-void interrupt_dispatcher(interrupt_frame_t *frame) {
-    uint8_t int_num = frame->int_num;
+// Hand out a free device vector, or -1 when all are taken. Lower vectors
+// have lower priority at the local APIC, so allocate from the top down and
+// let the first devices found get the higher classes.
+int irq_alloc_vector(void) {
+    int vector = -1;
     
-    // Update statistics
-    interrupt_stats[int_num].count++;
-    interrupt_stats[int_num].last_time = get_system_time();
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&vector_lock);
+    for (int i = IRQ_VECTOR_END - 1; i >= IRQ_VECTOR_BASE; i--) {
+        if (!(vector_bitmap[i / 64] & (1ULL << (i % 64)))) {
+            vector_bitmap[i / 64] |= 1ULL << (i % 64);
+            vector = i;
+            break;
+        }
+    }
+    spinlock_release(&vector_lock);
+    local_irq_restore(flags);
     
-    // AI prediction: Should we batch this interrupt?
-    if (int_predictor->should_batch(int_num)) {
-        // Queue interrupt for batch processing
-        queue_interrupt(frame);
+    return vector;
+}
+
+void irq_free_vector(uint8_t vector) {
+    if (vector < IRQ_VECTOR_BASE || vector >= IRQ_VECTOR_END ||
+        vector == IRQ_VECTOR_SYSCALL) {
         return;
     }
     
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&vector_lock);
+    interrupt_handlers[vector] = NULL;
+    vector_bitmap[vector / 64] &= ~(1ULL << (vector % 64));
+    spinlock_release(&vector_lock);
+    local_irq_restore(flags);
+}
+
+void irq_poll_register(irq_poll_t *p) {
+    if (!p->weight) {
+        p->weight = IRQ_POLL_WEIGHT;
+    }
+    p->next = NULL;
+    p->state = 0;
+    
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&irq_poll_lock);
+    p->all_next = irq_poll_all;
+    __atomic_store_n(&irq_poll_all, p, __ATOMIC_RELEASE);
+    spinlock_release(&irq_poll_lock);
+    local_irq_restore(flags);
+}
+
+// Called from the queue's interrupt handler: mask the interrupt and poll
+// from this CPU's softirq until the queue drains
+void irq_poll_schedule(irq_poll_t *p) {
+    uint64_t flags = local_irq_save();
+    p->irqs++;
+    
+    if (!(__atomic_fetch_or(&p->state, IRQ_POLL_SCHED, __ATOMIC_ACQUIRE) & IRQ_POLL_SCHED)) {
+        p->irq_disable(p);
+        
+        irq_poll_list_t *list = &irq_poll_lists[smp_processor_id()];
+        p->next = NULL;
+        if (list->tail[p->softirq]) {
+            list->tail[p->softirq]->next = p;
+        } else {
+            list->head[p->softirq] = p;
+        }
+        list->tail[p->softirq] = p;
+        raise_softirq_irqoff(p->softirq);
+    }
+    
+    local_irq_restore(flags);
+}
+
+// Once per window, derive the coalescing for the measured rate and pass
+// it on when it moved a step
+static void irq_poll_adapt(irq_poll_t *p, uint64_t now) {
+    if (now - p->window_start < IRQ_RATE_WINDOW_NS) {
+        return;
+    }
+    if (p->window_start) {
+        p->rate = p->window_items * NSEC_PER_SEC / (now - p->window_start);
+    }
+    p->window_start = now;
+    p->window_items = 0;
+    
+    uint32_t usecs;
+    if (p->rate <= IRQ_COALESCE_RATE_LOW) {
+        usecs = 0;
+    } else if (p->rate >= IRQ_COALESCE_RATE_HIGH) {
+        usecs = IRQ_COALESCE_MAX_US;
+    } else {
+        usecs = IRQ_COALESCE_MAX_US * (p->rate - IRQ_COALESCE_RATE_LOW) /
+                (IRQ_COALESCE_RATE_HIGH - IRQ_COALESCE_RATE_LOW);
+        usecs -= usecs % IRQ_COALESCE_STEP_US;
+    }
+    
+    // Items expected in that time, at most one poll's worth
+    uint64_t frames = p->rate * usecs / 1000000;
+    if (frames < 1) {
+        frames = 1;
+    }
+    if (frames > p->weight) {
+        frames = p->weight;
+    }
+    
+    if (usecs != p->coalesce_usecs) {
+        p->coalesce_usecs = usecs;
+        p->coalesce_frames = frames;
+        if (p->set_coalesce && irq_tune_task) {
+            __atomic_fetch_or(&p->state, IRQ_POLL_COALESCE, __ATOMIC_RELEASE);
+            __atomic_store_n(&irq_tune_pending, true, __ATOMIC_RELEASE);
+            wake_up_process(irq_tune_task);
+        }
+    }
+}
+
+// Pass each queue's latest coalescing to its driver. Queues are only ever
+// added at the head of the registered list, so it is walked unlocked.
+static void irq_tune_main(void) {
+    while (1) {
+        uint64_t flags = local_irq_save();
+        while (!__atomic_load_n(&irq_tune_pending, __ATOMIC_ACQUIRE)) {
+            current_process->state = PROCESS_STATE_BLOCKED;
+            local_irq_restore(flags);
+            schedule();
+            flags = local_irq_save();
+        }
+        irq_tune_pending = false;
+        local_irq_restore(flags);
+        
+        irq_poll_t *p = __atomic_load_n(&irq_poll_all, __ATOMIC_ACQUIRE);
+        for (; p; p = p->all_next) {
+            if (__atomic_fetch_and(&p->state, ~IRQ_POLL_COALESCE, __ATOMIC_ACQUIRE) &
+                IRQ_POLL_COALESCE) {
+                p->set_coalesce(p, p->coalesce_usecs, p->coalesce_frames);
+            }
+        }
+    }
+}
+
+// Start kirqtuned. Until it runs, coalescing stays where drivers left it.
+void irq_poll_init(void) {
+    process_t *task = process_create("kirqtuned", irq_tune_main, IRQ_TUNE_PRIORITY);
+    if (!task) {
+        kprintf("[INTERRUPTS] Failed to start kirqtuned, coalescing stays fixed\n");
+        return;
+    }
+    task->flags |= PROCESS_FLAG_SYSTEM;
+    irq_tune_task = task;
+}
+
+// Poll this CPU's queues for one softirq round-robin. A queue that used
+// its whole weight goes to the back of the list; one that drained gets
+// its interrupt back. When the budget runs out the softirq is raised
+// again, which hands the rest to ksoftirqd if it keeps up.
+static void irq_poll_run(uint32_t nr) {
+    irq_poll_list_t *list = &irq_poll_lists[smp_processor_id()];
+    uint64_t deadline = get_time_ns() + SOFTIRQ_BUDGET_NS;
+    int budget = IRQ_POLL_BUDGET;
+    
+    uint64_t flags = local_irq_save();
+    irq_poll_t *p;
+    while ((p = list->head[nr])) {
+        local_irq_restore(flags);
+        
+        int work = p->poll(p, p->weight);
+        uint64_t now = get_time_ns();
+        p->polls++;
+        p->items += work;
+        p->window_items += work;
+        irq_poll_adapt(p, now);
+        budget -= work;
+        
+        // Interrupts only ever append, so p is still at the head
+        flags = local_irq_save();
+        list->head[nr] = p->next;
+        if (!list->head[nr]) {
+            list->tail[nr] = NULL;
+        }
+        p->next = NULL;
+        
+        if ((uint32_t)work < p->weight) {
+            __atomic_and_fetch(&p->state, ~IRQ_POLL_SCHED, __ATOMIC_RELEASE);
+            p->irq_enable(p);
+        } else {
+            p->exhausted++;
+            if (list->tail[nr]) {
+                list->tail[nr]->next = p;
+            } else {
+                list->head[nr] = p;
+            }
+            list->tail[nr] = p;
+        }
+        
+        if (budget <= 0 || now >= deadline) {
+            if (list->head[nr]) {
+                raise_softirq_irqoff(nr);
+            }
+            break;
+        }
+    }
+    local_irq_restore(flags);
+}
+
+static void net_rx_softirq(void) {
+    irq_poll_run(SOFTIRQ_NET_RX);
+}
+
+static void block_softirq(void) {
+    irq_poll_run(SOFTIRQ_BLOCK);
+}
+
+// Common interrupt dispatcher. Handlers only acknowledge the device and
+// raise a softirq for anything slow; the deferred part runs on the way out.
+void interrupt_dispatcher(interrupt_frame_t *frame) {
+    uint8_t int_num = frame->int_num;
+    uint64_t start = rdtsc();
+    
     // Call registered handler
     if (interrupt_handlers[int_num]) {
         interrupt_handlers[int_num](frame);
@@ -115,9 +364,32 @@ void interrupt_dispatcher(interrupt_frame_t *frame) {
     // Send EOI
     send_eoi(int_num);
     
-    // AI learning: Record interrupt handling time
-    uint64_t handling_time = get_system_time() - interrupt_stats[int_num].last_time;
-    int_predictor->record_handling_time(int_num, handling_time);
+    // Account the top half
+    interrupt_stats_t *stats = &interrupt_stats[int_num];
+    uint64_t cycles = rdtsc() - start;
+    stats->count++;
+    stats->last_time = start;
+    stats->total_time += cycles;
+    if (!stats->min_time || cycles < stats->min_time) {
+        stats->min_time = cycles;
+    }
+    if (cycles > stats->max_time) {
+        stats->max_time = cycles;
+    }
+    stats->last_cpu = smp_processor_id();
+    
+    // Close the rate window once it has run its length
+    uint64_t now = get_time_ns();
+    if (now - stats->window_start >= IRQ_RATE_WINDOW_NS) {
+        if (stats->window_start) {
+            stats->rate = (stats->count - stats->window_count) * NSEC_PER_SEC /
+                          (now - stats->window_start);
+        }
+        stats->window_start = now;
+        stats->window_count = stats->count;
+    }
+    
+    irq_exit();
 }
 
 // Exception handlers
@@ -128,21 +400,26 @@ void divide_by_zero_handler(interrupt_frame_t *frame) {
     kernel_panic("Divide by zero exception");
 }
 
+__attribute__((interrupt))
+void device_not_available_handler(interrupt_frame_t *frame) {
+    fpu_handle_nm();
+}
+
 __attribute__((interrupt))
 void page_fault_handler(interrupt_frame_t *frame, uint64_t error_code) {
     uint64_t faulting_address;
     asm volatile("mov %%cr2, %0" : "=r"(faulting_address));
     
+    // Demand-zero and copy-on-write faults are resolved by the VMM
+    if (handle_page_fault(faulting_address, error_code)) {
+        return;  // Successfully handled
+    }
+    
     kprintf("[EXCEPTION] Page fault at 0x%llx\n", faulting_address);
     kprintf("  Error code: 0x%llx\n", error_code);
     kprintf("  Present: %d, Write: %d, User: %d\n",
             error_code & 0x1, (error_code >> 1) & 0x1, (error_code >> 2) & 0x1);
     
-    // Try to handle page fault
-    if (handle_page_fault(faulting_address, error_code)) {
-        return;  // Successfully handled
-    }
-    
     dump_interrupt_frame(frame);
     kernel_panic("Page fault");
 }
@@ -160,13 +437,13 @@ __attribute__((interrupt))
 void timer_irq_handler(interrupt_frame_t *frame) {
     // Update system time
     system_tick();
+    send_eoi(IRQ_TIMER);
+    irq_exit();
     
-    // AI-optimized scheduling decision
-    if (should_reschedule()) {
+    // Never switch away in the middle of softirq processing
+    if (!in_softirq() && should_reschedule()) {
         schedule();
     }
-    
-    send_eoi(IRQ_TIMER);
 }
 
 __attribute__((interrupt))
@@ -179,51 +456,15 @@ void keyboard_irq_handler(interrupt_frame_t *frame) {
     send_eoi(IRQ_KEYBOARD);
 }
 
-// System call handler
-__attribute__((interrupt))
-void syscall_handler(interrupt_frame_t *frame) {
-    // System call number in RAX
-    // Arguments in RDI, RSI, RDX, R10, R8, R9
-    
-    uint64_t syscall_num = frame->rax;
-    uint64_t result = 0;
-    
-    // Dispatch system call
-    switch (syscall_num) {
-        case SYS_READ:
-            result = sys_read(frame->rdi, (void*)frame->rsi, frame->rdx);
-            break;
-        case SYS_WRITE:
-            result = sys_write(frame->rdi, (void*)frame->rsi, frame->rdx);
-            break;
-        case SYS_OPEN:
-            result = sys_open((char*)frame->rdi, frame->rsi);
-            break;
-        case SYS_CLOSE:
-            result = sys_close(frame->rdi);
-            break;
-        case SYS_FORK:
-            result = sys_fork();
-            break;
-        case SYS_EXEC:
-            result = sys_exec((char*)frame->rdi, (char**)frame->rsi);
-            break;
-        case SYS_EXIT:
-            sys_exit(frame->rdi);
-            break;
-        case SYS_GETPID:
-            result = sys_getpid();
-            break;
-        case SYS_MMAP:
-            result = sys_mmap((void*)frame->rdi, frame->rsi, frame->rdx);
-            break;
-        default:
-            kprintf("[SYSCALL] Unknown syscall: %lld\n", syscall_num);
-            result = -1;
-    }
+// int 0x80 system call, called from syscall_int80_entry with the full
+// register frame. Number in RAX, arguments in RDI, RSI, RDX, R10, R8, R9.
+void syscall_int80(interrupt_frame_t *frame) {
+    syscall_args_t args = {{
+        frame->rdi, frame->rsi, frame->rdx, frame->r10, frame->r8, frame->r9
+    }};
     
     // Return result in RAX
-    frame->rax = result;
+    frame->rax = syscall_dispatch(frame->rax, &args, SYSCALL_ENTRY_INT);
 }
 
 // Dump interrupt frame for debugging
@@ -240,4 +481,41 @@ void dump_interrupt_frame(interrupt_frame_t *frame) {
     kprintf("  RIP: 0x%016llx  CS:  0x%04x\n", frame->rip, frame->cs);
     kprintf("  RFLAGS: 0x%016llx\n", frame->rflags);
     kprintf("  INT: %d  ERR: 0x%llx\n", frame->int_num, frame->error_code);
-}
\ No newline at end of file
+}
+// procfs: /proc/interrupts, rate and top-half cost per vector. A vector
+// that has gone quiet for a whole window reports a rate of zero.
+static size_t interrupts_show(char *buf, size_t size) {
+    size_t len = snprintf(buf, size, "vec        count     rate/s  cpu   avg_cycles   min_cycles   max_cycles\n");
+    uint64_t now = get_time_ns();
+    
+    for (uint32_t vec = 0; vec < 256 && len < size; vec++) {
+        interrupt_stats_t *stats = &interrupt_stats[vec];
+        if (!stats->count) {
+            continue;
+        }
+        uint64_t rate = now - stats->window_start < 2 * IRQ_RATE_WINDOW_NS ? stats->rate : 0;
+        len += snprintf(buf + len, size - len, "%3d %12llu %10llu %4d %12llu %12llu %12llu\n",
+                        vec, stats->count, rate, stats->last_cpu,
+                        stats->total_time / stats->count,
+                        stats->min_time, stats->max_time);
+    }
+    
+    return len < size ? len : size;
+}
+
+// procfs: /proc/irqpoll, polled queues and the coalescing they settled on
+static size_t irq_poll_show(char *buf, size_t size) {
+    size_t len = snprintf(buf, size, "queue                    irqs        polls        items  exhausted     rate/s  usecs frames\n");
+    
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&irq_poll_lock);
+    for (irq_poll_t *p = irq_poll_all; p && len < size; p = p->all_next) {
+        len += snprintf(buf + len, size - len, "%-16s %12llu %12llu %12llu %10llu %10llu %6d %6d\n",
+                        p->name, p->irqs, p->polls, p->items, p->exhausted,
+                        p->rate, p->coalesce_usecs, p->coalesce_frames);
+    }
+    spinlock_release(&irq_poll_lock);
+    local_irq_restore(flags);
+    
+    return len < size ? len : size;
+}
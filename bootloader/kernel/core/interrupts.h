@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "syscall.h"
 
 // IDT flags
 #define IDT_INTERRUPT_GATE 0x8E
@@ -24,17 +25,14 @@
 #define IRQ_PRIMARY_ATA 14
 #define IRQ_SECONDARY_ATA 15
 
-// System call numbers
-#define SYS_READ 0
-#define SYS_WRITE 1
-#define SYS_OPEN 2
-#define SYS_CLOSE 3
-#define SYS_FORK 4
-#define SYS_EXEC 5
-#define SYS_EXIT 6
-#define SYS_GETPID 7
-#define SYS_MMAP 8
-#define SYS_MUNMAP 9
+// Vectors handed out to MSI/MSI-X devices, between the legacy IRQs and
+// the IPIs. The system call gate in the middle is never allocated.
+#define IRQ_VECTOR_BASE 48
+#define IRQ_VECTOR_END 240
+#define IRQ_VECTOR_SYSCALL 128
+
+// Window over which the per-vector interrupt rate is measured
+#define IRQ_RATE_WINDOW_NS 1000000000ULL
 
 // IDT entry structure
 typedef struct {
@@ -61,25 +59,83 @@ typedef struct {
     uint64_t rip, cs, rflags, rsp, ss;
 } __attribute__((packed)) interrupt_frame_t;
 
-// Interrupt statistics
+// Interrupt statistics, times in cycles
 typedef struct {
     uint64_t count;
     uint64_t last_time;
     uint64_t total_time;
     uint64_t min_time;
     uint64_t max_time;
+    uint32_t last_cpu;        // CPU that took the last one
+    uint64_t rate;            // Per second, over the last complete window
+    uint64_t window_start;    // ns
+    uint64_t window_count;    // count at window_start
 } interrupt_stats_t;
 
 // Interrupt handler type
 typedef void (*interrupt_handler_t)(interrupt_frame_t *frame);
 
+// Adaptive polling. A queue whose interrupt fires masks it and is polled
+// from a softirq instead, weight items at a time; a poll that comes back
+// with weight to spare means the queue drained, and the interrupt is
+// re-armed. Under load a queue thus costs one interrupt per burst.
+#define IRQ_POLL_WEIGHT 64
+#define IRQ_POLL_BUDGET 300       // Items per softirq run, all queues together
+#define IRQ_POLL_SCHED 0x1        // On a CPU's poll list, interrupt masked
+#define IRQ_POLL_COALESCE 0x2     // New coalescing waits for kirqtuned
+#define IRQ_TUNE_PRIORITY 1
+
+// Coalescing follows the measured event rate: none below RATE_LOW so a
+// lone request completes at once, rising in STEP_US increments to MAX_US
+// at RATE_HIGH
+#define IRQ_COALESCE_RATE_LOW 10000
+#define IRQ_COALESCE_RATE_HIGH 200000
+#define IRQ_COALESCE_MAX_US 100
+#define IRQ_COALESCE_STEP_US 25
+
+// Filled in by the driver before irq_poll_register. set_coalesce is
+// optional, for devices that can hold back their interrupts; it runs in
+// kirqtuned, so it may wait for the device.
+typedef struct irq_poll {
+    struct irq_poll *next;        // On a CPU's poll list
+    struct irq_poll *all_next;    // On the registered list
+    const char *name;
+    uint32_t softirq;             // SOFTIRQ_NET_RX or SOFTIRQ_BLOCK
+    uint32_t weight;
+    volatile uint32_t state;
+    int (*poll)(struct irq_poll *p, int budget);    // Returns items done
+    void (*irq_enable)(struct irq_poll *p);
+    void (*irq_disable)(struct irq_poll *p);
+    void (*set_coalesce)(struct irq_poll *p, uint32_t usecs, uint32_t frames);
+    void *data;
+    
+    // Current coalescing and the rate it was derived from
+    uint32_t coalesce_usecs;
+    uint32_t coalesce_frames;
+    uint64_t rate;                // Items per second, last window
+    uint64_t window_start;        // ns
+    uint64_t window_items;
+    
+    // Statistics
+    uint64_t irqs;                // Interrupts that scheduled a poll
+    uint64_t polls;
+    uint64_t items;
+    uint64_t exhausted;           // Polls that used their whole weight
+} irq_poll_t;
+
 // Function prototypes
 void interrupts_init(void);
 void set_idt_gate(uint8_t num, uint64_t handler, uint16_t selector,
                   uint8_t flags, uint8_t dpl);
 void register_interrupt_handler(uint8_t num, interrupt_handler_t handler);
 void interrupt_dispatcher(interrupt_frame_t *frame);
+void syscall_int80(interrupt_frame_t *frame);
 void dump_interrupt_frame(interrupt_frame_t *frame);
 void send_eoi(uint8_t irq);
+int irq_alloc_vector(void);
+void irq_free_vector(uint8_t vector);
+void irq_poll_init(void);
+void irq_poll_register(irq_poll_t *p);
+void irq_poll_schedule(irq_poll_t *p);
 
 #endif // INTERRUPTS_H
\ No newline at end of file
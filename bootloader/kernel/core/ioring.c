@@ -0,0 +1,201 @@
+// AION OS Submission/Completion Rings
+#include "ioring.h"
+#include "../process/process.h"
+#include "../drivers/storage/nvme.h"
+
+static inline ioring_sqe_t* ioring_sqe(ioring_t *ring, uint32_t index) {
+    ioring_sqe_t *page = phys_to_virt(ring->pages[1 + index / IORING_SQES_PER_PAGE]);
+    return &page[index % IORING_SQES_PER_PAGE];
+}
+
+static inline ioring_cqe_t* ioring_cqe(ioring_t *ring, uint32_t index) {
+    ioring_cqe_t *page = phys_to_virt(ring->pages[1 + ring->sq_pages +
+                                                  index / IORING_CQES_PER_PAGE]);
+    return &page[index % IORING_CQES_PER_PAGE];
+}
+
+static void ioring_free_pages(ioring_t *ring) {
+    for (uint32_t i = 0; i < ring->nr_pages && ring->pages[i]; i++) {
+        vmm_release_special_page(ring->pages[i]);
+    }
+    kfree(ring->pages);
+    kfree(ring);
+}
+
+// Create the calling process's ring and map it. Returns the user address
+// of the mapping; params gives the layout within it.
+int64_t ioring_setup(uint32_t entries, ioring_params_t *params) {
+    process_t *proc = current_process;
+    if (!proc) {
+        return -ESRCH;
+    }
+    if (!proc->memory.mm) {
+        return -EINVAL;     // Kernel threads have nowhere to map the ring
+    }
+    if (entries == 0 || entries > IORING_MAX_ENTRIES || (entries & (entries - 1))) {
+        return -EINVAL;
+    }
+    if (proc->ioring) {
+        return -EBUSY;
+    }
+
+    ioring_t *ring = kmalloc(sizeof(ioring_t));
+    if (!ring) {
+        return -ENOMEM;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->sq_entries = entries;
+    ring->cq_entries = entries * 2;
+    ring->sq_pages = (entries + IORING_SQES_PER_PAGE - 1) / IORING_SQES_PER_PAGE;
+    ring->cq_pages = (ring->cq_entries + IORING_CQES_PER_PAGE - 1) / IORING_CQES_PER_PAGE;
+    ring->nr_pages = 1 + ring->sq_pages + ring->cq_pages;
+
+    ring->pages = kmalloc(ring->nr_pages * sizeof(uint64_t));
+    if (!ring->pages) {
+        kfree(ring);
+        return -ENOMEM;
+    }
+    memset(ring->pages, 0, ring->nr_pages * sizeof(uint64_t));
+
+    // Single pages, so each carries its own reference count
+    for (uint32_t i = 0; i < ring->nr_pages; i++) {
+        void *page = pmm_try_alloc_pages(1);
+        if (!page) {
+            ioring_free_pages(ring);
+            return -ENOMEM;
+        }
+        memset(phys_to_virt((uint64_t)page), 0, PAGE_SIZE);
+        ring->pages[i] = (uint64_t)page;
+    }
+
+    ring->shared = phys_to_virt(ring->pages[0]);
+    ring->shared->sq_entries = ring->sq_entries;
+    ring->shared->cq_entries = ring->cq_entries;
+
+    uint64_t addr = vmm_install_special_pages(proc->memory.mm, 0, ring->pages, ring->nr_pages,
+                                              PTE_USER | PTE_WRITABLE | PTE_NX);
+    if (!addr) {
+        ioring_free_pages(ring);
+        return -ENOMEM;
+    }
+    ring->user_addr = addr;
+
+    params->sq_entries = ring->sq_entries;
+    params->cq_entries = ring->cq_entries;
+    params->sqes_off = PAGE_SIZE;
+    params->cqes_off = (1 + ring->sq_pages) * PAGE_SIZE;
+    params->size = ring->nr_pages * PAGE_SIZE;
+
+    proc->ioring = ring;
+    return addr;
+}
+
+static int32_t ioring_issue(const ioring_sqe_t *sqe) {
+    switch (sqe->opcode) {
+        case IORING_OP_NOP:
+            return 0;
+        case IORING_OP_READ:
+            return vfs_read(sqe->fd, (void*)sqe->addr, sqe->len);
+        case IORING_OP_WRITE:
+            return vfs_write(sqe->fd, (const void*)sqe->addr, sqe->len);
+        case IORING_OP_READV:
+            return vfs_readv(sqe->fd, (const iovec_t*)sqe->addr, sqe->len);
+        case IORING_OP_WRITEV:
+            return vfs_writev(sqe->fd, (const iovec_t*)sqe->addr, sqe->len);
+        case IORING_OP_OPEN:
+            return vfs_open((const char*)sqe->addr, sqe->op_flags, sqe->len);
+        case IORING_OP_CLOSE:
+            return vfs_close(sqe->fd);
+        case IORING_OP_FSTAT:
+            return vfs_fstat(sqe->fd, (struct stat*)sqe->addr);
+        case IORING_OP_SEND:
+            return socket_send(sqe->fd, (const void*)sqe->addr, sqe->len, sqe->op_flags);
+        case IORING_OP_RECV:
+            return socket_recv(sqe->fd, (void*)sqe->addr, sqe->len, sqe->op_flags);
+        case IORING_OP_NVME_READ:
+        case IORING_OP_NVME_WRITE: {
+            nvme_controller_t *ctrl = nvme_get_controller(sqe->fd);
+            if (!ctrl || sqe->len == 0 || sqe->op_flags == 0 ||
+                sqe->op_flags > (uint32_t)ctrl->num_namespaces) {
+                return -EINVAL;
+            }
+            // addr is a user buffer: pinned and translated, never handed
+            // to the controller as is
+            return nvme_rw_user(ctrl, sqe->op_flags, sqe->off, sqe->len,
+                                current_process->memory.mm, sqe->addr,
+                                sqe->opcode == IORING_OP_NVME_WRITE);
+        }
+        default:
+            return -EINVAL;
+    }
+}
+
+// Consume up to to_submit entries in one kernel entry. Operations finish
+// before they are completed, so user space reaps everything submitted
+// here straight from the completion ring. Stops early rather than drop a
+// completion. Returns the number of entries consumed.
+int64_t ioring_enter(uint32_t to_submit) {
+    ioring_t *ring = current_process->ioring;
+    if (!ring) {
+        return -EINVAL;
+    }
+    if (__atomic_exchange_n(&ring->busy, 1, __ATOMIC_ACQUIRE)) {
+        return -EBUSY;
+    }
+
+    // Our own indices are kept privately; the ones user space writes are
+    // never trusted beyond the ring size
+    ioring_shared_t *sh = ring->shared;
+    uint32_t sq_head = ring->sq_head;
+    uint32_t cq_tail = ring->cq_tail;
+
+    uint32_t pending = __atomic_load_n(&sh->sq_tail, __ATOMIC_ACQUIRE) - sq_head;
+    if (pending > ring->sq_entries) {
+        pending = ring->sq_entries;
+    }
+    if (to_submit > pending) {
+        to_submit = pending;
+    }
+
+    uint32_t done = 0;
+    while (done < to_submit) {
+        uint32_t cq_used = cq_tail - __atomic_load_n(&sh->cq_head, __ATOMIC_ACQUIRE);
+        if (cq_used >= ring->cq_entries) {
+            sh->cq_overflow++;
+            break;
+        }
+
+        // Copy the entry so user space cannot change it under us
+        ioring_sqe_t sqe = *ioring_sqe(ring, sq_head & (ring->sq_entries - 1));
+        sq_head++;
+        done++;
+        if (sqe.opcode >= IORING_OP_LAST) {
+            sh->sq_dropped++;
+        }
+
+        ioring_cqe_t *cqe = ioring_cqe(ring, cq_tail & (ring->cq_entries - 1));
+        cqe->user_data = sqe.user_data;
+        cqe->res = ioring_issue(&sqe);
+        cqe->flags = 0;
+        cq_tail++;
+
+        // Publish as we go so a long batch completes incrementally
+        __atomic_store_n(&sh->sq_head, sq_head, __ATOMIC_RELEASE);
+        __atomic_store_n(&sh->cq_tail, cq_tail, __ATOMIC_RELEASE);
+    }
+
+    ring->sq_head = sq_head;
+    ring->cq_tail = cq_tail;
+    ring->enters++;
+    ring->submitted += done;
+    __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+    return done;
+}
+
+// Drop the kernel's references. Forked children that still map the pages
+// keep them alive until their own address space goes.
+void ioring_destroy(ioring_t *ring) {
+    if (ring) {
+        ioring_free_pages(ring);
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef IORING_H
+#define IORING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "syscall.h"
+#include "../memory/vmm.h"
+
+// Ring sizes. The completion ring is twice the submission ring so a full
+// batch always has room to complete.
+#define IORING_MAX_ENTRIES 4096
+#define IORING_SQES_PER_PAGE (PAGE_SIZE / sizeof(ioring_sqe_t))
+#define IORING_CQES_PER_PAGE (PAGE_SIZE / sizeof(ioring_cqe_t))
+
+// Operations
+typedef enum {
+    IORING_OP_NOP,
+    IORING_OP_READ,           // vfs_read at the file position
+    IORING_OP_WRITE,
+    IORING_OP_READV,          // addr is an iovec_t array, len its count
+    IORING_OP_WRITEV,
+    IORING_OP_OPEN,           // addr is the path, op_flags the open flags
+    IORING_OP_CLOSE,
+    IORING_OP_FSTAT,          // addr is a struct stat
+    IORING_OP_SEND,           // Sockets; op_flags are the send/recv flags
+    IORING_OP_RECV,
+    IORING_OP_NVME_READ,      // fd is the controller, off the LBA, len the
+    IORING_OP_NVME_WRITE,     // block count and op_flags the namespace; the
+                              // buffer spans at most NVME_MAX_XFER_PAGES pages
+    IORING_OP_LAST
+} ioring_op_t;
+
+// Submission entry, written by user space
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t reserved;
+    int32_t fd;
+    uint64_t off;
+    uint64_t addr;
+    uint32_t len;
+    uint32_t op_flags;
+    uint64_t user_data;       // Copied to the completion
+    uint64_t pad[3];
+} ioring_sqe_t;
+
+// Completion entry, written by the kernel
+typedef struct {
+    uint64_t user_data;
+    int32_t res;              // Result of the operation or -errno
+    uint32_t flags;
+} ioring_cqe_t;
+
+// First page of the mapping. User space produces at sq_tail and consumes
+// at cq_head; the kernel does the opposite. Each side publishes its index
+// with a release store after the entries it covers.
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    uint32_t sq_entries;
+    uint32_t sq_dropped;      // Entries with an unknown opcode
+    uint8_t pad0[48];
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t cq_entries;
+    uint32_t cq_overflow;     // Enters that stopped on a full completion ring
+    uint8_t pad1[48];
+} ioring_shared_t;
+
+// Filled in by ioring_setup: offsets from the returned address
+typedef struct {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sqes_off;
+    uint32_t cqes_off;
+    uint32_t size;
+} ioring_params_t;
+
+// Kernel side, one per process. The ring pages are mapped into the owner
+// and reached here through the kernel mapping, page by page.
+typedef struct ioring {
+    uint64_t user_addr;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_pages;
+    uint32_t cq_pages;
+    uint32_t nr_pages;
+    uint64_t *pages;          // Physical address of each page
+    ioring_shared_t *shared;
+    uint32_t sq_head;         // Kernel copies of the indices it owns
+    uint32_t cq_tail;
+    uint32_t busy;            // Set while an enter is running
+
+    // Statistics
+    uint64_t enters;
+    uint64_t submitted;
+} ioring_t;
+
+// Function prototypes
+int64_t ioring_setup(uint32_t entries, ioring_params_t *params);
+int64_t ioring_enter(uint32_t to_submit);
+void ioring_destroy(ioring_t *ring);
+
+#endif // IORING_H
@@ -0,0 +1,118 @@
+; AION OS Device Interrupt Vectors
+; Entry stubs for the vectors handed out to MSI/MSI-X devices. Each pushes
+; a dummy error code and its vector number, completing an interrupt_frame_t
+; for the common dispatcher. Entries from user mode swap to the kernel GS
+; base and back, so the per-CPU area is in GS for the whole handler. The
+; int 0x80 system call entry builds the same frame.
+[BITS 64]
+
+IRQ_VECTOR_BASE equ 48
+IRQ_VECTOR_END  equ 240
+
+section .text
+    global irq_vector_stubs
+    global syscall_int80_entry
+    extern interrupt_dispatcher
+    extern syscall_int80
+
+%assign vec IRQ_VECTOR_BASE
+%rep IRQ_VECTOR_END - IRQ_VECTOR_BASE
+irq_vector_stub_ %+ vec:
+    push 0
+    push vec
+    jmp irq_vector_common
+%assign vec vec + 1
+%endrep
+
+; Entry with the vector and error code pushed: complete the frame,
+; switching to the kernel GS base if we came from user mode
+%macro SAVE_FRAME 0
+    ; CS of the interrupted code sits above the vector and error code
+    test qword [rsp + 24], 3
+    jz %%from_kernel
+    swapgs
+%%from_kernel:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+%endmacro
+
+%macro RESTORE_FRAME 0
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+
+    test qword [rsp + 24], 3
+    jz %%to_kernel
+    swapgs
+%%to_kernel:
+    ; Drop the vector and error code
+    add rsp, 16
+    iretq
+%endmacro
+
+irq_vector_common:
+    SAVE_FRAME
+
+    ; Frame pointer as the argument; rbx survives the call
+    cld
+    mov rdi, rsp
+    mov rbx, rsp
+    and rsp, -16
+    call interrupt_dispatcher
+    mov rsp, rbx
+
+    RESTORE_FRAME
+
+; int 0x80 system calls, through the same frame. The handler reads the
+; arguments from it and stores the result in its rax slot, which is
+; restored on the way out. Interrupts are on while the call runs.
+syscall_int80_entry:
+    push 0
+    push 0x80
+    SAVE_FRAME
+
+    cld
+    mov rdi, rsp
+    mov rbx, rsp
+    and rsp, -16
+    sti
+    call syscall_int80
+    cli
+    mov rsp, rbx
+
+    RESTORE_FRAME
+
+section .rodata
+    align 8
+; Stub address per vector, starting at IRQ_VECTOR_BASE
+irq_vector_stubs:
+%assign vec IRQ_VECTOR_BASE
+%rep IRQ_VECTOR_END - IRQ_VECTOR_BASE
+    dq irq_vector_stub_ %+ vec
+%assign vec vec + 1
+%endrep
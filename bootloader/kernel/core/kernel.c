@@ -1,7 +1,17 @@
 // AION OS Kernel Core
 #include "kernel.h"
+#include "fpu.h"
+#include "syscall.h"
+#include "softirq.h"
+#include "interrupts.h"
+#include "printk.h"
+#include "smp.h"
 #include "../memory/memory.h"
+#include "../memory/vmm.h"
+#include "../memory/compaction.h"
+#include "../drivers/vclock.h"
 #include "../process/process.h"
+#include "../process/runqueue.h"
 #include "../drivers/driver.h"
 #include "../terminal/terminal.h"
 #include "../ai/predictor.h"
@@ -17,6 +27,9 @@ kernel_state_t kernel_state = {
     .debug_mode = true
 };
 
+// Boot CPU features
+cpu_features_t cpu_features;
+
 // Multiboot info structure
 extern multiboot_info_t *multiboot_info;
 
@@ -25,12 +38,19 @@ void kernel_early_init(void) {
     // Disable interrupts during init
     asm volatile("cli");
     
+    // smp_processor_id reads GS, and printk uses it from the first line
+    smp_cpu_local_init(0);
+    
     // Initialize serial port for debugging
     init_serial();
     kprintf("[KERNEL] AION OS %s starting...\n", KERNEL_VERSION);
     
     // Initialize CPU features detection
     detect_cpu_features();
+    fpu_init();
+    
+    // Record the boot CPU's APIC ID
+    smp_init();
     
     // Setup GDT and IDT
     init_gdt();
@@ -47,7 +67,11 @@ void kernel_main(void) {
     // Initialize memory management
     kprintf("[KERNEL] Initializing memory management...\n");
     memory_init(multiboot_info);
-    heap_init();
+    slab_init();
+    memory_predictor_init();    // Needs kmalloc
+    vmm_init();
+    fpu_state_cache_init();
+    vclock_init();
     
     // Initialize AI predictor early for optimization
     kprintf("[KERNEL] Initializing AI predictor...\n");
@@ -57,12 +81,19 @@ void kernel_main(void) {
     kprintf("[KERNEL] Initializing process management...\n");
     process_init();
     scheduler_init();
+    syscall_init();
+    softirq_init();
+    irq_poll_init();
+    printk_init();
     
     // Initialize drivers
     kprintf("[KERNEL] Initializing drivers...\n");
     driver_manager_init();
     pci_init();
     
+    // Start background memory compaction
+    kcompactd_init();
+    
     // Initialize filesystem
     kprintf("[KERNEL] Initializing filesystem...\n");
     vfs_init();
@@ -119,6 +150,7 @@ void kernel_panic(const char *message) {
     terminal_set_color(TERMINAL_COLOR_RED);
     kprintf("\n\n[KERNEL PANIC] %s\n", message);
     kprintf("System halted. Please restart your computer.\n");
+    console_flush();
     
     // Dump registers and stack trace
     dump_registers();
@@ -137,6 +169,7 @@ void detect_cpu_features(void) {
     
     // Get CPU vendor
     cpuid(0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
     *((uint32_t*)&features.vendor[0]) = ebx;
     *((uint32_t*)&features.vendor[4]) = edx;
     *((uint32_t*)&features.vendor[8]) = ecx;
@@ -146,12 +179,35 @@ void detect_cpu_features(void) {
     features.has_sse = (edx >> 25) & 1;
     features.has_sse2 = (edx >> 26) & 1;
     features.has_sse3 = ecx & 1;
+    features.has_fma = (ecx >> 12) & 1;
+    features.has_tsc_deadline = (ecx >> 24) & 1;
+    features.has_aes = (ecx >> 25) & 1;
+    features.has_xsave = (ecx >> 26) & 1;
     features.has_avx = (ecx >> 28) & 1;
     
+    // Structured extended features (leaf 7, subleaf 0)
+    if (max_leaf >= 7) {
+        asm volatile("cpuid"
+                     : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(7), "c"(0));
+        features.has_avx2 = (ebx >> 5) & 1;
+    }
+    
+    // XSAVE extensions (leaf 0xD, subleaf 1)
+    if (features.has_xsave && max_leaf >= 0xD) {
+        asm volatile("cpuid"
+                     : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(0xD), "c"(1));
+        features.has_xsaveopt = eax & 1;
+    }
+    
+    cpu_features = features;
+    
     kprintf("[CPU] Vendor: %s\n", features.vendor);
-    kprintf("[CPU] Features: SSE=%d SSE2=%d SSE3=%d AVX=%d\n",
+    kprintf("[CPU] Features: SSE=%d SSE2=%d SSE3=%d AVX=%d AVX2=%d FMA=%d XSAVE=%d\n",
             features.has_sse, features.has_sse2, 
-            features.has_sse3, features.has_avx);
+            features.has_sse3, features.has_avx, features.has_avx2,
+            features.has_fma, features.has_xsave);
 }
 
 // Initialize GDT (Global Descriptor Table)
@@ -162,17 +218,17 @@ void init_gdt(void) {
     // Null segment
     set_gdt_entry(&gdt[0], 0, 0, 0, 0);
     
-    // Kernel code segment
-    set_gdt_entry(&gdt[1], 0, 0xFFFFFFFF, 0x9A, 0xCF);
+    // Kernel code segment (64-bit)
+    set_gdt_entry(&gdt[1], 0, 0xFFFFFFFF, 0x9A, 0xAF);
     
     // Kernel data segment
     set_gdt_entry(&gdt[2], 0, 0xFFFFFFFF, 0x92, 0xCF);
     
-    // User code segment
-    set_gdt_entry(&gdt[3], 0, 0xFFFFFFFF, 0xFA, 0xCF);
+    // User data segment; SYSCALL/SYSRET fix the order of the user pair
+    set_gdt_entry(&gdt[3], 0, 0xFFFFFFFF, 0xF2, 0xCF);
     
-    // User data segment
-    set_gdt_entry(&gdt[4], 0, 0xFFFFFFFF, 0xF2, 0xCF);
+    // User code segment (64-bit)
+    set_gdt_entry(&gdt[4], 0, 0xFFFFFFFF, 0xFA, 0xAF);
     
     // TSS segment (for task switching)
     set_gdt_entry(&gdt[5], (uint32_t)&tss, sizeof(tss_t), 0x89, 0x00);
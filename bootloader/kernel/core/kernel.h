@@ -8,8 +8,8 @@
 // Kernel constants
 #define KERNEL_CS 0x08
 #define KERNEL_DS 0x10
-#define USER_CS 0x18
-#define USER_DS 0x20
+#define USER_DS 0x18          // SYSRET wants user data right below user code
+#define USER_CS 0x20
 #define TSS_SEGMENT 0x28
 
 #define GDT_ENTRIES 6
@@ -32,7 +32,11 @@ typedef struct {
     bool has_sse3;
     bool has_avx;
     bool has_avx2;
+    bool has_fma;
     bool has_aes;
+    bool has_xsave;
+    bool has_xsaveopt;
+    bool has_tsc_deadline;
 } cpu_features_t;
 
 // GDT entry structure
@@ -87,12 +91,15 @@ typedef struct {
     uint16_t iomap_base;
 } __attribute__((packed)) tss_t;
 
+extern tss_t tss;
+
 // Function prototypes
 void kernel_main(void);
 void kernel_early_init(void);
 void kernel_idle_loop(void);
 void kernel_panic(const char *message);
 void detect_cpu_features(void);
+extern cpu_features_t cpu_features;
 void init_gdt(void);
 void init_idt(void);
 void init_serial(void);
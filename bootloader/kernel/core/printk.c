@@ -0,0 +1,356 @@
+// AION OS Kernel Log: per-CPU rings drained to the console by klogd
+#include "printk.h"
+#include "kernel.h"
+#include "../process/process.h"
+#include "../process/runqueue.h"
+#include "../terminal/terminal.h"
+#include "../fs/procfs.h"
+#include <stdarg.h>
+
+#define COM1_PORT 0x3F8
+#define COM1_LSR (COM1_PORT + 5)
+#define LSR_THR_EMPTY 0x20
+
+static log_ring_t log_rings[MAX_CPUS];
+static uint64_t log_seq;
+static int console_loglevel = CONSOLE_LOGLEVEL_DEFAULT;
+static uint32_t console_busy;
+static process_t *klogd_task;
+
+static size_t dmesg_show(char *buf, size_t size);
+
+static inline uint64_t log_record_size(uint16_t len) {
+    return (sizeof(log_record_t) + len + LOG_ALIGN - 1) & ~(uint64_t)(LOG_ALIGN - 1);
+}
+
+// Where a record at pos really starts: a header never straddles the end
+static inline uint64_t log_fix_pos(uint64_t pos) {
+    if (pos % LOG_RING_SIZE + sizeof(log_record_t) > LOG_RING_SIZE) {
+        pos += LOG_RING_SIZE - pos % LOG_RING_SIZE;
+    }
+    return pos;
+}
+
+static inline log_record_t* log_record_at(log_ring_t *ring, uint64_t pos) {
+    return (log_record_t*)&ring->buf[pos % LOG_RING_SIZE];
+}
+
+// Position after the record (or wrap marker) at pos
+static inline uint64_t log_next_pos(log_ring_t *ring, uint64_t pos) {
+    uint16_t len = log_record_at(ring, pos)->len;
+    if (len == 0) {
+        return pos + LOG_RING_SIZE - pos % LOG_RING_SIZE;
+    }
+    return pos + log_record_size(len);
+}
+
+// Append one record to this CPU's ring, reclaiming the oldest records if
+// it is full. Interrupts must be off.
+static void log_store(int level, const char *text, uint16_t len) {
+    uint32_t cpu = smp_processor_id();
+    log_ring_t *ring = &log_rings[cpu];
+    uint64_t need = log_record_size(len);
+
+    uint64_t pos = log_fix_pos(ring->head);
+    uint64_t wrap = 0;
+    if (pos % LOG_RING_SIZE + need > LOG_RING_SIZE) {
+        wrap = pos;
+        pos += LOG_RING_SIZE - pos % LOG_RING_SIZE;
+    }
+
+    // Move tail first, so readers of what is about to be overwritten
+    // notice and drop their copy
+    uint64_t tail = ring->tail;
+    while (pos + need - tail > LOG_RING_SIZE) {
+        tail = log_fix_pos(tail);
+        if (tail >= ring->console && log_record_at(ring, tail)->len) {
+            ring->overwritten++;
+        }
+        tail = log_next_pos(ring, tail);
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (wrap) {
+        log_record_at(ring, wrap)->len = 0;
+    }
+
+    log_record_t *rec = log_record_at(ring, pos);
+    rec->seq = __atomic_fetch_add(&log_seq, 1, __ATOMIC_RELAXED);
+    // Safe from the first kprintf: the clock page is static and reads
+    // 0 ns until the tick starts, so early records are stamped 0
+    rec->ts_ns = get_time_ns();
+    rec->len = len;
+    rec->level = level;
+    rec->cpu = cpu;
+    memcpy(rec + 1, text, len);
+
+    __atomic_store_n(&ring->head, pos + need, __ATOMIC_RELEASE);
+}
+
+// Copy out the next record at or after *pos and move *pos past it. text
+// may be NULL to read the header only. Skips anything the producer has
+// reclaimed meanwhile. Returns false when the ring holds nothing more,
+// with *pos at the end.
+static bool log_read(log_ring_t *ring, uint64_t *pos, log_record_t *hdr, char *text) {
+    while (1) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t p = *pos;
+        uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (p < tail) {
+            p = tail;
+        }
+        if (p >= head) {
+            *pos = p;
+            return false;
+        }
+
+        p = log_fix_pos(p);
+        *hdr = *log_record_at(ring, p);
+        uint64_t next = hdr->len ? p + log_record_size(hdr->len)
+                                 : p + LOG_RING_SIZE - p % LOG_RING_SIZE;
+        if (text && hdr->len && hdr->len < LOG_LINE_MAX) {
+            memcpy(text, log_record_at(ring, p) + 1, hdr->len);
+        }
+
+        // Valid only if the producer did not reclaim it while we copied
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) > p) {
+            *pos = p;
+            continue;
+        }
+        *pos = next;
+        if (hdr->len == 0 || hdr->len >= LOG_LINE_MAX) {
+            continue;
+        }
+        return true;
+    }
+}
+
+// Oldest record across all CPUs, by sequence number, starting from pos[]
+static log_ring_t* log_next(uint64_t *pos, log_record_t *hdr) {
+    log_ring_t *best = NULL;
+    uint64_t best_seq = UINT64_MAX;
+
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        log_record_t peek;
+        uint64_t p = pos[cpu];
+        if (log_read(&log_rings[cpu], &p, &peek, NULL) && peek.seq < best_seq) {
+            best_seq = peek.seq;
+            best = &log_rings[cpu];
+            *hdr = peek;
+        }
+    }
+    return best;
+}
+
+static void serial_putc(char c) {
+    while (!(inb(COM1_LSR) & LSR_THR_EMPTY)) {
+        cpu_pause();
+    }
+    outb(COM1_PORT, c);
+}
+
+static void console_write(const char *text, uint16_t len) {
+    for (uint16_t i = 0; i < len; i++) {
+        if (text[i] == '\n') {
+            serial_putc('\r');
+        }
+        serial_putc(text[i]);
+        terminal_putchar(text[i]);
+    }
+}
+
+static bool log_pending(void) {
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        if (log_rings[cpu].console < __atomic_load_n(&log_rings[cpu].head, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Write out everything logged so far, in order. Whoever finds the console
+// busy leaves its messages to the flusher already running, which checks
+// once more after letting go.
+void console_flush(void) {
+    uint64_t pos[MAX_CPUS];
+    char text[LOG_LINE_MAX];
+
+    do {
+        if (__atomic_exchange_n(&console_busy, 1, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+
+        for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+            pos[cpu] = log_rings[cpu].console;
+        }
+
+        log_record_t hdr;
+        log_ring_t *ring;
+        while ((ring = log_next(pos, &hdr))) {
+            uint32_t cpu = ring - log_rings;
+            if (!log_read(ring, &pos[cpu], &hdr, text)) {
+                continue;
+            }
+            if (hdr.level <= console_loglevel) {
+                console_write(text, hdr.len);
+            }
+            ring->console = pos[cpu];
+        }
+
+        // Rings whose last records were wrap markers
+        for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+            log_rings[cpu].console = pos[cpu];
+        }
+
+        __atomic_store_n(&console_busy, 0, __ATOMIC_RELEASE);
+    } while (log_pending());
+}
+
+// Format into the calling CPU's ring. The console is written by klogd,
+// except for emergencies and before klogd runs, when it happens here.
+void kprintf(const char *format, ...) {
+    char line[LOG_LINE_MAX];
+    int level = LOGLEVEL_DEFAULT;
+
+    if (format[0] == '<' && format[1] >= '0' && format[1] <= '7' && format[2] == '>') {
+        level = format[1] - '0';
+        format += 3;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len <= 0) {
+        return;
+    }
+    if (len >= LOG_LINE_MAX) {
+        len = LOG_LINE_MAX - 1;
+    }
+
+    uint64_t flags = local_irq_save();
+    log_store(level, line, len);
+    local_irq_restore(flags);
+
+    if (!klogd_task || level <= LOGLEVEL_CRIT) {
+        console_flush();
+        return;
+    }
+
+    // Waking may append to this CPU's run queue, which is only edited with
+    // interrupts off; a caller running that way may be in the middle of
+    // such an edit, or of a switch. The periodic kick covers that case.
+    if ((flags & 0x200) && klogd_task->state == PROCESS_STATE_BLOCKED) {
+        wake_up_process(klogd_task);
+    }
+}
+
+// Allow burst messages per interval from one call site, then count what
+// is dropped and report it when the next interval starts
+bool printk_ratelimit(ratelimit_t *rs, const char *site) {
+    uint64_t now = get_time_ns();
+    uint64_t begin = __atomic_load_n(&rs->begin, __ATOMIC_RELAXED);
+
+    if (!begin || now - begin >= RATELIMIT_INTERVAL_NS) {
+        if (__atomic_compare_exchange_n(&rs->begin, &begin, now, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            uint32_t missed = __atomic_exchange_n(&rs->missed, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&rs->printed, 0, __ATOMIC_RELAXED);
+            if (missed) {
+                kprintf(KERN_WARNING "%s: %d messages suppressed\n", site, missed);
+            }
+        }
+    }
+
+    if (__atomic_fetch_add(&rs->printed, 1, __ATOMIC_RELAXED) < RATELIMIT_BURST) {
+        return true;
+    }
+    __atomic_fetch_add(&rs->missed, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+void console_set_loglevel(int level) {
+    if (level >= LOGLEVEL_EMERG && level <= LOGLEVEL_DEBUG) {
+        console_loglevel = level;
+    }
+}
+
+static void klogd_main(void) {
+    while (1) {
+        uint64_t flags = local_irq_save();
+        while (!log_pending()) {
+            current_process->state = PROCESS_STATE_BLOCKED;
+            local_irq_restore(flags);
+            schedule();
+            flags = local_irq_save();
+        }
+        local_irq_restore(flags);
+
+        console_flush();
+    }
+}
+
+static void klogd_timer(void *data) {
+    (void)data;
+    if (klogd_task && klogd_task->state == PROCESS_STATE_BLOCKED && log_pending()) {
+        wake_up_process(klogd_task);
+    }
+}
+
+// Hand the console to klogd. Until this runs every kprintf writes it out.
+void printk_init(void) {
+    procfs_register("dmesg", dmesg_show);
+
+    process_t *task = process_create("klogd", klogd_main, KLOGD_PRIORITY);
+    if (!task) {
+        kprintf(KERN_ERR "[PRINTK] Failed to start klogd, console stays synchronous\n");
+        return;
+    }
+    task->flags |= PROCESS_FLAG_SYSTEM;
+    klogd_task = task;
+
+    register_timer_callback(LOG_FLUSH_INTERVAL_MS, klogd_timer, NULL, true);
+    kprintf("[PRINTK] %d KB log per CPU, console level %d\n",
+            LOG_RING_SIZE / 1024, console_loglevel);
+}
+
+// procfs: /proc/dmesg, everything still held, oldest first
+static size_t dmesg_show(char *buf, size_t size) {
+    uint64_t pos[MAX_CPUS];
+    uint64_t overwritten = 0;
+    char text[LOG_LINE_MAX];
+    bool line_start = true;
+    size_t len = 0;
+
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        pos[cpu] = __atomic_load_n(&log_rings[cpu].tail, __ATOMIC_ACQUIRE);
+        overwritten += log_rings[cpu].overwritten;
+    }
+    if (overwritten) {
+        len += snprintf(buf + len, size - len, "<4>[ %llu messages lost before the console wrote them ]\n",
+                        overwritten);
+    }
+
+    log_record_t hdr;
+    log_ring_t *ring;
+    while (len < size && (ring = log_next(pos, &hdr))) {
+        uint32_t cpu = ring - log_rings;
+        if (!log_read(ring, &pos[cpu], &hdr, text)) {
+            continue;
+        }
+
+        // Continuations of a line printed in pieces get no prefix
+        if (line_start) {
+            len += snprintf(buf + len, size - len, "<%d>[%5llu.%06llu] ", hdr.level,
+                            hdr.ts_ns / 1000000000ULL, (hdr.ts_ns / 1000) % 1000000);
+        }
+        if (len < size) {
+            len += snprintf(buf + len, size - len, "%.*s", hdr.len, text);
+        }
+        line_start = text[hdr.len - 1] == '\n';
+    }
+
+    return len < size ? len : size;
+}
@@ -0,0 +1,85 @@
+#ifndef PRINTK_H
+#define PRINTK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "smp.h"
+
+// Log levels, given as a prefix on the format: kprintf(KERN_DEBUG "...")
+#define KERN_EMERG "<0>"
+#define KERN_ALERT "<1>"
+#define KERN_CRIT "<2>"
+#define KERN_ERR "<3>"
+#define KERN_WARNING "<4>"
+#define KERN_NOTICE "<5>"
+#define KERN_INFO "<6>"
+#define KERN_DEBUG "<7>"
+
+#define LOGLEVEL_EMERG 0
+#define LOGLEVEL_CRIT 2
+#define LOGLEVEL_DEFAULT 6        // Messages without a prefix
+#define LOGLEVEL_DEBUG 7
+
+// Levels above this are kept in the log but not shown on the console
+#define CONSOLE_LOGLEVEL_DEFAULT 6
+
+// Per-CPU log ring, in bytes. Records are 8-byte aligned and never split
+// across the end: a record that would be is preceded by a wrap marker.
+#define LOG_RING_SIZE 16384
+#define LOG_LINE_MAX 256
+#define LOG_ALIGN 8
+
+// The console thread is also kicked periodically, for messages logged
+// where it could not be woken directly
+#define LOG_FLUSH_INTERVAL_MS 50
+#define KLOGD_PRIORITY 1
+
+// Rate limiting: at most burst messages per interval per call site
+#define RATELIMIT_INTERVAL_NS 5000000000ULL
+#define RATELIMIT_BURST 10
+
+// Record header, followed by len bytes of text
+typedef struct {
+    uint64_t seq;                 // Global order across CPUs
+    uint64_t ts_ns;
+    uint16_t len;                 // 0 marks a wrap to the ring start
+    uint8_t level;
+    uint8_t cpu;
+    uint32_t reserved;
+} log_record_t;
+
+// Written only by its own CPU, with interrupts off, so there is a single
+// producer. When full the producer reclaims the oldest records by moving
+// tail; readers copy a record out and then check tail has not passed it.
+// Positions count bytes from boot and are reduced modulo the ring size.
+typedef struct {
+    uint8_t buf[LOG_RING_SIZE];
+    volatile uint64_t head;       // Next byte to write
+    volatile uint64_t tail;       // Oldest record still held
+    uint64_t console;             // Next record for the console
+    uint64_t overwritten;         // Records reclaimed before the console got them
+} __attribute__((aligned(64))) log_ring_t;
+
+// Call site state for kprintf_ratelimited
+typedef struct {
+    uint64_t begin;               // Start of the interval, ns
+    uint32_t printed;
+    uint32_t missed;
+} ratelimit_t;
+
+#define kprintf_ratelimited(fmt, ...)                       \
+    do {                                                    \
+        static ratelimit_t _rs;                             \
+        if (printk_ratelimit(&_rs, __func__)) {             \
+            kprintf(fmt, ##__VA_ARGS__);                    \
+        }                                                   \
+    } while (0)
+
+// Function prototypes
+void printk_init(void);
+bool printk_ratelimit(ratelimit_t *rs, const char *site);
+void console_flush(void);
+void console_set_loglevel(int level);
+
+#endif // PRINTK_H
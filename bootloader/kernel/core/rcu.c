@@ -0,0 +1,27 @@
+// AION OS Read-Copy-Update: lockless readers, writers wait out old sections
+#include "rcu.h"
+
+rcu_cpu_t rcu_cpus[MAX_CPUS];
+
+// Wait until every read section in progress on entry has finished. Objects
+// unlinked before the call can then be freed. Must not be called from
+// inside a read section.
+void synchronize_rcu(void) {
+    uint64_t snap[MAX_CPUS];
+
+    // Order the caller's unlinking before the snapshot
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        snap[cpu] = __atomic_load_n(&rcu_cpus[cpu].seq, __ATOMIC_ACQUIRE);
+    }
+
+    // An even count was outside any section; an odd one only has to move
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        if (!(snap[cpu] & 1)) {
+            continue;
+        }
+        while (__atomic_load_n(&rcu_cpus[cpu].seq, __ATOMIC_ACQUIRE) == snap[cpu]) {
+            asm volatile("pause");
+        }
+    }
+}
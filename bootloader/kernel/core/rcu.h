@@ -0,0 +1,45 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "smp.h"
+
+// Read-side state per CPU. seq is odd while the CPU is inside a read
+// section. Readers run with interrupts off, so a section can never block
+// or migrate, and a writer only has to see each CPU leave the section it
+// was in when the writer started.
+typedef struct {
+    volatile uint64_t seq;
+    uint32_t nesting;
+} __attribute__((aligned(64))) rcu_cpu_t;
+
+extern rcu_cpu_t rcu_cpus[MAX_CPUS];
+
+// Publish a fully initialized object / load a published one
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+// Enter a read section; the returned flags go back to rcu_read_unlock
+static inline uint64_t rcu_read_lock(void) {
+    uint64_t flags = local_irq_save();
+    rcu_cpu_t *rc = &rcu_cpus[smp_processor_id()];
+    if (rc->nesting++ == 0) {
+        rc->seq++;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    return flags;
+}
+
+static inline void rcu_read_unlock(uint64_t flags) {
+    rcu_cpu_t *rc = &rcu_cpus[smp_processor_id()];
+    if (--rc->nesting == 0) {
+        __atomic_store_n(&rc->seq, rc->seq + 1, __ATOMIC_RELEASE);
+    }
+    local_irq_restore(flags);
+}
+
+// Function prototypes
+void synchronize_rcu(void);
+
+#endif // RCU_H
@@ -0,0 +1,57 @@
+// AION OS SMP Support
+#include "smp.h"
+#include "kernel.h"
+
+uint32_t num_cpus = 1;
+
+// Logical CPU number -> local APIC ID
+static uint8_t cpu_to_apic[MAX_CPUS];
+
+static cpu_local_t cpu_local[MAX_CPUS];
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                 "d"((uint32_t)(value >> 32)));
+}
+
+// Point this CPU's GS at its per-CPU area. Each CPU runs this before it
+// touches per-CPU data: the boot CPU first thing in kernel_early_init,
+// an AP with its number from smp_register_cpu. User GS starts out as 0.
+void smp_cpu_local_init(uint32_t cpu) {
+    cpu_local[cpu].cpu = cpu;
+    wrmsr(MSR_GS_BASE, (uint64_t)&cpu_local[cpu]);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+// Initialize SMP bookkeeping for the boot CPU. Application processors
+// are not started yet, so every per-CPU structure has a single live
+// instance until AP bring-up registers more.
+void smp_init(void) {
+    volatile uint32_t *lapic_id = (volatile uint32_t*)(LAPIC_BASE + LAPIC_REG_ID);
+    cpu_to_apic[0] = *lapic_id >> 24;
+    num_cpus = 1;
+
+    kprintf("[SMP] Boot CPU APIC ID %d, application processors not started\n",
+            *lapic_id >> 24);
+}
+
+// Assign the next logical CPU number to an application processor and
+// return it, -1 if there is no room. For the AP bring-up path, which
+// hands the number to the AP's smp_cpu_local_init before anything else;
+// each CPU must be running before it is registered, since the scheduler
+// starts handing it work at once.
+int smp_register_cpu(uint32_t apic_id) {
+    if (num_cpus >= MAX_CPUS || apic_id > 255) {
+        kprintf("[SMP] Ignoring CPU with APIC ID %d\n", apic_id);
+        return -1;
+    }
+
+    cpu_to_apic[num_cpus] = apic_id;
+    return num_cpus++;
+}
+
+// Local APIC ID of a logical CPU
+uint32_t smp_cpu_apic_id(uint32_t cpu) {
+    return cpu < num_cpus ? cpu_to_apic[cpu] : 0;
+}
+
@@ -0,0 +1,60 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// SMP constants
+#define MAX_CPUS 64
+#define LAPIC_BASE 0xFEE00000
+#define LAPIC_REG_ID 0x20
+
+#define MSR_GS_BASE 0xC0000101
+#define MSR_KERNEL_GS_BASE 0xC0000102
+
+// Per-CPU area. GS_BASE points at this CPU's copy whenever the kernel
+// runs; the user's GS_BASE waits in KERNEL_GS_BASE, and swapgs trades
+// them on every ring 3 entry and exit. The SYSCALL entry reaches the
+// stack fields before it has a stack.
+typedef struct {
+    uint64_t kernel_rsp;          // Top of the running task's stack
+    uint64_t user_rsp;            // Scratch until the user stack is pushed
+    uint32_t cpu;                 // Logical CPU number
+} __attribute__((aligned(64))) cpu_local_t;
+
+// Online CPU count, set up during AP bring-up
+extern uint32_t num_cpus;
+
+// Function prototypes
+void smp_cpu_local_init(uint32_t cpu);
+void smp_init(void);
+int smp_register_cpu(uint32_t apic_id);
+uint32_t smp_cpu_apic_id(uint32_t cpu);
+
+// Logical number of the CPU we are running on, a single GS-relative
+// load. Unless preemption is off the task may move right after.
+static inline uint32_t smp_processor_id(void) {
+    uint32_t cpu;
+    asm volatile("movl %%gs:%c1, %0" : "=r"(cpu) : "i"(offsetof(cpu_local_t, cpu)));
+    return cpu;
+}
+
+// Save RFLAGS and disable interrupts on this CPU
+static inline uint64_t local_irq_save(void) {
+    uint64_t flags;
+    asm volatile("pushfq\n"
+                 "popq %0\n"
+                 "cli"
+                 : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Restore interrupt state saved by local_irq_save
+static inline void local_irq_restore(uint64_t flags) {
+    if (flags & 0x200) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+#endif // SMP_H
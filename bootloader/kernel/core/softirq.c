@@ -0,0 +1,175 @@
+// AION OS Softirqs: interrupt work deferred out of the hard IRQ path
+#include "softirq.h"
+#include "../process/runqueue.h"
+#include "../fs/procfs.h"
+
+static softirq_fn_t softirq_vec[NR_SOFTIRQS];
+static softirq_cpu_t softirq_cpus[MAX_CPUS];
+
+static const char *softirq_names[NR_SOFTIRQS] = {
+    [SOFTIRQ_TIMER]  = "TIMER",
+    [SOFTIRQ_NET_RX] = "NET_RX",
+    [SOFTIRQ_BLOCK]  = "BLOCK",
+};
+
+static size_t softirq_show(char *buf, size_t size);
+
+void open_softirq(softirq_nr_t nr, softirq_fn_t fn) {
+    softirq_vec[nr] = fn;
+}
+
+static void wakeup_ksoftirqd(softirq_cpu_t *sc) {
+    process_t *task = sc->ksoftirqd;
+    if (task && task->state == PROCESS_STATE_BLOCKED) {
+        wake_up_process(task);
+    }
+}
+
+// Mark a vector pending on this CPU; runs on the next interrupt exit.
+// Interrupts must be off.
+void raise_softirq_irqoff(softirq_nr_t nr) {
+    softirq_cpu_t *sc = &softirq_cpus[smp_processor_id()];
+    sc->pending |= 1U << nr;
+    sc->raised[nr]++;
+}
+
+// From task context there may be no interrupt exit soon: let ksoftirqd run it
+void raise_softirq(softirq_nr_t nr) {
+    uint64_t flags = local_irq_save();
+    raise_softirq_irqoff(nr);
+    softirq_cpu_t *sc = &softirq_cpus[smp_processor_id()];
+    if (!sc->active) {
+        wakeup_ksoftirqd(sc);
+    }
+    local_irq_restore(flags);
+}
+
+bool in_softirq(void) {
+    return softirq_cpus[smp_processor_id()].active;
+}
+
+// Run pending vectors with interrupts enabled, so new hard interrupts are
+// not held off. Vectors raised meanwhile are picked up in further rounds
+// until max_rounds or the time budget runs out. Called and returns with
+// interrupts off; returns whether work is left.
+static bool softirq_run(softirq_cpu_t *sc, uint32_t max_rounds) {
+    uint64_t deadline = get_time_ns() + SOFTIRQ_BUDGET_NS;
+    uint32_t pending;
+
+    sc->active = true;
+    while ((pending = sc->pending)) {
+        sc->pending = 0;
+        asm volatile("sti" : : : "memory");
+
+        while (pending) {
+            uint32_t nr = __builtin_ctz(pending);
+            pending &= pending - 1;
+            if (!softirq_vec[nr]) {
+                continue;
+            }
+
+            uint64_t start = rdtsc();
+            softirq_vec[nr]();
+            uint64_t cycles = rdtsc() - start;
+
+            sc->runs[nr]++;
+            sc->cycles[nr] += cycles;
+            if (cycles > sc->max_cycles[nr]) {
+                sc->max_cycles[nr] = cycles;
+            }
+        }
+
+        asm volatile("cli" : : : "memory");
+        if (--max_rounds == 0 || get_time_ns() >= deadline) {
+            break;
+        }
+    }
+    sc->active = false;
+
+    return sc->pending != 0;
+}
+
+// Hard interrupt epilogue, interrupts still off. Skipped when nested in
+// running softirqs, which pick the new work up themselves, and when
+// ksoftirqd is already working through a backlog.
+void irq_exit(void) {
+    softirq_cpu_t *sc = &softirq_cpus[smp_processor_id()];
+    if (!sc->pending || sc->active) {
+        return;
+    }
+    if (sc->ksoftirqd && sc->ksoftirqd->state != PROCESS_STATE_BLOCKED) {
+        return;
+    }
+
+    if (softirq_run(sc, SOFTIRQ_MAX_RESTART)) {
+        sc->deferred++;
+        wakeup_ksoftirqd(sc);
+    }
+}
+
+// Per-CPU fallback: works off what interrupt exits left behind one round
+// at a time, as an ordinary task the scheduler can interleave with others
+static void ksoftirqd_main(void) {
+    while (1) {
+        uint64_t flags = local_irq_save();
+        softirq_cpu_t *sc = &softirq_cpus[smp_processor_id()];
+        while (!sc->pending) {
+            current_process->state = PROCESS_STATE_BLOCKED;
+            local_irq_restore(flags);
+            schedule();
+            flags = local_irq_save();
+        }
+        softirq_run(sc, 1);
+        local_irq_restore(flags);
+
+        yield_cpu();
+    }
+}
+
+void softirq_init(void) {
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        process_t *task = process_create("ksoftirqd", ksoftirqd_main, KSOFTIRQD_PRIORITY);
+        if (!task) {
+            kprintf("[SOFTIRQ] Failed to start ksoftirqd for CPU %d\n", cpu);
+            continue;
+        }
+        task->flags |= PROCESS_FLAG_SYSTEM;
+        migrate_process(task, cpu);
+        task->flags |= PROCESS_FLAG_PINNED;
+        softirq_cpus[cpu].ksoftirqd = task;
+    }
+
+    procfs_register("softirqs", softirq_show);
+    kprintf("[SOFTIRQ] %d vectors, %llu us budget per interrupt exit\n",
+            NR_SOFTIRQS, SOFTIRQ_BUDGET_NS / 1000);
+}
+
+// procfs: /proc/softirqs
+static size_t softirq_show(char *buf, size_t size) {
+    size_t len = snprintf(buf, size, "vector       raised         runs   avg_cycles   max_cycles\n");
+    uint64_t deferred = 0;
+
+    for (uint32_t nr = 0; nr < NR_SOFTIRQS && len < size; nr++) {
+        uint64_t raised = 0, runs = 0, cycles = 0, max = 0;
+        for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+            softirq_cpu_t *sc = &softirq_cpus[cpu];
+            raised += sc->raised[nr];
+            runs += sc->runs[nr];
+            cycles += sc->cycles[nr];
+            if (sc->max_cycles[nr] > max) {
+                max = sc->max_cycles[nr];
+            }
+        }
+        len += snprintf(buf + len, size - len, "%-8s %10llu %12llu %12llu %12llu\n",
+                        softirq_names[nr], raised, runs, runs ? cycles / runs : 0, max);
+    }
+
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        deferred += softirq_cpus[cpu].deferred;
+    }
+    if (len < size) {
+        len += snprintf(buf + len, size - len, "deferred to ksoftirqd: %llu\n", deferred);
+    }
+
+    return len < size ? len : size;
+}
@@ -0,0 +1,49 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "smp.h"
+#include "../process/process.h"
+
+// Deferred work raised by interrupt handlers, lowest number runs first
+typedef enum {
+    SOFTIRQ_TIMER,            // Expire timer wheel entries
+    SOFTIRQ_NET_RX,           // Process received packets
+    SOFTIRQ_BLOCK,            // Complete block requests
+    NR_SOFTIRQS
+} softirq_nr_t;
+
+// Work done on interrupt exit before the rest is handed to ksoftirqd
+#define SOFTIRQ_MAX_RESTART 10
+#define SOFTIRQ_BUDGET_NS 2000000ULL
+
+// Competes with ordinary tasks, so a flood cannot starve them
+#define KSOFTIRQD_PRIORITY 10
+
+typedef void (*softirq_fn_t)(void);
+
+// Per-CPU state. pending is only touched with interrupts off on its CPU.
+typedef struct {
+    uint32_t pending;
+    bool active;              // Softirqs are running on this CPU
+    process_t *ksoftirqd;
+
+    // Statistics, per vector
+    uint64_t raised[NR_SOFTIRQS];
+    uint64_t runs[NR_SOFTIRQS];
+    uint64_t cycles[NR_SOFTIRQS];
+    uint64_t max_cycles[NR_SOFTIRQS];
+    uint64_t deferred;        // Times the budget ran out and ksoftirqd took over
+} __attribute__((aligned(64))) softirq_cpu_t;
+
+// Function prototypes
+void softirq_init(void);
+void open_softirq(softirq_nr_t nr, softirq_fn_t fn);
+void raise_softirq(softirq_nr_t nr);
+void raise_softirq_irqoff(softirq_nr_t nr);
+void irq_exit(void);
+bool in_softirq(void);
+
+#endif // SOFTIRQ_H
@@ -0,0 +1,321 @@
+// AION OS System Call Entry and Dispatch
+#include "syscall.h"
+#include "kernel.h"
+#include "../process/process.h"
+#include "../memory/vmm.h"
+#include "../fs/procfs.h"
+#include "ioring.h"
+
+// SYSRET loads SS from STAR[63:48] + 8 and CS from STAR[63:48] + 16
+_Static_assert(USER_CS == USER_DS + 8, "SYSRET needs user data right below user code");
+
+static syscall_cpu_t syscall_cpus[MAX_CPUS];
+
+static size_t syscall_show(char *buf, size_t size);
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                 "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+// Table entries unpack the registers for the existing handlers
+
+static int64_t sc_read(const syscall_args_t *a) {
+    return sys_read(a->arg[0], (void*)a->arg[1], a->arg[2]);
+}
+
+static int64_t sc_write(const syscall_args_t *a) {
+    return sys_write(a->arg[0], (void*)a->arg[1], a->arg[2]);
+}
+
+static int64_t sc_open(const syscall_args_t *a) {
+    return sys_open((char*)a->arg[0], a->arg[1]);
+}
+
+static int64_t sc_close(const syscall_args_t *a) {
+    return sys_close(a->arg[0]);
+}
+
+static int64_t sc_fork(const syscall_args_t *a) {
+    (void)a;
+    return sys_fork();
+}
+
+static int64_t sc_exec(const syscall_args_t *a) {
+    return sys_exec((char*)a->arg[0], (char**)a->arg[1]);
+}
+
+static int64_t sc_exit(const syscall_args_t *a) {
+    sys_exit(a->arg[0]);
+    return 0;
+}
+
+static int64_t sc_getpid(const syscall_args_t *a) {
+    (void)a;
+    return sys_getpid();
+}
+
+static int64_t sc_mmap(const syscall_args_t *a) {
+    return sys_mmap((void*)a->arg[0], a->arg[1], a->arg[2]);
+}
+
+static int64_t sc_munmap(const syscall_args_t *a) {
+    return sys_munmap((void*)a->arg[0], a->arg[1]);
+}
+
+static int64_t sc_null(const syscall_args_t *a) {
+    (void)a;
+    return 0;
+}
+
+static int64_t sc_readv(const syscall_args_t *a) {
+    return vfs_readv(a->arg[0], (const iovec_t*)a->arg[1], a->arg[2]);
+}
+
+static int64_t sc_writev(const syscall_args_t *a) {
+    return vfs_writev(a->arg[0], (const iovec_t*)a->arg[1], a->arg[2]);
+}
+
+static int64_t sc_ioring_setup(const syscall_args_t *a) {
+    return ioring_setup(a->arg[0], (ioring_params_t*)a->arg[1]);
+}
+
+static int64_t sc_ioring_enter(const syscall_args_t *a) {
+    return ioring_enter(a->arg[0]);
+}
+
+static int64_t sc_chdir(const syscall_args_t *a) {
+    return vfs_chdir((const char*)a->arg[0]);
+}
+
+static int64_t sc_mmap_file(const syscall_args_t *a) {
+    return (int64_t)vfs_mmap(a->arg[0], a->arg[1], a->arg[2], a->arg[3], a->arg[4]);
+}
+
+static const syscall_fn_t syscall_table[NR_SYSCALLS] = {
+    [SYS_READ]   = sc_read,
+    [SYS_WRITE]  = sc_write,
+    [SYS_OPEN]   = sc_open,
+    [SYS_CLOSE]  = sc_close,
+    [SYS_FORK]   = sc_fork,
+    [SYS_EXEC]   = sc_exec,
+    [SYS_EXIT]   = sc_exit,
+    [SYS_GETPID] = sc_getpid,
+    [SYS_MMAP]   = sc_mmap,
+    [SYS_MUNMAP] = sc_munmap,
+    [SYS_NULL]   = sc_null,
+    [SYS_READV]  = sc_readv,
+    [SYS_WRITEV] = sc_writev,
+    [SYS_IORING_SETUP] = sc_ioring_setup,
+    [SYS_IORING_ENTER] = sc_ioring_enter,
+    [SYS_CHDIR]  = sc_chdir,
+    [SYS_MMAP_FILE] = sc_mmap_file,
+};
+
+static const char *syscall_names[NR_SYSCALLS] = {
+    [SYS_READ]   = "read",
+    [SYS_WRITE]  = "write",
+    [SYS_OPEN]   = "open",
+    [SYS_CLOSE]  = "close",
+    [SYS_FORK]   = "fork",
+    [SYS_EXEC]   = "exec",
+    [SYS_EXIT]   = "exit",
+    [SYS_GETPID] = "getpid",
+    [SYS_MMAP]   = "mmap",
+    [SYS_MUNMAP] = "munmap",
+    [SYS_NULL]   = "null",
+    [SYS_READV]  = "readv",
+    [SYS_WRITEV] = "writev",
+    [SYS_IORING_SETUP] = "ioring_setup",
+    [SYS_IORING_ENTER] = "ioring_enter",
+    [SYS_CHDIR]  = "chdir",
+    [SYS_MMAP_FILE] = "mmap_file",
+};
+
+void syscall_init(void) {
+    memset(syscall_cpus, 0, sizeof(syscall_cpus));
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        syscall_cpus[cpu].cpu = cpu;
+    }
+
+    syscall_cpu_init(smp_processor_id());
+    procfs_register("syscalls", syscall_show);
+
+    kprintf("[SYSCALL] SYSCALL/SYSRET entry enabled, %d system calls\n", NR_SYSCALLS);
+}
+
+// Program this CPU's MSRs. Each CPU runs this once before entering user
+// mode, after smp_cpu_local_init has set up GS.
+void syscall_cpu_init(uint32_t cpu) {
+    (void)cpu;
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+    wrmsr(MSR_STAR, ((uint64_t)(USER_DS - 8) << 48) | ((uint64_t)KERNEL_CS << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+    wrmsr(MSR_FMASK, SYSCALL_RFLAGS_MASK);
+}
+
+// Called on every switch so the next SYSCALL, or interrupt from user
+// mode, lands on the new task's stack
+void syscall_set_kernel_stack(uint64_t rsp) {
+    asm volatile("movq %0, %%gs:%c1"
+                 : : "r"(rsp), "i"(offsetof(cpu_local_t, kernel_rsp)) : "memory");
+    tss.rsp0 = rsp;
+}
+
+// Shared by both entry paths
+int64_t syscall_dispatch(uint64_t nr, const syscall_args_t *args, syscall_entry_t entry) {
+    syscall_cpu_t *sc = &syscall_cpus[smp_processor_id()];
+    sc->entries[entry]++;
+
+    if (nr >= NR_SYSCALLS || !syscall_table[nr]) {
+        sc->bad_calls++;
+        kprintf("[SYSCALL] Unknown syscall: %lld\n", nr);
+        return -1;
+    }
+
+    sc->stats[nr].count++;
+    uint64_t start = rdtsc();
+    int64_t result = syscall_table[nr](args);
+    uint64_t cycles = rdtsc() - start;
+
+    // The handler may have slept and woken on another CPU
+    sc = &syscall_cpus[smp_processor_id()];
+    uint32_t bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+    if (bucket >= SYSCALL_HIST_BUCKETS) {
+        bucket = SYSCALL_HIST_BUCKETS - 1;
+    }
+    sc->stats[nr].cycles += cycles;
+    sc->stats[nr].hist[bucket]++;
+
+    return result;
+}
+
+// SYSCALL entry. The CPU has put the user rip in rcx and rflags in r11,
+// masked interrupts and switched to kernel CS, but left the user stack and
+// GS. Swap in the kernel GS, move to the task's kernel stack, then save
+// what SYSRET needs and lay the arguments out as a syscall_args_t for the
+// dispatcher. The user GS comes back on the way out.
+__attribute__((naked)) void syscall_entry(void) {
+    asm volatile(
+        "swapgs\n"
+        "movq %%rsp, %%gs:%c[user_rsp]\n"
+        "movq %%gs:%c[kernel_rsp], %%rsp\n"
+
+        // Off the per-CPU scratch before interrupts can switch tasks
+        "pushq %%gs:%c[user_rsp]\n"
+        "pushq %%r11\n"
+        "pushq %%rcx\n"
+        "pushq %%rax\n"
+        "pushq %%r9\n"
+        "pushq %%r8\n"
+        "pushq %%r10\n"
+        "pushq %%rdx\n"
+        "pushq %%rsi\n"
+        "pushq %%rdi\n"
+
+        "movq %%rax, %%rdi\n"
+        "movq %%rsp, %%rsi\n"
+        "movl %[fast], %%edx\n"
+        "sti\n"
+        "call syscall_dispatch\n"
+        "cli\n"
+
+        // SYSRET to a non-canonical rip faults in ring 0 on the user
+        // stack and GS. Anything outside the lower half goes back through
+        // iretq instead, which faults, if at all, on the kernel stack.
+        "movq 56(%%rsp), %%rdi\n"
+        "shrq $47, %%rdi\n"
+        "jnz 1f\n"
+
+        // Restore the argument registers so no kernel values leak back
+        "popq %%rdi\n"
+        "popq %%rsi\n"
+        "popq %%rdx\n"
+        "popq %%r10\n"
+        "popq %%r8\n"
+        "popq %%r9\n"
+        "addq $8, %%rsp\n"
+        "popq %%rcx\n"
+        "popq %%r11\n"
+        "popq %%rsp\n"
+        "swapgs\n"
+        "sysretq\n"
+
+        "1:\n"
+        "popq %%rdi\n"
+        "popq %%rsi\n"
+        "popq %%rdx\n"
+        "popq %%r10\n"
+        "popq %%r8\n"
+        "popq %%r9\n"
+        "addq $8, %%rsp\n"
+        "popq %%rcx\n"
+        "popq %%r11\n"
+        "pushq %[user_ss]\n"
+        "pushq 8(%%rsp)\n"           // The saved user rsp
+        "pushq %%r11\n"
+        "pushq %[user_cs]\n"
+        "pushq %%rcx\n"
+        "swapgs\n"
+        "iretq\n"
+        :
+        : [kernel_rsp] "i"(offsetof(cpu_local_t, kernel_rsp)),
+          [user_rsp] "i"(offsetof(cpu_local_t, user_rsp)),
+          [fast] "i"(SYSCALL_ENTRY_FAST),
+          [user_ss] "i"(USER_DS | 3),
+          [user_cs] "i"(USER_CS | 3)
+        : "memory"
+    );
+}
+
+void syscall_get_stats(uint32_t cpu, syscall_cpu_t *out) {
+    *out = syscall_cpus[cpu];
+}
+
+// procfs: /proc/syscalls, calls and handler latency per system call
+static size_t syscall_show(char *buf, size_t size) {
+    uint64_t entries[SYSCALL_ENTRIES] = {0};
+    uint64_t bad = 0;
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        for (uint32_t e = 0; e < SYSCALL_ENTRIES; e++) {
+            entries[e] += syscall_cpus[cpu].entries[e];
+        }
+        bad += syscall_cpus[cpu].bad_calls;
+    }
+
+    size_t len = snprintf(buf, size, "entries: %llu syscall, %llu int80, %llu bad\n",
+                          entries[SYSCALL_ENTRY_FAST], entries[SYSCALL_ENTRY_INT], bad);
+
+    for (uint32_t nr = 0; nr < NR_SYSCALLS && len < size; nr++) {
+        uint64_t count = 0, cycles = 0;
+        uint64_t hist[SYSCALL_HIST_BUCKETS] = {0};
+        for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+            syscall_stats_t *st = &syscall_cpus[cpu].stats[nr];
+            count += st->count;
+            cycles += st->cycles;
+            for (uint32_t b = 0; b < SYSCALL_HIST_BUCKETS; b++) {
+                hist[b] += st->hist[b];
+            }
+        }
+        if (!count) {
+            continue;
+        }
+
+        len += snprintf(buf + len, size - len, "%s: %llu calls, %llu cycles avg\n",
+                        syscall_names[nr], count, cycles / count);
+        for (uint32_t b = 0; b < SYSCALL_HIST_BUCKETS && len < size; b++) {
+            if (hist[b]) {
+                len += snprintf(buf + len, size - len, "  %10llu-%llu cycles: %llu\n",
+                                1ULL << b, (2ULL << b) - 1, hist[b]);
+            }
+        }
+    }
+
+    return len < size ? len : size;
+}
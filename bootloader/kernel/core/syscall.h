@@ -0,0 +1,83 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "smp.h"
+
+// System call numbers
+#define SYS_READ 0
+#define SYS_WRITE 1
+#define SYS_OPEN 2
+#define SYS_CLOSE 3
+#define SYS_FORK 4
+#define SYS_EXEC 5
+#define SYS_EXIT 6
+#define SYS_GETPID 7
+#define SYS_MMAP 8
+#define SYS_MUNMAP 9
+#define SYS_NULL 10           // Does nothing; measures entry and exit
+#define SYS_READV 11
+#define SYS_WRITEV 12
+#define SYS_IORING_SETUP 13
+#define SYS_IORING_ENTER 14
+#define SYS_CHDIR 15
+#define SYS_MMAP_FILE 16
+#define NR_SYSCALLS 17
+
+// Scatter/gather element for readv and writev
+typedef struct {
+    void *base;
+    size_t len;
+} iovec_t;
+
+#define IOV_MAX 1024
+
+// SYSCALL/SYSRET MSRs
+#define MSR_EFER 0xC0000080
+#define MSR_STAR 0xC0000081
+#define MSR_LSTAR 0xC0000082
+#define MSR_FMASK 0xC0000084
+#define EFER_SCE (1ULL << 0)
+
+// RFLAGS cleared on entry: TF, IF, DF, IOPL, NT and AC
+#define SYSCALL_RFLAGS_MASK 0x47700
+
+#define SYSCALL_HIST_BUCKETS 32
+
+typedef enum {
+    SYSCALL_ENTRY_FAST,       // SYSCALL instruction
+    SYSCALL_ENTRY_INT,        // int $0x80
+    SYSCALL_ENTRIES
+} syscall_entry_t;
+
+// Arguments in ABI order: rdi, rsi, rdx, r10, r8, r9
+typedef struct {
+    uint64_t arg[6];
+} syscall_args_t;
+
+typedef int64_t (*syscall_fn_t)(const syscall_args_t *args);
+
+typedef struct {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t hist[SYSCALL_HIST_BUCKETS];  // log2 of cycles in the handler
+} syscall_stats_t;
+
+// Per-CPU counters; the entry stub's own state is in cpu_local_t
+typedef struct {
+    uint32_t cpu;
+    uint64_t entries[SYSCALL_ENTRIES];
+    uint64_t bad_calls;
+    syscall_stats_t stats[NR_SYSCALLS];
+} __attribute__((aligned(64))) syscall_cpu_t;
+
+// Function prototypes
+void syscall_init(void);
+void syscall_cpu_init(uint32_t cpu);
+void syscall_set_kernel_stack(uint64_t rsp);
+int64_t syscall_dispatch(uint64_t nr, const syscall_args_t *args, syscall_entry_t entry);
+void syscall_entry(void);
+void syscall_get_stats(uint32_t cpu, syscall_cpu_t *out);
+
+#endif // SYSCALL_H
@@ -0,0 +1,78 @@
+// AION OS ACPI Table Discovery
+#include "acpi.h"
+
+static acpi_rsdp_t *rsdp = NULL;
+static acpi_sdt_header_t *root_table = NULL;
+static bool use_xsdt = false;
+
+static bool acpi_checksum_ok(const void *table, uint32_t length) {
+    const uint8_t *bytes = table;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+// RSDP lives on a 16-byte boundary in the EBDA or the BIOS area
+static acpi_rsdp_t* acpi_scan_rsdp(uint64_t start, uint64_t end) {
+    for (uint64_t addr = start; addr < end; addr += 16) {
+        acpi_rsdp_t *candidate = (acpi_rsdp_t*)addr;
+        if (memcmp(candidate->signature, "RSD PTR ", 8) == 0 &&
+            acpi_checksum_ok(candidate, 20)) {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+// Locate the RSDP and the root table
+bool acpi_init(void) {
+    uint64_t ebda = (uint64_t)(*(uint16_t*)ACPI_EBDA_PTR) << 4;
+    if (ebda) {
+        rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    }
+    if (!rsdp) {
+        rsdp = acpi_scan_rsdp(ACPI_BIOS_START, ACPI_BIOS_END);
+    }
+
+    if (!rsdp) {
+        kprintf("[ACPI] RSDP not found\n");
+        return false;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address) {
+        root_table = (acpi_sdt_header_t*)rsdp->xsdt_address;
+        use_xsdt = true;
+    } else {
+        root_table = (acpi_sdt_header_t*)(uint64_t)rsdp->rsdt_address;
+        use_xsdt = false;
+    }
+
+    kprintf("[ACPI] %s at 0x%llx (revision %d)\n",
+            use_xsdt ? "XSDT" : "RSDT", (uint64_t)root_table, rsdp->revision);
+    return true;
+}
+
+// Find a table by its 4-character signature
+acpi_sdt_header_t* acpi_find_table(const char *signature) {
+    if (!root_table) {
+        return NULL;
+    }
+
+    uint32_t entry_size = use_xsdt ? 8 : 4;
+    uint32_t entries = (root_table->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    uint8_t *base = (uint8_t*)(root_table + 1);
+
+    for (uint32_t i = 0; i < entries; i++) {
+        uint64_t addr = use_xsdt ? ((uint64_t*)base)[i] : ((uint32_t*)base)[i];
+        acpi_sdt_header_t *table = (acpi_sdt_header_t*)addr;
+
+        if (memcmp(table->signature, signature, 4) == 0 &&
+            acpi_checksum_ok(table, table->length)) {
+            return table;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,43 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// RSDP search ranges
+#define ACPI_EBDA_PTR 0x40E
+#define ACPI_BIOS_START 0xE0000
+#define ACPI_BIOS_END 0x100000
+
+// Root System Description Pointer
+typedef struct {
+    char signature[8];       // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    // ACPI 2.0+
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+// Common header of every System Description Table
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+// Function prototypes
+bool acpi_init(void);
+acpi_sdt_header_t* acpi_find_table(const char *signature);
+
+#endif // ACPI_H
@@ -0,0 +1,253 @@
+// AION OS MSI/MSI-X: message signalled interrupts steered per vector
+#include "msi.h"
+#include "../core/interrupts.h"
+
+// Owner of each device vector, looked up by the common handler
+static msi_vector_t *vector_owner[256];
+
+static void msi_irq(interrupt_frame_t *frame) {
+    msi_vector_t *v = vector_owner[frame->int_num];
+    if (v && v->handler) {
+        v->handler(v->data);
+    }
+}
+
+static inline volatile uint32_t* msix_entry(msi_device_t *msi, uint16_t index, uint32_t reg) {
+    return (volatile uint32_t*)(msi->table + index * MSIX_ENTRY_SIZE + reg);
+}
+
+static inline uint32_t msi_address(uint32_t cpu) {
+    return MSI_ADDR_BASE | MSI_ADDR_DEST(smp_cpu_apic_id(cpu));
+}
+
+// Walk the capability list; returns the offset of the first match or 0
+uint8_t pci_find_capability(pci_device_t *pci, uint8_t id) {
+    if (!(pci_config_read16(pci, PCI_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+
+    // Bounded in case a broken device links the list into a loop
+    uint8_t pos = pci_config_read8(pci, PCI_CAPABILITY_LIST) & ~3;
+    for (int ttl = 48; pos >= 0x40 && ttl > 0; ttl--) {
+        if (pci_config_read8(pci, pos) == id) {
+            return pos;
+        }
+        pos = pci_config_read8(pci, pos + 1) & ~3;
+    }
+    return 0;
+}
+
+static void msi_free_vectors(msi_device_t *msi) {
+    for (uint16_t i = 0; i < msi->nvec; i++) {
+        vector_owner[msi->vectors[i].vector] = NULL;
+        irq_free_vector(msi->vectors[i].vector);
+    }
+    msi->nvec = 0;
+}
+
+// Every table entry starts masked and aimed at the boot CPU; a vector only
+// fires once a handler is attached to it
+static int msix_setup(msi_device_t *msi, uint16_t nvec) {
+    pci_device_t *pci = msi->pci;
+    uint16_t flags = pci_config_read16(pci, msi->cap + MSIX_FLAGS);
+    uint16_t table_size = (flags & MSIX_FLAGS_QSIZE) + 1;
+    if (nvec > table_size) {
+        nvec = table_size;
+    }
+
+    uint32_t table = pci_config_read32(pci, msi->cap + MSIX_TABLE);
+    msi->table = (volatile uint8_t*)(pci_read_bar(pci, table & MSIX_BIR_MASK) +
+                                     (table & ~MSIX_BIR_MASK));
+
+    // Hold the whole function masked while the table is filled in
+    pci_config_write16(pci, msi->cap + MSIX_FLAGS,
+                       flags | MSIX_FLAGS_ENABLE | MSIX_FLAGS_MASKALL);
+
+    for (uint16_t i = 0; i < nvec; i++) {
+        int vector = irq_alloc_vector();
+        if (vector < 0) {
+            break;
+        }
+        msi_vector_t *v = &msi->vectors[i];
+        v->vector = vector;
+        v->index = i;
+        v->cpu = 0;
+        msi->nvec++;
+
+        *msix_entry(msi, i, MSIX_ENTRY_CTRL) = MSIX_ENTRY_CTRL_MASKBIT;
+        *msix_entry(msi, i, MSIX_ENTRY_ADDR_LO) = msi_address(0);
+        *msix_entry(msi, i, MSIX_ENTRY_ADDR_HI) = 0;
+        *msix_entry(msi, i, MSIX_ENTRY_DATA) = vector;
+    }
+
+    if (msi->nvec == 0) {
+        pci_config_write16(pci, msi->cap + MSIX_FLAGS, flags & ~MSIX_FLAGS_ENABLE);
+        return -1;
+    }
+
+    pci_config_write16(pci, msi->cap + MSIX_FLAGS, (flags | MSIX_FLAGS_ENABLE) & ~MSIX_FLAGS_MASKALL);
+    msi->mode = MSI_MODE_MSIX;
+    return msi->nvec;
+}
+
+// Multi-message MSI needs an aligned block of vectors that all share one
+// destination, which defeats per-queue steering: take a single vector
+static int msi_setup(msi_device_t *msi) {
+    pci_device_t *pci = msi->pci;
+    uint16_t flags = pci_config_read16(pci, msi->cap + MSI_FLAGS);
+
+    int vector = irq_alloc_vector();
+    if (vector < 0) {
+        return -1;
+    }
+    msi->vectors[0].vector = vector;
+    msi->vectors[0].index = 0;
+    msi->vectors[0].cpu = 0;
+    msi->nvec = 1;
+
+    pci_config_write32(pci, msi->cap + MSI_ADDRESS_LO, msi_address(0));
+    if (flags & MSI_FLAGS_64BIT) {
+        pci_config_write32(pci, msi->cap + MSI_ADDRESS_HI, 0);
+        pci_config_write16(pci, msi->cap + MSI_DATA_64, vector);
+    } else {
+        pci_config_write16(pci, msi->cap + MSI_DATA_32, vector);
+    }
+
+    pci_config_write16(pci, msi->cap + MSI_FLAGS,
+                       (flags & ~MSI_FLAGS_QSIZE) | MSI_FLAGS_ENABLE);
+    msi->mode = MSI_MODE_MSI;
+    msi_mask_vector(msi, 0);
+    return 1;
+}
+
+// Switch the device to message signalled interrupts, preferring MSI-X, and
+// allocate up to nvec vectors. Returns how many were granted, or -1 when
+// the device has to stay on polling or INTx.
+int msi_enable(msi_device_t *msi, pci_device_t *pci, uint16_t nvec) {
+    memset(msi, 0, sizeof(*msi));
+    msi->pci = pci;
+    if (nvec > MSI_MAX_VECTORS) {
+        nvec = MSI_MAX_VECTORS;
+    }
+
+    int granted = -1;
+    if ((msi->cap = pci_find_capability(pci, PCI_CAP_ID_MSIX))) {
+        granted = msix_setup(msi, nvec);
+    } else if ((msi->cap = pci_find_capability(pci, PCI_CAP_ID_MSI))) {
+        granted = msi_setup(msi);
+    }
+
+    if (granted < 0) {
+        msi->mode = MSI_MODE_NONE;
+        return -1;
+    }
+
+    uint16_t cmd = pci_config_read16(pci, PCI_COMMAND);
+    pci_config_write16(pci, PCI_COMMAND, cmd | PCI_COMMAND_INTX_DISABLE);
+
+    kprintf("[MSI] %s enabled with %d vectors\n",
+            msi->mode == MSI_MODE_MSIX ? "MSI-X" : "MSI", granted);
+    return granted;
+}
+
+void msi_disable(msi_device_t *msi) {
+    if (msi->mode == MSI_MODE_NONE) {
+        return;
+    }
+
+    for (uint16_t i = 0; i < msi->nvec; i++) {
+        msi_mask_vector(msi, i);
+    }
+
+    uint16_t flags = pci_config_read16(msi->pci, msi->cap + MSI_FLAGS);
+    uint16_t enable = msi->mode == MSI_MODE_MSIX ? MSIX_FLAGS_ENABLE : MSI_FLAGS_ENABLE;
+    pci_config_write16(msi->pci, msi->cap + MSI_FLAGS, flags & ~enable);
+
+    msi_free_vectors(msi);
+    msi->mode = MSI_MODE_NONE;
+}
+
+// Attach a handler to one vector, aim it at cpu and unmask it. Returns the
+// IDT vector.
+int msi_request_vector(msi_device_t *msi, uint16_t index, msi_handler_t handler,
+                       void *data, uint32_t cpu) {
+    if (index >= msi->nvec || !handler) {
+        return -1;
+    }
+
+    msi_vector_t *v = &msi->vectors[index];
+    v->handler = handler;
+    v->data = data;
+    v->active = 1;
+    vector_owner[v->vector] = v;
+    register_interrupt_handler(v->vector, msi_irq);
+
+    msi_set_affinity(msi, index, cpu);
+    msi_unmask_vector(msi, index);
+    return v->vector;
+}
+
+// Retarget one vector. Under MSI-X the entry is masked while its address
+// changes so the device never sees a torn message; under plain MSI there
+// is only one address and the whole device moves.
+int msi_set_affinity(msi_device_t *msi, uint16_t index, uint32_t cpu) {
+    if (index >= msi->nvec || cpu >= num_cpus) {
+        return -1;
+    }
+
+    msi_vector_t *v = &msi->vectors[index];
+    if (msi->mode == MSI_MODE_MSIX) {
+        volatile uint32_t *ctrl = msix_entry(msi, index, MSIX_ENTRY_CTRL);
+        uint32_t saved = *ctrl;
+        *ctrl = saved | MSIX_ENTRY_CTRL_MASKBIT;
+        *msix_entry(msi, index, MSIX_ENTRY_ADDR_LO) = msi_address(cpu);
+        *ctrl = saved;
+    } else if (msi->mode == MSI_MODE_MSI) {
+        pci_config_write32(msi->pci, msi->cap + MSI_ADDRESS_LO, msi_address(cpu));
+    }
+    v->cpu = cpu;
+    return 0;
+}
+
+// Deliver the vector's next interrupts to the calling CPU. Queues submit
+// here so their completions come back to the cache that issued the work;
+// the table is only written when the destination actually changes.
+void msi_steer_to_current(msi_device_t *msi, uint16_t index) {
+    if (index >= msi->nvec) {
+        return;
+    }
+    uint32_t cpu = smp_processor_id();
+    if (msi->vectors[index].cpu != cpu) {
+        msi_set_affinity(msi, index, cpu);
+    }
+}
+
+void msi_mask_vector(msi_device_t *msi, uint16_t index) {
+    if (index >= msi->nvec) {
+        return;
+    }
+    if (msi->mode == MSI_MODE_MSIX) {
+        *msix_entry(msi, index, MSIX_ENTRY_CTRL) |= MSIX_ENTRY_CTRL_MASKBIT;
+    } else if (msi->mode == MSI_MODE_MSI) {
+        uint16_t flags = pci_config_read16(msi->pci, msi->cap + MSI_FLAGS);
+        if (flags & MSI_FLAGS_MASKBIT) {
+            uint8_t reg = msi->cap + ((flags & MSI_FLAGS_64BIT) ? MSI_MASK_64 : MSI_MASK_32);
+            pci_config_write32(msi->pci, reg, pci_config_read32(msi->pci, reg) | 1);
+        }
+    }
+}
+
+void msi_unmask_vector(msi_device_t *msi, uint16_t index) {
+    if (index >= msi->nvec) {
+        return;
+    }
+    if (msi->mode == MSI_MODE_MSIX) {
+        *msix_entry(msi, index, MSIX_ENTRY_CTRL) &= ~MSIX_ENTRY_CTRL_MASKBIT;
+    } else if (msi->mode == MSI_MODE_MSI) {
+        uint16_t flags = pci_config_read16(msi->pci, msi->cap + MSI_FLAGS);
+        if (flags & MSI_FLAGS_MASKBIT) {
+            uint8_t reg = msi->cap + ((flags & MSI_FLAGS_64BIT) ? MSI_MASK_64 : MSI_MASK_32);
+            pci_config_write32(msi->pci, reg, pci_config_read32(msi->pci, reg) & ~1U);
+        }
+    }
+}
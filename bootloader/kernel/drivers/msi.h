@@ -0,0 +1,96 @@
+#ifndef MSI_H
+#define MSI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pci.h"
+#include "../core/smp.h"
+
+// PCI configuration space
+#define PCI_COMMAND 0x04
+#define PCI_COMMAND_INTX_DISABLE (1 << 10)
+#define PCI_STATUS 0x06
+#define PCI_STATUS_CAP_LIST (1 << 4)
+#define PCI_CAPABILITY_LIST 0x34
+
+// Capability IDs
+#define PCI_CAP_ID_MSI 0x05
+#define PCI_CAP_ID_MSIX 0x11
+
+// MSI capability, offsets from the capability
+#define MSI_FLAGS 0x02
+#define MSI_FLAGS_ENABLE (1 << 0)
+#define MSI_FLAGS_QMASK (7 << 1)      // log2 of vectors supported
+#define MSI_FLAGS_QSIZE (7 << 4)      // log2 of vectors enabled
+#define MSI_FLAGS_64BIT (1 << 7)
+#define MSI_FLAGS_MASKBIT (1 << 8)
+#define MSI_ADDRESS_LO 0x04
+#define MSI_ADDRESS_HI 0x08
+#define MSI_DATA_32 0x08
+#define MSI_DATA_64 0x0C
+#define MSI_MASK_32 0x0C
+#define MSI_MASK_64 0x10
+
+// MSI-X capability
+#define MSIX_FLAGS 0x02
+#define MSIX_FLAGS_QSIZE 0x7FF        // Table size - 1
+#define MSIX_FLAGS_MASKALL (1 << 14)
+#define MSIX_FLAGS_ENABLE (1 << 15)
+#define MSIX_TABLE 0x04               // BIR in the low 3 bits, offset above
+#define MSIX_BIR_MASK 0x7
+
+// MSI-X table entry
+#define MSIX_ENTRY_SIZE 16
+#define MSIX_ENTRY_ADDR_LO 0x0
+#define MSIX_ENTRY_ADDR_HI 0x4
+#define MSIX_ENTRY_DATA 0x8
+#define MSIX_ENTRY_CTRL 0xC
+#define MSIX_ENTRY_CTRL_MASKBIT 1
+
+// Message: fixed delivery, edge triggered, physical destination
+#define MSI_ADDR_BASE 0xFEE00000
+#define MSI_ADDR_DEST(apic_id) ((uint32_t)(apic_id) << 12)
+
+// Vectors one device may hold
+#define MSI_MAX_VECTORS 64
+
+typedef enum {
+    MSI_MODE_NONE,
+    MSI_MODE_MSI,
+    MSI_MODE_MSIX
+} msi_mode_t;
+
+typedef void (*msi_handler_t)(void *data);
+
+// One device vector. index is the MSI-X table entry, or the offset from
+// the base vector under multi-message MSI.
+typedef struct {
+    uint8_t vector;
+    uint8_t active;           // A handler is attached
+    uint16_t index;
+    uint32_t cpu;             // Destination
+    msi_handler_t handler;
+    void *data;
+} msi_vector_t;
+
+typedef struct {
+    pci_device_t *pci;
+    msi_mode_t mode;
+    uint8_t cap;              // Capability offset in config space
+    uint16_t nvec;
+    volatile uint8_t *table;  // MSI-X table
+    msi_vector_t vectors[MSI_MAX_VECTORS];
+} msi_device_t;
+
+// Function prototypes
+int msi_enable(msi_device_t *msi, pci_device_t *pci, uint16_t nvec);
+void msi_disable(msi_device_t *msi);
+int msi_request_vector(msi_device_t *msi, uint16_t index, msi_handler_t handler,
+                       void *data, uint32_t cpu);
+int msi_set_affinity(msi_device_t *msi, uint16_t index, uint32_t cpu);
+void msi_steer_to_current(msi_device_t *msi, uint16_t index);
+void msi_mask_vector(msi_device_t *msi, uint16_t index);
+void msi_unmask_vector(msi_device_t *msi, uint16_t index);
+uint8_t pci_find_capability(pci_device_t *pci, uint8_t id);
+
+#endif // MSI_H
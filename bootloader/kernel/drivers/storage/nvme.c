@@ -1,18 +1,99 @@
 #include "nvme.h"
 #include "../pci.h"
+#include "../../core/interrupts.h"
+#include "../../core/softirq.h"
+#include "../../process/runqueue.h"
 #include <string.h>
 
 static nvme_controller_t* nvme_controllers[8];
 static int nvme_controller_count = 0;
 
-// Submit command to queue
+// A command in flight. Lives on the submitter's stack; the slot in
+// requests is cleared before done is set, so it is never touched after.
+typedef struct nvme_request {
+    nvme_completion_t cqe;
+    volatile bool done;
+    process_t* waiter;      // Sleeping submitter, or NULL when it spins
+} nvme_request_t;
+
+// Consume up to budget completions, handing each to its request. Called by
+// spinning submitters and from the BLOCK softirq; returns how many.
+static int nvme_reap(nvme_queue_t* queue, int budget) {
+    int done = 0;
+    
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&queue->lock);
+    while (done < budget) {
+        nvme_completion_t* cqe = &queue->cq[queue->cq_head];
+        
+        // Check phase bit, then read the rest of the entry
+        if ((cqe->status & 1) != queue->cq_phase) {
+            break;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        
+        // The command ID is the submission slot
+        uint16_t slot = cqe->cid % queue->queue_depth;
+        nvme_request_t* req = queue->requests[slot];
+        queue->requests[slot] = NULL;
+        queue->sq_head = cqe->sq_head;
+        
+        // Advance head
+        queue->cq_head = (queue->cq_head + 1) % queue->queue_depth;
+        if (queue->cq_head == 0) {
+            queue->cq_phase = !queue->cq_phase;
+        }
+        
+        if (req) {
+            req->cqe = *cqe;
+            __atomic_store_n(&req->done, true, __ATOMIC_RELEASE);
+            if (req->waiter) {
+                wake_up_process(req->waiter);
+            }
+        }
+        done++;
+    }
+    
+    // Update doorbell
+    if (done) {
+        *queue->cq_doorbell = queue->cq_head;
+    }
+    spinlock_release(&queue->lock);
+    local_irq_restore(flags);
+    
+    return done;
+}
+
+// Submit command to queue and wait for it. On a queue with its own vector
+// the submitter sleeps until the completion interrupt (or a poll already
+// under way) reaps it; elsewhere it reaps by spinning.
 static int nvme_submit_command(nvme_queue_t* queue, nvme_command_t* cmd, 
                                nvme_completion_t* completion) {
+    nvme_request_t req = {0};
+    bool sleep = queue->irq_driven && current_process && !in_softirq();
+    req.waiter = sleep ? current_process : NULL;
+    
+    uint64_t flags = local_irq_save();
     spinlock_acquire(&queue->lock);
     
-    // Copy command to submission queue
+    // Queue full, or the slot's previous command still outstanding: wait
+    // for completions to free it
     uint16_t tail = queue->sq_tail;
+    while (queue->requests[tail] || (tail + 1) % queue->queue_depth == queue->sq_head) {
+        spinlock_release(&queue->lock);
+        local_irq_restore(flags);
+        if (!nvme_reap(queue, queue->queue_depth)) {
+            cpu_pause();
+        }
+        flags = local_irq_save();
+        spinlock_acquire(&queue->lock);
+        tail = queue->sq_tail;
+    }
+    
+    // Copy command to submission queue
+    cmd->cdw0 = (cmd->cdw0 & 0xFFFF) | ((uint32_t)tail << 16);
     memcpy(&queue->sq[tail], cmd, sizeof(nvme_command_t));
+    queue->requests[tail] = &req;
     
     // Advance tail
     queue->sq_tail = (tail + 1) % queue->queue_depth;
@@ -20,40 +101,36 @@ static int nvme_submit_command(nvme_queue_t* queue, nvme_command_t* cmd,
     // Ring doorbell
     *queue->sq_doorbell = queue->sq_tail;
     
-    // AI: Track submission time for latency prediction
-    uint64_t start_time = rdtsc();
+    spinlock_release(&queue->lock);
+    local_irq_restore(flags);
     
     // Wait for completion
-    while (1) {
-        uint16_t head = queue->cq_head;
-        nvme_completion_t* cqe = &queue->cq[head];
-        
-        // Check phase bit
-        if (((cqe->status >> 0) & 1) == queue->cq_phase) {
-            // Command completed
-            if (completion) {
-                memcpy(completion, cqe, sizeof(nvme_completion_t));
+    if (sleep) {
+        flags = local_irq_save();
+        while (!__atomic_load_n(&req.done, __ATOMIC_ACQUIRE)) {
+            current_process->state = PROCESS_STATE_BLOCKED;
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&req.done, __ATOMIC_ACQUIRE)) {
+                current_process->state = PROCESS_STATE_RUNNING;
+                break;
             }
-            
-            // Advance head
-            queue->cq_head = (head + 1) % queue->queue_depth;
-            if (queue->cq_head == 0) {
-                queue->cq_phase = !queue->cq_phase;
+            local_irq_restore(flags);
+            schedule();
+            flags = local_irq_save();
+        }
+        local_irq_restore(flags);
+    } else {
+        while (!__atomic_load_n(&req.done, __ATOMIC_ACQUIRE)) {
+            if (!nvme_reap(queue, queue->queue_depth)) {
+                cpu_pause();
             }
-            
-            // Update doorbell
-            *queue->cq_doorbell = queue->cq_head;
-            
-            // AI: Calculate latency
-            uint64_t latency_cycles = rdtsc() - start_time;
-            // Update average latency metrics
-            
-            spinlock_release(&queue->lock);
-            return (cqe->status >> 1) & 0x7FF;
         }
-        
-        cpu_pause();
     }
+    
+    if (completion) {
+        memcpy(completion, &req.cqe, sizeof(nvme_completion_t));
+    }
+    return (req.cqe.status >> 1) & 0x7FF;
 }
 
 // Identify Controller/Namespace
@@ -67,8 +144,85 @@ static int nvme_identify(nvme_controller_t* ctrl, uint32_t nsid, void* buffer) {
     return nvme_submit_command(&ctrl->admin_queue, &cmd, NULL);
 }
 
-// Create I/O Queue Pair
-static int nvme_create_io_queue(nvme_controller_t* ctrl, int qid, int queue_depth) {
+// Ask for I/O queue pairs; returns how many the controller granted
+static int nvme_set_num_queues(nvme_controller_t* ctrl, int count) {
+    nvme_command_t cmd = {0};
+    nvme_completion_t completion = {0};
+    cmd.cdw0 = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10 = NVME_FEAT_NUM_QUEUES;
+    cmd.cdw11 = ((count - 1) << 16) | (count - 1);
+    
+    if (nvme_submit_command(&ctrl->admin_queue, &cmd, &completion) != 0) {
+        return -1;
+    }
+    
+    // Both counts come back zero-based; a pair needs one of each
+    int sqs = (completion.dw0 & 0xFFFF) + 1;
+    int cqs = (completion.dw0 >> 16) + 1;
+    int granted = sqs < cqs ? sqs : cqs;
+    return granted < count ? granted : count;
+}
+
+// The admin queue is always reaped by its submitter; I/O queues hand
+// their completions to the BLOCK softirq
+static void nvme_queue_irq(void* data) {
+    nvme_queue_t* queue = data;
+    queue->interrupts++;
+    if (queue->irq_driven) {
+        irq_poll_schedule(&queue->poll);
+    }
+}
+
+static int nvme_poll(irq_poll_t* p, int budget) {
+    return nvme_reap(p->data, budget);
+}
+
+static void nvme_poll_irq_enable(irq_poll_t* p) {
+    nvme_queue_t* queue = p->data;
+    msi_unmask_vector(&queue->ctrl->msi, queue->vector_index);
+}
+
+static void nvme_poll_irq_disable(irq_poll_t* p) {
+    nvme_queue_t* queue = p->data;
+    msi_mask_vector(&queue->ctrl->msi, queue->vector_index);
+}
+
+// Aggregation time and threshold are per controller: apply the most
+// coalescing any queue asked for
+static void nvme_set_coalesce(irq_poll_t* p, uint32_t usecs, uint32_t frames) {
+    nvme_controller_t* ctrl = ((nvme_queue_t*)p->data)->ctrl;
+    uint32_t max_usecs = 0, max_frames = 1;
+    for (int qid = 1; qid <= ctrl->num_io_queues; qid++) {
+        irq_poll_t* q = &ctrl->io_queues[qid].poll;
+        if (q->coalesce_usecs > max_usecs) {
+            max_usecs = q->coalesce_usecs;
+        }
+        if (q->coalesce_frames > max_frames) {
+            max_frames = q->coalesce_frames;
+        }
+    }
+    
+    // Time is in 100 us units, the threshold zero-based and 8 bits wide
+    uint32_t time = (max_usecs + 99) / 100;
+    uint32_t thr = max_frames > 256 ? 255 : max_frames - 1;
+    uint32_t value = (time << 8) | thr;
+    if (value == ctrl->coalescing) {
+        return;
+    }
+    
+    nvme_command_t cmd = {0};
+    cmd.cdw0 = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10 = NVME_FEAT_IRQ_COALESCE;
+    cmd.cdw11 = value;
+    if (nvme_submit_command(&ctrl->admin_queue, &cmd, NULL) == 0) {
+        ctrl->coalescing = value;
+    }
+}
+
+// Create I/O Queue Pair. With per-queue vectors the completion queue
+// signals MSI-X entry iv, otherwise it is left polled.
+static int nvme_create_io_queue(nvme_controller_t* ctrl, int qid, int queue_depth,
+                                uint16_t iv) {
     nvme_queue_t* queue = &ctrl->io_queues[qid];
     
     // Allocate queues
@@ -79,6 +233,9 @@ static int nvme_create_io_queue(nvme_controller_t* ctrl, int qid, int queue_dept
     queue->sq_tail = 0;
     queue->cq_head = 0;
     queue->cq_phase = 1;
+    queue->ctrl = ctrl;
+    queue->requests = kmalloc(queue_depth * sizeof(nvme_request_t*));
+    memset(queue->requests, 0, queue_depth * sizeof(nvme_request_t*));
     
     spinlock_init(&queue->lock);
     
@@ -94,7 +251,11 @@ static int nvme_create_io_queue(nvme_controller_t* ctrl, int qid, int queue_dept
     cmd.cdw0 = NVME_ADMIN_CREATE_CQ | ((qid & 0xFFFF) << 16);
     cmd.prp1 = (uint64_t)queue->cq;
     cmd.cdw10 = ((queue_depth - 1) << 16) | qid;
-    cmd.cdw11 = 1; // Physically contiguous
+    cmd.cdw11 = NVME_CQ_PC;
+    if (ctrl->queue_vectors) {
+        cmd.cdw11 |= NVME_CQ_IEN | NVME_CQ_IV(iv);
+        queue->vector_index = iv;
+    }
     
     if (nvme_submit_command(&ctrl->admin_queue, &cmd, NULL) != 0) {
         kprintf("[NVMe] Failed to create CQ %d\n", qid);
@@ -113,71 +274,152 @@ static int nvme_create_io_queue(nvme_controller_t* ctrl, int qid, int queue_dept
         return -1;
     }
     
+    if (ctrl->queue_vectors) {
+        queue->poll.name = "nvme";
+        queue->poll.softirq = SOFTIRQ_BLOCK;
+        queue->poll.weight = IRQ_POLL_WEIGHT;
+        queue->poll.poll = nvme_poll;
+        queue->poll.irq_enable = nvme_poll_irq_enable;
+        queue->poll.irq_disable = nvme_poll_irq_disable;
+        queue->poll.set_coalesce = nvme_set_coalesce;
+        queue->poll.data = queue;
+        irq_poll_register(&queue->poll);
+        queue->irq_driven = true;
+    }
+    
     kprintf("[NVMe] Created I/O queue pair %d (depth: %d)\n", qid, queue_depth);
     return 0;
 }
 
-// Read sectors
-int nvme_read(nvme_controller_t* ctrl, int nsid, uint64_t lba, 
-              uint32_t count, void* buffer) {
-    // AI: Choose optimal queue based on current load
-    int queue_id = 1; // Simplified - use first I/O queue
-    nvme_queue_t* queue = &ctrl->io_queues[queue_id];
+// The calling CPU's queue pair. Where CPUs outnumber queues, a shared
+// queue's vector follows whichever CPU submitted last.
+static nvme_queue_t* nvme_cpu_queue(nvme_controller_t* ctrl) {
+    nvme_queue_t* queue = &ctrl->io_queues[ctrl->cpu_queue[smp_processor_id()]];
+    if (ctrl->queue_vectors) {
+        msi_steer_to_current(&ctrl->msi, queue->vector_index);
+    }
+    return queue;
+}
+
+// Submit a read or write of count blocks to or from the pages in
+// pages[], the first used from offset on. prp1 takes the first page, prp2
+// the second page or a list holding the rest.
+static int nvme_rw(nvme_controller_t* ctrl, int nsid, uint32_t opcode, uint64_t lba,
+                   uint32_t count, const uint64_t* pages, uint32_t offset) {
+    if (nsid < 1 || nsid > ctrl->num_namespaces || count == 0 || count > 0x10000) {
+        return -EINVAL;
+    }
+    nvme_namespace_t* ns = &ctrl->namespaces[nsid - 1];
+    uint64_t bytes = (uint64_t)count * ns->block_size;
+    uint64_t nr_pages = (offset + bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (nr_pages > NVME_MAX_XFER_PAGES || (offset & 3)) {
+        return -EINVAL;
+    }
+    
+    // Submit on this CPU's queue so the completion interrupts it
+    nvme_queue_t* queue = nvme_cpu_queue(ctrl);
     
     nvme_command_t cmd = {0};
-    cmd.cdw0 = NVME_CMD_READ | ((ctrl->next_cid++ & 0xFFFF) << 16);
+    cmd.cdw0 = opcode;  // Command ID assigned on submission
     cmd.nsid = nsid;
-    cmd.prp1 = (uint64_t)buffer;
+    cmd.prp1 = pages[0] + offset;
     cmd.cdw10 = (uint32_t)lba;
     cmd.cdw11 = (uint32_t)(lba >> 32);
     cmd.cdw12 = (count - 1) & 0xFFFF; // Number of blocks - 1
     
+    uint64_t* prp_list = NULL;
+    if (nr_pages == 2) {
+        cmd.prp2 = pages[1];
+    } else if (nr_pages > 2) {
+        prp_list = pmm_alloc_pages(1);
+        if (!prp_list) {
+            return -ENOMEM;
+        }
+        for (uint32_t i = 1; i < nr_pages; i++) {
+            prp_list[i - 1] = pages[i];
+        }
+        cmd.prp2 = (uint64_t)prp_list;
+    }
+    
     uint64_t start = rdtsc();
     int status = nvme_submit_command(queue, &cmd, NULL);
     uint64_t latency = rdtsc() - start;
     
-    // AI: Update performance metrics
-    nvme_namespace_t* ns = &ctrl->namespaces[nsid - 1];
-    ns->reads++;
-    ns->bytes_read += count * ns->block_size;
+    if (prp_list) {
+        pmm_free_pages(prp_list, 1);
+    }
     
-    // Update average latency using exponential moving average
+    // AI: Update performance metrics, using an exponential moving average
+    // for latency
     uint32_t latency_us = (uint32_t)(latency / (cpu_frequency_hz() / 1000000));
-    ns->avg_read_latency_us = (ns->avg_read_latency_us * 7 + latency_us) / 8;
-    
-    // AI: Predict next access for prefetching
-    nvme_ai_predict_access_pattern(ctrl, lba);
+    if (opcode == NVME_CMD_READ) {
+        ns->reads++;
+        ns->bytes_read += bytes;
+        ns->avg_read_latency_us = (ns->avg_read_latency_us * 7 + latency_us) / 8;
+        
+        // AI: Predict next access for prefetching
+        nvme_ai_predict_access_pattern(ctrl, lba);
+    } else {
+        ns->writes++;
+        ns->bytes_written += bytes;
+        ns->avg_write_latency_us = (ns->avg_write_latency_us * 7 + latency_us) / 8;
+    }
     
     return status;
 }
 
-// Write sectors
+// Pages of a physically contiguous kernel buffer
+static uint32_t nvme_kernel_pages(const void* buffer, uint64_t* pages) {
+    uint64_t base = (uint64_t)buffer & ~((uint64_t)PAGE_SIZE - 1);
+    for (uint32_t i = 0; i < NVME_MAX_XFER_PAGES; i++) {
+        pages[i] = base + (uint64_t)i * PAGE_SIZE;
+    }
+    return (uint64_t)buffer & (PAGE_SIZE - 1);
+}
+
+// Read sectors into a physically contiguous kernel buffer
+int nvme_read(nvme_controller_t* ctrl, int nsid, uint64_t lba, 
+              uint32_t count, void* buffer) {
+    uint64_t pages[NVME_MAX_XFER_PAGES];
+    uint32_t offset = nvme_kernel_pages(buffer, pages);
+    return nvme_rw(ctrl, nsid, NVME_CMD_READ, lba, count, pages, offset);
+}
+
+// Write sectors from a physically contiguous kernel buffer
 int nvme_write(nvme_controller_t* ctrl, int nsid, uint64_t lba,
                uint32_t count, const void* buffer) {
-    int queue_id = 1;
-    nvme_queue_t* queue = &ctrl->io_queues[queue_id];
-    
-    nvme_command_t cmd = {0};
-    cmd.cdw0 = NVME_CMD_WRITE | ((ctrl->next_cid++ & 0xFFFF) << 16);
-    cmd.nsid = nsid;
-    cmd.prp1 = (uint64_t)buffer;
-    cmd.cdw10 = (uint32_t)lba;
-    cmd.cdw11 = (uint32_t)(lba >> 32);
-    cmd.cdw12 = (count - 1) & 0xFFFF;
-    
-    uint64_t start = rdtsc();
-    int status = nvme_submit_command(queue, &cmd, NULL);
-    uint64_t latency = rdtsc() - start;
+    uint64_t pages[NVME_MAX_XFER_PAGES];
+    uint32_t offset = nvme_kernel_pages(buffer, pages);
+    return nvme_rw(ctrl, nsid, NVME_CMD_WRITE, lba, count, pages, offset);
+}
+
+// Read into or write from a user buffer in as. Its pages are pinned for
+// the duration, so the controller only ever sees frames the caller maps.
+int nvme_rw_user(nvme_controller_t* ctrl, int nsid, uint64_t lba, uint32_t count,
+                 address_space_t* as, uint64_t addr, bool write) {
+    if (!as || nsid < 1 || nsid > ctrl->num_namespaces || count == 0) {
+        return -EINVAL;
+    }
+    uint64_t bytes = (uint64_t)count * ctrl->namespaces[nsid - 1].block_size;
+    if (bytes > (uint64_t)NVME_MAX_XFER_PAGES * PAGE_SIZE) {
+        return -EINVAL;
+    }
     
-    // AI: Update metrics
-    nvme_namespace_t* ns = &ctrl->namespaces[nsid - 1];
-    ns->writes++;
-    ns->bytes_written += count * ns->block_size;
+    vm_pin_t* pin = kmalloc(sizeof(vm_pin_t));
+    if (!pin) {
+        return -ENOMEM;
+    }
     
-    uint32_t latency_us = (uint32_t)(latency / (cpu_frequency_hz() / 1000000));
-    ns->avg_write_latency_us = (ns->avg_write_latency_us * 7 + latency_us) / 8;
+    // A device write to memory is a read from the disk
+    int result = vmm_pin_user_pages(as, addr, bytes, !write, pin);
+    if (result == 0) {
+        result = nvme_rw(ctrl, nsid, write ? NVME_CMD_WRITE : NVME_CMD_READ, lba, count,
+                         pin->phys, addr & (PAGE_SIZE - 1));
+        vmm_unpin_user_pages(pin);
+    }
     
-    return status;
+    kfree(pin);
+    return result;
 }
 
 // AI: Predict access patterns for prefetching
@@ -238,6 +480,9 @@ static int nvme_probe(pci_device_t* pci_dev) {
     ctrl->admin_queue.sq_tail = 0;
     ctrl->admin_queue.cq_head = 0;
     ctrl->admin_queue.cq_phase = 1;
+    ctrl->admin_queue.ctrl = ctrl;
+    ctrl->admin_queue.requests = kmalloc(admin_queue_size * sizeof(nvme_request_t*));
+    memset(ctrl->admin_queue.requests, 0, admin_queue_size * sizeof(nvme_request_t*));
     
     spinlock_init(&ctrl->admin_queue.lock);
     
@@ -278,12 +523,49 @@ static int nvme_probe(pci_device_t* pci_dev) {
     uint32_t nn = *(uint32_t*)(identify_buf + 516);
     kprintf("[NVMe] Namespaces: %d\n", nn);
     
-    // Create I/O queues
-    ctrl->num_io_queues = 4; // Create 4 I/O queue pairs
-    for (int i = 0; i < ctrl->num_io_queues; i++) {
-        nvme_create_io_queue(ctrl, i + 1, 256);
+    // One I/O queue pair per CPU, each with its own MSI-X vector aimed at
+    // that CPU; vector 0 belongs to the admin queue
+    int nr_queues = num_cpus < NVME_MAX_IO_QUEUES ? num_cpus : NVME_MAX_IO_QUEUES;
+    int granted = nvme_set_num_queues(ctrl, nr_queues);
+    if (granted > 0) {
+        nr_queues = granted;
     }
     
+    int nvec = msi_enable(&ctrl->msi, pci_dev, nr_queues + 1);
+    if (nvec > 1) {
+        if (nvec - 1 < nr_queues) {
+            nr_queues = nvec - 1;
+        }
+        ctrl->queue_vectors = true;
+    }
+    if (nvec > 0) {
+        msi_request_vector(&ctrl->msi, 0, nvme_queue_irq, &ctrl->admin_queue, 0);
+    }
+    
+    for (int i = 0; i < nr_queues; i++) {
+        int qid = ctrl->num_io_queues + 1;
+        if (nvme_create_io_queue(ctrl, qid, 256, qid) != 0) {
+            break;
+        }
+        if (ctrl->queue_vectors) {
+            msi_request_vector(&ctrl->msi, qid, nvme_queue_irq, &ctrl->io_queues[qid], i);
+        }
+        ctrl->num_io_queues++;
+    }
+    
+    if (ctrl->num_io_queues == 0) {
+        kprintf("[NVMe] No I/O queues, giving up on controller\n");
+        msi_disable(&ctrl->msi);
+        kfree(identify_buf);
+        kfree(ctrl);
+        return -1;
+    }
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        ctrl->cpu_queue[cpu] = cpu % ctrl->num_io_queues + 1;
+    }
+    kprintf("[NVMe] %d I/O queues, %s\n", ctrl->num_io_queues,
+            ctrl->queue_vectors ? "one vector each" : "polled");
+    
     // Identify each namespace
     ctrl->num_namespaces = nn;
     for (uint32_t i = 1; i <= nn; i++) {
@@ -320,4 +602,11 @@ static pci_driver_t nvme_driver = {
 
 void nvme_init(void) {
     pci_register_driver(&nvme_driver);
+}
+
+nvme_controller_t* nvme_get_controller(int index) {
+    if (index < 0 || index >= nvme_controller_count) {
+        return NULL;
+    }
+    return nvme_controllers[index];
 }
\ No newline at end of file
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "../msi.h"
+#include "../../core/interrupts.h"
+#include "../../memory/vmm.h"
 
 // NVMe Register Offsets
 #define NVME_REG_CAP        0x00
@@ -27,6 +30,22 @@
 #define NVME_CMD_WRITE      0x01
 #define NVME_CMD_READ       0x02
 
+// Feature Identifiers
+#define NVME_FEAT_NUM_QUEUES    0x07
+#define NVME_FEAT_IRQ_COALESCE  0x08
+
+// Create I/O Completion Queue, CDW11
+#define NVME_CQ_PC          (1 << 0)    // Physically contiguous
+#define NVME_CQ_IEN         (1 << 1)    // Interrupts enabled
+#define NVME_CQ_IV(v)       ((uint32_t)(v) << 16)
+
+// One I/O queue pair per CPU, up to the io_queues slots after qid 0
+#define NVME_MAX_IO_QUEUES  63
+
+// Largest transfer: prp1 plus one PRP list page of entries, bounded by
+// what a pinned user buffer can hold
+#define NVME_MAX_XFER_PAGES VMM_PIN_MAX_PAGES
+
 // NVMe Submission Queue Entry
 typedef struct {
     uint32_t cdw0;      // Command Dword 0
@@ -53,6 +72,9 @@ typedef struct {
     uint16_t status;
 } __attribute__((packed)) nvme_completion_t;
 
+struct nvme_controller;
+struct nvme_request;
+
 // NVMe Queue Pair
 typedef struct {
     nvme_command_t* sq;     // Submission Queue
@@ -68,6 +90,14 @@ typedef struct {
     
     uint16_t queue_depth;
     
+    struct nvme_request** requests;     // In flight, by submission slot
+    struct nvme_controller* ctrl;
+    
+    uint16_t vector_index;  // MSI-X entry its completions signal
+    bool irq_driven;        // Completions reaped by polling from the softirq
+    irq_poll_t poll;
+    uint64_t interrupts;
+    
     spinlock_t lock;
 } nvme_queue_t;
 
@@ -93,18 +123,21 @@ typedef struct {
 } nvme_namespace_t;
 
 // NVMe Controller
-typedef struct {
+typedef struct nvme_controller {
     volatile uint64_t* bar0;    // Memory-mapped registers
     
     nvme_queue_t admin_queue;
     nvme_queue_t io_queues[64];
     int num_io_queues;
+    uint8_t cpu_queue[MAX_CPUS];    // I/O queue each CPU submits to
+    
+    msi_device_t msi;
+    bool queue_vectors;             // Each I/O queue has its own vector
+    uint32_t coalescing;            // Interrupt Coalescing feature value
     
     nvme_namespace_t namespaces[256];
     int num_namespaces;
     
-    uint16_t next_cid;
-    
     // AI-Enhanced I/O Scheduler
     struct {
         uint64_t pending_reads;
@@ -122,7 +155,10 @@ int nvme_read(nvme_controller_t* ctrl, int nsid, uint64_t lba,
               uint32_t count, void* buffer);
 int nvme_write(nvme_controller_t* ctrl, int nsid, uint64_t lba,
                uint32_t count, const void* buffer);
+int nvme_rw_user(nvme_controller_t* ctrl, int nsid, uint64_t lba, uint32_t count,
+                 address_space_t* as, uint64_t addr, bool write);
 int nvme_flush(nvme_controller_t* ctrl, int nsid);
+nvme_controller_t* nvme_get_controller(int index);
 
 // AI-Enhanced Features
 void nvme_ai_optimize_queue_depth(nvme_controller_t* ctrl);
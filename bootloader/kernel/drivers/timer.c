@@ -1,47 +1,181 @@
 // AION OS High-Precision Timer with AI Optimization
 #include "timer.h"
+#include "timer_wheel.h"
+#include "apic.h"
+#include "vclock.h"
 #include "../core/interrupts.h"
+#include "../core/softirq.h"
 #include "../ai/predictor.h"
+#include "../process/runqueue.h"
+#include "../memory/slab.h"
+#include "../fs/procfs.h"
+
+#define TICK_NS (NSEC_PER_SEC / TIMER_FREQUENCY)
+
+// Local APIC timer in TSC-deadline mode
+#define MSR_IA32_TSC_DEADLINE 0x6E0
+#define LAPIC_LVT_TIMER 0x320
+#define LVT_TIMER_TSC_DEADLINE (2 << 17)
+
+// HPET comparators only fire on an exact match, so a deadline that has
+// already passed is pushed this many counter ticks ahead
+#define HPET_MIN_DELTA 32
 
 // Timer sources
 static timer_source_t timer_source = TIMER_PIT;
 static uint64_t system_ticks = 0;
 static uint64_t system_time_ms = 0;
+static uint64_t tsc_frequency;
+static hpet_t *hpet;
+
+// Interrupt source for the tick; one-shot capable devices can stop it
+typedef struct {
+    const char *name;
+    bool oneshot;
+    void (*setup)(void);
+    void (*program)(uint64_t deadline_ns);   // Nanoseconds since boot
+} clock_event_t;
+
+static clock_event_t *clock_event;
+
+// Per-CPU tickless state
+typedef struct {
+    bool stopped;
+    uint64_t stopped_at;          // Tick when the tick was stopped
+    uint64_t idle_entries;
+    uint64_t ticks_skipped;
+} __attribute__((aligned(64))) tick_sched_t;
+
+static tick_sched_t tick_sched[MAX_CPUS];
 
-// Timer callbacks for AI scheduling
-#define MAX_TIMER_CALLBACKS 256
-static timer_callback_t timer_callbacks[MAX_TIMER_CALLBACKS];
-static uint32_t num_callbacks = 0;
+// All kernel timers live on one wheel driven from the tick
+static timer_wheel_t timer_wheel;
+
+// register_timer_callback timers
+typedef struct {
+    timer_entry_t entry;
+    timer_callback_func_t callback;
+    void *data;
+} callback_timer_t;
+
+static kmem_cache_t *callback_timer_cache;
+static uint32_t next_callback_id = 1;
 
 // AI timer optimizer
 static ai_timer_optimizer_t *timer_optimizer;
 
+static void timer_tick_program(void);
+static size_t timer_show(char *buf, size_t size);
+static void timer_softirq(void);
+
+// Read TSC
+static inline uint64_t read_tsc(void) {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                 "d"((uint32_t)(value >> 32)));
+}
+
+static uint64_t read_hpet_main_counter(void) {
+    return hpet->main_counter;
+}
+
+// Clock events
+
+static void tsc_deadline_setup(void) {
+    lapic_write(LAPIC_LVT_TIMER, (IRQ_TIMER + 32) | LVT_TIMER_TSC_DEADLINE);
+    timer_tick_program();
+}
+
+static void tsc_deadline_program(uint64_t deadline_ns) {
+    wrmsr(MSR_IA32_TSC_DEADLINE, vclock_ns_to_cycles(deadline_ns));
+}
+
+static void hpet_setup(void) {
+    hpet->timer[0].config = HPET_TIMER_INT_ENABLE;
+    timer_tick_program();
+}
+
+// The comparator counts HPET periods, whatever clock keeps time. The
+// deadline is taken relative to now so the two clocks' epochs need not
+// agree.
+static void hpet_program(uint64_t deadline_ns) {
+    uint64_t now_ns = get_time_ns();
+    uint64_t delta_ns = deadline_ns > now_ns ? deadline_ns - now_ns : 0;
+    uint64_t target = hpet->main_counter +
+                      (uint64_t)((unsigned __int128)delta_ns * 1000000 / hpet->period);
+    hpet->timer[0].comparator = target;
+
+    // A comparator written behind the counter would not fire until wrap
+    while ((int64_t)(hpet->main_counter - target) >= 0) {
+        target = hpet->main_counter + HPET_MIN_DELTA;
+        hpet->timer[0].comparator = target;
+    }
+}
+
+static clock_event_t tsc_deadline_event = {
+    "TSC-deadline", true, tsc_deadline_setup, tsc_deadline_program
+};
+static clock_event_t hpet_event = {
+    "HPET one-shot", true, hpet_setup, hpet_program
+};
+static clock_event_t pit_event = {
+    "PIT periodic", false, init_pit, NULL
+};
+
 // Initialize timer system
 void timer_init(void) {
     kprintf("[TIMER] Initializing timer system...\n");
     
-    // Detect available timer sources
+    // Initialize AI timer optimizer
+    timer_optimizer = ai_timer_optimizer_create();
+    
+    // Detect available timer sources; the best counter keeps time
     if (detect_hpet()) {
-        timer_source = TIMER_HPET;
         init_hpet();
-        kprintf("[TIMER] Using HPET\n");
-    } else if (detect_tsc()) {
+    }
+    if (detect_tsc()) {
         timer_source = TIMER_TSC;
         init_tsc();
+        vclock_set_source(VCLOCK_TSC, tsc_frequency, read_tsc);
         kprintf("[TIMER] Using TSC\n");
+    } else if (hpet) {
+        timer_source = TIMER_HPET;
+        // Counter period is in femtoseconds
+        vclock_set_source(VCLOCK_HPET, 1000000000000000ULL / hpet->period,
+                          read_hpet_main_counter);
+        kprintf("[TIMER] Using HPET\n");
     } else {
         timer_source = TIMER_PIT;
-        init_pit();
         kprintf("[TIMER] Using PIT\n");
     }
     
-    // Initialize AI timer optimizer
-    timer_optimizer = ai_timer_optimizer_create();
+    timer_wheel_init(&timer_wheel, 0);
+    open_softirq(SOFTIRQ_TIMER, timer_softirq);
+    callback_timer_cache = kmem_cache_create("timer_callback", sizeof(callback_timer_t),
+                                             0, 0, NULL);
+    
+    // Pick the tick device: one-shot capable ones allow tickless idle
+    if (timer_source == TIMER_TSC && cpu_features.has_tsc_deadline) {
+        clock_event = &tsc_deadline_event;
+    } else if (hpet) {
+        clock_event = &hpet_event;
+    } else {
+        clock_event = &pit_event;
+    }
     
     // Register timer interrupt handler
     register_interrupt_handler(IRQ_TIMER + 32, timer_interrupt_handler);
+    clock_event->setup();
     
-    kprintf("[TIMER] Timer initialized, frequency: %d Hz\n", TIMER_FREQUENCY);
+    procfs_register("timers", timer_show);
+    
+    kprintf("[TIMER] Timer initialized, frequency: %d Hz, tick device: %s\n",
+            TIMER_FREQUENCY, clock_event->name);
 }
 
 // Initialize PIT (Programmable Interval Timer)
@@ -56,30 +190,21 @@ void init_pit(void) {
     outb(PIT_CHANNEL0_PORT, (divisor >> 8) & 0xFF);
 }
 
-// Initialize HPET (High Precision Event Timer)
+// Initialize HPET (High Precision Event Timer): start the main counter.
+// Timer 0 is set up as a clock event if the tick uses it.
 void init_hpet(void) {
     // Parse ACPI tables to find HPET base address
-    hpet_t *hpet = (hpet_t*)find_hpet_base();
+    hpet = (hpet_t*)find_hpet_base();
     
     if (!hpet) {
-        kprintf("[TIMER] HPET not found, falling back to PIT\n");
-        timer_source = TIMER_PIT;
-        init_pit();
+        kprintf("[TIMER] HPET not found\n");
         return;
     }
     
-    // Enable HPET
-    uint64_t config = hpet->general_config;
-    config |= HPET_ENABLE;
-    hpet->general_config = config;
-    
-    // Configure timer 0
-    hpet->timer[0].config = HPET_TIMER_PERIODIC | HPET_TIMER_INT_ENABLE;
-    
-    // Set period
-    uint64_t period = (1000000000000000ULL / TIMER_FREQUENCY) / hpet->period;
-    hpet->timer[0].comparator = period;
+    // Reset the counter while stopped, then enable HPET
+    hpet->general_config &= ~HPET_ENABLE;
     hpet->main_counter = 0;
+    hpet->general_config |= HPET_ENABLE;
     
     kprintf("[TIMER] HPET initialized at 0x%llx\n", (uint64_t)hpet);
 }
@@ -91,82 +216,188 @@ void init_tsc(void) {
     pit_sleep(100);  // Sleep 100ms using PIT
     uint64_t tsc_end = read_tsc();
     
-    uint64_t tsc_frequency = (tsc_end - tsc_start) * 10;  // Hz
+    tsc_frequency = (tsc_end - tsc_start) * 10;  // Hz
     kprintf("[TIMER] TSC frequency: %llu MHz\n", tsc_frequency / 1000000);
     
     // Store TSC frequency for time calculations
     timer_optimizer->tsc_frequency = tsc_frequency;
 }
 
-// Read TSC
-static inline uint64_t read_tsc(void) {
-    uint32_t low, high;
-    asm volatile("rdtsc" : "=a"(low), "=d"(high));
-    return ((uint64_t)high << 32) | low;
+// Bring jiffies up to date. With a one-shot device ticks can be skipped,
+// so they are derived from the clock rather than counted.
+static void tick_update_time(void) {
+    if (clock_event->oneshot) {
+        system_ticks = vclock_now_ns() / TICK_NS;
+    } else {
+        system_ticks++;
+    }
+    system_time_ms = system_ticks * 1000 / TIMER_FREQUENCY;
+    vclock_update(system_ticks * TICK_NS);
+}
+
+// Arm the next periodic tick on a one-shot device
+static void timer_tick_program(void) {
+    uint64_t now = vclock_now_ns();
+    clock_event->program((now / TICK_NS + 1) * TICK_NS);
+}
+
+static void tick_nohz_restart(tick_sched_t *ts) {
+    ts->stopped = false;
+    if (system_ticks > ts->stopped_at) {
+        ts->ticks_skipped += system_ticks - ts->stopped_at - 1;
+    }
 }
 
 // Timer interrupt handler
 void timer_interrupt_handler(interrupt_frame_t *frame) {
-    system_ticks++;
-    system_time_ms += (1000 / TIMER_FREQUENCY);
+    tick_sched_t *ts = &tick_sched[smp_processor_id()];
     
-    // AI-optimized callback processing
-    if (timer_optimizer->should_process_callbacks(system_ticks)) {
-        process_timer_callbacks();
+    tick_update_time();
+    if (ts->stopped) {
+        // Woken from tickless idle; the tick runs again until idle
+        // decides otherwise
+        tick_nohz_restart(ts);
     }
     
+    // Expiry runs on interrupt exit, outside the hard IRQ
+    raise_softirq_irqoff(SOFTIRQ_TIMER);
+    
     // Update scheduler quantum
     update_scheduler_quantum();
     
-    // AI power management
+    if (clock_event->oneshot) {
+        timer_tick_program();
+    }
+}
+
+// O(1) amortized: only slots that are due are visited
+static void timer_softirq(void) {
+    timer_wheel_run(&timer_wheel, system_ticks);
+}
+
+// Stop the tick on an idle CPU until the next timer is due. Called by
+// the idle task with interrupts disabled, right before halting.
+void tick_nohz_idle_enter(void) {
+    tick_sched_t *ts = &tick_sched[smp_processor_id()];
+    if (!clock_event->oneshot || ts->stopped) {
+        return;
+    }
+    
+    uint64_t now = system_ticks;
+    uint64_t next = timer_wheel_next_expiry(&timer_wheel);
+    if (next <= now + 1) {
+        return;    // Due by the next tick anyway
+    }
+    if (next - now > NOHZ_MAX_IDLE_TICKS) {
+        next = now + NOHZ_MAX_IDLE_TICKS;
+    }
+    
+    // AI power management, once per idle period instead of every tick
     timer_optimizer->optimize_power_state();
+    
+    ts->stopped = true;
+    ts->stopped_at = now;
+    ts->idle_entries++;
+    clock_event->program(next * TICK_NS);
+}
+
+// Leaving idle without a timer interrupt: catch up and restart the tick
+void tick_nohz_idle_exit(void) {
+    uint64_t flags = local_irq_save();
+    tick_sched_t *ts = &tick_sched[smp_processor_id()];
+    
+    if (ts->stopped) {
+        tick_update_time();
+        tick_nohz_restart(ts);
+        timer_wheel_run(&timer_wheel, system_ticks);
+        timer_tick_program();
+    }
+    
+    local_irq_restore(flags);
+}
+
+uint64_t timer_ticks(void) {
+    return system_ticks;
+}
+
+uint64_t ms_to_ticks(uint64_t ms) {
+    return (ms * TIMER_FREQUENCY + 999) / 1000;
+}
+
+// Arm a timer for an absolute tick
+void timer_add(timer_entry_t *timer, uint64_t expires) {
+    timer->expires = expires;
+    uint64_t flags = local_irq_save();
+    timer_wheel_add(&timer_wheel, timer);
+    local_irq_restore(flags);
+}
+
+bool timer_del(timer_entry_t *timer) {
+    uint64_t flags = local_irq_save();
+    bool pending = timer_wheel_del(&timer_wheel, timer);
+    local_irq_restore(flags);
+    return pending;
+}
+
+static void callback_timer_fire(void *data) {
+    callback_timer_t *timer = data;
+    timer->callback(timer->data);
+    
+    if (!timer->entry.interval) {
+        kmem_cache_free(callback_timer_cache, timer);
+    }
 }
 
 // Register timer callback
 uint32_t register_timer_callback(uint64_t interval_ms, 
                                   timer_callback_func_t callback,
                                   void *data, bool repeating) {
-    if (num_callbacks >= MAX_TIMER_CALLBACKS) {
+    callback_timer_t *timer = kmem_cache_alloc(callback_timer_cache);
+    if (!timer) {
         return 0;
     }
     
-    timer_callback_t *cb = &timer_callbacks[num_callbacks];
-    cb->id = num_callbacks + 1;
-    cb->interval_ms = interval_ms;
-    cb->next_trigger = system_time_ms + interval_ms;
-    cb->callback = callback;
-    cb->data = data;
-    cb->repeating = repeating;
-    cb->enabled = true;
-    
-    num_callbacks++;
+    uint64_t ticks = ms_to_ticks(interval_ms);
+    if (!ticks) {
+        ticks = 1;
+    }
     
-    // AI prediction: Optimize callback order
-    timer_optimizer->optimize_callback_order(timer_callbacks, num_callbacks);
+    timer_entry_init(&timer->entry, callback_timer_fire, timer);
+    timer->entry.interval = repeating ? ticks : 0;
+    timer->callback = callback;
+    timer->data = data;
+    timer_add(&timer->entry, system_ticks + ticks);
     
-    return cb->id;
+    return __atomic_fetch_add(&next_callback_id, 1, __ATOMIC_RELAXED);
 }
 
-// Process timer callbacks
-void process_timer_callbacks(void) {
-    for (uint32_t i = 0; i < num_callbacks; i++) {
-        timer_callback_t *cb = &timer_callbacks[i];
-        
-        if (!cb->enabled) continue;
-        
-        if (system_time_ms >= cb->next_trigger) {
-            // Call callback
-            cb->callback(cb->data);
-            
-            if (cb->repeating) {
-                // Reschedule
-                cb->next_trigger = system_time_ms + cb->interval_ms;
-            } else {
-                // Disable one-shot callback
-                cb->enabled = false;
-            }
+static void sleep_timer_fire(void *data) {
+    wake_up_process((process_t*)data);
+}
+
+// Block the current task until system_time_ms reaches target
+void block_until(uint64_t target) {
+    if (!current_process) {
+        while (system_time_ms < target) {
+            asm volatile("pause");
         }
+        return;
+    }
+    
+    timer_entry_t timer;
+    timer_entry_init(&timer, sleep_timer_fire, current_process);
+    timer_add(&timer, ms_to_ticks(target));
+    
+    uint64_t flags = local_irq_save();
+    while (system_time_ms < target) {
+        current_process->state = PROCESS_STATE_BLOCKED;
+        local_irq_restore(flags);
+        schedule();
+        flags = local_irq_save();
     }
+    local_irq_restore(flags);
+    
+    timer_del(&timer);
 }
 
 // High-resolution sleep
@@ -198,17 +429,15 @@ void sleep_ms(uint64_t milliseconds) {
     }
 }
 
-// Get current time in various formats
+// Milliseconds since boot, whatever the clock source. A seqlock read of
+// the clock page: no branches on the source, no runtime divides.
 uint64_t get_system_time(void) {
-    switch (timer_source) {
-        case TIMER_TSC:
-            return read_tsc() / (timer_optimizer->tsc_frequency / 1000000);
-        case TIMER_HPET:
-            return read_hpet_counter();
-        case TIMER_PIT:
-        default:
-            return system_time_ms;
-    }
+    return vclock_now_ns() / 1000000;
+}
+
+// Nanoseconds since boot
+uint64_t get_time_ns(void) {
+    return vclock_now_ns();
 }
 
 // Get uptime
@@ -220,4 +449,20 @@ void get_uptime(uptime_t *uptime) {
     uptime->minutes = (total_seconds % 3600) / 60;
     uptime->seconds = total_seconds % 60;
     uptime->milliseconds = system_time_ms % 1000;
-}
\ No newline at end of file
+}
+
+// procfs: /proc/timers
+static size_t timer_show(char *buf, size_t size) {
+    size_t len = snprintf(buf, size,
+                          "tick_device %s\nticks %llu\npending %d\nexpired %llu\n"
+                          "cascaded %llu\ncpu idle_entries ticks_skipped\n",
+                          clock_event->name, system_ticks, timer_wheel.pending,
+                          timer_wheel.expired, timer_wheel.cascaded);
+    
+    for (uint32_t cpu = 0; cpu < num_cpus && len < size; cpu++) {
+        len += snprintf(buf + len, size - len, "%3d %12llu %13llu\n", cpu,
+                        tick_sched[cpu].idle_entries, tick_sched[cpu].ticks_skipped);
+    }
+    
+    return len < size ? len : size;
+}
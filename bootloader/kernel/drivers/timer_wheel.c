@@ -0,0 +1,245 @@
+// AION OS Hierarchical Timer Wheel
+#include "timer_wheel.h"
+
+static inline uint32_t tvn_shift(uint32_t level) {
+    return TVR_BITS + level * TVN_BITS;
+}
+
+static timer_slot_t* timer_slot(timer_wheel_t *wheel, timer_entry_t *timer) {
+    return timer->level < 0 ? &wheel->tv1[timer->index]
+                            : &wheel->tvn[timer->level][timer->index];
+}
+
+static void slot_mark(timer_wheel_t *wheel, int8_t level, uint32_t index) {
+    if (level < 0) {
+        wheel->tv1_map[index / 64] |= 1ULL << (index % 64);
+    } else {
+        wheel->tvn_map[level] |= 1ULL << index;
+    }
+}
+
+static void slot_clear(timer_wheel_t *wheel, int8_t level, uint32_t index) {
+    if (level < 0) {
+        wheel->tv1_map[index / 64] &= ~(1ULL << (index % 64));
+    } else {
+        wheel->tvn_map[level] &= ~(1ULL << index);
+    }
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now) {
+    memset(wheel, 0, sizeof(timer_wheel_t));
+    wheel->clk = now;
+    spinlock_init(&wheel->lock);
+}
+
+void timer_entry_init(timer_entry_t *timer, timer_fn_t fn, void *data) {
+    memset(timer, 0, sizeof(timer_entry_t));
+    timer->fn = fn;
+    timer->data = data;
+}
+
+// Put a timer in the slot its distance from clk calls for. Lock held.
+static void internal_add(timer_wheel_t *wheel, timer_entry_t *timer) {
+    if (timer->expires < wheel->clk) {
+        timer->expires = wheel->clk;
+    }
+    uint64_t delta = timer->expires - wheel->clk;
+    if (delta > TIMER_MAX_DELTA) {
+        timer->expires = wheel->clk + TIMER_MAX_DELTA;
+        delta = TIMER_MAX_DELTA;
+    }
+
+    if (delta < TVR_SIZE) {
+        timer->level = -1;
+        timer->index = timer->expires & TVR_MASK;
+    } else {
+        uint32_t level = 0;
+        while (delta >= 1ULL << tvn_shift(level + 1)) {
+            level++;
+        }
+        timer->level = level;
+        timer->index = (timer->expires >> tvn_shift(level)) & TVN_MASK;
+    }
+
+    timer_slot_t *slot = timer_slot(wheel, timer);
+    timer->next = slot->head;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    slot->head = timer;
+    timer->pprev = &slot->head;
+
+    slot_mark(wheel, timer->level, timer->index);
+    wheel->pending++;
+}
+
+// Unlink a pending timer. Lock held.
+static void detach(timer_wheel_t *wheel, timer_entry_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+
+    if (!timer_slot(wheel, timer)->head) {
+        slot_clear(wheel, timer->level, timer->index);
+    }
+    wheel->pending--;
+}
+
+// O(1): hash into a slot. Re-adding a pending timer moves it.
+void timer_wheel_add(timer_wheel_t *wheel, timer_entry_t *timer) {
+    spinlock_acquire(&wheel->lock);
+    if (timer->pprev) {
+        detach(wheel, timer);
+    }
+    internal_add(wheel, timer);
+    spinlock_release(&wheel->lock);
+}
+
+// Returns true if the timer was pending
+bool timer_wheel_del(timer_wheel_t *wheel, timer_entry_t *timer) {
+    spinlock_acquire(&wheel->lock);
+    bool pending = timer->pprev != NULL;
+    if (pending) {
+        detach(wheel, timer);
+    }
+    spinlock_release(&wheel->lock);
+    return pending;
+}
+
+// Re-hash one coarse slot into finer levels. Returns its index.
+static uint32_t cascade(timer_wheel_t *wheel, uint32_t level, uint32_t index) {
+    timer_entry_t *list = wheel->tvn[level][index].head;
+    wheel->tvn[level][index].head = NULL;
+    slot_clear(wheel, level, index);
+
+    while (list) {
+        timer_entry_t *next = list->next;
+        wheel->pending--;
+        internal_add(wheel, list);
+        wheel->cascaded++;
+        list = next;
+    }
+
+    return index;
+}
+
+// Distance from start to the first set bit at or after it, wrapping
+// around nbits; -1 if none is set
+static int32_t find_next_cyclic(const uint64_t *map, uint32_t nbits, uint32_t start) {
+    uint32_t words = nbits / 64;
+    for (uint32_t i = 0; i <= words; i++) {
+        uint32_t w = (start / 64 + i) % words;
+        uint64_t bits = map[w];
+        if (i == 0) {
+            bits &= ~0ULL << (start % 64);
+        } else if (i == words) {
+            bits &= (1ULL << (start % 64)) - 1;
+        }
+        if (bits) {
+            uint32_t bit = w * 64 + __builtin_ctzll(bits);
+            return (bit - start) & (nbits - 1);
+        }
+    }
+    return -1;
+}
+
+// Earliest tick at which any slot needs attention: a first-level expiry
+// or a coarse slot's cascade. Lock held.
+static uint64_t next_event(timer_wheel_t *wheel) {
+    if (!wheel->pending) {
+        return TIMER_NO_EXPIRY;
+    }
+
+    uint64_t clk = wheel->clk;
+    uint64_t next = TIMER_NO_EXPIRY;
+
+    int32_t dist = find_next_cyclic(wheel->tv1_map, TVR_SIZE, clk & TVR_MASK);
+    if (dist >= 0) {
+        next = clk + dist;
+    }
+
+    for (uint32_t level = 0; level < TVN_LEVELS; level++) {
+        uint32_t shift = tvn_shift(level);
+        uint64_t n = (clk + (1ULL << shift) - 1) >> shift;
+        dist = find_next_cyclic(&wheel->tvn_map[level], TVN_SIZE, n & TVN_MASK);
+        if (dist >= 0 && ((n + dist) << shift) < next) {
+            next = (n + dist) << shift;
+        }
+    }
+
+    return next;
+}
+
+// Lower bound on the next expiry, TIMER_NO_EXPIRY if nothing is pending.
+// Coarse timers report their cascade tick, so an early wakeup can happen
+// but a late one cannot.
+uint64_t timer_wheel_next_expiry(timer_wheel_t *wheel) {
+    spinlock_acquire(&wheel->lock);
+    uint64_t next = next_event(wheel);
+    spinlock_release(&wheel->lock);
+    return next;
+}
+
+// Expire everything due up to and including now. Ticks with nothing to
+// do are skipped, so catching up after a tickless stretch is cheap.
+// Callbacks run with the lock dropped, in the caller's interrupt state,
+// and may add or delete timers. The lock itself is only held with
+// interrupts off, so an interrupt adding a timer cannot deadlock on it.
+void timer_wheel_run(timer_wheel_t *wheel, uint64_t now) {
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&wheel->lock);
+
+    while (wheel->clk <= now) {
+        uint64_t next = next_event(wheel);
+        if (next > now) {
+            wheel->clk = now + 1;
+            break;
+        }
+        wheel->clk = next;
+
+        uint32_t index = wheel->clk & TVR_MASK;
+        if (!index) {
+            for (uint32_t level = 0; level < TVN_LEVELS; level++) {
+                uint32_t slot = (wheel->clk >> tvn_shift(level)) & TVN_MASK;
+                if (cascade(wheel, level, slot)) {
+                    break;
+                }
+            }
+        }
+
+        // Move the slot to a local list; its timers stay pending so a
+        // callback can still delete them
+        timer_entry_t *work = wheel->tv1[index].head;
+        wheel->tv1[index].head = NULL;
+        slot_clear(wheel, -1, index);
+        if (work) {
+            work->pprev = &work;
+        }
+        wheel->clk++;
+
+        while (work) {
+            timer_entry_t *timer = work;
+            detach(wheel, timer);
+
+            if (timer->interval) {
+                timer->expires += timer->interval;
+                internal_add(wheel, timer);
+            }
+            wheel->expired++;
+
+            timer_fn_t fn = timer->fn;
+            void *data = timer->data;
+            spinlock_release(&wheel->lock);
+            local_irq_restore(flags);
+            fn(data);
+            flags = local_irq_save();
+            spinlock_acquire(&wheel->lock);
+        }
+    }
+
+    spinlock_release(&wheel->lock);
+    local_irq_restore(flags);
+}
@@ -0,0 +1,77 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../core/smp.h"
+
+// Wheel geometry: a 256-slot first level at tick resolution, then four
+// 64-slot levels each 64 times coarser, covering 2^32 ticks
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 4
+#define TIMER_MAX_DELTA 0xFFFFFFFFULL
+
+#define TIMER_NO_EXPIRY UINT64_MAX
+
+// Longest tickless stretch, in ticks; bounds clock event programming
+#define NOHZ_MAX_IDLE_TICKS TIMER_FREQUENCY
+
+typedef void (*timer_fn_t)(void *data);
+
+// A pending timer, linked into one wheel slot
+typedef struct timer_entry {
+    struct timer_entry *next;
+    struct timer_entry **pprev;   // NULL while not pending
+    uint64_t expires;             // Absolute tick
+    uint64_t interval;            // Re-arm period in ticks, 0 for one-shot
+    timer_fn_t fn;
+    void *data;
+    int8_t level;                 // -1 for the tick-resolution level
+    uint8_t index;
+} timer_entry_t;
+
+typedef struct {
+    timer_entry_t *head;
+} timer_slot_t;
+
+// Every slot has a bit in its level's bitmap while it holds timers, so
+// empty stretches are skipped and the next expiry found without walking
+// the slots
+typedef struct {
+    uint64_t clk;                 // Next tick to process
+    timer_slot_t tv1[TVR_SIZE];
+    timer_slot_t tvn[TVN_LEVELS][TVN_SIZE];
+    uint64_t tv1_map[TVR_SIZE / 64];
+    uint64_t tvn_map[TVN_LEVELS];
+    uint32_t pending;
+    spinlock_t lock;
+
+    // Statistics
+    uint64_t expired;
+    uint64_t cascaded;
+} timer_wheel_t;
+
+// Timer wheel
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now);
+void timer_entry_init(timer_entry_t *timer, timer_fn_t fn, void *data);
+void timer_wheel_add(timer_wheel_t *wheel, timer_entry_t *timer);
+bool timer_wheel_del(timer_wheel_t *wheel, timer_entry_t *timer);
+void timer_wheel_run(timer_wheel_t *wheel, uint64_t now);
+uint64_t timer_wheel_next_expiry(timer_wheel_t *wheel);
+
+// Kernel timers on the system wheel (timer.c)
+void timer_add(timer_entry_t *timer, uint64_t expires);
+bool timer_del(timer_entry_t *timer);
+uint64_t timer_ticks(void);
+uint64_t ms_to_ticks(uint64_t ms);
+
+// Tickless idle (timer.c)
+void tick_nohz_idle_enter(void);
+void tick_nohz_idle_exit(void);
+
+#endif // TIMER_WHEEL_H
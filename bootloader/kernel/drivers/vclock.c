@@ -0,0 +1,106 @@
+// AION OS Clock Page (vDSO-style time reads)
+#include "vclock.h"
+
+// The page is in the kernel image, so time can be read from the first
+// kprintf on. Zeroed it is the tick source at 0 ns until the tick runs.
+// A whole page of its own, since user space gets it mapped.
+static union {
+    vclock_page_t page;
+    uint8_t bytes[PAGE_SIZE];
+} vclock_storage __attribute__((aligned(PAGE_SIZE)));
+
+vclock_page_t *vclock = &vclock_storage.page;
+static uint64_t vclock_phys;
+
+// Kernel-only conversion state, fixed once the source is calibrated
+static uint64_t (*vclock_read_counter)(void);
+static uint64_t vclock_inv_mult;          // cycles = ns * inv_mult >> VCLOCK_SHIFT
+
+static inline void vclock_write_begin(void) {
+    __atomic_store_n(&vclock->seq, vclock->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void vclock_write_end(void) {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&vclock->seq, vclock->seq + 1, __ATOMIC_RELAXED);
+}
+
+// Make the page mappable before any address space is created. Time runs
+// off the tick until timer_init picks a counter.
+void vclock_init(void) {
+    vclock_phys = (uint64_t)&vclock_storage;    // Identity mapped
+    vclock->shift = VCLOCK_SHIFT;
+}
+
+// Switch to a calibrated counter. The only divides happen here; reads
+// are a multiply and a shift.
+void vclock_set_source(vclock_source_t source, uint64_t frequency,
+                       uint64_t (*read_counter)(void)) {
+    uint64_t flags = local_irq_save();
+    uint64_t now = vclock_now_ns();
+
+    vclock_write_begin();
+    vclock_read_counter = read_counter;
+    vclock->source = source;
+    vclock->shift = VCLOCK_SHIFT;
+    vclock->mult = (uint64_t)(((unsigned __int128)NSEC_PER_SEC << VCLOCK_SHIFT) / frequency);
+    vclock_inv_mult = (uint64_t)(((unsigned __int128)frequency << VCLOCK_SHIFT) / NSEC_PER_SEC);
+    vclock->cycle_last = read_counter();
+    vclock->base_ns = now;
+    vclock_write_end();
+
+    local_irq_restore(flags);
+}
+
+// Called from the tick. Counter sources move their base forward so the
+// delta readers multiply stays small; the tick source just advances.
+void vclock_update(uint64_t tick_ns) {
+    vclock_write_begin();
+    if (vclock->source == VCLOCK_TICKS) {
+        vclock->base_ns = tick_ns;
+    } else {
+        uint64_t cycles = vclock_read_counter();
+        vclock->base_ns = vclock_cycles_to_ns(vclock, cycles);
+        vclock->cycle_last = cycles;
+    }
+    vclock_write_end();
+}
+
+// Kernel reads also cover counters user space cannot reach
+uint64_t vclock_now_ns(void) {
+    if (vclock->source != VCLOCK_HPET) {
+        return vclock_read_ns(vclock);
+    }
+
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = vclock_read_begin(vclock);
+        ns = vclock_cycles_to_ns(vclock, vclock_read_counter());
+    } while (vclock_read_retry(vclock, seq));
+    return ns;
+}
+
+// Counter value at a given time, for programming one-shot deadlines
+uint64_t vclock_ns_to_cycles(uint64_t ns) {
+    uint32_t seq;
+    uint64_t cycles;
+
+    do {
+        seq = vclock_read_begin(vclock);
+        uint64_t delta = ns > vclock->base_ns ? ns - vclock->base_ns : 0;
+        cycles = vclock->cycle_last +
+                 (uint64_t)(((unsigned __int128)delta * vclock_inv_mult) >> VCLOCK_SHIFT);
+    } while (vclock_read_retry(vclock, seq));
+
+    return cycles;
+}
+
+// Map the page read-only and non-executable into a user address space
+int vclock_map(address_space_t *as) {
+    if (!vclock_phys) {
+        return 0;
+    }
+    return vmm_install_special_page(as, VCLOCK_USER_ADDR, vclock_phys, PTE_USER | PTE_NX);
+}
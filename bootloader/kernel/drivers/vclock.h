@@ -0,0 +1,84 @@
+#ifndef VCLOCK_H
+#define VCLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../memory/vmm.h"
+
+// Where every user address space sees the clock page, read-only
+#define VCLOCK_USER_ADDR (USER_SPACE_END - 2 * PAGE_SIZE)
+
+#define VCLOCK_SHIFT 32
+#define NSEC_PER_SEC 1000000000ULL
+
+typedef enum {
+    VCLOCK_TICKS,       // No readable counter: base_ns advances per tick
+    VCLOCK_TSC,
+    VCLOCK_HPET         // Counter is MMIO, readable by the kernel only
+} vclock_source_t;
+
+// Clock page shared with user space. Writers bump seq to odd, update,
+// then bump it to even; readers retry if seq was odd or changed.
+typedef struct {
+    volatile uint32_t seq;
+    uint32_t source;
+    uint64_t cycle_last;          // Counter value at base_ns
+    uint64_t base_ns;             // Nanoseconds since boot
+    uint64_t mult;                // ns = (cycles - cycle_last) * mult >> shift
+    uint32_t shift;
+} vclock_page_t;
+
+static inline uint32_t vclock_read_begin(const volatile vclock_page_t *vc) {
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&vc->seq, __ATOMIC_ACQUIRE)) & 1) {
+        asm volatile("pause");
+    }
+    return seq;
+}
+
+static inline bool vclock_read_retry(const volatile vclock_page_t *vc, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&vc->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline uint64_t vclock_cycles_to_ns(const volatile vclock_page_t *vc, uint64_t cycles) {
+    return vc->base_ns +
+           (uint64_t)(((unsigned __int128)(cycles - vc->cycle_last) * vc->mult) >> vc->shift);
+}
+
+static inline uint64_t vclock_rdtsc(void) {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+// Nanoseconds since boot without entering the kernel. With the TSC this
+// is exact; other sources give tick resolution.
+static inline uint64_t vclock_read_ns(const volatile vclock_page_t *vc) {
+    uint32_t seq;
+    uint64_t ns;
+
+    do {
+        seq = vclock_read_begin(vc);
+        if (vc->source == VCLOCK_TSC) {
+            ns = vclock_cycles_to_ns(vc, vclock_rdtsc());
+        } else {
+            ns = vc->base_ns;
+        }
+    } while (vclock_read_retry(vc, seq));
+
+    return ns;
+}
+
+// Kernel side
+extern vclock_page_t *vclock;
+
+void vclock_init(void);
+void vclock_set_source(vclock_source_t source, uint64_t frequency,
+                       uint64_t (*read_counter)(void));
+void vclock_update(uint64_t tick_ns);
+uint64_t vclock_now_ns(void);
+uint64_t vclock_ns_to_cycles(uint64_t ns);
+int vclock_map(address_space_t *as);
+
+#endif // VCLOCK_H
@@ -0,0 +1,311 @@
+// AION OS Dentry Cache: path components resolved without the filesystem
+#include "dcache.h"
+#include "procfs.h"
+#include "../core/rcu.h"
+#include "../memory/slab.h"
+#include "../memory/shrinker.h"
+
+static dentry_t *dentry_hash[DCACHE_HASH_SIZE];
+static kmem_cache_t *dentry_cache;
+
+// Writers: hash chain updates, the LRU list and the counters below
+static spinlock_t dcache_lock;
+
+// LRU list, most recently added at the head. Hits only set referenced;
+// the shrinker gives referenced entries a second pass.
+static dentry_t *lru_head;
+static dentry_t *lru_tail;
+static uint64_t nr_dentries;
+static uint64_t nr_negative;
+static uint64_t nr_evicted;
+static uint64_t nr_invalidated;
+
+static dcache_cpu_stats_t dcache_cpu_stats[MAX_CPUS];
+
+static uint64_t dcache_count(void);
+static shrinker_t dcache_shrinker = {
+    .name = "dcache",
+    .count = dcache_count,
+    .scan = dcache_shrink,
+};
+
+static inline dentry_t** d_bucket(vfs_node_t *parent, uint32_t hash) {
+    uint64_t key = ((uintptr_t)parent >> 4) ^ hash;
+    return &dentry_hash[(key * 0x9E3779B97F4A7C15ULL) >> (64 - DCACHE_HASH_BITS)];
+}
+
+static inline bool d_match(dentry_t *d, vfs_node_t *parent, const char *name,
+                           uint32_t len, uint32_t hash) {
+    return d->parent == parent && d->hash == hash && d->len == len &&
+           memcmp(d->name, name, len) == 0;
+}
+
+static void lru_add(dentry_t *d) {
+    d->lru_prev = NULL;
+    d->lru_next = lru_head;
+    if (lru_head) {
+        lru_head->lru_prev = d;
+    } else {
+        lru_tail = d;
+    }
+    lru_head = d;
+}
+
+static void lru_del(dentry_t *d) {
+    if (d->lru_prev) {
+        d->lru_prev->lru_next = d->lru_next;
+    } else {
+        lru_head = d->lru_next;
+    }
+    if (d->lru_next) {
+        d->lru_next->lru_prev = d->lru_prev;
+    } else {
+        lru_tail = d->lru_prev;
+    }
+}
+
+// Unlink from the hash chain and LRU. Readers already on the entry keep
+// following hash_next, so it stays intact until the entry is freed.
+// Called with dcache_lock held; the caller frees after synchronize_rcu.
+static void d_unlink(dentry_t *d) {
+    dentry_t **pp = d_bucket(d->parent, d->hash);
+    while (*pp != d) {
+        pp = &(*pp)->hash_next;
+    }
+    __atomic_store_n(pp, d->hash_next, __ATOMIC_RELEASE);
+    lru_del(d);
+
+    nr_dentries--;
+    if (!d->node) {
+        nr_negative--;
+    }
+}
+
+// Wait out readers, then free a list of unlinked entries chained on lru_next
+static void d_free_list(dentry_t *list) {
+    if (!list) {
+        return;
+    }
+    synchronize_rcu();
+    while (list) {
+        dentry_t *next = list->lru_next;
+        kmem_cache_free(dentry_cache, list);
+        list = next;
+    }
+}
+
+// Find the entry for a name under parent. Must be called inside an RCU
+// read section, which also keeps the result valid. A hit whose node is
+// NULL means the name is known not to exist.
+dentry_t* dcache_lookup(vfs_node_t *parent, const char *name, uint32_t len, uint32_t hash) {
+    dcache_cpu_stats_t *stats = &dcache_cpu_stats[smp_processor_id()];
+    stats->lookups++;
+
+    for (dentry_t *d = rcu_dereference(*d_bucket(parent, hash)); d;
+         d = rcu_dereference(d->hash_next)) {
+        if (d_match(d, parent, name, len, hash)) {
+            if (!d->referenced) {
+                d->referenced = 1;
+            }
+            if (rcu_dereference(d->node)) {
+                stats->hits++;
+            } else {
+                stats->negative_hits++;
+            }
+            return d;
+        }
+    }
+
+    stats->misses++;
+    return NULL;
+}
+
+// Record the result of a filesystem lookup; node NULL caches the miss.
+// An existing entry for the name is updated in place.
+void dcache_add(vfs_node_t *parent, const char *name, uint32_t len, uint32_t hash,
+                vfs_node_t *node) {
+    if (len >= DNAME_INLINE_LEN) {
+        return;
+    }
+
+    dentry_t *fresh = kmem_cache_alloc(dentry_cache);
+    if (!fresh) {
+        return;
+    }
+
+    fresh->parent = parent;
+    fresh->node = node;
+    fresh->hash = hash;
+    fresh->len = len;
+    fresh->referenced = 0;
+    memcpy(fresh->name, name, len);
+    fresh->name[len] = '\0';
+
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&dcache_lock);
+
+    dentry_t **bucket = d_bucket(parent, hash);
+    dentry_t *d = *bucket;
+    while (d && !d_match(d, parent, name, len, hash)) {
+        d = d->hash_next;
+    }
+
+    if (d) {
+        // Lost a race with another walker, or a negative entry turning positive
+        if (!d->node && node) {
+            nr_negative--;
+        } else if (d->node && !node) {
+            nr_negative++;
+        }
+        rcu_assign_pointer(d->node, node);
+    } else {
+        fresh->hash_next = *bucket;
+        rcu_assign_pointer(*bucket, fresh);
+        lru_add(fresh);
+        nr_dentries++;
+        if (!node) {
+            nr_negative++;
+        }
+    }
+    bool over = nr_dentries > DCACHE_MAX_ENTRIES;
+
+    spinlock_release(&dcache_lock);
+    local_irq_restore(flags);
+
+    if (d) {
+        kmem_cache_free(dentry_cache, fresh);
+    }
+    if (over) {
+        dcache_shrink(DCACHE_SHRINK_BATCH);
+    }
+}
+
+// Forget one name, after the directory it lives in has changed
+void dcache_invalidate(vfs_node_t *parent, const char *name, uint32_t len) {
+    if (len >= DNAME_INLINE_LEN) {
+        return;
+    }
+    uint32_t hash = dcache_hash_name(name, len);
+
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&dcache_lock);
+
+    dentry_t *d = *d_bucket(parent, hash);
+    while (d && !d_match(d, parent, name, len, hash)) {
+        d = d->hash_next;
+    }
+    if (d) {
+        d_unlink(d);
+        d->lru_next = NULL;
+        nr_invalidated++;
+    }
+
+    spinlock_release(&dcache_lock);
+    local_irq_restore(flags);
+
+    d_free_list(d);
+}
+
+// Drop every entry naming node or living under it, before node is freed.
+// Rare, so it walks the whole table.
+void dcache_drop_node(vfs_node_t *node) {
+    dentry_t *victims = NULL;
+
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&dcache_lock);
+
+    for (uint32_t i = 0; i < DCACHE_HASH_SIZE; i++) {
+        dentry_t *d = dentry_hash[i];
+        while (d) {
+            dentry_t *next = d->hash_next;
+            if (d->node == node || d->parent == node) {
+                d_unlink(d);
+                d->lru_next = victims;
+                victims = d;
+                nr_invalidated++;
+            }
+            d = next;
+        }
+    }
+
+    spinlock_release(&dcache_lock);
+    local_irq_restore(flags);
+
+    d_free_list(victims);
+}
+
+// Evict up to nr entries from the cold end. Entries hit since the last
+// pass are moved back to the head instead, so each is looked at at most
+// twice. Returns how many were freed.
+uint64_t dcache_shrink(uint64_t nr) {
+    dentry_t *victims = NULL;
+    uint64_t freed = 0;
+
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&dcache_lock);
+
+    for (uint64_t scan = nr * 2; scan && freed < nr && lru_tail; scan--) {
+        dentry_t *d = lru_tail;
+        if (d->referenced) {
+            d->referenced = 0;
+            lru_del(d);
+            lru_add(d);
+            continue;
+        }
+        d_unlink(d);
+        d->lru_next = victims;
+        victims = d;
+        freed++;
+    }
+    nr_evicted += freed;
+
+    spinlock_release(&dcache_lock);
+    local_irq_restore(flags);
+
+    d_free_list(victims);
+    if (freed) {
+        kmem_cache_shrink(dentry_cache);
+    }
+    return freed;
+}
+
+static uint64_t dcache_count(void) {
+    return nr_dentries;
+}
+
+// procfs: /proc/dcache
+size_t dcache_show(char *buf, size_t size) {
+    dcache_cpu_stats_t total = {0};
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        total.lookups += dcache_cpu_stats[cpu].lookups;
+        total.hits += dcache_cpu_stats[cpu].hits;
+        total.negative_hits += dcache_cpu_stats[cpu].negative_hits;
+        total.misses += dcache_cpu_stats[cpu].misses;
+    }
+
+    size_t len = 0;
+    len += snprintf(buf + len, size - len,
+                    "entries %llu\nnegative %llu\nlookups %llu\nhits %llu\n"
+                    "negative_hits %llu\nmisses %llu\nevicted %llu\n"
+                    "invalidated %llu\n",
+                    nr_dentries, nr_negative, total.lookups, total.hits,
+                    total.negative_hits, total.misses, nr_evicted,
+                    nr_invalidated);
+
+    return len < size ? len : size;
+}
+
+void dcache_init(void) {
+    memset(dentry_hash, 0, sizeof(dentry_hash));
+    memset(dcache_cpu_stats, 0, sizeof(dcache_cpu_stats));
+    spinlock_init(&dcache_lock);
+
+    dentry_cache = kmem_cache_create("dentry", sizeof(dentry_t), 0,
+                                     SLAB_HWCACHE_ALIGN, NULL);
+
+    register_shrinker(&dcache_shrinker);
+    procfs_register("dcache", dcache_show);
+
+    kprintf("[DCACHE] %d hash buckets, up to %d entries\n",
+            DCACHE_HASH_SIZE, DCACHE_MAX_ENTRIES);
+}
@@ -0,0 +1,69 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "vfs.h"
+#include "../core/smp.h"
+
+// Hash table of (parent, name) -> node
+#define DCACHE_HASH_BITS 12
+#define DCACHE_HASH_SIZE (1 << DCACHE_HASH_BITS)
+
+// Names are stored inline; longer components are never cached
+#define DNAME_INLINE_LEN 48
+#define DCACHE_NAME_MAX 255
+
+// Past this many entries an insert first evicts a batch
+#define DCACHE_MAX_ENTRIES 16384
+#define DCACHE_SHRINK_BATCH 64
+
+// FNV-1a, applied one byte at a time while the path is scanned
+#define DCACHE_HASH_INIT 2166136261U
+
+static inline uint32_t dcache_hash_step(uint32_t hash, char c) {
+    return (hash ^ (uint8_t)c) * 16777619U;
+}
+
+static inline uint32_t dcache_hash_name(const char *name, uint32_t len) {
+    uint32_t hash = DCACHE_HASH_INIT;
+    for (uint32_t i = 0; i < len; i++) {
+        hash = dcache_hash_step(hash, name[i]);
+    }
+    return hash;
+}
+
+// One cached directory entry. Hash chains are walked without a lock
+// inside an RCU read section; everything else is under the dcache lock.
+typedef struct dentry {
+    struct dentry *hash_next;
+    struct dentry *lru_prev;
+    struct dentry *lru_next;
+    vfs_node_t *parent;
+    vfs_node_t *node;             // NULL for a negative entry
+    uint32_t hash;                // Of the name alone
+    uint16_t len;
+    volatile uint8_t referenced;  // Hit since the shrinker last passed
+    char name[DNAME_INLINE_LEN];
+} dentry_t;
+
+// Lookup counters, per CPU so the lockless path shares no lines
+typedef struct {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t negative_hits;
+    uint64_t misses;
+} __attribute__((aligned(64))) dcache_cpu_stats_t;
+
+// Function prototypes
+void dcache_init(void);
+dentry_t* dcache_lookup(vfs_node_t *parent, const char *name, uint32_t len, uint32_t hash);
+void dcache_add(vfs_node_t *parent, const char *name, uint32_t len, uint32_t hash,
+                vfs_node_t *node);
+void dcache_invalidate(vfs_node_t *parent, const char *name, uint32_t len);
+void dcache_drop_node(vfs_node_t *node);
+uint64_t dcache_shrink(uint64_t nr);
+size_t dcache_show(char *buf, size_t size);
+
+#endif // DCACHE_H
@@ -0,0 +1,240 @@
+// AION OS File Descriptor Tables
+#include "fdtable.h"
+#include "../memory/memory.h"
+
+// Point table at zeroed arrays for max_fds descriptors, all from one
+// allocation so growing and freeing is a single call
+static int fdtable_alloc(fd_table_t *table, uint32_t max_fds) {
+    uint32_t words = max_fds / 64;
+    uint32_t room_words = (words + 63) / 64;
+    size_t size = max_fds * sizeof(file_descriptor_t*) +
+                  (words + room_words) * sizeof(uint64_t);
+
+    void *mem = kmalloc(size);
+    if (!mem) {
+        return -ENOMEM;
+    }
+    memset(mem, 0, size);
+
+    table->files = mem;
+    table->open_fds = (uint64_t*)(table->files + max_fds);
+    table->room = table->open_fds + words;
+    table->max_fds = max_fds;
+
+    // Every word starts with room
+    for (uint32_t w = 0; w < words; w++) {
+        table->room[w / 64] |= 1ULL << (w % 64);
+    }
+    return 0;
+}
+
+int fdtable_init(fd_table_t *table) {
+    memset(table, 0, sizeof(fd_table_t));
+    spinlock_init(&table->lock);
+    return fdtable_alloc(table, FDTABLE_INIT_FDS);
+}
+
+fd_table_t* fdtable_create(void) {
+    fd_table_t *table = kmalloc(sizeof(fd_table_t));
+    if (!table) {
+        return NULL;
+    }
+    if (fdtable_init(table) < 0) {
+        kfree(table);
+        return NULL;
+    }
+    return table;
+}
+
+// Lowest free fd at or after start, -1 if none
+static int32_t fd_find_free(fd_table_t *table, uint32_t start) {
+    if (start >= table->max_fds) {
+        return -1;
+    }
+
+    uint32_t word = start / 64;
+    uint64_t bits = ~table->open_fds[word] & (~0ULL << (start % 64));
+    if (bits) {
+        return word * 64 + __builtin_ctzll(bits);
+    }
+
+    // Let the summary skip the full words
+    uint32_t words = table->max_fds / 64;
+    uint32_t next = word + 1;
+    for (uint32_t i = next / 64; i * 64 < words; i++) {
+        uint64_t room = table->room[i];
+        if (i == next / 64) {
+            room &= ~0ULL << (next % 64);
+        }
+        if (room) {
+            uint32_t w = i * 64 + __builtin_ctzll(room);
+            return w * 64 + __builtin_ctzll(~table->open_fds[w]);
+        }
+    }
+
+    return -1;
+}
+
+// Double the table. Called and returns with the lock held, but drops it
+// around the allocation.
+static int fdtable_grow(fd_table_t *table) {
+    uint32_t max_fds = table->max_fds;
+    spinlock_release(&table->lock);
+
+    fd_table_t bigger;
+    int result = fdtable_alloc(&bigger, min(max_fds * 2, FDTABLE_MAX_FDS));
+
+    spinlock_acquire(&table->lock);
+    if (result < 0) {
+        return result;
+    }
+    if (table->max_fds != max_fds) {
+        // Grown while unlocked
+        kfree(bigger.files);
+        return 0;
+    }
+
+    // The new words keep their room bits; the copied ones are recomputed
+    uint32_t words = max_fds / 64;
+    memcpy(bigger.files, table->files, max_fds * sizeof(file_descriptor_t*));
+    memcpy(bigger.open_fds, table->open_fds, words * sizeof(uint64_t));
+    for (uint32_t w = 0; w < words; w++) {
+        if (bigger.open_fds[w] == ~0ULL) {
+            bigger.room[w / 64] &= ~(1ULL << (w % 64));
+        }
+    }
+
+    kfree(table->files);
+    table->files = bigger.files;
+    table->open_fds = bigger.open_fds;
+    table->room = bigger.room;
+    table->max_fds = bigger.max_fds;
+    return 0;
+}
+
+// Give file the lowest free fd. The table's reference to file is the
+// caller's, which it keeps on failure.
+int fd_install(fd_table_t *table, file_descriptor_t *file) {
+    spinlock_acquire(&table->lock);
+
+    int32_t fd;
+    while ((fd = fd_find_free(table, table->next_fd)) < 0) {
+        int result = table->max_fds < FDTABLE_MAX_FDS ? fdtable_grow(table) : -EMFILE;
+        if (result < 0) {
+            spinlock_release(&table->lock);
+            return result;
+        }
+    }
+
+    uint32_t word = fd / 64;
+    table->open_fds[word] |= 1ULL << (fd % 64);
+    if (table->open_fds[word] == ~0ULL) {
+        table->room[word / 64] &= ~(1ULL << (word % 64));
+    }
+    table->files[fd] = file;
+    table->next_fd = fd + 1;
+    table->nr_open++;
+
+    spinlock_release(&table->lock);
+    return fd;
+}
+
+// The open file description behind fd with a reference held, NULL if fd
+// is not open. Drop the reference with vfs_file_put.
+file_descriptor_t* fd_get(fd_table_t *table, int fd) {
+    file_descriptor_t *file = NULL;
+
+    spinlock_acquire(&table->lock);
+    if (fd >= 0 && (uint32_t)fd < table->max_fds && table->files[fd]) {
+        file = table->files[fd];
+        vfs_file_get(file);
+    }
+    spinlock_release(&table->lock);
+
+    return file;
+}
+
+// Free fd and hand its reference to the caller, NULL if fd is not open
+file_descriptor_t* fd_remove(fd_table_t *table, int fd) {
+    file_descriptor_t *file = NULL;
+
+    spinlock_acquire(&table->lock);
+    if (fd >= 0 && (uint32_t)fd < table->max_fds && table->files[fd]) {
+        file = table->files[fd];
+        table->files[fd] = NULL;
+
+        uint32_t word = fd / 64;
+        table->open_fds[word] &= ~(1ULL << (fd % 64));
+        table->room[word / 64] |= 1ULL << (word % 64);
+        if ((uint32_t)fd < table->next_fd) {
+            table->next_fd = fd;
+        }
+        table->nr_open--;
+    }
+    spinlock_release(&table->lock);
+
+    return file;
+}
+
+// Copy a table for fork: the same fds, each sharing its open file
+// description (and so its position) with the original
+fd_table_t* fdtable_dup(fd_table_t *table) {
+    fd_table_t *copy = kmalloc(sizeof(fd_table_t));
+    if (!copy) {
+        return NULL;
+    }
+    memset(copy, 0, sizeof(fd_table_t));
+    spinlock_init(&copy->lock);
+
+    spinlock_acquire(&table->lock);
+    while (!copy->files || copy->max_fds != table->max_fds) {
+        uint32_t max_fds = table->max_fds;
+        spinlock_release(&table->lock);
+
+        kfree(copy->files);
+        if (fdtable_alloc(copy, max_fds) < 0) {
+            kfree(copy);
+            return NULL;
+        }
+
+        spinlock_acquire(&table->lock);
+    }
+
+    uint32_t words = table->max_fds / 64;
+    memcpy(copy->files, table->files, table->max_fds * sizeof(file_descriptor_t*));
+    memcpy(copy->open_fds, table->open_fds, words * sizeof(uint64_t));
+    memcpy(copy->room, table->room, (words + 63) / 64 * sizeof(uint64_t));
+    copy->next_fd = table->next_fd;
+    copy->nr_open = table->nr_open;
+
+    for (uint32_t w = 0; w < words; w++) {
+        uint64_t bits = copy->open_fds[w];
+        while (bits) {
+            vfs_file_get(copy->files[w * 64 + __builtin_ctzll(bits)]);
+            bits &= bits - 1;
+        }
+    }
+    spinlock_release(&table->lock);
+
+    return copy;
+}
+
+// Close every fd and free the table. Descriptions shared with another
+// table stay open there.
+void fdtable_destroy(fd_table_t *table) {
+    if (!table) {
+        return;
+    }
+
+    uint32_t words = table->max_fds / 64;
+    for (uint32_t w = 0; w < words; w++) {
+        uint64_t bits = table->open_fds[w];
+        while (bits) {
+            vfs_file_put(table->files[w * 64 + __builtin_ctzll(bits)]);
+            bits &= bits - 1;
+        }
+    }
+
+    kfree(table->files);
+    kfree(table);
+}
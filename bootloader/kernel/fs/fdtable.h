@@ -0,0 +1,41 @@
+#ifndef FDTABLE_H
+#define FDTABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vfs.h"
+#include "../core/smp.h"
+
+// Descriptors in a new table; it doubles whenever it fills up
+#define FDTABLE_INIT_FDS 64
+#define FDTABLE_MAX_FDS 65536         // Per-process limit
+
+// A process's descriptors. Each fd points at a refcounted open file
+// description, which fork shares between the tables of parent and child.
+// A set bit in room means the matching word of open_fds still has a free
+// fd, so finding the lowest free fd touches at most
+// FDTABLE_MAX_FDS / 4096 + 1 words.
+typedef struct {
+    file_descriptor_t **files;    // By fd, NULL when free
+    uint64_t *open_fds;           // Bit per fd in use
+    uint64_t *room;               // Bit per open_fds word with a free fd
+    uint32_t max_fds;             // Capacity, a multiple of FDTABLE_INIT_FDS
+    uint32_t next_fd;             // No fd below this is free
+    uint32_t nr_open;
+    spinlock_t lock;
+} fd_table_t;
+
+// Function prototypes
+int fdtable_init(fd_table_t *table);
+fd_table_t* fdtable_create(void);
+fd_table_t* fdtable_dup(fd_table_t *table);
+void fdtable_destroy(fd_table_t *table);
+int fd_install(fd_table_t *table, file_descriptor_t *file);
+file_descriptor_t* fd_get(fd_table_t *table, int fd);
+file_descriptor_t* fd_remove(fd_table_t *table, int fd);
+
+// Open file description references, kept by vfs.c
+void vfs_file_get(file_descriptor_t *file);
+void vfs_file_put(file_descriptor_t *file);
+
+#endif // FDTABLE_H
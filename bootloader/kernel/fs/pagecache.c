@@ -0,0 +1,897 @@
+// AION OS Page Cache: file pages indexed by offset, shared by every reader
+#include "pagecache.h"
+#include "procfs.h"
+#include "fdtable.h"
+#include "../memory/slab.h"
+#include "../memory/shrinker.h"
+
+static kmem_cache_t *cached_page_cache;
+static kmem_cache_t *radix_node_cache;
+
+// Trees, LRU lists, page flags and the counters below
+static spinlock_t pagecache_lock;
+
+// Two LRU lists, most recently added at the head. New pages start
+// inactive; one hit while inactive moves a page to the active list when
+// the shrinker next passes, so a single streaming read cannot flush the
+// pages that are used over and over.
+typedef struct {
+    cached_page_t *head;
+    cached_page_t *tail;
+    uint64_t nr;
+} pcache_lru_t;
+
+static pcache_lru_t active_list;
+static pcache_lru_t inactive_list;
+
+static uint64_t nr_pages;
+static uint64_t nr_dirty;
+static uint64_t nr_hits;
+static uint64_t nr_misses;
+static uint64_t nr_evicted;
+static uint64_t nr_written_back;
+
+static uint64_t pagecache_count(void);
+static shrinker_t pagecache_shrinker = {
+    .name = "pagecache",
+    .count = pagecache_count,
+    .scan = pagecache_shrink,
+};
+
+static inline uint64_t pcache_lock(void) {
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&pagecache_lock);
+    return flags;
+}
+
+static inline void pcache_unlock(uint64_t flags) {
+    spinlock_release(&pagecache_lock);
+    local_irq_restore(flags);
+}
+
+static inline pcache_lru_t* pcache_lru(cached_page_t *page) {
+    return (page->flags & PCACHE_ACTIVE) ? &active_list : &inactive_list;
+}
+
+static void lru_add(pcache_lru_t *lru, cached_page_t *page) {
+    page->lru_prev = NULL;
+    page->lru_next = lru->head;
+    if (lru->head) {
+        lru->head->lru_prev = page;
+    } else {
+        lru->tail = page;
+    }
+    lru->head = page;
+    lru->nr++;
+}
+
+static void lru_del(pcache_lru_t *lru, cached_page_t *page) {
+    if (page->lru_prev) {
+        page->lru_prev->lru_next = page->lru_next;
+    } else {
+        lru->head = page->lru_next;
+    }
+    if (page->lru_next) {
+        page->lru_next->lru_prev = page->lru_prev;
+    } else {
+        lru->tail = page->lru_prev;
+    }
+    lru->nr--;
+}
+
+// Radix tree. A tree of height h covers indices below 64^h; its root
+// level is split on bits (h - 1) * 6 and up, and leaf slots hold pages.
+static inline uint64_t radix_max_index(uint32_t height) {
+    if (height * PCACHE_RADIX_SHIFT >= 64) {
+        return UINT64_MAX;
+    }
+    return (1ULL << (height * PCACHE_RADIX_SHIFT)) - 1;
+}
+
+static pcache_radix_node_t* radix_node_alloc(void) {
+    pcache_radix_node_t *node = kmem_cache_alloc(radix_node_cache);
+    if (node) {
+        memset(node, 0, sizeof(pcache_radix_node_t));
+    }
+    return node;
+}
+
+static cached_page_t* radix_lookup(page_tree_t *tree, uint64_t index) {
+    if (!tree->root || index > radix_max_index(tree->height)) {
+        return NULL;
+    }
+
+    pcache_radix_node_t *node = tree->root;
+    for (uint32_t shift = (tree->height - 1) * PCACHE_RADIX_SHIFT; shift;
+         shift -= PCACHE_RADIX_SHIFT) {
+        node = node->slots[(index >> shift) & PCACHE_RADIX_MASK];
+        if (!node) {
+            return NULL;
+        }
+    }
+    return node->slots[index & PCACHE_RADIX_MASK];
+}
+
+// Grow the tree until it covers index, then fill in the path to its slot
+static int radix_insert(page_tree_t *tree, uint64_t index, cached_page_t *page) {
+    if (!tree->root) {
+        tree->root = radix_node_alloc();
+        if (!tree->root) {
+            return -ENOMEM;
+        }
+        tree->height = 1;
+    }
+
+    while (index > radix_max_index(tree->height)) {
+        pcache_radix_node_t *top = radix_node_alloc();
+        if (!top) {
+            return -ENOMEM;
+        }
+        top->slots[0] = tree->root;
+        top->count = 1;
+        tree->root = top;
+        tree->height++;
+    }
+
+    pcache_radix_node_t *node = tree->root;
+    for (uint32_t shift = (tree->height - 1) * PCACHE_RADIX_SHIFT; shift;
+         shift -= PCACHE_RADIX_SHIFT) {
+        void **slot = &node->slots[(index >> shift) & PCACHE_RADIX_MASK];
+        if (!*slot) {
+            *slot = radix_node_alloc();
+            if (!*slot) {
+                return -ENOMEM;
+            }
+            node->count++;
+        }
+        node = *slot;
+    }
+
+    node->slots[index & PCACHE_RADIX_MASK] = page;
+    node->count++;
+    return 0;
+}
+
+// Clear the slot for index and free the nodes it leaves empty
+static void radix_delete(page_tree_t *tree, uint64_t index) {
+    pcache_radix_node_t *path[PCACHE_RADIX_MAX_HEIGHT];
+    uint32_t height = tree->height;
+
+    if (!tree->root || index > radix_max_index(height)) {
+        return;
+    }
+
+    pcache_radix_node_t *node = tree->root;
+    for (uint32_t level = 0; ; level++) {
+        path[level] = node;
+        uint32_t shift = (height - 1 - level) * PCACHE_RADIX_SHIFT;
+        if (!shift) {
+            break;
+        }
+        node = node->slots[(index >> shift) & PCACHE_RADIX_MASK];
+        if (!node) {
+            return;
+        }
+    }
+
+    for (int32_t level = height - 1; level >= 0; level--) {
+        uint32_t shift = (height - 1 - level) * PCACHE_RADIX_SHIFT;
+        void **slot = &path[level]->slots[(index >> shift) & PCACHE_RADIX_MASK];
+        if (!*slot) {
+            return;
+        }
+        *slot = NULL;
+        if (--path[level]->count) {
+            return;
+        }
+        kmem_cache_free(radix_node_cache, path[level]);
+    }
+
+    tree->root = NULL;
+    tree->height = 0;
+}
+
+// Collect pages with index in [first, last] and all of flag set, in index
+// order, appending to out[nr..max). shift is the split of node's level.
+static uint32_t radix_collect(pcache_radix_node_t *node, uint32_t shift, uint64_t base,
+                              uint64_t first, uint64_t last, uint32_t flag,
+                              cached_page_t **out, uint32_t nr, uint32_t max) {
+    for (uint32_t i = 0; i < PCACHE_RADIX_SLOTS && nr < max; i++) {
+        uint64_t lo = base + ((uint64_t)i << shift);
+        uint64_t hi = lo + ((1ULL << shift) - 1);
+        if (lo > last) {
+            break;
+        }
+        if (!node->slots[i] || hi < first) {
+            continue;
+        }
+
+        if (shift) {
+            nr = radix_collect(node->slots[i], shift - PCACHE_RADIX_SHIFT, lo,
+                               first, last, flag, out, nr, max);
+        } else {
+            cached_page_t *page = node->slots[i];
+            if ((page->flags & flag) == flag) {
+                out[nr++] = page;
+            }
+        }
+    }
+    return nr;
+}
+
+static uint32_t radix_gang_lookup(page_tree_t *tree, uint64_t first, uint64_t last,
+                                  uint32_t flag, cached_page_t **out, uint32_t max) {
+    if (!tree->root) {
+        return 0;
+    }
+    return radix_collect(tree->root, (tree->height - 1) * PCACHE_RADIX_SHIFT, 0,
+                         first, last, flag, out, 0, max);
+}
+
+// Free interior nodes left behind by a failed insert
+static void radix_free(pcache_radix_node_t *node, uint32_t shift) {
+    if (shift) {
+        for (uint32_t i = 0; i < PCACHE_RADIX_SLOTS; i++) {
+            if (node->slots[i]) {
+                radix_free(node->slots[i], shift - PCACHE_RADIX_SHIFT);
+            }
+        }
+    }
+    kmem_cache_free(radix_node_cache, node);
+}
+
+// The node's tree, created on first use. Called with the lock held.
+static page_tree_t* pcache_tree(vfs_node_t *node) {
+    if (!node->page_tree) {
+        page_tree_t *tree = kzalloc(sizeof(page_tree_t));
+        if (!tree) {
+            return NULL;
+        }
+        tree->node = node;
+        node->page_tree = tree;
+    }
+    return node->page_tree;
+}
+
+static cached_page_t* pcache_alloc_page(void) {
+    cached_page_t *page = kmem_cache_alloc(cached_page_cache);
+    if (!page) {
+        return NULL;
+    }
+
+    page->data = pmm_try_alloc_pages(1);
+    if (!page->data) {
+        // Trade cold cached pages for this one
+        pagecache_shrink(PCACHE_RECLAIM_BATCH);
+        page->data = pmm_try_alloc_pages(1);
+    }
+    if (!page->data) {
+        kmem_cache_free(cached_page_cache, page);
+        return NULL;
+    }
+
+    page->tree = NULL;
+    page->flags = 0;
+    page->refcount = 0;
+    page->referenced = 0;
+    return page;
+}
+
+// Drop the cache's reference on the frame; a mapping may still hold it
+static void pcache_free_page(cached_page_t *page) {
+    vmm_release_special_page((uint64_t)page->data);
+    kmem_cache_free(cached_page_cache, page);
+}
+
+// Whether a process still maps the frame
+static inline bool pcache_mapped(cached_page_t *page) {
+    page_t *frame = phys_to_page((uint64_t)page->data);
+    return frame && __atomic_load_n(&frame->refcount, __ATOMIC_ACQUIRE) > 1;
+}
+
+// Free a list of removed pages chained on lru_next
+static void pcache_free_list(cached_page_t *list) {
+    while (list) {
+        cached_page_t *next = list->lru_next;
+        pcache_free_page(list);
+        list = next;
+    }
+}
+
+static void pcache_set_dirty(cached_page_t *page) {
+    if (!(page->flags & PCACHE_DIRTY)) {
+        page->flags |= PCACHE_DIRTY;
+        page->tree->nr_dirty++;
+        nr_dirty++;
+    }
+}
+
+static void pcache_clear_dirty(cached_page_t *page) {
+    if (page->flags & PCACHE_DIRTY) {
+        page->flags &= ~PCACHE_DIRTY;
+        page->tree->nr_dirty--;
+        nr_dirty--;
+    }
+}
+
+// Take page out of its tree and LRU list. Called with the lock held; the
+// caller frees it once the lock is dropped.
+static void pcache_remove(cached_page_t *page) {
+    page_tree_t *tree = page->tree;
+
+    pcache_clear_dirty(page);
+    radix_delete(tree, page->index);
+    lru_del(pcache_lru(page), page);
+    tree->nr_pages--;
+    nr_pages--;
+}
+
+// Claim a dirty page for writing. Clearing the dirty bit first means a
+// write that lands while the page is being written dirties it again.
+static void pcache_start_writeback(cached_page_t *page) {
+    __atomic_add_fetch(&page->refcount, 1, __ATOMIC_ACQUIRE);
+    pcache_clear_dirty(page);
+    page->flags |= PCACHE_WRITEBACK;
+}
+
+// Write one claimed page back to its filesystem, up to end of file
+static int pcache_write_page(cached_page_t *page) {
+    vfs_node_t *node = page->tree->node;
+    off_t offset = (off_t)page->index << PAGE_SHIFT;
+    int result = 0;
+
+    if (offset < node->size) {
+        size_t len = min(PAGE_SIZE, node->size - offset);
+        ssize_t written = node->ops->write(node, page->data, len, offset);
+        if (written < 0) {
+            result = written;
+        } else if ((size_t)written < len) {
+            result = -EIO;
+        }
+    }
+
+    uint64_t flags = pcache_lock();
+    page->flags &= ~PCACHE_WRITEBACK;
+    if (result < 0) {
+        pcache_set_dirty(page);
+    } else {
+        nr_written_back++;
+        // Nothing write-protects a shared mapping again, so a page it
+        // wrote stays dirty for as long as it is mapped
+        if (page->flags & PCACHE_MAPPED_WRITE) {
+            if (pcache_mapped(page)) {
+                pcache_set_dirty(page);
+            } else {
+                page->flags &= ~PCACHE_MAPPED_WRITE;
+            }
+        }
+    }
+    pcache_unlock(flags);
+
+    pagecache_put(page);
+    return result;
+}
+
+// Look up a cached page. A hit comes back with a reference held.
+cached_page_t* pagecache_find(vfs_node_t *node, uint64_t index) {
+    uint64_t flags = pcache_lock();
+
+    cached_page_t *page = node->page_tree ? radix_lookup(node->page_tree, index) : NULL;
+    if (page) {
+        __atomic_add_fetch(&page->refcount, 1, __ATOMIC_ACQUIRE);
+        page->referenced = 1;
+        nr_hits++;
+    }
+
+    pcache_unlock(flags);
+    return page;
+}
+
+// Insert a filled page at index and return the cached page, with a
+// reference held. If another caller inserted one first, theirs is
+// returned and fresh thrown away.
+static cached_page_t* pcache_insert(vfs_node_t *node, uint64_t index, cached_page_t *fresh) {
+    cached_page_t *page;
+    uint64_t flags = pcache_lock();
+
+    page_tree_t *tree = pcache_tree(node);
+    page = tree ? radix_lookup(tree, index) : NULL;
+    if (page) {
+        __atomic_add_fetch(&page->refcount, 1, __ATOMIC_ACQUIRE);
+        page->referenced = 1;
+    } else if (tree && radix_insert(tree, index, fresh) == 0) {
+        fresh->tree = tree;
+        fresh->index = index;
+        fresh->refcount = 1;
+        lru_add(&inactive_list, fresh);
+        tree->nr_pages++;
+        nr_pages++;
+        nr_misses++;
+        page = fresh;
+        fresh = NULL;
+    }
+
+    pcache_unlock(flags);
+
+    if (fresh) {
+        pcache_free_page(fresh);
+    }
+    return page;
+}
+
+// Find or create the page at index, with a reference held. A new page is
+// read from the filesystem when fill is set and zeroed otherwise; the read
+// happens outside the lock.
+cached_page_t* pagecache_get(vfs_node_t *node, uint64_t index, bool fill) {
+    cached_page_t *page = pagecache_find(node, index);
+    if (page) {
+        return page;
+    }
+
+    cached_page_t *fresh = pcache_alloc_page();
+    if (!fresh) {
+        return NULL;
+    }
+
+    size_t filled = 0;
+    if (fill) {
+        ssize_t result = node->ops->read(node, fresh->data, PAGE_SIZE,
+                                         (off_t)index << PAGE_SHIFT);
+        if (result < 0) {
+            pcache_free_page(fresh);
+            return NULL;
+        }
+        filled = result;
+    }
+    if (filled < PAGE_SIZE) {
+        memset((uint8_t*)fresh->data + filled, 0, PAGE_SIZE - filled);
+    }
+
+    return pcache_insert(node, index, fresh);
+}
+
+void pagecache_put(cached_page_t *page) {
+    __atomic_sub_fetch(&page->refcount, 1, __ATOMIC_RELEASE);
+}
+
+void pagecache_mark_dirty(cached_page_t *page) {
+    uint64_t flags = pcache_lock();
+    pcache_set_dirty(page);
+    pcache_unlock(flags);
+}
+
+// Read through the cache. Data is copied once, from the cached page
+// straight into the caller's buffer.
+ssize_t pagecache_read(vfs_node_t *node, void *buffer, size_t count, off_t offset) {
+    if (offset >= node->size) {
+        return 0;
+    }
+    count = min(count, (size_t)(node->size - offset));
+
+    size_t done = 0;
+    while (done < count) {
+        off_t pos = offset + done;
+        size_t in_page = pos & (PAGE_SIZE - 1);
+        size_t chunk = min(PAGE_SIZE - in_page, count - done);
+
+        cached_page_t *page = pagecache_get(node, pos >> PAGE_SHIFT, true);
+        if (!page) {
+            return done ? (ssize_t)done : -ENOMEM;
+        }
+        memcpy((uint8_t*)buffer + done, (uint8_t*)page->data + in_page, chunk);
+        pagecache_put(page);
+
+        done += chunk;
+    }
+
+    return done;
+}
+
+// Write into the cache and leave the pages dirty for writeback. Only a
+// partial page that already holds file data is read in first. The size
+// grows with each page so writeback never cuts one short.
+ssize_t pagecache_write(vfs_node_t *node, const void *buffer, size_t count, off_t offset) {
+    size_t done = 0;
+    while (done < count) {
+        off_t pos = offset + done;
+        uint64_t index = pos >> PAGE_SHIFT;
+        size_t in_page = pos & (PAGE_SIZE - 1);
+        size_t chunk = min(PAGE_SIZE - in_page, count - done);
+        bool fill = chunk < PAGE_SIZE && ((off_t)index << PAGE_SHIFT) < node->size;
+
+        cached_page_t *page = pagecache_get(node, index, fill);
+        if (!page) {
+            return done ? (ssize_t)done : -ENOMEM;
+        }
+        memcpy((uint8_t*)page->data + in_page, (const uint8_t*)buffer + done, chunk);
+        if (pos + (off_t)chunk > node->size) {
+            node->size = pos + chunk;
+        }
+        pagecache_mark_dirty(page);
+        pagecache_put(page);
+
+        done += chunk;
+    }
+
+    return done;
+}
+
+// Read a run of nr uncached pages with one filesystem call, so the device
+// sees one large request. The run lands in a bounce buffer and is copied
+// into single page frames, which the cache can evict one by one. Readahead
+// is optional, so a bounce buffer memory can't spare falls back to a
+// single page read. Returns how many pages were cached.
+static uint32_t pcache_fill_run(vfs_node_t *node, uint64_t index, uint32_t nr) {
+    uint8_t *bounce = nr > 1 ? pmm_try_alloc_pages(nr) : NULL;
+    if (!bounce) {
+        cached_page_t *page = pagecache_get(node, index, true);
+        if (!page) {
+            return 0;
+        }
+        pagecache_put(page);
+        return 1;
+    }
+
+    ssize_t result = node->ops->read(node, bounce, (size_t)nr * PAGE_SIZE,
+                                     (off_t)index << PAGE_SHIFT);
+    uint32_t filled = 0;
+    while (result > 0 && (ssize_t)filled * PAGE_SIZE < result) {
+        cached_page_t *fresh = pcache_alloc_page();
+        if (!fresh) {
+            break;
+        }
+
+        size_t len = min((size_t)PAGE_SIZE, (size_t)result - (size_t)filled * PAGE_SIZE);
+        memcpy(fresh->data, bounce + (size_t)filled * PAGE_SIZE, len);
+        if (len < PAGE_SIZE) {
+            memset((uint8_t*)fresh->data + len, 0, PAGE_SIZE - len);
+        }
+
+        cached_page_t *page = pcache_insert(node, index + filled, fresh);
+        if (!page) {
+            break;
+        }
+        pagecache_put(page);
+        filled++;
+    }
+
+    pmm_free_pages(bounce, nr);
+    return filled;
+}
+
+// Bring up to nr pages from index on into the cache, stopping at end of
+// file. Cached pages are skipped and each uncached run is read in batches
+// of PCACHE_READ_BATCH. Returns how many pages were read.
+uint32_t pagecache_readahead(vfs_node_t *node, uint64_t index, uint32_t nr) {
+    uint64_t eof = (node->size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    uint64_t end = min(index + nr, eof);
+    uint32_t issued = 0;
+
+    for (uint64_t i = index; i < end; ) {
+        uint64_t flags = pcache_lock();
+        page_tree_t *tree = node->page_tree;
+        while (i < end && tree && radix_lookup(tree, i)) {
+            i++;
+        }
+        uint64_t run = i;
+        while (run < end && run - i < PCACHE_READ_BATCH && !(tree && radix_lookup(tree, run))) {
+            run++;
+        }
+        pcache_unlock(flags);
+
+        if (run == i) {
+            break;
+        }
+        uint32_t filled = pcache_fill_run(node, i, run - i);
+        issued += filled;
+        if (filled < run - i) {
+            break;
+        }
+        i = run;
+    }
+
+    return issued;
+}
+
+// Write back dirty pages in [start, end). Returns the first error seen.
+int pagecache_writeback(vfs_node_t *node, off_t start, off_t end) {
+    if (!node->page_tree || end <= start) {
+        return 0;
+    }
+
+    uint64_t first = start >> PAGE_SHIFT;
+    uint64_t last = (end - 1) >> PAGE_SHIFT;
+    cached_page_t *batch[PCACHE_WRITEBACK_BATCH];
+    int result = 0;
+
+    while (first <= last) {
+        uint64_t flags = pcache_lock();
+        uint32_t n = radix_gang_lookup(node->page_tree, first, last, PCACHE_DIRTY,
+                                       batch, PCACHE_WRITEBACK_BATCH);
+        for (uint32_t i = 0; i < n; i++) {
+            pcache_start_writeback(batch[i]);
+        }
+        pcache_unlock(flags);
+
+        if (!n) {
+            break;
+        }
+        first = batch[n - 1]->index + 1;
+
+        for (uint32_t i = 0; i < n; i++) {
+            int err = pcache_write_page(batch[i]);
+            if (err < 0 && !result) {
+                result = err;
+            }
+        }
+    }
+
+    return result;
+}
+
+// Drop clean, unused pages in [start, end), after the file changed
+// underneath the cache. Dirty and pinned pages stay.
+void pagecache_invalidate(vfs_node_t *node, off_t start, off_t end) {
+    if (!node->page_tree || end <= start) {
+        return;
+    }
+
+    uint64_t first = start >> PAGE_SHIFT;
+    uint64_t last = (end - 1) >> PAGE_SHIFT;
+    cached_page_t *batch[PCACHE_WRITEBACK_BATCH];
+    cached_page_t *victims = NULL;
+
+    uint64_t flags = pcache_lock();
+    while (first <= last) {
+        uint32_t n = radix_gang_lookup(node->page_tree, first, last, 0,
+                                       batch, PCACHE_WRITEBACK_BATCH);
+        if (!n) {
+            break;
+        }
+        first = batch[n - 1]->index + 1;
+
+        for (uint32_t i = 0; i < n; i++) {
+            cached_page_t *page = batch[i];
+            if (page->refcount || pcache_mapped(page) ||
+                (page->flags & (PCACHE_DIRTY | PCACHE_WRITEBACK))) {
+                continue;
+            }
+            pcache_remove(page);
+            page->lru_next = victims;
+            victims = page;
+        }
+    }
+    pcache_unlock(flags);
+
+    pcache_free_list(victims);
+}
+
+// Discard every page of node, dirty or not, before node is freed
+void pagecache_drop_node(vfs_node_t *node) {
+    page_tree_t *tree = node->page_tree;
+    if (!tree) {
+        return;
+    }
+
+    cached_page_t *batch[PCACHE_WRITEBACK_BATCH];
+    cached_page_t *victims = NULL;
+
+    uint64_t flags = pcache_lock();
+    uint32_t n;
+    while ((n = radix_gang_lookup(tree, 0, UINT64_MAX, 0, batch,
+                                  PCACHE_WRITEBACK_BATCH)) != 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            pcache_remove(batch[i]);
+            batch[i]->lru_next = victims;
+            victims = batch[i];
+        }
+    }
+    if (tree->root) {
+        radix_free(tree->root, (tree->height - 1) * PCACHE_RADIX_SHIFT);
+    }
+    node->page_tree = NULL;
+    pcache_unlock(flags);
+
+    pcache_free_list(victims);
+    kfree(tree);
+}
+
+// File mappings carry the open file description as their object, with a
+// reference per VMA, so the node stays valid after close(fd)
+static void pagecache_vm_open(void *object) {
+    vfs_file_get(object);
+}
+
+static void pagecache_vm_close(void *object) {
+    vfs_file_put(object);
+}
+
+// Trade a page reference for a frame reference held by a mapping. A
+// mapped frame is never evicted and outlives the cache entry if the file
+// is dropped. Returns the frame.
+static uint64_t pcache_pin_frame(cached_page_t *page) {
+    uint64_t phys = (uint64_t)page->data;
+    page_t *frame = phys_to_page(phys);
+    if (frame) {
+        __atomic_add_fetch(&frame->refcount, 1, __ATOMIC_RELAXED);
+    }
+    pagecache_put(page);
+    return phys;
+}
+
+// Map nr pages of node from index on read-only into kernel space, so a
+// kernel consumer can use a file in place instead of copying it. Missing
+// pages are read in batches first. Returns NULL on failure.
+void* pagecache_vmap(vfs_node_t *node, uint64_t index, uint32_t nr) {
+    uint64_t *frames = kmalloc(nr * sizeof(uint64_t));
+    if (!frames) {
+        return NULL;
+    }
+
+    pagecache_readahead(node, index, nr);
+
+    uint32_t pinned = 0;
+    for (; pinned < nr; pinned++) {
+        cached_page_t *page = ((off_t)(index + pinned) << PAGE_SHIFT) < node->size ?
+                              pagecache_get(node, index + pinned, true) : NULL;
+        if (!page) {
+            break;
+        }
+        frames[pinned] = pcache_pin_frame(page);
+    }
+
+    void *addr = pinned == nr ? vmm_vmap(frames, nr, 0) : NULL;
+    if (!addr) {
+        for (uint32_t i = 0; i < pinned; i++) {
+            vmm_release_special_page(frames[i]);
+        }
+    }
+    kfree(frames);
+    return addr;
+}
+
+// Undo pagecache_vmap
+void pagecache_vunmap(void *addr, uint32_t nr) {
+    vmm_vunmap(addr, nr);
+}
+
+// vm_ops fault: the page at pgoff, reading the pages around it in one
+// request on a miss. The frame gets a reference for the mapping.
+static uint64_t pagecache_vm_fault(void *object, uint64_t pgoff) {
+    vfs_node_t *node = ((file_descriptor_t*)object)->node;
+    if (((off_t)pgoff << PAGE_SHIFT) >= node->size) {
+        return 0;
+    }
+
+    cached_page_t *page = pagecache_find(node, pgoff);
+    if (!page) {
+        pagecache_readahead(node, pgoff & ~(uint64_t)(PCACHE_FAULT_AROUND - 1),
+                            PCACHE_FAULT_AROUND);
+        page = pagecache_get(node, pgoff, true);
+        if (!page) {
+            return 0;
+        }
+    }
+    return pcache_pin_frame(page);
+}
+
+// vm_ops page_mkwrite: a shared mapping writes the page from now on
+static int pagecache_vm_mkwrite(void *object, uint64_t pgoff) {
+    cached_page_t *page = pagecache_find(((file_descriptor_t*)object)->node, pgoff);
+    if (!page) {
+        return 0;      // Evicted; the mapping owns the frame
+    }
+
+    uint64_t flags = pcache_lock();
+    pcache_set_dirty(page);
+    page->flags |= PCACHE_MAPPED_WRITE;
+    pcache_unlock(flags);
+
+    pagecache_put(page);
+    return 0;
+}
+
+const vm_ops_t pagecache_vm_ops = {
+    .fault = pagecache_vm_fault,
+    .page_mkwrite = pagecache_vm_mkwrite,
+    .open = pagecache_vm_open,
+    .close = pagecache_vm_close,
+};
+
+bool pagecache_over_dirty_limit(void) {
+    return nr_dirty > PCACHE_DIRTY_LIMIT;
+}
+
+// Evict up to nr clean pages from the cold end of the inactive list.
+// The active list is first aged down to the inactive list's size. Dirty
+// pages met on the way are written back so a later pass can take them.
+// Returns how many pages were freed.
+uint64_t pagecache_shrink(uint64_t nr) {
+    cached_page_t *victims = NULL;
+    cached_page_t *dirty[PCACHE_WRITEBACK_BATCH];
+    uint32_t nr_claimed = 0;
+    uint64_t freed = 0;
+
+    uint64_t flags = pcache_lock();
+
+    for (uint64_t scan = nr; scan && active_list.nr > inactive_list.nr; scan--) {
+        cached_page_t *page = active_list.tail;
+        lru_del(&active_list, page);
+        if (page->referenced) {
+            page->referenced = 0;
+        } else {
+            page->flags &= ~PCACHE_ACTIVE;
+        }
+        lru_add(pcache_lru(page), page);
+    }
+
+    for (uint64_t scan = nr * 2; scan && freed < nr && inactive_list.tail; scan--) {
+        cached_page_t *page = inactive_list.tail;
+
+        bool mapped = pcache_mapped(page);
+        if (page->referenced || page->refcount || mapped ||
+            (page->flags & (PCACHE_DIRTY | PCACHE_WRITEBACK))) {
+            lru_del(&inactive_list, page);
+            if (page->referenced) {
+                page->referenced = 0;
+                page->flags |= PCACHE_ACTIVE;
+            } else if ((page->flags & PCACHE_DIRTY) && !page->refcount && !mapped &&
+                       nr_claimed < PCACHE_WRITEBACK_BATCH) {
+                pcache_start_writeback(page);
+                dirty[nr_claimed++] = page;
+            }
+            lru_add(pcache_lru(page), page);
+            continue;
+        }
+
+        pcache_remove(page);
+        page->lru_next = victims;
+        victims = page;
+        freed++;
+    }
+    nr_evicted += freed;
+
+    pcache_unlock(flags);
+
+    pcache_free_list(victims);
+    for (uint32_t i = 0; i < nr_claimed; i++) {
+        pcache_write_page(dirty[i]);
+    }
+    if (freed) {
+        kmem_cache_shrink(cached_page_cache);
+    }
+    return freed;
+}
+
+static uint64_t pagecache_count(void) {
+    return nr_pages;
+}
+
+// procfs: /proc/pagecache
+size_t pagecache_show(char *buf, size_t size) {
+    size_t len = 0;
+    len += snprintf(buf + len, size - len,
+                    "pages %llu\ndirty %llu\nactive %llu\ninactive %llu\n"
+                    "hits %llu\nmisses %llu\nevicted %llu\nwritten_back %llu\n",
+                    nr_pages, nr_dirty, active_list.nr, inactive_list.nr,
+                    nr_hits, nr_misses, nr_evicted, nr_written_back);
+
+    return len < size ? len : size;
+}
+
+void pagecache_init(void) {
+    memset(&active_list, 0, sizeof(active_list));
+    memset(&inactive_list, 0, sizeof(inactive_list));
+    spinlock_init(&pagecache_lock);
+
+    cached_page_cache = kmem_cache_create("cached_page", sizeof(cached_page_t), 0,
+                                          SLAB_HWCACHE_ALIGN, NULL);
+    radix_node_cache = kmem_cache_create("radix_node", sizeof(pcache_radix_node_t), 0,
+                                         0, NULL);
+
+    register_shrinker(&pagecache_shrinker);
+    procfs_register("pagecache", pagecache_show);
+
+    kprintf("[PCACHE] Page cache ready, writeback past %d dirty pages\n",
+            PCACHE_DIRTY_LIMIT);
+}
@@ -0,0 +1,102 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "vfs.h"
+#include "../memory/memory.h"
+#include "../memory/vmm.h"
+
+// Radix tree over file page numbers, 64 slots per level
+#define PCACHE_RADIX_SHIFT 6
+#define PCACHE_RADIX_SLOTS (1 << PCACHE_RADIX_SHIFT)
+#define PCACHE_RADIX_MASK (PCACHE_RADIX_SLOTS - 1)
+#define PCACHE_RADIX_MAX_HEIGHT 11     // Enough levels for any 64-bit index
+
+// Past this many dirty pages a writer flushes its own file first
+#define PCACHE_DIRTY_LIMIT 4096
+
+// Pages written back per batch, and by the shrinker per pass
+#define PCACHE_WRITEBACK_BATCH 16
+
+// Largest run of pages read from the filesystem in one call
+#define PCACHE_READ_BATCH 64
+
+// Pages read around a fault that misses the cache
+#define PCACHE_FAULT_AROUND 16
+
+// Cold pages given up when a page frame cannot be allocated
+#define PCACHE_RECLAIM_BATCH 32
+
+// Node flag: contents are rendered on every read and never cached
+#define VFS_NODE_NOCACHE 0x01
+
+// Open flag: read and write the filesystem directly
+#define O_DIRECT 0x4000
+
+// Cached page state
+#define PCACHE_DIRTY     0x01   // Newer than the filesystem's copy
+#define PCACHE_ACTIVE    0x02   // On the active list
+#define PCACHE_WRITEBACK 0x04   // Being written, not evictable
+#define PCACHE_MAPPED_WRITE 0x08 // Written through a shared mapping
+
+struct page_tree;
+
+// One cached 4 KiB page of a file. Tree and list links are under the
+// page cache lock; the data is read and written in place.
+typedef struct cached_page {
+    struct cached_page *lru_prev;
+    struct cached_page *lru_next;
+    struct page_tree *tree;
+    uint64_t index;               // File offset >> PAGE_SHIFT
+    void *data;                   // One page frame
+    uint32_t flags;
+    uint32_t refcount;            // Users that keep it from being evicted;
+                                  // mappings hold the frame's refcount instead
+    volatile uint8_t referenced;  // Hit since the shrinker last passed
+} cached_page_t;
+
+// Interior radix node; leaf level slots point at cached pages
+typedef struct pcache_radix_node {
+    void *slots[PCACHE_RADIX_SLOTS];
+    uint32_t count;
+} pcache_radix_node_t;
+
+// Pages of one node, created on first use and hung off node->page_tree
+typedef struct page_tree {
+    vfs_node_t *node;
+    pcache_radix_node_t *root;
+    uint32_t height;              // Levels below root, 0 when empty
+    uint64_t nr_pages;
+    uint64_t nr_dirty;
+} page_tree_t;
+
+// Whether reads and writes of node go through the cache
+static inline bool pagecache_enabled(vfs_node_t *node) {
+    return node->type == VFS_FILE && !(node->flags & VFS_NODE_NOCACHE) &&
+           node->ops && node->ops->read;
+}
+
+// Backs file mappings with cached pages
+extern const vm_ops_t pagecache_vm_ops;
+
+// Function prototypes
+void pagecache_init(void);
+cached_page_t* pagecache_find(vfs_node_t *node, uint64_t index);
+cached_page_t* pagecache_get(vfs_node_t *node, uint64_t index, bool fill);
+void pagecache_put(cached_page_t *page);
+void pagecache_mark_dirty(cached_page_t *page);
+ssize_t pagecache_read(vfs_node_t *node, void *buffer, size_t count, off_t offset);
+ssize_t pagecache_write(vfs_node_t *node, const void *buffer, size_t count, off_t offset);
+uint32_t pagecache_readahead(vfs_node_t *node, uint64_t index, uint32_t nr);
+void* pagecache_vmap(vfs_node_t *node, uint64_t index, uint32_t nr);
+void pagecache_vunmap(void *addr, uint32_t nr);
+int pagecache_writeback(vfs_node_t *node, off_t start, off_t end);
+void pagecache_invalidate(vfs_node_t *node, off_t start, off_t end);
+void pagecache_drop_node(vfs_node_t *node);
+bool pagecache_over_dirty_limit(void);
+uint64_t pagecache_shrink(uint64_t nr);
+size_t pagecache_show(char *buf, size_t size);
+
+#endif // PAGECACHE_H
@@ -0,0 +1,97 @@
+// AION OS procfs: read-only files rendered on demand by kernel subsystems
+#include "vfs.h"
+#include "procfs.h"
+#include "dcache.h"
+#include "pagecache.h"
+#include "../memory/slab.h"
+
+static procfs_entry_t procfs_entries[PROCFS_MAX_ENTRIES];
+static uint32_t num_procfs_entries = 0;
+static vfs_node_t *procfs_root = NULL;
+
+static vfs_node_t *procfs_lookup(vfs_node_t *dir, const char *name);
+static ssize_t procfs_read(vfs_node_t *node, void *buffer, size_t count, off_t offset);
+static int procfs_mount(mount_point_t *mp);
+
+static vfs_node_ops_t procfs_dir_ops = {
+    .lookup = procfs_lookup,
+};
+
+static vfs_node_ops_t procfs_file_ops = {
+    .read = procfs_read,
+};
+
+filesystem_ops_t procfs_ops = {
+    .mount = procfs_mount,
+};
+
+// Register a file under /proc
+int procfs_register(const char *name, procfs_show_t show) {
+    if (num_procfs_entries >= PROCFS_MAX_ENTRIES) {
+        return -ENOMEM;
+    }
+
+    procfs_entry_t *entry = &procfs_entries[num_procfs_entries++];
+    strncpy(entry->name, name, PROCFS_NAME_MAX - 1);
+    entry->show = show;
+    entry->node = NULL;
+
+    // A lookup before registration may have cached the name as missing
+    if (procfs_root) {
+        dcache_invalidate(procfs_root, entry->name, strlen(entry->name));
+    }
+
+    kprintf("[PROCFS] Registered /proc/%s\n", name);
+    return 0;
+}
+
+static int procfs_mount(mount_point_t *mp) {
+    mp->root = vfs_create_node("proc", VFS_DIRECTORY, 0555);
+    if (!mp->root) {
+        return -ENOMEM;
+    }
+    mp->root->ops = &procfs_dir_ops;
+    procfs_root = mp->root;
+    return 0;
+}
+
+static vfs_node_t *procfs_lookup(vfs_node_t *dir, const char *name) {
+    for (uint32_t i = 0; i < num_procfs_entries; i++) {
+        procfs_entry_t *entry = &procfs_entries[i];
+        if (strcmp(entry->name, name) != 0) {
+            continue;
+        }
+
+        if (!entry->node) {
+            entry->node = vfs_create_node(entry->name, VFS_FILE, 0444);
+            if (!entry->node) {
+                return NULL;
+            }
+            entry->node->ops = &procfs_file_ops;
+            entry->node->flags |= VFS_NODE_NOCACHE;
+            entry->node->private_data = entry;
+        }
+        return entry->node;
+    }
+    return NULL;
+}
+
+// Render the file and copy out the requested window
+static ssize_t procfs_read(vfs_node_t *node, void *buffer, size_t count, off_t offset) {
+    procfs_entry_t *entry = node->private_data;
+
+    char *text = kmalloc(PROCFS_BUF_SIZE);
+    if (!text) {
+        return -ENOMEM;
+    }
+
+    size_t len = entry->show(text, PROCFS_BUF_SIZE);
+    ssize_t copied = 0;
+    if ((size_t)offset < len) {
+        copied = min(count, len - (size_t)offset);
+        memcpy(buffer, text + offset, copied);
+    }
+
+    kfree(text);
+    return copied;
+}
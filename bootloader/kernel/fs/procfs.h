@@ -0,0 +1,25 @@
+#ifndef PROCFS_H
+#define PROCFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PROCFS_MAX_ENTRIES 64
+#define PROCFS_NAME_MAX 32
+#define PROCFS_BUF_SIZE (16 * 1024)   // Render buffer per read
+
+// Renders the whole file into buf, returns bytes written
+typedef size_t (*procfs_show_t)(char *buf, size_t size);
+
+typedef struct {
+    char name[PROCFS_NAME_MAX];
+    procfs_show_t show;
+    vfs_node_t *node;
+} procfs_entry_t;
+
+// Function prototypes
+int procfs_register(const char *name, procfs_show_t show);
+
+extern filesystem_ops_t procfs_ops;
+
+#endif // PROCFS_H
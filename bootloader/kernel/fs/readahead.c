@@ -0,0 +1,233 @@
+// AION OS Readahead: per-stream windows that grow while reads stay sequential
+#include "readahead.h"
+#include "pagecache.h"
+#include "procfs.h"
+#include "../process/process.h"
+
+static ra_request_t ra_queue[RA_QUEUE_SIZE];
+static uint32_t ra_head;
+static uint32_t ra_tail;
+static vfs_node_t *ra_busy_node;     // Being read by kreadahead right now
+
+// Queue, busy node and stats
+static spinlock_t ra_lock;
+
+static process_t *kreadahead_task;
+static readahead_stats_t ra_stats;
+
+// First window: the request rounded up to a power of two, then 4x for
+// small reads and 2x for medium ones
+static uint32_t ra_init_size(uint64_t req) {
+    uint32_t size = RA_MIN_PAGES;
+    while (size < req && size < RA_MAX_PAGES) {
+        size <<= 1;
+    }
+
+    if (size <= RA_MAX_PAGES / 32) {
+        size *= 4;
+    } else if (size <= RA_MAX_PAGES / 4) {
+        size *= 2;
+    } else {
+        size = RA_MAX_PAGES;
+    }
+    return size;
+}
+
+// Each window that is read through quadruples the next while small, then
+// doubles it up to the maximum
+static uint32_t ra_next_size(uint32_t size) {
+    if (size < RA_MAX_PAGES / 16) {
+        return size * 4;
+    }
+    if (size <= RA_MAX_PAGES / 2) {
+        return size * 2;
+    }
+    return RA_MAX_PAGES;
+}
+
+static void ra_read_sync(vfs_node_t *node, uint64_t index, uint64_t nr) {
+    uint32_t pages = pagecache_readahead(node, index, nr);
+
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&ra_lock);
+    ra_stats.sync_pages += pages;
+    spinlock_release(&ra_lock);
+    local_irq_restore(flags);
+}
+
+// Hand a window to kreadahead. Without room in the queue it is read
+// inline, so a window is never silently dropped.
+static void ra_submit(vfs_node_t *node, uint64_t index, uint32_t nr) {
+    if (((off_t)index << PAGE_SHIFT) >= node->size) {
+        return;
+    }
+
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&ra_lock);
+
+    bool queued = false;
+    if (kreadahead_task && ra_tail - ra_head < RA_QUEUE_SIZE) {
+        ra_request_t *req = &ra_queue[ra_tail++ % RA_QUEUE_SIZE];
+        req->node = node;
+        req->index = index;
+        req->nr = nr;
+        ra_stats.async_requests++;
+        queued = true;
+
+        if (kreadahead_task->state == PROCESS_STATE_BLOCKED) {
+            wake_up_process(kreadahead_task);
+        }
+    } else {
+        ra_stats.queue_full++;
+    }
+
+    spinlock_release(&ra_lock);
+    local_irq_restore(flags);
+
+    if (!queued) {
+        ra_read_sync(node, index, nr);
+    }
+}
+
+// Called before a page cache read of [pos, pos + count). Sequential reads
+// open a window, then each crossing of its marker queues the next, larger
+// window in the background. Any other access collapses the window and
+// reads only what was asked for.
+void readahead_on_read(vfs_node_t *node, file_ra_state_t *ra, off_t pos, size_t count) {
+    if (!count || pos >= node->size) {
+        return;
+    }
+
+    uint64_t index = pos >> PAGE_SHIFT;
+    uint64_t last = (min((off_t)(pos + count), node->size) - 1) >> PAGE_SHIFT;
+    uint64_t req = last - index + 1;
+    uint64_t end = ra->start + ra->size;
+
+    bool sequential = index == ra->prev_index || index == ra->prev_index + 1 ||
+                      (ra->size && index >= ra->start && index < end);
+    ra->prev_index = last;
+
+    if (!sequential) {
+        if (ra->size) {
+            ra_stats.random_resets++;
+        }
+        ra->size = 0;
+        ra->async_size = 0;
+        return;
+    }
+
+    if (!ra->size && req < ra_init_size(req)) {
+        // A new stream: read the whole first window now, and let the read
+        // that reaches the pages past this request queue the next one
+        ra->start = index;
+        ra->size = ra_init_size(req);
+        ra->async_size = ra->size - req;
+        ra_stats.streams++;
+        ra_read_sync(node, ra->start, ra->size);
+        return;
+    }
+
+    if (!ra->size || last >= end) {
+        // The request reaches past any window: read it now in large runs
+        // and queue the next window right behind it
+        if (!ra->size) {
+            ra_stats.streams++;
+        }
+        ra_read_sync(node, index, req);
+        ra->size = ra->size ? ra_next_size(ra->size) : ra_init_size(req);
+        ra->start = last + 1;
+        ra->async_size = ra->size;
+        ra_submit(node, ra->start, ra->size);
+        return;
+    }
+
+    uint64_t marker = end - ra->async_size;
+    if (ra->async_size && index <= marker && marker <= last) {
+        ra->start = end;
+        ra->size = ra_next_size(ra->size);
+        ra->async_size = ra->size;
+        ra_submit(node, ra->start, ra->size);
+    }
+}
+
+// Drop queued windows for node and wait out one being read, before node
+// is freed
+void readahead_forget(vfs_node_t *node) {
+    uint64_t flags = local_irq_save();
+    spinlock_acquire(&ra_lock);
+    for (uint32_t i = ra_head; i != ra_tail; i++) {
+        if (ra_queue[i % RA_QUEUE_SIZE].node == node) {
+            ra_queue[i % RA_QUEUE_SIZE].node = NULL;
+        }
+    }
+    spinlock_release(&ra_lock);
+    local_irq_restore(flags);
+
+    while (__atomic_load_n(&ra_busy_node, __ATOMIC_ACQUIRE) == node) {
+        yield_cpu();
+    }
+}
+
+// Readahead daemon: reads queued windows in order
+static void kreadahead_main(void) {
+    while (1) {
+        uint64_t flags = local_irq_save();
+        spinlock_acquire(&ra_lock);
+        while (ra_head == ra_tail) {
+            current_process->state = PROCESS_STATE_BLOCKED;
+            spinlock_release(&ra_lock);
+            local_irq_restore(flags);
+            schedule();
+            flags = local_irq_save();
+            spinlock_acquire(&ra_lock);
+        }
+        ra_request_t req = ra_queue[ra_head++ % RA_QUEUE_SIZE];
+        ra_busy_node = req.node;
+        spinlock_release(&ra_lock);
+        local_irq_restore(flags);
+
+        if (!req.node) {
+            continue;
+        }
+        uint32_t pages = pagecache_readahead(req.node, req.index, req.nr);
+
+        flags = local_irq_save();
+        spinlock_acquire(&ra_lock);
+        ra_stats.async_pages += pages;
+        __atomic_store_n(&ra_busy_node, NULL, __ATOMIC_RELEASE);
+        spinlock_release(&ra_lock);
+        local_irq_restore(flags);
+    }
+}
+
+// procfs: /proc/readahead
+size_t readahead_show(char *buf, size_t size) {
+    readahead_stats_t stats = ra_stats;
+    size_t len = 0;
+
+    len += snprintf(buf + len, size - len,
+                    "streams %llu\nrandom_resets %llu\nsync_pages %llu\n"
+                    "async_requests %llu\nasync_pages %llu\nqueue_full %llu\n",
+                    stats.streams, stats.random_resets, stats.sync_pages,
+                    stats.async_requests, stats.async_pages, stats.queue_full);
+
+    return len < size ? len : size;
+}
+
+// Start the readahead daemon
+void readahead_init(void) {
+    memset(ra_queue, 0, sizeof(ra_queue));
+    memset(&ra_stats, 0, sizeof(ra_stats));
+    spinlock_init(&ra_lock);
+
+    kreadahead_task = process_create("kreadahead", kreadahead_main, 1);
+    if (!kreadahead_task) {
+        kprintf("[READAHEAD] Failed to start, reading ahead inline\n");
+    } else {
+        kreadahead_task->flags |= PROCESS_FLAG_SYSTEM;
+    }
+
+    procfs_register("readahead", readahead_show);
+
+    kprintf("[READAHEAD] Windows of %d to %d pages\n", RA_MIN_PAGES, RA_MAX_PAGES);
+}
@@ -0,0 +1,56 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "vfs.h"
+
+// Window sizes in pages
+#define RA_MIN_PAGES 4        // Smallest first window
+#define RA_MAX_PAGES 256      // 1 MiB
+
+// Async windows waiting for kreadahead
+#define RA_QUEUE_SIZE 32
+
+// Per open file stream state. The window [start, start + size) has been
+// read or queued; its last async_size pages were read ahead, and the
+// first of those is the marker whose read queues the next window.
+typedef struct {
+    uint64_t start;
+    uint32_t size;            // 0 when the file is not being streamed
+    uint32_t async_size;
+    uint64_t prev_index;      // Last page of the previous read
+} file_ra_state_t;
+
+// Queued async window
+typedef struct {
+    vfs_node_t *node;         // NULL once the node is forgotten
+    uint64_t index;
+    uint32_t nr;
+} ra_request_t;
+
+typedef struct {
+    uint64_t streams;         // Windows opened by a sequential read
+    uint64_t random_resets;   // Windows collapsed by a seek
+    uint64_t sync_pages;
+    uint64_t async_requests;
+    uint64_t async_pages;
+    uint64_t queue_full;      // Async windows read inline instead
+} readahead_stats_t;
+
+// A fresh stream; a first read at offset 0 counts as sequential
+static inline void file_ra_init(file_ra_state_t *ra) {
+    ra->start = 0;
+    ra->size = 0;
+    ra->async_size = 0;
+    ra->prev_index = UINT64_MAX;
+}
+
+// Function prototypes
+void readahead_init(void);
+void readahead_on_read(vfs_node_t *node, file_ra_state_t *ra, off_t pos, size_t count);
+void readahead_forget(vfs_node_t *node);
+size_t readahead_show(char *buf, size_t size);
+
+#endif // READAHEAD_H
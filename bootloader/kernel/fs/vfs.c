@@ -1,7 +1,15 @@
 // AION OS Virtual File System with AI Optimization
 #include "vfs.h"
+#include "dcache.h"
+#include "fdtable.h"
+#include "pagecache.h"
+#include "readahead.h"
 #include "../memory/memory.h"
+#include "../memory/slab.h"
 #include "../ai/predictor.h"
+#include "../core/syscall.h"
+#include "../core/rcu.h"
+#include "../process/process.h"
 
 // VFS structures
 static vfs_node_t *vfs_root = NULL;
@@ -12,14 +20,17 @@ static uint32_t num_filesystems = 0;
 static mount_point_t mount_points[MAX_MOUNT_POINTS];
 static uint32_t num_mounts = 0;
 
-// File descriptor table
-static file_descriptor_t fd_table[MAX_FILE_DESCRIPTORS];
+// Descriptors opened before any process runs
+static fd_table_t kernel_files;
 
 // AI file system optimizer
 static ai_fs_optimizer_t *fs_optimizer;
 
-// VFS cache
-static vfs_cache_t *vfs_cache;
+// Object caches for nodes and open file descriptions
+static kmem_cache_t *vfs_node_cache;
+static kmem_cache_t *vfs_file_cache;
+
+static vfs_node_t* vfs_lookup_parent(const char *path, const char **name);
 
 // Initialize VFS
 void vfs_init(void) {
@@ -28,15 +39,20 @@ void vfs_init(void) {
     // Clear structures
     memset(registered_filesystems, 0, sizeof(registered_filesystems));
     memset(mount_points, 0, sizeof(mount_points));
-    memset(fd_table, 0, sizeof(fd_table));
+    
+    // Create object caches before the first node
+    vfs_node_cache = kmem_cache_create("vfs_node", sizeof(vfs_node_t), 0,
+                                       SLAB_HWCACHE_ALIGN, NULL);
+    vfs_file_cache = kmem_cache_create("vfs_file", sizeof(file_descriptor_t), 0,
+                                       SLAB_HWCACHE_ALIGN, NULL);
+    fdtable_init(&kernel_files);
+    dcache_init();
+    pagecache_init();
+    readahead_init();
     
     // Initialize AI optimizer
     fs_optimizer = ai_fs_optimizer_create();
     
-    // Initialize cache with AI-predicted size
-    uint32_t cache_size = fs_optimizer->predict_cache_size();
-    vfs_cache = vfs_cache_create(cache_size);
-    
     // Create root node
     vfs_root = vfs_create_node("/", VFS_DIRECTORY, 0755);
     vfs_root->mount_point = NULL;
@@ -67,6 +83,38 @@ void vfs_init(void) {
     kprintf("[VFS] Virtual file system initialized\n");
 }
 
+// Allocate and initialize a VFS node
+vfs_node_t* vfs_create_node(const char *name, uint32_t type, mode_t mode) {
+    vfs_node_t *node = kmem_cache_alloc(vfs_node_cache);
+    if (!node) {
+        return NULL;
+    }
+    
+    memset(node, 0, sizeof(vfs_node_t));
+    strncpy(node->name, name, sizeof(node->name) - 1);
+    node->type = type;
+    node->mode = mode;
+    node->mtime = get_system_time();
+    
+    return node;
+}
+
+// Release a VFS node, once no cached path, page or readahead can reach it
+void vfs_free_node(vfs_node_t *node) {
+    dcache_drop_node(node);
+    readahead_forget(node);
+    pagecache_drop_node(node);
+    kmem_cache_free(vfs_node_cache, node);
+}
+
+// The directory whose children a lookup in node actually searches
+static inline vfs_node_t* vfs_follow_mount(vfs_node_t *node) {
+    if (node->mount_point && node->mount_point->root) {
+        return node->mount_point->root;
+    }
+    return node;
+}
+
 // Register filesystem
 int register_filesystem(const char *name, filesystem_ops_t *ops) {
     if (num_filesystems >= MAX_FILESYSTEMS) {
@@ -100,8 +148,8 @@ int mount(const char *source, const char *target,
     
     // Find or create mount point
     vfs_node_t *mount_node = vfs_lookup_path(target);
-    if (!mount_node) {
-        mount_node = vfs_mkdir(target, 0755);
+    if (!mount_node && vfs_mkdir(target, 0755) == 0) {
+        mount_node = vfs_lookup_path(target);
     }
     
     if (!mount_node) {
@@ -125,138 +173,198 @@ int mount(const char *source, const char *target,
         }
     }
     
+    // ".." from the mounted root leaves through the directory it covers
+    if (mp->root && mp->root != mount_node) {
+        mp->root->parent = mount_node->parent;
+    }
     mount_node->mount_point = mp;
     
     kprintf("[VFS] Mounted %s on %s (type %s)\n", source, target, fstype);
     return 0;
 }
 
+// The running process's descriptors, or the kernel's before any process
+// runs. A process gets its table on its first open.
+static fd_table_t* vfs_files(bool create) {
+    if (!current_process) {
+        return &kernel_files;
+    }
+    if (!current_process->files && create) {
+        current_process->files = fdtable_create();
+    }
+    return current_process->files;
+}
+
+// Open file description behind fd, with a reference for the caller
+static file_descriptor_t* vfs_fd_get(int fd) {
+    fd_table_t *files = vfs_files(false);
+    return files ? fd_get(files, fd) : NULL;
+}
+
+void vfs_file_get(file_descriptor_t *file) {
+    __atomic_add_fetch(&file->refcount, 1, __ATOMIC_RELAXED);
+}
+
+// Drop a reference; the last one closes the file
+void vfs_file_put(file_descriptor_t *file) {
+    if (__atomic_sub_fetch(&file->refcount, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    
+    vfs_node_t *node = file->node;
+    if (node->ops && node->ops->close) {
+        node->ops->close(node, file);
+    }
+    kmem_cache_free(vfs_file_cache, file);
+}
+
 // Open file
 int vfs_open(const char *path, int flags, mode_t mode) {
     // AI prediction: Pre-cache likely files
     fs_optimizer->predict_next_open(path);
     
-    // Check cache first
-    vfs_node_t *node = vfs_cache_lookup(vfs_cache, path);
+    // Resolved through the dentry cache
+    vfs_node_t *node = vfs_lookup_path(path);
     
     if (!node) {
-        // Lookup path
-        node = vfs_lookup_path(path);
+        if (!(flags & O_CREAT)) {
+            return -ENOENT;
+        }
         
+        // Create file, replacing the negative entry the lookup left
+        node = vfs_create_file(path, mode);
         if (!node) {
-            if (flags & O_CREAT) {
-                // Create file
-                node = vfs_create_file(path, mode);
-                if (!node) {
-                    return -ENOENT;
-                }
-            } else {
-                return -ENOENT;
-            }
+            return -ENOENT;
         }
         
-        // Add to cache
-        vfs_cache_add(vfs_cache, path, node);
-    }
-    
-    // Find free file descriptor
-    int fd = -1;
-    for (int i = 0; i < MAX_FILE_DESCRIPTORS; i++) {
-        if (!fd_table[i].in_use) {
-            fd = i;
-            break;
+        const char *name;
+        vfs_node_t *dir = vfs_lookup_parent(path, &name);
+        if (dir) {
+            uint32_t len = strlen(name);
+            dcache_add(dir, name, len, dcache_hash_name(name, len), node);
+            if (!node->parent) {
+                node->parent = dir;
+            }
         }
     }
     
-    if (fd < 0) {
-        return -EMFILE;
+    fd_table_t *files = vfs_files(true);
+    if (!files) {
+        return -ENOMEM;
     }
     
-    // Initialize file descriptor
-    file_descriptor_t *file = &fd_table[fd];
+    // Initialize the open file description
+    file_descriptor_t *file = kmem_cache_alloc(vfs_file_cache);
+    if (!file) {
+        return -ENOMEM;
+    }
+    memset(file, 0, sizeof(file_descriptor_t));
     file->in_use = true;
     file->node = node;
     file->flags = flags;
     file->position = 0;
     file->refcount = 1;
+    file_ra_init(&file->ra);
     
     // Call filesystem-specific open
     if (node->ops && node->ops->open) {
         int result = node->ops->open(node, file);
         if (result < 0) {
-            file->in_use = false;
+            kmem_cache_free(vfs_file_cache, file);
             return result;
         }
     }
     
+    int fd = fd_install(files, file);
+    if (fd < 0) {
+        vfs_file_put(file);
+        return fd;
+    }
+    
     // AI learning: Record file access pattern
     fs_optimizer->record_file_access(path, flags);
     
     return fd;
 }
 
+// Close fd. The file itself closes with the last descriptor sharing it.
+int vfs_close(int fd) {
+    fd_table_t *files = vfs_files(false);
+    file_descriptor_t *file = files ? fd_remove(files, fd) : NULL;
+    if (!file) {
+        return -EBADF;
+    }
+    
+    vfs_file_put(file);
+    return 0;
+}
+
 // Read from file
 ssize_t vfs_read(int fd, void *buffer, size_t count) {
-    if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS || !fd_table[fd].in_use) {
+    file_descriptor_t *file = vfs_fd_get(fd);
+    if (!file) {
         return -EBADF;
     }
     
-    file_descriptor_t *file = &fd_table[fd];
-    
     if (!(file->flags & (O_RDONLY | O_RDWR))) {
+        vfs_file_put(file);
         return -EBADF;
     }
     
-    // AI-optimized read strategy
-    read_strategy_t strategy = fs_optimizer->get_read_strategy(file, count);
-    
+    vfs_node_t *node = file->node;
     ssize_t result = 0;
     
-    switch (strategy) {
-        case READ_DIRECT:
-            // Direct read without caching
-            if (file->node->ops && file->node->ops->read) {
-                result = file->node->ops->read(file->node, buffer, 
-                                              count, file->position);
-            }
-            break;
-            
-        case READ_CACHED:
-            // Read through cache
-            result = vfs_cache_read(vfs_cache, file, buffer, count);
-            break;
-            
-        case READ_PREFETCH:
-            // Prefetch and read
-            vfs_prefetch(file, count);
-            result = vfs_cache_read(vfs_cache, file, buffer, count);
-            break;
+    if (pagecache_enabled(node) && !(file->flags & O_DIRECT)) {
+        readahead_on_read(node, &file->ra, file->position, count);
+        result = pagecache_read(node, buffer, count, file->position);
+    } else if (node->ops && node->ops->read) {
+        // Direct read; dirty cached pages reach the filesystem first
+        if (pagecache_enabled(node)) {
+            pagecache_writeback(node, file->position, file->position + count);
+        }
+        result = node->ops->read(node, buffer, count, file->position);
     }
     
     if (result > 0) {
         file->position += result;
     }
     
+    vfs_file_put(file);
     return result;
 }
 
 // Write to file
 ssize_t vfs_write(int fd, const void *buffer, size_t count) {
-    if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS || !fd_table[fd].in_use) {
+    file_descriptor_t *file = vfs_fd_get(fd);
+    if (!file) {
         return -EBADF;
     }
     
-    file_descriptor_t *file = &fd_table[fd];
-    
     if (!(file->flags & (O_WRONLY | O_RDWR))) {
+        vfs_file_put(file);
         return -EBADF;
     }
     
+    vfs_node_t *node = file->node;
     ssize_t result = 0;
     
-    if (file->node->ops && file->node->ops->write) {
-        result = file->node->ops->write(file->node, buffer, 
-                                       count, file->position);
+    if (!node->ops || !node->ops->write) {
+        // Nothing could write the pages back
+    } else if (pagecache_enabled(node) && !(file->flags & O_DIRECT)) {
+        result = pagecache_write(node, buffer, count, file->position);
+        if (result > 0 && pagecache_over_dirty_limit()) {
+            pagecache_writeback(node, 0, node->size);
+        }
+    } else {
+        // Direct write around the cache, then drop the stale copies
+        off_t end = file->position + count;
+        if (pagecache_enabled(node)) {
+            pagecache_writeback(node, file->position, end);
+        }
+        result = node->ops->write(node, buffer, count, file->position);
+        if (pagecache_enabled(node)) {
+            pagecache_invalidate(node, file->position, end);
+        }
     }
     
     if (result > 0) {
@@ -267,98 +375,286 @@ ssize_t vfs_write(int fd, const void *buffer, size_t count) {
     
     // AI: Predict when to flush
     if (fs_optimizer->should_flush(file)) {
-        vfs_sync(fd);
+        pagecache_writeback(node, 0, node->size);
     }
     
+    vfs_file_put(file);
     return result;
 }
 
-// Lookup path in VFS
-vfs_node_t* vfs_lookup_path(const char *path) {
-    if (!path || path[0] != '/') {
+// Vectored read: the whole scatter list in one call, stopping at the first
+// short read as a plain read would
+ssize_t vfs_readv(int fd, const iovec_t *iov, int iovcnt) {
+    if (iovcnt < 0 || iovcnt > IOV_MAX) {
+        return -EINVAL;
+    }
+    
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        ssize_t result = vfs_read(fd, iov[i].base, iov[i].len);
+        if (result < 0) {
+            return total ? total : result;
+        }
+        total += result;
+        if ((size_t)result < iov[i].len) {
+            break;
+        }
+    }
+    
+    return total;
+}
+
+// Vectored write
+ssize_t vfs_writev(int fd, const iovec_t *iov, int iovcnt) {
+    if (iovcnt < 0 || iovcnt > IOV_MAX) {
+        return -EINVAL;
+    }
+    
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        ssize_t result = vfs_write(fd, iov[i].base, iov[i].len);
+        if (result < 0) {
+            return total ? total : result;
+        }
+        total += result;
+        if ((size_t)result < iov[i].len) {
+            break;
+        }
+    }
+    
+    return total;
+}
+
+// Ask the filesystem for one child on a dcache miss and cache the answer,
+// including a miss. The name is only copied out of the path here.
+static vfs_node_t* vfs_lookup_child(vfs_node_t *dir, const char *name,
+                                    uint32_t len, uint32_t hash) {
+    char buf[DCACHE_NAME_MAX + 1];
+    if (len > DCACHE_NAME_MAX) {
         return NULL;
     }
+    memcpy(buf, name, len);
+    buf[len] = '\0';
     
-    vfs_node_t *current = vfs_root;
-    char *path_copy = strdup(path);
-    char *token = strtok(path_copy, "/");
+    vfs_node_t *child = NULL;
+    if (dir->ops && dir->ops->lookup) {
+        child = dir->ops->lookup(dir, buf);
+    }
     
-    while (token != NULL) {
-        // Check if current node is a mount point
-        if (current->mount_point) {
-            // Follow mount point
-            current = current->mount_point->root;
+    if (child && !child->parent) {
+        child->parent = dir;
+    }
+    dcache_add(dir, name, len, hash, child);
+    return child;
+}
+
+// Resolve [path, end) starting at start, in place. Each component is hashed
+// as it is scanned and looked up in the dcache without taking a lock; only
+// a miss leaves the read section to ask the filesystem.
+static vfs_node_t* vfs_lookup_at(vfs_node_t *start, const char *path, const char *end) {
+    vfs_node_t *current = start;
+    const char *p = path;
+    
+    uint64_t flags = rcu_read_lock();
+    while (current) {
+        while (p < end && *p == '/') {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        
+        const char *name = p;
+        uint32_t hash = DCACHE_HASH_INIT;
+        while (p < end && *p != '/') {
+            hash = dcache_hash_step(hash, *p++);
         }
+        uint32_t len = p - name;
         
-        // Look up child
-        vfs_node_t *child = NULL;
-        if (current->ops && current->ops->lookup) {
-            child = current->ops->lookup(current, token);
+        if (len == 1 && name[0] == '.') {
+            continue;
+        }
+        if (len == 2 && name[0] == '.' && name[1] == '.') {
+            // The root is its own parent
+            if (current->parent) {
+                current = current->parent;
+            }
+            continue;
         }
         
-        if (!child) {
-            free(path_copy);
-            return NULL;
+        vfs_node_t *dir = vfs_follow_mount(current);
+        dentry_t *dentry = dcache_lookup(dir, name, len, hash);
+        if (dentry) {
+            // A negative entry ends the walk
+            current = rcu_dereference(dentry->node);
+            continue;
         }
         
-        current = child;
-        token = strtok(NULL, "/");
+        rcu_read_unlock(flags);
+        current = vfs_lookup_child(dir, name, len, hash);
+        flags = rcu_read_lock();
     }
+    rcu_read_unlock(flags);
     
-    free(path_copy);
     return current;
 }
 
+// Where a lookup of path starts: the root, or the cwd for a relative path
+static inline vfs_node_t* vfs_lookup_start(const char *path) {
+    if (path[0] != '/' && current_process && current_process->cwd) {
+        return current_process->cwd;
+    }
+    return vfs_root;
+}
+
+// Lookup path in VFS
+vfs_node_t* vfs_lookup_path(const char *path) {
+    if (!path || !path[0]) {
+        return NULL;
+    }
+    
+    return vfs_lookup_at(vfs_lookup_start(path), path, path + strlen(path));
+}
+
+// Resolve everything but the last component. Returns the directory that
+// component would be looked up in and points name at it.
+static vfs_node_t* vfs_lookup_parent(const char *path, const char **name) {
+    const char *slash = strrchr(path, '/');
+    *name = slash ? slash + 1 : path;
+    if (!**name) {
+        return NULL;
+    }
+    
+    vfs_node_t *dir = vfs_lookup_at(vfs_lookup_start(path), path, *name);
+    return dir ? vfs_follow_mount(dir) : NULL;
+}
+
+// Change the calling process's working directory
+int vfs_chdir(const char *path) {
+    if (!current_process) {
+        return -ESRCH;
+    }
+    
+    vfs_node_t *node = vfs_lookup_path(path);
+    if (!node) {
+        return -ENOENT;
+    }
+    if (node->type != VFS_DIRECTORY) {
+        return -ENOTDIR;
+    }
+    
+    current_process->cwd = node;
+    return 0;
+}
+
 // Create directory
 int vfs_mkdir(const char *path, mode_t mode) {
-    // Parse parent path and directory name
-    char *parent_path = strdup(path);
-    char *dir_name = strrchr(parent_path, '/');
-    
-    if (dir_name) {
-        *dir_name = '\0';
-        dir_name++;
-    } else {
-        free(parent_path);
+    if (!path) {
         return -EINVAL;
     }
     
     // Find parent directory
-    vfs_node_t *parent = vfs_lookup_path(parent_path[0] ? parent_path : "/");
-    free(parent_path);
-    
+    const char *dir_name;
+    vfs_node_t *parent = vfs_lookup_parent(path, &dir_name);
     if (!parent) {
-        return -ENOENT;
+        return *dir_name ? -ENOENT : -EINVAL;
     }
     
-    // Create directory
+    int result = -ENOSYS;
     if (parent->ops && parent->ops->mkdir) {
-        return parent->ops->mkdir(parent, dir_name, mode);
+        result = parent->ops->mkdir(parent, dir_name, mode);
+    }
+    
+    // Drop any negative entry so the next lookup asks the filesystem
+    if (result == 0) {
+        dcache_invalidate(parent, dir_name, strlen(dir_name));
     }
     
-    return -ENOSYS;
+    return result;
 }
 
-// AI-powered file prefetching
-void vfs_prefetch(file_descriptor_t *file, size_t count) {
-    // Predict next access pattern
-    prefetch_prediction_t pred = fs_optimizer->predict_prefetch(file, count);
+// Write back the file's dirty pages
+int vfs_sync(int fd) {
+    file_descriptor_t *file = vfs_fd_get(fd);
+    if (!file) {
+        return -EBADF;
+    }
     
-    if (pred.should_prefetch) {
-        // Prefetch predicted data
-        size_t prefetch_size = pred.prefetch_size;
-        off_t prefetch_offset = file->position + count;
-        
-        void *prefetch_buffer = kmalloc(prefetch_size);
-        if (prefetch_buffer) {
-            if (file->node->ops && file->node->ops->read) {
-                file->node->ops->read(file->node, prefetch_buffer,
-                                     prefetch_size, prefetch_offset);
-            }
-            
-            // Add to cache
-            vfs_cache_add_data(vfs_cache, file->node, prefetch_offset,
-                              prefetch_buffer, prefetch_size);
-        }
+    vfs_node_t *node = file->node;
+    int result = pagecache_writeback(node, 0, node->size);
+    vfs_file_put(file);
+    return result;
+}
+
+// Map [offset, offset + length) of an open file into the calling process.
+// Pages come from the page cache on first touch, so MAP_SHARED mappings of
+// a file share its cached frames and MAP_PRIVATE ones share them until
+// they write. Each VMA holds a reference on the file, so the mapping
+// survives close(fd).
+void* vfs_mmap(int fd, off_t offset, size_t length, int prot, int flags) {
+    if (!current_process || !current_process->memory.mm) {
+        return MAP_FAILED;
     }
-}
\ No newline at end of file
+    
+    file_descriptor_t *file = vfs_fd_get(fd);
+    if (!file) {
+        return MAP_FAILED;
+    }
+    
+    vfs_node_t *node = file->node;
+    bool allowed = pagecache_enabled(node) && offset >= 0 && !(offset & (PAGE_SIZE - 1));
+    
+    // The open mode bounds what the mapping may do to the file
+    if (!(file->flags & (O_RDONLY | O_RDWR))) {
+        allowed = false;
+    }
+    if ((flags & MAP_SHARED) && (prot & PROT_WRITE) &&
+        (!(file->flags & (O_WRONLY | O_RDWR)) || !node->ops->write)) {
+        allowed = false;
+    }
+    
+    void *addr = MAP_FAILED;
+    if (allowed) {
+        addr = vmm_mmap_object(current_process->memory.mm, NULL, length, prot, flags,
+                               &pagecache_vm_ops, file, offset >> PAGE_SHIFT);
+    }
+    
+    vfs_file_put(file);
+    return addr;
+}
+
+// Unmap a range from vfs_mmap
+int vfs_munmap(void *addr, size_t length) {
+    if (!current_process || !current_process->memory.mm) {
+        return -EINVAL;
+    }
+    return vmm_munmap(current_process->memory.mm, addr, length);
+}
+
+// Map [offset, offset + length) of an open file read-only into kernel
+// space, for kernel consumers such as model loaders. The cached pages are
+// pinned for the life of the mapping, which does not need fd to stay
+// open; the range must lie within the file. Returns NULL on failure.
+void* vfs_vmap(int fd, off_t offset, size_t length) {
+    file_descriptor_t *file = vfs_fd_get(fd);
+    if (!file) {
+        return NULL;
+    }
+    
+    vfs_node_t *node = file->node;
+    void *addr = NULL;
+    if (pagecache_enabled(node) && (file->flags & (O_RDONLY | O_RDWR)) &&
+        offset >= 0 && !(offset & (PAGE_SIZE - 1)) && length &&
+        offset + (off_t)length <= node->size) {
+        addr = pagecache_vmap(node, offset >> PAGE_SHIFT,
+                              (length + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    }
+    
+    vfs_file_put(file);
+    return addr;
+}
+
+// Release a mapping from vfs_vmap
+void vfs_vunmap(void *addr, size_t length) {
+    pagecache_vunmap(addr, (length + PAGE_SIZE - 1) >> PAGE_SHIFT);
+}
@@ -0,0 +1,283 @@
+// AION OS Binary Buddy Allocator
+#include "memory.h"
+
+// Free list helpers
+static void free_list_add(free_area_t *area, page_t *page) {
+    page->prev = NULL;
+    page->next = area->head;
+    if (area->head) {
+        area->head->prev = page;
+    }
+    area->head = page;
+    area->nr_free++;
+}
+
+static void free_list_del(free_area_t *area, page_t *page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        area->head = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+    page->next = NULL;
+    page->prev = NULL;
+    area->nr_free--;
+}
+
+static inline uint64_t page_pfn(memory_zone_t *zone, page_t *page) {
+    return zone->base_pfn + (uint64_t)(page - zone->pages);
+}
+
+static inline bool pfn_in_zone(memory_zone_t *zone, uint64_t pfn) {
+    return pfn >= zone->base_pfn && pfn < zone->base_pfn + zone->num_pages;
+}
+
+// Set up descriptors and seed the free lists with maximal aligned blocks
+void buddy_init_zone(memory_zone_t *zone, uint32_t zone_id) {
+    uint64_t start = (zone->start_addr + PAGE_SIZE - 1) & ~((uint64_t)PAGE_SIZE - 1);
+    uint64_t end = zone->end_addr & ~((uint64_t)PAGE_SIZE - 1);
+
+    if (start < PMM_RESERVED_END) {
+        start = PMM_RESERVED_END;
+    }
+
+    memset(zone->free_area, 0, sizeof(zone->free_area));
+    zone->pages = NULL;
+    zone->num_pages = 0;
+    zone->free_pages = 0;
+    zone->used_pages = 0;
+    spinlock_init(&zone->lock);
+
+    if (end <= start) {
+        return;
+    }
+
+    // Carve the descriptor array out of the start of the zone itself
+    uint64_t total_pages = (end - start) / PAGE_SIZE;
+    uint64_t desc_pages = (total_pages * sizeof(page_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (desc_pages >= total_pages) {
+        return;
+    }
+
+    zone->pages = (page_t*)start;
+    zone->base_pfn = (start / PAGE_SIZE) + desc_pages;
+    zone->num_pages = total_pages - desc_pages;
+    memset(zone->pages, 0, zone->num_pages * sizeof(page_t));
+
+    for (uint32_t i = 0; i < zone->num_pages; i++) {
+        zone->pages[i].zone_id = zone_id;
+        zone->pages[i].order = INVALID_ORDER;
+    }
+
+    // Hand out the largest naturally aligned block that fits at each step
+    uint64_t pfn = zone->base_pfn;
+    uint64_t end_pfn = zone->base_pfn + zone->num_pages;
+    while (pfn < end_pfn) {
+        uint32_t order = MAX_ORDER;
+        while (order > 0 &&
+               ((pfn & ((1ULL << order) - 1)) || pfn + (1ULL << order) > end_pfn)) {
+            order--;
+        }
+
+        page_t *page = &zone->pages[pfn - zone->base_pfn];
+        page->flags = PAGE_FLAG_BUDDY;
+        page->order = order;
+        free_list_add(&zone->free_area[order], page);
+
+        zone->free_pages += 1U << order;
+        pfn += 1ULL << order;
+    }
+}
+
+// Take a 2^order block off the free lists. Caller holds zone->lock.
+static page_t* buddy_alloc_locked(memory_zone_t *zone, uint32_t order) {
+    uint32_t current = order;
+    while (current <= MAX_ORDER && !zone->free_area[current].head) {
+        current++;
+    }
+
+    if (current > MAX_ORDER) {
+        return NULL;
+    }
+
+    page_t *page = zone->free_area[current].head;
+    free_list_del(&zone->free_area[current], page);
+
+    // Split down, returning the upper halves to the free lists
+    while (current > order) {
+        current--;
+        page_t *buddy = page + (1U << current);
+        buddy->flags = PAGE_FLAG_BUDDY;
+        buddy->order = current;
+        free_list_add(&zone->free_area[current], buddy);
+    }
+
+    page->flags = PAGE_FLAG_ALLOCATED;
+    page->order = order;
+    page->refcount = 1;
+
+    zone->free_pages -= 1U << order;
+    zone->used_pages += 1U << order;
+    return page;
+}
+
+// Give a 2^order block back and coalesce it. Caller holds zone->lock.
+static bool buddy_free_locked(memory_zone_t *zone, page_t *page, uint32_t order) {
+    if (!(page->flags & PAGE_FLAG_ALLOCATED) || page->order != order) {
+        kprintf("[BUDDY] Bad free of pfn 0x%llx order %d\n",
+                page_pfn(zone, page), order);
+        return false;
+    }
+
+    page->flags = 0;
+    page->refcount = 0;
+    zone->free_pages += 1U << order;
+    zone->used_pages -= 1U << order;
+
+    coalesce_free_blocks(zone, page, order);
+    return true;
+}
+
+// Allocate a 2^order block, splitting larger blocks as needed
+page_t* buddy_alloc(memory_zone_t *zone, uint32_t order) {
+    if (order > MAX_ORDER) {
+        return NULL;
+    }
+
+    spinlock_acquire(&zone->lock);
+    page_t *page = buddy_alloc_locked(zone, order);
+    spinlock_release(&zone->lock);
+    return page;
+}
+
+// Free a 2^order block previously returned by buddy_alloc
+void buddy_free(memory_zone_t *zone, page_t *page, uint32_t order) {
+    spinlock_acquire(&zone->lock);
+    buddy_free_locked(zone, page, order);
+    spinlock_release(&zone->lock);
+}
+
+// Allocate up to count blocks of one order under a single lock hold
+uint32_t buddy_alloc_bulk(memory_zone_t *zone, uint32_t order,
+                          page_t **pages, uint32_t count) {
+    if (order > MAX_ORDER) {
+        return 0;
+    }
+
+    uint32_t allocated = 0;
+    spinlock_acquire(&zone->lock);
+    while (allocated < count) {
+        page_t *page = buddy_alloc_locked(zone, order);
+        if (!page) {
+            break;
+        }
+        pages[allocated++] = page;
+    }
+    spinlock_release(&zone->lock);
+    return allocated;
+}
+
+// Free count blocks of one order under a single lock hold
+void buddy_free_bulk(memory_zone_t *zone, uint32_t order,
+                     page_t **pages, uint32_t count) {
+    spinlock_acquire(&zone->lock);
+    for (uint32_t i = 0; i < count; i++) {
+        buddy_free_locked(zone, pages[i], order);
+    }
+    spinlock_release(&zone->lock);
+}
+
+// Take one page out of the highest free block above min_pfn whose order is
+// below below_order. Compaction migrates into these so that the low end of
+// the zone drains into large blocks instead of splitting them.
+page_t* buddy_alloc_above(memory_zone_t *zone, uint64_t min_pfn, uint32_t below_order) {
+    spinlock_acquire(&zone->lock);
+
+    page_t *best = NULL;
+    for (uint32_t order = 0; order < below_order && order <= MAX_ORDER; order++) {
+        for (page_t *page = zone->free_area[order].head; page; page = page->next) {
+            if (page_pfn(zone, page) > min_pfn && (!best || page > best)) {
+                best = page;
+            }
+        }
+    }
+
+    if (!best) {
+        spinlock_release(&zone->lock);
+        return NULL;
+    }
+
+    uint32_t current = best->order;
+    free_list_del(&zone->free_area[current], best);
+
+    // Keep the last page of the block, return the rest to the free lists
+    while (current > 0) {
+        current--;
+        best->flags = PAGE_FLAG_BUDDY;
+        best->order = current;
+        free_list_add(&zone->free_area[current], best);
+        best += 1U << current;
+    }
+
+    best->flags = PAGE_FLAG_ALLOCATED;
+    best->order = 0;
+    best->refcount = 1;
+    zone->free_pages--;
+    zone->used_pages++;
+
+    spinlock_release(&zone->lock);
+    return best;
+}
+
+// Merge a free block with its buddy for as long as the buddy is also free,
+// then put the result on the matching free list. Caller holds zone->lock.
+void coalesce_free_blocks(memory_zone_t *zone, page_t *page, uint32_t order) {
+    uint64_t pfn = page_pfn(zone, page);
+
+    while (order < MAX_ORDER) {
+        uint64_t buddy_pfn = pfn ^ (1ULL << order);
+        if (!pfn_in_zone(zone, buddy_pfn)) {
+            break;
+        }
+
+        page_t *buddy = &zone->pages[buddy_pfn - zone->base_pfn];
+        if (!(buddy->flags & PAGE_FLAG_BUDDY) || buddy->order != order) {
+            break;
+        }
+
+        free_list_del(&zone->free_area[order], buddy);
+        buddy->flags = 0;
+        buddy->order = INVALID_ORDER;
+
+        pfn &= ~(1ULL << order);
+        order++;
+    }
+
+    page = &zone->pages[pfn - zone->base_pfn];
+    page->flags = PAGE_FLAG_BUDDY;
+    page->order = order;
+    free_list_add(&zone->free_area[order], page);
+}
+
+// Largest order with a free block, INVALID_ORDER if the zone is exhausted
+uint32_t buddy_largest_free_order(memory_zone_t *zone) {
+    for (int order = MAX_ORDER; order >= 0; order--) {
+        if (zone->free_area[order].nr_free) {
+            return order;
+        }
+    }
+    return INVALID_ORDER;
+}
+
+// Dump per-order free counts
+void buddy_dump_zone(memory_zone_t *zone) {
+    kprintf("[BUDDY] pfn 0x%llx-0x%llx free %d used %d:",
+            zone->base_pfn, zone->base_pfn + zone->num_pages,
+            zone->free_pages, zone->used_pages);
+    for (int order = 0; order <= MAX_ORDER; order++) {
+        kprintf(" %d", zone->free_area[order].nr_free);
+    }
+    kprintf("\n");
+}
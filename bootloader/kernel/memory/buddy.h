@@ -0,0 +1,64 @@
+#ifndef BUDDY_H
+#define BUDDY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Buddy allocator constants
+#define MAX_ORDER 10            // Largest block: 2^10 pages = 4MB
+#define NUM_ORDERS (MAX_ORDER + 1)
+#define INVALID_ORDER 0xFF
+
+// Page descriptor flags
+#define PAGE_FLAG_BUDDY     0x01  // Head of a free block on a free list
+#define PAGE_FLAG_RESERVED  0x02  // Never handed to the buddy allocator
+#define PAGE_FLAG_ALLOCATED 0x04  // Head of an allocated block
+#define PAGE_FLAG_PCP       0x08  // Parked on a per-CPU page list
+#define PAGE_FLAG_SLAB      0x10  // Backs a slab, private points at it
+#define PAGE_FLAG_MOVABLE   0x20  // Singly mapped anonymous user page
+
+struct memory_zone;
+
+// Per-page descriptor, one per physical page frame in a zone
+typedef struct page {
+    struct page *next;
+    struct page *prev;
+    uint32_t flags;
+    uint8_t order;       // Block order while PAGE_FLAG_BUDDY/ALLOCATED set
+    uint8_t zone_id;
+    uint16_t reserved;
+    uint32_t refcount;
+    void *private;       // Owner data (slab descriptor, address space, ...)
+    uint64_t index;      // Mapped virtual address while PAGE_FLAG_MOVABLE set
+} page_t;
+
+// Free list for a single order
+typedef struct {
+    page_t *head;
+    uint32_t nr_free;    // Number of free blocks of this order
+} free_area_t;
+
+// Function prototypes
+void buddy_init_zone(struct memory_zone *zone, uint32_t zone_id);
+page_t* buddy_alloc(struct memory_zone *zone, uint32_t order);
+void buddy_free(struct memory_zone *zone, page_t *page, uint32_t order);
+uint32_t buddy_alloc_bulk(struct memory_zone *zone, uint32_t order,
+                          page_t **pages, uint32_t count);
+void buddy_free_bulk(struct memory_zone *zone, uint32_t order,
+                     page_t **pages, uint32_t count);
+page_t* buddy_alloc_above(struct memory_zone *zone, uint64_t min_pfn, uint32_t below_order);
+void coalesce_free_blocks(struct memory_zone *zone, page_t *page, uint32_t order);
+uint32_t buddy_largest_free_order(struct memory_zone *zone);
+void buddy_dump_zone(struct memory_zone *zone);
+
+// Smallest order whose block holds num_pages pages
+static inline uint32_t pages_to_order(size_t num_pages) {
+    uint32_t order = 0;
+    while (((size_t)1 << order) < num_pages) {
+        order++;
+    }
+    return order;
+}
+
+#endif // BUDDY_H
@@ -0,0 +1,301 @@
+// AION OS Background Memory Compaction (kcompactd)
+#include "compaction.h"
+#include "vmm.h"
+#include "shrinker.h"
+#include "../core/smp.h"
+#include "../fs/procfs.h"
+#include "../process/process.h"
+#include "../process/runqueue.h"
+
+static compact_control_t compact_ctl[MAX_MEMORY_ZONES];
+static kcompactd_stats_t kcompactd_stats;
+
+static process_t *kcompactd_task;
+static volatile bool kcompactd_pending;
+static volatile bool kcompactd_forced;     // An allocation already failed
+static volatile bool compact_busy;         // kcompactd or a direct pass is scanning
+
+// Summarize free block sizes across all zones
+fragmentation_info_t analyze_fragmentation(void) {
+    fragmentation_info_t info = {0};
+
+    for (uint32_t z = 0; z < num_memory_zones; z++) {
+        memory_zone_t *zone = &memory_zones[z];
+        if (!zone->num_pages) {
+            continue;
+        }
+
+        spinlock_acquire(&zone->lock);
+        for (uint32_t order = 0; order <= MAX_ORDER; order++) {
+            uint32_t blocks = zone->free_area[order].nr_free;
+            if (!blocks) {
+                continue;
+            }
+
+            info.total_fragments += blocks;
+            info.free_pages += blocks << order;
+            if (order < COMPACTION_ORDER) {
+                info.unusable_pages += blocks << order;
+            }
+            if ((1U << order) > info.largest_free_block) {
+                info.largest_free_block = 1U << order;
+            }
+        }
+        spinlock_release(&zone->lock);
+    }
+
+    info.fragmentation_ratio = info.free_pages ?
+        (float)info.unusable_pages / info.free_pages : 0.0f;
+    return info;
+}
+
+// Whether more than percent of free memory is in blocks too small to use
+bool fragmentation_above(fragmentation_info_t *info, uint32_t percent) {
+    return info->free_pages &&
+           (uint64_t)info->unusable_pages * 100 > (uint64_t)info->free_pages * percent;
+}
+
+static void trend_record(uint32_t largest) {
+    kcompactd_stats_t *stats = &kcompactd_stats;
+    if (stats->trend_count == KCOMPACTD_TREND_SAMPLES) {
+        memmove(&stats->largest_free[0], &stats->largest_free[1],
+                (KCOMPACTD_TREND_SAMPLES - 1) * sizeof(uint32_t));
+        stats->trend_count--;
+    }
+    stats->largest_free[stats->trend_count++] = largest;
+}
+
+// Migrate movable pages from the low end of a zone into free frames near
+// its top, so the low end coalesces into COMPACTION_ORDER blocks
+static uint32_t compact_zone(memory_zone_t *zone, uint32_t *budget, uint32_t *scan) {
+    compact_control_t *ctl = &compact_ctl[zone - memory_zones];
+    uint64_t end_pfn = zone->base_pfn + zone->num_pages;
+    uint32_t moved = 0;
+
+    if (ctl->migrate_pfn < zone->base_pfn || ctl->migrate_pfn >= end_pfn) {
+        ctl->migrate_pfn = zone->base_pfn;
+    }
+
+    uint64_t pfn = ctl->migrate_pfn;
+    while (pfn < end_pfn && *budget && *scan) {
+        page_t *page = &zone->pages[pfn - zone->base_pfn];
+        uint32_t flags = page->flags;
+        (*scan)--;
+        kcompactd_stats.pages_scanned++;
+
+        if (flags & PAGE_FLAG_BUDDY) {
+            // Free block: skip it whole
+            pfn += 1ULL << page->order;
+            continue;
+        }
+
+        if (!(flags & PAGE_FLAG_MOVABLE) || page->order != 0) {
+            // Anything pinned keeps this block from freeing up, move on to
+            // the next one instead of migrating around it
+            pfn = (pfn | ((1ULL << COMPACTION_ORDER) - 1)) + 1;
+            continue;
+        }
+
+        page_t *target = buddy_alloc_above(zone, pfn, COMPACTION_ORDER);
+        if (!target) {
+            // The scanners met: nothing left to fill above us
+            pfn = end_pfn;
+            break;
+        }
+
+        uint64_t old_phys = pfn * PAGE_SIZE;
+        if (vmm_migrate_page(page, old_phys, page_to_phys(zone, target))) {
+            buddy_free(zone, page, 0);
+            moved++;
+            (*budget)--;
+        } else {
+            buddy_free(zone, target, 0);
+            kcompactd_stats.pages_failed++;
+        }
+        pfn++;
+    }
+
+    ctl->migrate_pfn = pfn;
+    ctl->pages_moved += moved;
+    return moved;
+}
+
+// The scanner positions in compact_ctl are shared, so only one pass runs
+static bool compact_begin(void) {
+    bool idle = false;
+    return __atomic_compare_exchange_n(&compact_busy, &idle, true, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void compact_end(void) {
+    __atomic_store_n(&compact_busy, false, __ATOMIC_RELEASE);
+}
+
+// Compact every zone on one budget, resuming where the last pass stopped
+static uint32_t compact_zones(void) {
+    uint32_t budget = KCOMPACTD_BUDGET;
+    uint32_t scan = KCOMPACTD_SCAN_LIMIT;
+    uint32_t moved = 0;
+
+    // Pages parked in this CPU's cache would pin their blocks
+    pcp_drain_cpu(smp_processor_id());
+
+    for (uint32_t z = 0; z < num_memory_zones && budget && scan; z++) {
+        if (memory_zones[z].num_pages) {
+            moved += compact_zone(&memory_zones[z], &budget, &scan);
+        }
+    }
+    return moved;
+}
+
+// One budgeted compaction pass over all zones
+static void kcompactd_run(void) {
+    kcompactd_stats.wakeups++;
+
+    fragmentation_info_t before = analyze_fragmentation();
+    trend_record(before.largest_free_block);
+
+    bool forced = kcompactd_forced;
+    kcompactd_forced = false;
+
+    // Reclaimable caches go first: freed objects may also merge blocks
+    if (forced || shrink_needed(before.free_pages)) {
+        uint64_t freed = shrink_caches(forced ? SHRINK_PRIORITY_URGENT
+                                              : SHRINK_PRIORITY_DEFAULT);
+        kcompactd_stats.objects_shrunk += freed;
+        if (freed) {
+            before = analyze_fragmentation();
+        }
+    }
+
+    if (!forced && !fragmentation_above(&before, COMPACT_WMARK_HIGH)) {
+        return;
+    }
+
+    if (!compact_begin()) {
+        // A direct pass is running; look again once it is done
+        kcompactd_pending = true;
+        return;
+    }
+
+    uint64_t start = get_system_time();
+    uint32_t moved = compact_zones();
+    uint64_t elapsed = get_system_time() - start;
+
+    kcompactd_stats.passes++;
+    kcompactd_stats.pages_moved += moved;
+    kcompactd_stats.time_ms += elapsed;
+    compact_end();
+
+    fragmentation_info_t after = analyze_fragmentation();
+
+    kprintf("[KCOMPACTD] Moved %d pages in %llu ms, largest free block %d -> %d pages\n",
+            moved, elapsed, before.largest_free_block, after.largest_free_block);
+
+    // Budget exhausted while still fragmented: go again
+    if (moved == KCOMPACTD_BUDGET && fragmentation_above(&after, COMPACT_WMARK_LOW)) {
+        kcompactd_pending = true;
+    }
+}
+
+// Synchronous pass for an allocation that must not fail. Caches are left
+// to kcompactd: shrinkers take locks the allocating caller may hold.
+// Returns the number of pages moved; 0 can also mean kcompactd was busy.
+uint32_t compact_direct(void) {
+    if (!compact_begin()) {
+        return 0;
+    }
+    uint32_t moved = compact_zones();
+    kcompactd_stats.direct_passes++;
+    kcompactd_stats.pages_moved += moved;
+    compact_end();
+    return moved;
+}
+
+// Compaction daemon: sleeps until woken by a watermark or a failed allocation
+static void kcompactd_main(void) {
+    while (1) {
+        uint64_t flags = local_irq_save();
+        while (!kcompactd_pending) {
+            current_process->state = PROCESS_STATE_BLOCKED;
+            local_irq_restore(flags);
+            schedule();
+            flags = local_irq_save();
+        }
+        kcompactd_pending = false;
+        local_irq_restore(flags);
+
+        kcompactd_run();
+    }
+}
+
+// Wake kcompactd. With allocation_failed the next pass ignores the
+// high watermark.
+void kcompactd_wakeup(bool allocation_failed) {
+    if (allocation_failed) {
+        kcompactd_forced = true;
+    }
+
+    uint64_t flags = local_irq_save();
+    kcompactd_pending = true;
+    if (kcompactd_task && kcompactd_task->state == PROCESS_STATE_BLOCKED) {
+        wake_up_process(kcompactd_task);
+    }
+    local_irq_restore(flags);
+}
+
+// Periodic check; the watermark itself is evaluated by kcompactd
+static void kcompactd_timer(void *data) {
+    (void)data;
+    kcompactd_wakeup(false);
+}
+
+void kcompactd_get_stats(kcompactd_stats_t *stats) {
+    *stats = kcompactd_stats;
+}
+
+// procfs: /proc/kcompactd
+size_t kcompactd_show(char *buf, size_t size) {
+    kcompactd_stats_t stats = kcompactd_stats;
+    fragmentation_info_t frag = analyze_fragmentation();
+    size_t len = 0;
+
+    len += snprintf(buf + len, size - len,
+                    "wakeups %llu\npasses %llu\npages_scanned %llu\n"
+                    "pages_moved %llu\npages_failed %llu\ntime_ms %llu\n"
+                    "objects_shrunk %llu\ndirect_passes %llu\n"
+                    "free_pages %d\nunusable_pages %d\n"
+                    "largest_free_block %d\nlargest_free_trend",
+                    stats.wakeups, stats.passes, stats.pages_scanned,
+                    stats.pages_moved, stats.pages_failed, stats.time_ms,
+                    stats.objects_shrunk, stats.direct_passes,
+                    frag.free_pages, frag.unusable_pages, frag.largest_free_block);
+
+    for (uint32_t i = 0; i < stats.trend_count && len < size; i++) {
+        len += snprintf(buf + len, size - len, " %d", stats.largest_free[i]);
+    }
+    if (len < size) {
+        len += snprintf(buf + len, size - len, "\n");
+    }
+
+    return len < size ? len : size;
+}
+
+// Start the compaction daemon
+void kcompactd_init(void) {
+    memset(compact_ctl, 0, sizeof(compact_ctl));
+    memset(&kcompactd_stats, 0, sizeof(kcompactd_stats));
+
+    kcompactd_task = process_create("kcompactd", kcompactd_main, 1);
+    if (!kcompactd_task) {
+        kprintf("[KCOMPACTD] Failed to start\n");
+        return;
+    }
+    kcompactd_task->flags |= PROCESS_FLAG_SYSTEM;
+
+    register_timer_callback(KCOMPACTD_CHECK_MS, kcompactd_timer, NULL, true);
+    procfs_register("kcompactd", kcompactd_show);
+
+    kprintf("[KCOMPACTD] Started, watermarks %d%%/%d%% below order %d\n",
+            COMPACT_WMARK_HIGH, COMPACT_WMARK_LOW, COMPACTION_ORDER);
+}
@@ -0,0 +1,52 @@
+#ifndef COMPACTION_H
+#define COMPACTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory.h"
+
+// Compaction targets 2MB blocks so huge page faults keep succeeding
+#define COMPACTION_ORDER 9
+
+// Fragmentation watermarks: percent of free memory sitting in blocks
+// smaller than COMPACTION_ORDER
+#define COMPACT_WMARK_HIGH 50     // Start compacting above this
+#define COMPACT_WMARK_LOW 25      // Stop once back under this
+
+#define KCOMPACTD_BUDGET 256      // Pages migrated per wakeup
+#define KCOMPACTD_SCAN_LIMIT 4096 // Page frames examined per wakeup
+#define KCOMPACTD_CHECK_MS 1000   // Periodic watermark check
+#define KCOMPACTD_TREND_SAMPLES 16
+#define COMPACT_DIRECT_RETRIES 16 // Direct passes before a no-fail allocation panics
+
+// Per-zone scanner position, kept across wakeups
+typedef struct {
+    uint64_t migrate_pfn;     // Next frame the migration scanner looks at
+    uint64_t pages_moved;
+} compact_control_t;
+
+// kcompactd statistics
+typedef struct {
+    uint64_t wakeups;
+    uint64_t passes;          // Wakeups that found work above the watermark
+    uint64_t pages_scanned;
+    uint64_t pages_moved;
+    uint64_t pages_failed;
+    uint64_t time_ms;
+    uint64_t objects_shrunk;  // Returned by cache shrinkers
+    uint64_t direct_passes;   // Run by allocations that must not fail
+
+    // Largest free block (pages) sampled at each wakeup, oldest first
+    uint32_t largest_free[KCOMPACTD_TREND_SAMPLES];
+    uint32_t trend_count;
+} kcompactd_stats_t;
+
+// Function prototypes
+void kcompactd_init(void);
+void kcompactd_wakeup(bool allocation_failed);
+uint32_t compact_direct(void);
+bool fragmentation_above(fragmentation_info_t *info, uint32_t percent);
+void kcompactd_get_stats(kcompactd_stats_t *stats);
+size_t kcompactd_show(char *buf, size_t size);
+
+#endif // COMPACTION_H
@@ -1,14 +1,15 @@
 // AION OS Memory Management with AI Prediction
 #include "memory.h"
+#include "numa.h"
+#include "compaction.h"
 #include "../ai/predictor.h"
+#include "../core/smp.h"
 
 // Physical memory bitmap
 static uint32_t *memory_bitmap;
 static uint32_t total_memory;
-static uint32_t used_memory;
-static uint32_t free_memory;
 
-// Memory zones for NUMA support
+// Memory zones, split at NUMA node boundaries
 memory_zone_t memory_zones[MAX_MEMORY_ZONES];
 uint32_t num_memory_zones = 0;
 
@@ -21,12 +22,10 @@ void memory_init(multiboot_info_t *mboot_info) {
     
     // Get total memory from multiboot
     total_memory = mboot_info->mem_upper * 1024;
-    free_memory = total_memory;
-    used_memory = 0;
     
     kprintf("[MEMORY] Total memory: %d MB\n", total_memory / (1024 * 1024));
     
-    // Initialize memory bitmap
+    // Initialize memory bitmap (debug view, zones own the real state)
     uint32_t bitmap_size = total_memory / (PAGE_SIZE * 32);
     memory_bitmap = (uint32_t*)MEMORY_BITMAP_ADDR;
     memset(memory_bitmap, 0, bitmap_size);
@@ -34,137 +33,272 @@ void memory_init(multiboot_info_t *mboot_info) {
     // Mark kernel memory as used
     mark_memory_used(0, KERNEL_SIZE);
     
-    // Initialize memory zones
+    // Discover NUMA topology, then build zones and per-node fallback lists
+    numa_init();
     init_memory_zones(mboot_info);
+    numa_build_zonelists();
+    numa_dump();
     
-    // Initialize AI memory predictor
-    mem_predictor = ai_memory_predictor_create();
+    // Initialize per-CPU page caches in front of the zones. This already
+    // reads the time: before vclock_init the clock page is static and
+    // reads 0 ns.
+    pcp_init();
     
     kprintf("[MEMORY] Memory management initialized\n");
 }
 
-// Allocate physical pages with AI prediction
+// The predictor is built with kmalloc, so it starts after slab_init;
+// allocations before then go untracked
+void memory_predictor_init(void) {
+    mem_predictor = ai_memory_predictor_create();
+}
+
+// Find the zone containing a physical address
+memory_zone_t* zone_for_address(uint64_t phys_addr) {
+    uint64_t pfn = phys_addr / PAGE_SIZE;
+    for (uint32_t i = 0; i < num_memory_zones; i++) {
+        memory_zone_t *zone = &memory_zones[i];
+        if (zone->num_pages && pfn >= zone->base_pfn &&
+            pfn < zone->base_pfn + zone->num_pages) {
+            return zone;
+        }
+    }
+    return NULL;
+}
+
+// Translate a physical address to its page descriptor
+page_t* phys_to_page(uint64_t phys_addr) {
+    memory_zone_t *zone = zone_for_address(phys_addr);
+    if (!zone) {
+        return NULL;
+    }
+    return &zone->pages[phys_addr / PAGE_SIZE - zone->base_pfn];
+}
+
+// Translate a page descriptor back to its physical address
+uint64_t page_to_phys(memory_zone_t *zone, page_t *page) {
+    return (zone->base_pfn + (uint64_t)(page - zone->pages)) * PAGE_SIZE;
+}
+
+// Debug view: mirror buddy state into the page bitmap and check it
+static void bitmap_mark_range(uint64_t start_page, size_t num_pages, bool used) {
+#ifdef MEMORY_DEBUG
+    for (size_t i = 0; i < num_pages; i++) {
+        if (used && !is_page_free(start_page + i)) {
+            kprintf("[MEMORY] Page 0x%llx handed out twice\n", start_page + i);
+        }
+        if (used) {
+            set_page_used(start_page + i);
+        } else {
+            set_page_free(start_page + i);
+        }
+    }
+#else
+    (void)start_page;
+    (void)num_pages;
+    (void)used;
+#endif
+}
+
+// Nearest zone with memory, whose per-CPU cache serves the fast path
+static memory_zone_t* local_zone(uint32_t node) {
+    numa_node_t *numa = numa_get_node(node);
+    if (!numa || !numa->zonelist_len) {
+        return NULL;
+    }
+    return &memory_zones[numa->zonelist[0]];
+}
+
+// Free memory, summed from the zones and per-CPU caches rather than kept
+// in shared counters
+uint64_t pmm_free_bytes(void) {
+    uint64_t free_pages = pcp_cached_pages();
+    for (uint32_t i = 0; i < num_memory_zones; i++) {
+        free_pages += memory_zones[i].free_pages;
+    }
+    return free_pages * PAGE_SIZE;
+}
+
+// Walk a node's zonelist nearest-first
+static page_t* alloc_from_zonelist(numa_node_t *numa, uint32_t order,
+                                   memory_zone_t **out_zone) {
+    for (uint32_t i = 0; i < numa->zonelist_len; i++) {
+        memory_zone_t *zone = &memory_zones[numa->zonelist[i]];
+        page_t *page = buddy_alloc(zone, order);
+        if (page) {
+            *out_zone = zone;
+            return page;
+        }
+    }
+    
+    return NULL;
+}
+
+static void* pmm_alloc(size_t num_pages, uint32_t node, bool may_fail);
+
+// Allocate physical pages on the current CPU's node
 void* pmm_alloc_pages(size_t num_pages) {
-    // Use AI to predict best allocation strategy
-    allocation_hint_t hint = mem_predictor->predict_allocation(num_pages);
-    
-    // Find contiguous free pages
-    uint32_t start_page = find_free_pages(num_pages, hint);
-    if (start_page == INVALID_PAGE) {
-        // Try memory compaction
-        if (compact_memory()) {
-            start_page = find_free_pages(num_pages, hint);
+    return pmm_alloc(num_pages, numa_node_id(), false);
+}
+
+// Allocate physical pages, preferring a node and falling back by distance
+// Requests are rounded up to the next power-of-two block; callers free
+// with the same num_pages so the order matches.
+void* pmm_alloc_pages_node(size_t num_pages, uint32_t node) {
+    return pmm_alloc(num_pages, node, false);
+}
+
+// As pmm_alloc_pages, but out of memory returns NULL instead of
+// panicking, for callers that can reclaim something and retry
+void* pmm_try_alloc_pages(size_t num_pages) {
+    return pmm_alloc(num_pages, numa_node_id(), true);
+}
+
+static void* pmm_alloc(size_t num_pages, uint32_t node, bool may_fail) {
+    uint32_t order = pages_to_order(num_pages);
+    if (order > MAX_ORDER) {
+        kprintf("[MEMORY] Allocation of %d pages exceeds max order\n", num_pages);
+        return NULL;
+    }
+    
+    numa_node_t *numa = numa_get_node(node);
+    if (!numa) {
+        numa = numa_get_node(0);
+    }
+    
+    // Fast path: small blocks come from this CPU's cache of the nearest
+    // zone without touching the predictor or any shared counters
+    memory_zone_t *zone = local_zone(numa->id);
+    if (zone && order <= PCP_MAX_ORDER) {
+        page_t *page = pcp_alloc(zone, order);
+        if (page) {
+            uint64_t phys = page_to_phys(zone, page);
+            bitmap_mark_range(phys / PAGE_SIZE, 1U << order, true);
+            return (void*)phys;
+        }
+    }
+    
+    page_t *page = alloc_from_zonelist(numa, order, &zone);
+    if (!page) {
+        // Blocks parked on this CPU's cache are free but invisible to the
+        // buddy lists: give them back and try once more. Other CPUs'
+        // caches can only be drained by their owners.
+        pcp_drain_cpu(smp_processor_id());
+        page = alloc_from_zonelist(numa, order, &zone);
+    }
+    if (!page) {
+        if (pmm_free_bytes() < ((uint64_t)PAGE_SIZE << order)) {
+            if (!may_fail) {
+                kernel_panic("Out of physical memory!");
+            }
+            return NULL;
         }
         
-        if (start_page == INVALID_PAGE) {
-            kernel_panic("Out of physical memory!");
+        // Enough memory, just too fragmented. kcompactd does the work in
+        // the background; a caller that can fail is told to come back,
+        // one that cannot compacts synchronously until the block forms.
+        kcompactd_wakeup(true);
+        for (uint32_t i = 0; !may_fail && !page && i < COMPACT_DIRECT_RETRIES; i++) {
+            compact_direct();
+            page = alloc_from_zonelist(numa, order, &zone);
+        }
+        if (!page) {
+            if (!may_fail) {
+                kernel_panic("Out of physical memory: too fragmented to compact");
+            }
+            kprintf("[MEMORY] Order %d allocation failed, memory fragmented\n", order);
             return NULL;
         }
     }
     
-    // Mark pages as used
-    for (size_t i = 0; i < num_pages; i++) {
-        set_page_used(start_page + i);
+    // Splitting the last large block trips the fragmentation watermark
+    if (order > PCP_MAX_ORDER && buddy_largest_free_order(zone) < COMPACTION_ORDER) {
+        kcompactd_wakeup(false);
     }
     
-    // Update statistics
-    used_memory += num_pages * PAGE_SIZE;
-    free_memory -= num_pages * PAGE_SIZE;
+    if (zone->node == numa->id) {
+        numa->local_allocs++;
+    } else {
+        numa->remote_allocs++;
+    }
+    
+    uint64_t phys = page_to_phys(zone, page);
+    uint64_t start_page = phys / PAGE_SIZE;
+    bitmap_mark_range(start_page, 1U << order, true);
     
     // Train AI predictor
-    mem_predictor->record_allocation(num_pages, start_page);
+    if (mem_predictor) {
+        mem_predictor->record_allocation(num_pages, start_page);
+    }
     
-    return (void*)(start_page * PAGE_SIZE);
+    return (void*)phys;
 }
 
 // Free physical pages
 void pmm_free_pages(void *addr, size_t num_pages) {
-    uint32_t start_page = (uint32_t)addr / PAGE_SIZE;
+    uint64_t phys = (uint64_t)addr;
+    uint32_t order = pages_to_order(num_pages);
     
-    // Mark pages as free
-    for (size_t i = 0; i < num_pages; i++) {
-        set_page_free(start_page + i);
+    memory_zone_t *zone = zone_for_address(phys);
+    if (!zone) {
+        kprintf("[MEMORY] Free of unmanaged address 0x%llx\n", phys);
+        return;
     }
     
-    // Update statistics
-    used_memory -= num_pages * PAGE_SIZE;
-    free_memory += num_pages * PAGE_SIZE;
+    uint64_t start_page = phys / PAGE_SIZE;
+    page_t *page = &zone->pages[start_page - zone->base_pfn];
+    bitmap_mark_range(start_page, 1U << order, false);
     
-    // Notify AI predictor
-    mem_predictor->record_free(num_pages, start_page);
+    // Fast path: park small blocks on this CPU's cache
+    if (pcp_free(zone, page, order, false)) {
+        return;
+    }
+    
+    // Return the block to the buddy allocator, which coalesces it
+    buddy_free(zone, page, order);
     
-    // Attempt to coalesce free blocks
-    coalesce_free_blocks(start_page, num_pages);
+    // Notify AI predictor
+    if (mem_predictor) {
+        mem_predictor->record_free(num_pages, start_page);
+    }
 }
 
-// Initialize memory zones for NUMA support
+// Initialize memory zones, one per multiboot region per NUMA node
 void init_memory_zones(multiboot_info_t *mboot_info) {
     // Parse memory map from multiboot
     multiboot_memory_map_t *mmap = (multiboot_memory_map_t*)mboot_info->mmap_addr;
     
     while ((uint32_t)mmap < mboot_info->mmap_addr + mboot_info->mmap_length) {
-        if (mmap->type == MULTIBOOT_MEMORY_AVAILABLE) {
+        uint64_t start = mmap->addr;
+        uint64_t end = mmap->addr + mmap->len;
+        
+        while (mmap->type == MULTIBOOT_MEMORY_AVAILABLE && start < end &&
+               num_memory_zones < MAX_MEMORY_ZONES) {
+            // Split the region where SRAT moves it to another node
+            uint64_t split = numa_range_end(start);
+            if (split > end) {
+                split = end;
+            }
+            
             // Create memory zone
             memory_zone_t *zone = &memory_zones[num_memory_zones++];
-            zone->start_addr = mmap->addr;
-            zone->end_addr = mmap->addr + mmap->len;
-            zone->size = mmap->len;
-            zone->free_pages = mmap->len / PAGE_SIZE;
-            zone->used_pages = 0;
+            zone->start_addr = start;
+            zone->end_addr = split;
+            zone->size = split - start;
+            zone->node = numa_node_of_address(start);
+            
+            // Build the buddy free lists for this zone
+            buddy_init_zone(zone, num_memory_zones - 1);
             
-            kprintf("[MEMORY] Zone %d: 0x%llx - 0x%llx (%lld MB)\n",
-                   num_memory_zones - 1, zone->start_addr, 
-                   zone->end_addr, zone->size / (1024 * 1024));
+            kprintf("[MEMORY] Zone %d (node %d): 0x%llx - 0x%llx (%lld MB, %d free pages)\n",
+                   num_memory_zones - 1, zone->node, zone->start_addr, 
+                   zone->end_addr, zone->size / (1024 * 1024),
+                   zone->free_pages);
+            
+            start = split;
         }
         
         mmap = (multiboot_memory_map_t*)((uint32_t)mmap + 
                 mmap->size + sizeof(mmap->size));
     }
 }
-
-// Memory compaction with AI optimization
-bool compact_memory(void) {
-    kprintf("[MEMORY] Starting AI-optimized memory compaction...\n");
-    
-    // Use AI to determine best compaction strategy
-    compaction_strategy_t strategy = mem_predictor->get_compaction_strategy();
-    
-    uint32_t pages_moved = 0;
-    
-    switch (strategy) {
-        case COMPACT_AGGRESSIVE:
-            pages_moved = compact_aggressive();
-            break;
-        case COMPACT_LAZY:
-            pages_moved = compact_lazy();
-            break;
-        case COMPACT_SMART:
-            pages_moved = compact_smart();
-            break;
-    }
-    
-    kprintf("[MEMORY] Compaction complete, moved %d pages\n", pages_moved);
-    return pages_moved > 0;
-}
-
-// AI-powered smart memory compaction
-uint32_t compact_smart(void) {
-    uint32_t pages_moved = 0;
-    
-    // Analyze memory fragmentation
-    fragmentation_info_t frag_info = analyze_fragmentation();
-    
-    // Use AI to predict which pages to move
-    page_move_list_t *moves = mem_predictor->predict_moves(frag_info);
-    
-    // Execute moves
-    for (size_t i = 0; i < moves->count; i++) {
-        page_move_t *move = &moves->moves[i];
-        if (move_page(move->from, move->to)) {
-            pages_moved++;
-        }
-    }
-    
-    free(moves);
-    return pages_moved;
-}
\ No newline at end of file
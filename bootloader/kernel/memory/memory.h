@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "buddy.h"
+#include "pcp.h"
+#include "slab.h"
 
 // Memory constants
 #define PAGE_SIZE 4096
@@ -14,15 +17,24 @@
 #define HEAP_SIZE 0x1000000  // 16MB initial heap
 #define MAX_MEMORY_ZONES 16
 #define INVALID_PAGE 0xFFFFFFFF
+#define PMM_RESERVED_END (HEAP_START + HEAP_SIZE)  // Kernel, bitmap and heap
 
 // Memory zone structure
-typedef struct {
+typedef struct memory_zone {
     uint64_t start_addr;
     uint64_t end_addr;
     uint64_t size;
     uint32_t free_pages;
     uint32_t used_pages;
     uint32_t flags;
+    uint32_t node;            // NUMA node owning this range
+    
+    // Buddy allocator state
+    page_t *pages;            // Descriptors for [base_pfn, base_pfn + num_pages)
+    uint64_t base_pfn;
+    uint32_t num_pages;
+    free_area_t free_area[NUM_ORDERS];
+    spinlock_t lock;
 } memory_zone_t;
 
 // Allocation hint from AI
@@ -43,7 +55,9 @@ typedef enum {
 // Fragmentation info
 typedef struct {
     uint32_t total_fragments;
-    uint32_t largest_free_block;
+    uint32_t largest_free_block;   // In pages
+    uint32_t free_pages;
+    uint32_t unusable_pages;       // Free, but in blocks below COMPACTION_ORDER
     float fragmentation_ratio;
 } fragmentation_info_t;
 
@@ -58,16 +72,26 @@ typedef struct {
     size_t count;
 } page_move_list_t;
 
+// Zone table
+extern memory_zone_t memory_zones[MAX_MEMORY_ZONES];
+extern uint32_t num_memory_zones;
+
 // Function prototypes
 void memory_init(multiboot_info_t *mboot_info);
+void memory_predictor_init(void);
 void* pmm_alloc_pages(size_t num_pages);
+void* pmm_alloc_pages_node(size_t num_pages, uint32_t node);
+void* pmm_try_alloc_pages(size_t num_pages);
 void pmm_free_pages(void *addr, size_t num_pages);
 void init_memory_zones(multiboot_info_t *mboot_info);
-bool compact_memory(void);
-uint32_t compact_smart(void);
 fragmentation_info_t analyze_fragmentation(void);
+uint64_t pmm_free_bytes(void);
+memory_zone_t* zone_for_address(uint64_t phys_addr);
+page_t* phys_to_page(uint64_t phys_addr);
+uint64_t page_to_phys(memory_zone_t *zone, page_t *page);
 
-// Inline functions for bitmap operations
+// Inline functions for bitmap operations (debug/validation view only,
+// the buddy free lists are authoritative)
 static inline void set_page_used(uint32_t page) {
     memory_bitmap[page / 32] |= (1 << (page % 32));
 }
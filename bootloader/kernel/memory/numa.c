@@ -0,0 +1,242 @@
+// AION OS NUMA Topology (ACPI SRAT/SLIT)
+#include "numa.h"
+#include "../core/smp.h"
+
+uint32_t num_numa_nodes = 1;
+static numa_node_t numa_nodes[MAX_NUMA_NODES];
+
+static numa_range_t numa_ranges[MAX_NUMA_RANGES];
+static uint32_t num_numa_ranges = 0;
+
+static uint8_t apic_node[256];
+static uint8_t distance_table[MAX_NUMA_NODES][MAX_NUMA_NODES];
+
+// Map an ACPI proximity domain to a dense node number, creating it if new
+static uint32_t pxm_to_node(uint32_t pxm, bool create) {
+    for (uint32_t n = 0; n < num_numa_nodes; n++) {
+        if (numa_nodes[n].proximity_domain == pxm) {
+            return n;
+        }
+    }
+
+    if (!create) {
+        return NUMA_NO_NODE;
+    }
+
+    if (num_numa_nodes >= MAX_NUMA_NODES) {
+        kprintf("[NUMA] Too many proximity domains, folding %d into node 0\n", pxm);
+        return 0;
+    }
+
+    uint32_t node = num_numa_nodes++;
+    numa_nodes[node].id = node;
+    numa_nodes[node].proximity_domain = pxm;
+    return node;
+}
+
+static void numa_add_range(uint64_t start, uint64_t end, uint32_t node) {
+    if (num_numa_ranges >= MAX_NUMA_RANGES) {
+        kprintf("[NUMA] Too many memory ranges, ignoring 0x%llx\n", start);
+        return;
+    }
+
+    numa_range_t *range = &numa_ranges[num_numa_ranges++];
+    range->start = start;
+    range->end = end;
+    range->node = node;
+    numa_nodes[node].present_bytes += end - start;
+}
+
+static void numa_parse_srat(acpi_srat_t *srat) {
+    uint8_t *ptr = (uint8_t*)(srat + 1);
+    uint8_t *end = (uint8_t*)srat + srat->header.length;
+
+    while (ptr + sizeof(srat_entry_t) <= end) {
+        srat_entry_t *entry = (srat_entry_t*)ptr;
+        if (entry->length == 0) {
+            break;
+        }
+
+        switch (entry->type) {
+            case SRAT_TYPE_CPU_AFFINITY: {
+                srat_cpu_affinity_t *cpu = (srat_cpu_affinity_t*)entry;
+                if (cpu->flags & SRAT_FLAG_ENABLED) {
+                    uint32_t pxm = cpu->proximity_lo |
+                                   (cpu->proximity_hi[0] << 8) |
+                                   (cpu->proximity_hi[1] << 16) |
+                                   (cpu->proximity_hi[2] << 24);
+                    apic_node[cpu->apic_id] = pxm_to_node(pxm, true);
+                }
+                break;
+            }
+
+            case SRAT_TYPE_X2APIC_AFFINITY: {
+                srat_x2apic_affinity_t *cpu = (srat_x2apic_affinity_t*)entry;
+                if ((cpu->flags & SRAT_FLAG_ENABLED) && cpu->x2apic_id < 256) {
+                    apic_node[cpu->x2apic_id] = pxm_to_node(cpu->proximity, true);
+                }
+                break;
+            }
+
+            case SRAT_TYPE_MEMORY_AFFINITY: {
+                srat_memory_affinity_t *mem = (srat_memory_affinity_t*)entry;
+                uint64_t base = ((uint64_t)mem->base_hi << 32) | mem->base_lo;
+                uint64_t len = ((uint64_t)mem->length_hi << 32) | mem->length_lo;
+                if ((mem->flags & SRAT_FLAG_ENABLED) && len) {
+                    numa_add_range(base, base + len, pxm_to_node(mem->proximity, true));
+                }
+                break;
+            }
+        }
+
+        ptr += entry->length;
+    }
+}
+
+static void numa_parse_slit(acpi_slit_t *slit) {
+    for (uint64_t i = 0; i < slit->localities; i++) {
+        uint32_t from = pxm_to_node(i, false);
+        if (from == NUMA_NO_NODE) {
+            continue;
+        }
+        for (uint64_t j = 0; j < slit->localities; j++) {
+            uint32_t to = pxm_to_node(j, false);
+            if (to != NUMA_NO_NODE) {
+                distance_table[from][to] = slit->entries[i * slit->localities + j];
+            }
+        }
+    }
+}
+
+// Discover NUMA topology; must run before memory zones are built
+void numa_init(void) {
+    memset(numa_nodes, 0, sizeof(numa_nodes));
+    memset(apic_node, 0, sizeof(apic_node));
+    num_numa_ranges = 0;
+    num_numa_nodes = 1;
+
+    // Default topology: everything local
+    for (uint32_t i = 0; i < MAX_NUMA_NODES; i++) {
+        for (uint32_t j = 0; j < MAX_NUMA_NODES; j++) {
+            distance_table[i][j] = (i == j) ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+        }
+    }
+
+    acpi_srat_t *srat = acpi_init() ? (acpi_srat_t*)acpi_find_table("SRAT") : NULL;
+    if (!srat) {
+        kprintf("[NUMA] No SRAT, using a single node\n");
+        return;
+    }
+
+    num_numa_nodes = 0;
+    numa_parse_srat(srat);
+
+    if (num_numa_nodes == 0) {
+        kprintf("[NUMA] SRAT describes no nodes, using a single node\n");
+        num_numa_nodes = 1;
+        num_numa_ranges = 0;
+        memset(apic_node, 0, sizeof(apic_node));
+        return;
+    }
+
+    acpi_slit_t *slit = (acpi_slit_t*)acpi_find_table("SLIT");
+    if (slit) {
+        numa_parse_slit(slit);
+    }
+
+    kprintf("[NUMA] %d nodes, %d memory ranges, %s distances\n",
+            num_numa_nodes, num_numa_ranges, slit ? "SLIT" : "default");
+}
+
+// Order every zone by distance from each node
+void numa_build_zonelists(void) {
+    for (uint32_t n = 0; n < num_numa_nodes; n++) {
+        numa_node_t *node = &numa_nodes[n];
+        bool used[MAX_NUMA_NODES] = {0};
+        node->zonelist_len = 0;
+
+        for (uint32_t pass = 0; pass < num_numa_nodes; pass++) {
+            // Pick the nearest node not yet added; ties keep the lower id
+            uint32_t best = NUMA_NO_NODE;
+            for (uint32_t m = 0; m < num_numa_nodes; m++) {
+                if (!used[m] && (best == NUMA_NO_NODE ||
+                                 distance_table[n][m] < distance_table[n][best])) {
+                    best = m;
+                }
+            }
+            used[best] = true;
+
+            for (uint32_t z = 0; z < num_memory_zones; z++) {
+                if (memory_zones[z].node == best && memory_zones[z].num_pages) {
+                    node->zonelist[node->zonelist_len++] = z;
+                }
+            }
+        }
+    }
+}
+
+// Node owning a physical address (node 0 if SRAT does not cover it)
+uint32_t numa_node_of_address(uint64_t phys_addr) {
+    for (uint32_t i = 0; i < num_numa_ranges; i++) {
+        if (phys_addr >= numa_ranges[i].start && phys_addr < numa_ranges[i].end) {
+            return numa_ranges[i].node;
+        }
+    }
+    return 0;
+}
+
+// First address after phys_addr where node ownership may change
+uint64_t numa_range_end(uint64_t phys_addr) {
+    uint64_t next = UINT64_MAX;
+    for (uint32_t i = 0; i < num_numa_ranges; i++) {
+        if (phys_addr >= numa_ranges[i].start && phys_addr < numa_ranges[i].end) {
+            return numa_ranges[i].end;
+        }
+        if (numa_ranges[i].start > phys_addr && numa_ranges[i].start < next) {
+            next = numa_ranges[i].start;
+        }
+    }
+    return next;
+}
+
+uint32_t numa_cpu_to_node(uint32_t cpu) {
+    return apic_node[smp_cpu_apic_id(cpu)];
+}
+
+// Node of the CPU we are running on
+uint32_t numa_node_id(void) {
+    return numa_cpu_to_node(smp_processor_id());
+}
+
+uint8_t numa_distance(uint32_t from, uint32_t to) {
+    if (from >= num_numa_nodes || to >= num_numa_nodes) {
+        return NUMA_REMOTE_DISTANCE;
+    }
+    return distance_table[from][to];
+}
+
+numa_node_t* numa_get_node(uint32_t node) {
+    return node < num_numa_nodes ? &numa_nodes[node] : NULL;
+}
+
+// Print topology, fallback order and locality statistics
+void numa_dump(void) {
+    for (uint32_t n = 0; n < num_numa_nodes; n++) {
+        numa_node_t *node = &numa_nodes[n];
+        kprintf("[NUMA] Node %d (pxm %d): %lld MB, local %llu remote %llu, zones:",
+                n, node->proximity_domain, node->present_bytes / (1024 * 1024),
+                node->local_allocs, node->remote_allocs);
+        for (uint32_t i = 0; i < node->zonelist_len; i++) {
+            kprintf(" %d", node->zonelist[i]);
+        }
+        kprintf("\n");
+    }
+
+    for (uint32_t i = 0; i < num_numa_nodes; i++) {
+        kprintf("[NUMA] Distance %d:", i);
+        for (uint32_t j = 0; j < num_numa_nodes; j++) {
+            kprintf(" %d", distance_table[i][j]);
+        }
+        kprintf("\n");
+    }
+}
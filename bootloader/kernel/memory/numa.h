@@ -0,0 +1,112 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory.h"
+#include "../drivers/acpi.h"
+
+// NUMA constants
+#define MAX_NUMA_NODES 8
+#define MAX_NUMA_RANGES 32
+#define NUMA_NO_NODE 0xFF
+#define NUMA_LOCAL_DISTANCE 10
+#define NUMA_REMOTE_DISTANCE 20
+
+// SRAT affinity structure types
+#define SRAT_TYPE_CPU_AFFINITY    0
+#define SRAT_TYPE_MEMORY_AFFINITY 1
+#define SRAT_TYPE_X2APIC_AFFINITY 2
+#define SRAT_FLAG_ENABLED 0x1
+
+// System Resource Affinity Table
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t table_revision;
+    uint64_t reserved;
+} __attribute__((packed)) acpi_srat_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) srat_entry_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t proximity_lo;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t proximity_hi[3];
+    uint32_t clock_domain;
+} __attribute__((packed)) srat_cpu_affinity_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint32_t proximity;
+    uint16_t reserved1;
+    uint32_t base_lo;
+    uint32_t base_hi;
+    uint32_t length_lo;
+    uint32_t length_hi;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} __attribute__((packed)) srat_memory_affinity_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint16_t reserved1;
+    uint32_t proximity;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__((packed)) srat_x2apic_affinity_t;
+
+// System Locality Information Table
+typedef struct {
+    acpi_sdt_header_t header;
+    uint64_t localities;
+    uint8_t entries[];       // localities x localities distance matrix
+} __attribute__((packed)) acpi_slit_t;
+
+// Physical range owned by a node
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint8_t node;
+} numa_range_t;
+
+// NUMA node
+typedef struct {
+    uint32_t id;
+    uint32_t proximity_domain;
+    uint64_t present_bytes;
+
+    // Zones ordered nearest-first, own zones leading
+    uint32_t zonelist[MAX_MEMORY_ZONES];
+    uint32_t zonelist_len;
+
+    // Statistics
+    uint64_t local_allocs;
+    uint64_t remote_allocs;
+} numa_node_t;
+
+// Function prototypes
+void numa_init(void);
+void numa_build_zonelists(void);
+uint32_t numa_node_of_address(uint64_t phys_addr);
+uint64_t numa_range_end(uint64_t phys_addr);
+uint32_t numa_cpu_to_node(uint32_t cpu);
+uint32_t numa_node_id(void);
+uint8_t numa_distance(uint32_t from, uint32_t to);
+numa_node_t* numa_get_node(uint32_t node);
+void numa_dump(void);
+
+extern uint32_t num_numa_nodes;
+
+#endif // NUMA_H
@@ -0,0 +1,269 @@
+// AION OS Per-CPU Page Caches
+#include "memory.h"
+#include "../core/smp.h"
+
+// One cache per (zone, CPU); only the owning CPU touches its entry
+static per_cpu_pages_t pcp_sets[MAX_MEMORY_ZONES][MAX_CPUS];
+
+// Sampling state for pcp_dump_stats rate reporting
+static uint64_t last_dump_time;
+static pcp_stats_t last_dump_stats[MAX_CPUS];
+
+static inline per_cpu_pages_t* zone_pcp(memory_zone_t *zone, uint32_t cpu) {
+    return &pcp_sets[zone - memory_zones][cpu];
+}
+
+static inline uint32_t pcp_batch(uint32_t order) {
+    uint32_t batch = PCP_BATCH >> order;
+    return batch ? batch : 1;
+}
+
+static inline uint32_t pcp_high(uint32_t order) {
+    uint32_t high = PCP_HIGH >> order;
+    return high > pcp_batch(order) ? high : pcp_batch(order) * 2;
+}
+
+// List helpers
+static void pcp_push_head(pcp_list_t *list, page_t *page) {
+    page->prev = NULL;
+    page->next = list->head;
+    if (list->head) {
+        list->head->prev = page;
+    } else {
+        list->tail = page;
+    }
+    list->head = page;
+    list->count++;
+}
+
+static void pcp_push_tail(pcp_list_t *list, page_t *page) {
+    page->next = NULL;
+    page->prev = list->tail;
+    if (list->tail) {
+        list->tail->next = page;
+    } else {
+        list->head = page;
+    }
+    list->tail = page;
+    list->count++;
+}
+
+static page_t* pcp_pop_head(pcp_list_t *list) {
+    page_t *page = list->head;
+    if (!page) {
+        return NULL;
+    }
+    list->head = page->next;
+    if (list->head) {
+        list->head->prev = NULL;
+    } else {
+        list->tail = NULL;
+    }
+    page->next = NULL;
+    list->count--;
+    return page;
+}
+
+static page_t* pcp_pop_tail(pcp_list_t *list) {
+    page_t *page = list->tail;
+    if (!page) {
+        return NULL;
+    }
+    list->tail = page->prev;
+    if (list->tail) {
+        list->tail->next = NULL;
+    } else {
+        list->head = NULL;
+    }
+    page->prev = NULL;
+    list->count--;
+    return page;
+}
+
+// Pull a batch of blocks from the zone onto this CPU's list
+static void pcp_refill(memory_zone_t *zone, per_cpu_pages_t *pcp, uint32_t order) {
+    page_t *batch[PCP_BATCH];
+    uint32_t got = buddy_alloc_bulk(zone, order, batch, pcp_batch(order));
+
+    for (uint32_t i = 0; i < got; i++) {
+        batch[i]->flags = PAGE_FLAG_PCP;
+        pcp_push_tail(&pcp->lists[order], batch[i]);
+    }
+
+    if (got) {
+        pcp->refills++;
+        pcp->refill_pages += got << order;
+    }
+}
+
+// Return a batch of the coldest blocks on this CPU's list to the zone
+static void pcp_drain(memory_zone_t *zone, per_cpu_pages_t *pcp,
+                      uint32_t order, uint32_t count) {
+    page_t *batch[PCP_BATCH];
+    uint32_t n = 0;
+
+    while (n < count && n < PCP_BATCH) {
+        page_t *page = pcp_pop_tail(&pcp->lists[order]);
+        if (!page) {
+            break;
+        }
+        page->flags = PAGE_FLAG_ALLOCATED;
+        batch[n++] = page;
+    }
+
+    if (n) {
+        buddy_free_bulk(zone, order, batch, n);
+        pcp->drains++;
+        pcp->drain_pages += n << order;
+    }
+}
+
+// Initialize per-CPU page caches
+void pcp_init(void) {
+    memset(pcp_sets, 0, sizeof(pcp_sets));
+    memset(last_dump_stats, 0, sizeof(last_dump_stats));
+    last_dump_time = get_system_time();
+
+    kprintf("[PCP] Per-CPU page caches: orders 0-%d, batch %d, high %d\n",
+            PCP_MAX_ORDER, PCP_BATCH, PCP_HIGH);
+}
+
+// Allocate a small block from this CPU's cache, refilling it from the zone
+page_t* pcp_alloc(memory_zone_t *zone, uint32_t order) {
+    if (order > PCP_MAX_ORDER) {
+        return NULL;
+    }
+
+    uint64_t flags = local_irq_save();
+    per_cpu_pages_t *pcp = zone_pcp(zone, smp_processor_id());
+    pcp_list_t *list = &pcp->lists[order];
+
+    if (list->count) {
+        pcp->alloc_hits++;
+    } else {
+        pcp->alloc_misses++;
+        pcp_refill(zone, pcp, order);
+    }
+
+    page_t *page = pcp_pop_head(list);
+    if (page) {
+        page->flags = PAGE_FLAG_ALLOCATED;
+        page->order = order;
+        page->refcount = 1;
+    }
+
+    local_irq_restore(flags);
+    return page;
+}
+
+// Park a freed small block on this CPU's cache. Cold blocks (e.g. pages
+// whose contents were just evicted) go to the tail so they are reused last.
+bool pcp_free(memory_zone_t *zone, page_t *page, uint32_t order, bool cold) {
+    if (order > PCP_MAX_ORDER) {
+        return false;
+    }
+
+    if (!(page->flags & PAGE_FLAG_ALLOCATED) || page->order != order) {
+        kprintf("[PCP] Bad free of page %p order %d\n", page, order);
+        return true;
+    }
+
+    uint64_t flags = local_irq_save();
+    per_cpu_pages_t *pcp = zone_pcp(zone, smp_processor_id());
+    pcp_list_t *list = &pcp->lists[order];
+
+    page->flags = PAGE_FLAG_PCP;
+    page->refcount = 0;
+    if (cold) {
+        pcp_push_tail(list, page);
+    } else {
+        pcp_push_head(list, page);
+    }
+    pcp->frees++;
+
+    if (list->count >= pcp_high(order)) {
+        pcp_drain(zone, pcp, order, pcp_batch(order));
+    }
+
+    local_irq_restore(flags);
+    return true;
+}
+
+// Return everything a CPU has cached to the zones (CPU offline, low memory)
+void pcp_drain_cpu(uint32_t cpu) {
+    uint64_t flags = local_irq_save();
+
+    for (uint32_t z = 0; z < num_memory_zones; z++) {
+        per_cpu_pages_t *pcp = &pcp_sets[z][cpu];
+        for (uint32_t order = 0; order <= PCP_MAX_ORDER; order++) {
+            while (pcp->lists[order].count) {
+                pcp_drain(&memory_zones[z], pcp, order, PCP_BATCH);
+            }
+        }
+    }
+
+    local_irq_restore(flags);
+}
+
+// Pages parked in every CPU's caches: free, but not on the buddy lists.
+// Read without the owners' cooperation, so only a snapshot.
+uint64_t pcp_cached_pages(void) {
+    uint64_t pages = 0;
+    for (uint32_t z = 0; z < num_memory_zones; z++) {
+        for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+            per_cpu_pages_t *pcp = &pcp_sets[z][cpu];
+            for (uint32_t order = 0; order <= PCP_MAX_ORDER; order++) {
+                pages += (uint64_t)__atomic_load_n(&pcp->lists[order].count,
+                                                   __ATOMIC_RELAXED) << order;
+            }
+        }
+    }
+    return pages;
+}
+
+// Sum a CPU's counters across zones
+void pcp_get_stats(uint32_t cpu, pcp_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    for (uint32_t z = 0; z < num_memory_zones; z++) {
+        per_cpu_pages_t *pcp = &pcp_sets[z][cpu];
+        stats->alloc_hits += pcp->alloc_hits;
+        stats->alloc_misses += pcp->alloc_misses;
+        stats->frees += pcp->frees;
+        stats->refills += pcp->refills;
+        stats->refill_pages += pcp->refill_pages;
+        stats->drains += pcp->drains;
+        stats->drain_pages += pcp->drain_pages;
+        for (uint32_t order = 0; order <= PCP_MAX_ORDER; order++) {
+            stats->cached_pages += pcp->lists[order].count << order;
+        }
+    }
+}
+
+// Print per-CPU counters and refill/drain rates since the previous dump
+void pcp_dump_stats(void) {
+    uint64_t now = get_system_time();
+    uint64_t elapsed_ms = now - last_dump_time;
+    if (elapsed_ms == 0) {
+        elapsed_ms = 1;
+    }
+
+    kprintf("[PCP] cpu  hits      misses    cached  refills/s  drains/s\n");
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        pcp_stats_t stats;
+        pcp_get_stats(cpu, &stats);
+
+        uint64_t refill_rate = (stats.refills - last_dump_stats[cpu].refills) *
+                               1000 / elapsed_ms;
+        uint64_t drain_rate = (stats.drains - last_dump_stats[cpu].drains) *
+                              1000 / elapsed_ms;
+
+        kprintf("[PCP] %-3d  %-8llu  %-8llu  %-6d  %-9llu  %llu\n",
+                cpu, stats.alloc_hits, stats.alloc_misses,
+                stats.cached_pages, refill_rate, drain_rate);
+
+        last_dump_stats[cpu] = stats;
+    }
+
+    last_dump_time = now;
+}
@@ -0,0 +1,57 @@
+#ifndef PCP_H
+#define PCP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "buddy.h"
+
+// Per-CPU page cache constants
+#define PCP_MAX_ORDER 3      // Orders 0..3 are cached per CPU
+#define PCP_BATCH 16         // Pages moved per refill/drain (scaled by order)
+#define PCP_HIGH 96          // Drain once a list holds this many pages
+
+struct memory_zone;
+
+// Hot pages live at the head, cold pages at the tail
+typedef struct {
+    page_t *head;
+    page_t *tail;
+    uint32_t count;          // Blocks on the list
+} pcp_list_t;
+
+// Per-CPU, per-zone page cache
+typedef struct {
+    pcp_list_t lists[PCP_MAX_ORDER + 1];
+
+    // Statistics
+    uint64_t alloc_hits;
+    uint64_t alloc_misses;
+    uint64_t frees;
+    uint64_t refills;
+    uint64_t refill_pages;
+    uint64_t drains;
+    uint64_t drain_pages;
+} __attribute__((aligned(64))) per_cpu_pages_t;
+
+// Aggregated counters for one CPU
+typedef struct {
+    uint64_t alloc_hits;
+    uint64_t alloc_misses;
+    uint64_t frees;
+    uint64_t refills;
+    uint64_t refill_pages;
+    uint64_t drains;
+    uint64_t drain_pages;
+    uint32_t cached_pages;
+} pcp_stats_t;
+
+// Function prototypes
+void pcp_init(void);
+page_t* pcp_alloc(struct memory_zone *zone, uint32_t order);
+bool pcp_free(struct memory_zone *zone, page_t *page, uint32_t order, bool cold);
+void pcp_drain_cpu(uint32_t cpu);
+uint64_t pcp_cached_pages(void);
+void pcp_get_stats(uint32_t cpu, pcp_stats_t *stats);
+void pcp_dump_stats(void);
+
+#endif // PCP_H
@@ -0,0 +1,39 @@
+// AION OS Cache Shrinkers: give reclaimable kernel caches back under pressure
+#include "shrinker.h"
+#include "../core/rcu.h"
+
+static shrinker_t *shrinker_list = NULL;
+
+// Shrinkers register during init, before kcompactd first walks the list
+void register_shrinker(shrinker_t *shrinker) {
+    shrinker->freed = 0;
+    shrinker->next = shrinker_list;
+    rcu_assign_pointer(shrinker_list, shrinker);
+}
+
+// Whether free memory has dropped under SHRINK_WMARK_PERCENT of the total
+bool shrink_needed(uint64_t free_pages) {
+    uint64_t total = 0;
+    for (uint32_t z = 0; z < num_memory_zones; z++) {
+        total += memory_zones[z].num_pages;
+    }
+    return free_pages * 100 < total * SHRINK_WMARK_PERCENT;
+}
+
+// Ask every registered cache for its share. The list only grows, so it is
+// walked without a lock and scan may sleep.
+uint64_t shrink_caches(uint32_t priority) {
+    uint64_t freed = 0;
+
+    for (shrinker_t *s = rcu_dereference(shrinker_list); s; s = s->next) {
+        uint64_t nr = s->count() >> priority;
+        if (!nr) {
+            continue;
+        }
+        uint64_t done = s->scan(nr);
+        s->freed += done;
+        freed += done;
+    }
+
+    return freed;
+}
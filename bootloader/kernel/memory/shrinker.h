@@ -0,0 +1,30 @@
+#ifndef SHRINKER_H
+#define SHRINKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory.h"
+
+// Below this percentage of free pages kcompactd trims the caches
+#define SHRINK_WMARK_PERCENT 5
+
+// Share of each cache asked back per pass: count >> priority
+#define SHRINK_PRIORITY_DEFAULT 2
+#define SHRINK_PRIORITY_URGENT 1  // An allocation has already failed
+
+// A cache of reclaimable objects. count says how many could be freed,
+// scan frees up to nr of them and returns how many it did.
+typedef struct shrinker {
+    const char *name;
+    uint64_t (*count)(void);
+    uint64_t (*scan)(uint64_t nr);
+    uint64_t freed;
+    struct shrinker *next;
+} shrinker_t;
+
+// Function prototypes
+void register_shrinker(shrinker_t *shrinker);
+bool shrink_needed(uint64_t free_pages);
+uint64_t shrink_caches(uint32_t priority);
+
+#endif // SHRINKER_H
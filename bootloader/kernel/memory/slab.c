@@ -0,0 +1,460 @@
+// AION OS Slab Allocator
+#include "memory.h"
+#include "slab.h"
+#include "../fs/vfs.h"
+#include "../fs/procfs.h"
+
+// All caches, for slabinfo and CPU drain
+static kmem_cache_t *cache_list = NULL;
+static spinlock_t cache_list_lock;
+
+// Size-class caches backing kmalloc
+static kmem_cache_t *kmalloc_caches[KMALLOC_NUM_CLASSES];
+
+static inline size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline size_t cache_struct_pages(void) {
+    return (sizeof(kmem_cache_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+static inline void** free_link(kmem_cache_t *cache, void *obj) {
+    return (void**)((uint8_t*)obj + cache->free_offset);
+}
+
+// Slab list helpers
+static void slab_list_add(kmem_slab_t **list, kmem_slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+static void slab_list_del(kmem_slab_t **list, kmem_slab_t *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+// Allocate pages for a new slab and thread its objects onto the free list.
+// Caller holds cache->lock.
+static kmem_slab_t* cache_grow(kmem_cache_t *cache) {
+    size_t pages = 1U << cache->slab_order;
+    uint8_t *base = pmm_alloc_pages(pages);
+    if (!base) {
+        return NULL;
+    }
+
+    size_t slab_bytes = pages * PAGE_SIZE;
+    kmem_slab_t *slab = (kmem_slab_t*)(base + slab_bytes - sizeof(kmem_slab_t));
+    slab->cache = cache;
+    slab->mem = base;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+
+    // Build the free list back to front so objects hand out in address order
+    for (int i = cache->objects_per_slab - 1; i >= 0; i--) {
+        void *obj = base + i * cache->stride;
+        if (cache->ctor) {
+            cache->ctor(obj);
+        }
+        *free_link(cache, obj) = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    // Let kfree find the slab from any page it covers
+    page_t *page = phys_to_page((uint64_t)base);
+    for (size_t i = 0; i < pages; i++) {
+        page[i].flags |= PAGE_FLAG_SLAB;
+        page[i].private = slab;
+    }
+
+    slab_list_add(&cache->empty, slab);
+    cache->num_slabs++;
+    return slab;
+}
+
+// Return an empty slab's pages. Caller holds cache->lock.
+static void cache_release_slab(kmem_cache_t *cache, kmem_slab_t *slab) {
+    size_t pages = 1U << cache->slab_order;
+    page_t *page = phys_to_page((uint64_t)slab->mem);
+    for (size_t i = 0; i < pages; i++) {
+        page[i].flags &= ~PAGE_FLAG_SLAB;
+        page[i].private = NULL;
+    }
+
+    cache->num_slabs--;
+    pmm_free_pages(slab->mem, pages);
+}
+
+// Take one object out of the slab lists. Caller holds cache->lock.
+static void* slab_take_object(kmem_cache_t *cache) {
+    kmem_slab_t *slab = cache->partial;
+
+    if (!slab) {
+        slab = cache->empty;
+        if (!slab) {
+            slab = cache_grow(cache);
+            if (!slab) {
+                return NULL;
+            }
+        }
+        slab_list_del(&cache->empty, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    void *obj = slab->free_list;
+    slab->free_list = *free_link(cache, obj);
+    slab->in_use++;
+    cache->active_objects++;
+
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    return obj;
+}
+
+// Put one object back on its slab. Caller holds cache->lock.
+static void slab_put_object(kmem_cache_t *cache, void *obj) {
+    page_t *page = phys_to_page((uint64_t)obj);
+    kmem_slab_t *slab = page ? page->private : NULL;
+
+    if (!slab || slab->cache != cache) {
+        kprintf("[SLAB] %s: object %p does not belong to this cache\n",
+                cache->name, obj);
+        return;
+    }
+
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    *free_link(cache, obj) = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+    cache->active_objects--;
+
+    if (slab->in_use == 0) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->empty, slab);
+    }
+}
+
+// Move the top half of a magazine back to the slabs
+static void magazine_flush(kmem_cache_t *cache, kmem_magazine_t *mag,
+                           uint32_t count) {
+    spinlock_acquire(&cache->lock);
+    while (count-- && mag->rounds) {
+        slab_put_object(cache, mag->objects[--mag->rounds]);
+    }
+    spinlock_release(&cache->lock);
+}
+
+// Create a named object cache
+kmem_cache_t* kmem_cache_create(const char *name, size_t size, size_t align,
+                                uint32_t flags, void (*ctor)(void *obj)) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (align < SLAB_MIN_ALIGN) {
+        align = SLAB_MIN_ALIGN;
+    }
+    if (flags & SLAB_HWCACHE_ALIGN) {
+        align = align < 64 ? 64 : align;
+    }
+
+    kmem_cache_t *cache = pmm_alloc_pages(cache_struct_pages());
+    if (!cache) {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(kmem_cache_t));
+
+    strncpy(cache->name, name, SLAB_NAME_MAX - 1);
+    cache->object_size = size;
+    cache->flags = flags;
+    cache->ctor = ctor;
+
+    // Constructed objects keep their state while free, so the free-list
+    // link goes after the object instead of over its first word
+    if (ctor) {
+        cache->free_offset = align_up(size, sizeof(void*));
+        cache->stride = align_up(cache->free_offset + sizeof(void*), align);
+    } else {
+        cache->free_offset = 0;
+        cache->stride = align_up(size < sizeof(void*) ? sizeof(void*) : size, align);
+    }
+
+    // Grow the slab until enough objects fit to amortize the descriptor
+    cache->slab_order = 0;
+    while (1) {
+        size_t usable = (PAGE_SIZE << cache->slab_order) - sizeof(kmem_slab_t);
+        cache->objects_per_slab = usable / cache->stride;
+        if (cache->objects_per_slab >= SLAB_MIN_OBJECTS ||
+            cache->slab_order == PCP_MAX_ORDER) {
+            break;
+        }
+        cache->slab_order++;
+    }
+
+    if (cache->objects_per_slab == 0) {
+        kprintf("[SLAB] %s: object size %d too large for a slab\n", name, size);
+        pmm_free_pages(cache, cache_struct_pages());
+        return NULL;
+    }
+
+    spinlock_init(&cache->lock);
+
+    spinlock_acquire(&cache_list_lock);
+    cache->next = cache_list;
+    cache_list = cache;
+    spinlock_release(&cache_list_lock);
+
+    return cache;
+}
+
+// Destroy a cache; all objects must have been freed
+void kmem_cache_destroy(kmem_cache_t *cache) {
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        kmem_magazine_t *mag = &cache->magazines[cpu];
+        magazine_flush(cache, mag, mag->rounds);
+    }
+
+    if (cache->partial || cache->full) {
+        kprintf("[SLAB] %s: destroyed with %d objects in use\n",
+                cache->name, cache->active_objects);
+    }
+    kmem_cache_shrink(cache);
+
+    spinlock_acquire(&cache_list_lock);
+    kmem_cache_t **link = &cache_list;
+    while (*link && *link != cache) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = cache->next;
+    }
+    spinlock_release(&cache_list_lock);
+
+    pmm_free_pages(cache, cache_struct_pages());
+}
+
+// Allocate an object, from this CPU's magazine when possible
+void* kmem_cache_alloc(kmem_cache_t *cache) {
+    void *obj = NULL;
+    uint64_t flags = local_irq_save();
+    kmem_magazine_t *mag = &cache->magazines[smp_processor_id()];
+
+    mag->allocs++;
+    if (mag->rounds) {
+        mag->hits++;
+        obj = mag->objects[--mag->rounds];
+        local_irq_restore(flags);
+        return obj;
+    }
+
+    // Refill half a magazine so the next few allocations stay local
+    spinlock_acquire(&cache->lock);
+    while (mag->rounds < SLAB_MAGAZINE_SIZE / 2) {
+        void *fresh = slab_take_object(cache);
+        if (!fresh) {
+            break;
+        }
+        mag->objects[mag->rounds++] = fresh;
+    }
+    spinlock_release(&cache->lock);
+
+    if (mag->rounds) {
+        obj = mag->objects[--mag->rounds];
+    }
+
+    local_irq_restore(flags);
+    return obj;
+}
+
+// Free an object, into this CPU's magazine when there is room
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!obj) {
+        return;
+    }
+
+    uint64_t flags = local_irq_save();
+    kmem_magazine_t *mag = &cache->magazines[smp_processor_id()];
+
+    mag->frees++;
+    if (mag->rounds == SLAB_MAGAZINE_SIZE) {
+        magazine_flush(cache, mag, SLAB_MAGAZINE_SIZE / 2);
+    }
+    mag->objects[mag->rounds++] = obj;
+
+    local_irq_restore(flags);
+}
+
+// Release all empty slabs, returns pages freed
+uint32_t kmem_cache_shrink(kmem_cache_t *cache) {
+    uint32_t freed = 0;
+
+    spinlock_acquire(&cache->lock);
+    while (cache->empty) {
+        kmem_slab_t *slab = cache->empty;
+        slab_list_del(&cache->empty, slab);
+        cache_release_slab(cache, slab);
+        freed += 1U << cache->slab_order;
+    }
+    spinlock_release(&cache->lock);
+
+    return freed;
+}
+
+// Flush one CPU's magazines in every cache (CPU offline, memory pressure)
+void kmem_cache_drain_cpu(uint32_t cpu) {
+    spinlock_acquire(&cache_list_lock);
+    for (kmem_cache_t *cache = cache_list; cache; cache = cache->next) {
+        kmem_magazine_t *mag = &cache->magazines[cpu];
+        magazine_flush(cache, mag, mag->rounds);
+    }
+    spinlock_release(&cache_list_lock);
+}
+
+static uint32_t slab_list_count(kmem_slab_t *slab) {
+    uint32_t count = 0;
+    for (; slab; slab = slab->next) {
+        count++;
+    }
+    return count;
+}
+
+// Render /proc/slabinfo-style statistics into buf, returns bytes written
+size_t kmem_cache_slabinfo(char *buf, size_t size) {
+    size_t len = 0;
+
+    len += snprintf(buf + len, size - len,
+                    "slabinfo - version: 2.1\n"
+                    "# name            <active_objs> <num_objs> <objsize> "
+                    "<objperslab> <pagesperslab> : slabdata <active_slabs> "
+                    "<num_slabs> : magazine <allocs> <hits>\n");
+
+    spinlock_acquire(&cache_list_lock);
+    for (kmem_cache_t *cache = cache_list; cache && len < size; cache = cache->next) {
+        uint64_t allocs = 0;
+        uint64_t hits = 0;
+        uint32_t cached = 0;
+        for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+            allocs += cache->magazines[cpu].allocs;
+            hits += cache->magazines[cpu].hits;
+            cached += cache->magazines[cpu].rounds;
+        }
+
+        spinlock_acquire(&cache->lock);
+        uint32_t active_slabs = slab_list_count(cache->partial) +
+                                slab_list_count(cache->full);
+        uint32_t active = cache->active_objects - cached;
+        uint32_t total = cache->num_slabs * cache->objects_per_slab;
+        uint32_t num_slabs = cache->num_slabs;
+        spinlock_release(&cache->lock);
+
+        len += snprintf(buf + len, size - len,
+                        "%-17s %6d %6d %6d %4d %4d : slabdata %6d %6d : magazine %llu %llu\n",
+                        cache->name, active, total, (int)cache->object_size,
+                        cache->objects_per_slab, 1 << cache->slab_order,
+                        active_slabs, num_slabs, allocs, hits);
+    }
+    spinlock_release(&cache_list_lock);
+
+    return len < size ? len : size;
+}
+
+// Initialize the slab allocator and the kmalloc size classes
+void slab_init(void) {
+    kprintf("[SLAB] Initializing slab allocator...\n");
+
+    spinlock_init(&cache_list_lock);
+
+    for (int i = 0; i < KMALLOC_NUM_CLASSES; i++) {
+        char name[SLAB_NAME_MAX];
+        size_t size = (size_t)1 << (i + KMALLOC_MIN_SHIFT);
+        snprintf(name, sizeof(name), "kmalloc-%d", (int)size);
+        kmalloc_caches[i] = kmem_cache_create(name, size, size, 0, NULL);
+    }
+
+    procfs_register("slabinfo", kmem_cache_slabinfo);
+    
+    kprintf("[SLAB] kmalloc classes: %d-%d bytes\n",
+            1 << KMALLOC_MIN_SHIFT, 1 << KMALLOC_MAX_SHIFT);
+}
+
+static inline int kmalloc_index(size_t size) {
+    int shift = KMALLOC_MIN_SHIFT;
+    while (((size_t)1 << shift) < size) {
+        shift++;
+    }
+    return shift - KMALLOC_MIN_SHIFT;
+}
+
+// Allocate kernel memory: size classes up to 2KB, whole pages above
+void* kmalloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (size <= ((size_t)1 << KMALLOC_MAX_SHIFT)) {
+        return kmem_cache_alloc(kmalloc_caches[kmalloc_index(size)]);
+    }
+
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages_to_order(pages) > MAX_ORDER) {
+        kprintf("[SLAB] kmalloc(%d) exceeds the largest buddy block\n", size);
+        return NULL;
+    }
+    return pmm_alloc_pages(pages);
+}
+
+// Size classes are naturally aligned, as are buddy blocks
+void* kmalloc_aligned(size_t size, size_t align) {
+    if (align > size) {
+        size = align;
+    }
+    return kmalloc(size);
+}
+
+void* kzalloc(size_t size) {
+    void *ptr = kmalloc(size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+// Free memory from kmalloc, or an object from any cache
+void kfree(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    page_t *page = phys_to_page((uint64_t)ptr);
+    if (!page) {
+        kprintf("[SLAB] kfree of unmanaged pointer %p\n", ptr);
+        return;
+    }
+
+    if (page->flags & PAGE_FLAG_SLAB) {
+        kmem_slab_t *slab = page->private;
+        kmem_cache_free(slab->cache, ptr);
+        return;
+    }
+
+    pmm_free_pages(ptr, (size_t)1 << page->order);
+}
@@ -0,0 +1,83 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../core/smp.h"
+
+// Slab allocator constants
+#define SLAB_NAME_MAX 32
+#define SLAB_MAGAZINE_SIZE 16     // Objects cached per CPU per cache
+#define SLAB_MIN_ALIGN 8
+#define SLAB_MIN_OBJECTS 8        // Grow slab order until this many fit
+#define KMALLOC_MIN_SHIFT 3       // Smallest kmalloc class: 8 bytes
+#define KMALLOC_MAX_SHIFT 11      // Largest kmalloc class: 2048 bytes
+#define KMALLOC_NUM_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+// Cache creation flags
+#define SLAB_HWCACHE_ALIGN 0x01   // Align objects to cache lines
+
+struct kmem_cache;
+
+// Slab descriptor, stored at the end of the slab's pages so objects
+// start page-aligned
+typedef struct kmem_slab {
+    struct kmem_slab *next;
+    struct kmem_slab *prev;
+    struct kmem_cache *cache;
+    void *free_list;              // Embedded free-object list
+    void *mem;                    // First object
+    uint32_t in_use;
+} kmem_slab_t;
+
+// Per-CPU object stack in front of the shared slab lists
+typedef struct {
+    uint32_t rounds;
+    void *objects[SLAB_MAGAZINE_SIZE];
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t hits;
+} __attribute__((aligned(64))) kmem_magazine_t;
+
+// Object cache
+typedef struct kmem_cache {
+    char name[SLAB_NAME_MAX];
+    size_t object_size;           // Size requested by the creator
+    size_t stride;                // Distance between objects
+    size_t free_offset;           // Where the free-list link lives
+    uint32_t flags;
+    uint32_t slab_order;          // Pages per slab = 1 << slab_order
+    uint32_t objects_per_slab;
+    void (*ctor)(void *obj);
+
+    spinlock_t lock;
+    kmem_slab_t *partial;
+    kmem_slab_t *full;
+    kmem_slab_t *empty;
+    uint32_t num_slabs;
+    uint32_t active_objects;      // Objects handed out of slabs
+
+    kmem_magazine_t magazines[MAX_CPUS];
+
+    struct kmem_cache *next;      // Global cache list
+} kmem_cache_t;
+
+// Function prototypes
+void slab_init(void);
+kmem_cache_t* kmem_cache_create(const char *name, size_t size, size_t align,
+                                uint32_t flags, void (*ctor)(void *obj));
+void kmem_cache_destroy(kmem_cache_t *cache);
+void* kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+uint32_t kmem_cache_shrink(kmem_cache_t *cache);
+void kmem_cache_drain_cpu(uint32_t cpu);
+size_t kmem_cache_slabinfo(char *buf, size_t size);
+
+// General-purpose allocation on top of the size-class caches
+void* kmalloc(size_t size);
+void* kmalloc_aligned(size_t size, size_t align);
+void* kzalloc(size_t size);
+void kfree(void *ptr);
+
+#endif // SLAB_H
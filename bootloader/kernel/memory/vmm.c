@@ -0,0 +1,1134 @@
+// AION OS Virtual Memory Manager (x86-64 4-level paging)
+#include "memory.h"
+#include "vmm.h"
+#include "slab.h"
+#include "../core/smp.h"
+#include "../process/process.h"
+
+// Kernel address space (upper half shared into every process)
+static address_space_t kernel_space;
+
+static kmem_cache_t *vma_cache;
+static kmem_cache_t *address_space_cache;
+
+// Address space each CPU has loaded, to keep cpu_mask current
+static address_space_t *cpu_active_as[MAX_CPUS];
+
+// Virtual range for kernel huge-page arenas (bump allocated)
+static uint64_t huge_arena_next = KERNEL_HUGE_BASE;
+static spinlock_t huge_arena_lock;
+
+// Virtual range for vmm_vmap (bump allocated, also guards its tables)
+static uint64_t vmap_next = KERNEL_VMAP_BASE;
+static spinlock_t vmap_lock;
+
+static const int level_shift[] = {0, 12, 21, 30, 39};
+
+static inline uint32_t table_index(uint64_t virt, int level) {
+    return (virt >> level_shift[level]) & 0x1FF;
+}
+
+// Allocate a zeroed page table
+static uint64_t alloc_table(void) {
+    void *table = pmm_alloc_pages(1);
+    if (!table) {
+        return 0;
+    }
+    memset(phys_to_virt((uint64_t)table), 0, PAGE_SIZE);
+    return (uint64_t)table;
+}
+
+// Walk to the entry for virt at the given level (4 = PML4 ... 1 = PT).
+// Returns NULL if a table is missing and create is false, or if a huge
+// mapping sits above the requested level.
+static uint64_t* vmm_walk(uint64_t pml4, uint64_t virt, int level, bool create) {
+    uint64_t *table = phys_to_virt(pml4);
+
+    for (int l = 4; l > level; l--) {
+        uint64_t *entry = &table[table_index(virt, l)];
+
+        if (!(*entry & PTE_PRESENT)) {
+            if (!create) {
+                return NULL;
+            }
+            uint64_t next = alloc_table();
+            if (!next) {
+                return NULL;
+            }
+            // Intermediate entries are permissive, leaves restrict access
+            *entry = next | PTE_PRESENT | PTE_WRITABLE |
+                     (virt < USER_SPACE_END ? PTE_USER : 0);
+        } else if (*entry & PTE_HUGE) {
+            return NULL;
+        }
+
+        table = phys_to_virt(*entry & PTE_ADDR_MASK);
+    }
+
+    return &table[table_index(virt, level)];
+}
+
+// Record the single mapping of an anonymous page so compaction can move it
+static void page_set_movable(uint64_t phys, address_space_t *as, uint64_t virt) {
+    page_t *page = phys_to_page(phys);
+    if (page) {
+        page->private = as;
+        page->index = virt;
+        page->flags |= PAGE_FLAG_MOVABLE;
+    }
+}
+
+// Take an extra reference on a mapped frame. Shared frames cannot be
+// migrated through one mapping, so they stop being movable.
+static void page_get(uint64_t phys) {
+    page_t *page = phys_to_page(phys);
+    if (page) {
+        page->flags &= ~PAGE_FLAG_MOVABLE;
+        __atomic_add_fetch(&page->refcount, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Drop a reference, freeing the block with the last one
+static void page_put(uint64_t phys, uint32_t order) {
+    page_t *page = phys_to_page(phys);
+    if (page && __atomic_sub_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        page->refcount = 1;    // pmm_free_pages expects an allocated block
+        pmm_free_pages((void*)phys, 1U << order);
+    }
+}
+
+static uint64_t vma_pte_flags(vm_area_t *vma) {
+    uint64_t flags = PTE_PRESENT;
+    if (vma->flags & VMA_WRITE) {
+        flags |= PTE_WRITABLE;
+    }
+    if (vma->flags & VMA_USER) {
+        flags |= PTE_USER;
+    }
+    if (!(vma->flags & VMA_EXEC)) {
+        flags |= PTE_NX;
+    }
+    return flags;
+}
+
+// Initialize the VMM on top of the boot page tables
+void vmm_init(void) {
+    kprintf("[VMM] Initializing virtual memory manager...\n");
+
+    uint64_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    kernel_space.pml4 = cr3 & PTE_ADDR_MASK;
+    kernel_space.vmas = NULL;
+    spinlock_init(&kernel_space.lock);
+    spinlock_init(&huge_arena_lock);
+    spinlock_init(&vmap_lock);
+
+    // Create the arenas' PDPTs now so address spaces created later share them
+    vmm_walk(kernel_space.pml4, KERNEL_HUGE_BASE, 3, true);
+    vmm_walk(kernel_space.pml4, KERNEL_VMAP_BASE, 3, true);
+
+    vma_cache = kmem_cache_create("vm_area", sizeof(vm_area_t), 0, 0, NULL);
+    address_space_cache = kmem_cache_create("address_space", sizeof(address_space_t),
+                                            0, SLAB_HWCACHE_ALIGN, NULL);
+
+    kprintf("[VMM] Kernel PML4 at 0x%llx\n", kernel_space.pml4);
+}
+
+// Create an address space sharing the kernel half
+address_space_t* vmm_create_address_space(void) {
+    address_space_t *as = kmem_cache_alloc(address_space_cache);
+    if (!as) {
+        return NULL;
+    }
+    memset(as, 0, sizeof(address_space_t));
+
+    as->pml4 = alloc_table();
+    if (!as->pml4) {
+        kmem_cache_free(address_space_cache, as);
+        return NULL;
+    }
+
+    uint64_t *dst = phys_to_virt(as->pml4);
+    uint64_t *src = phys_to_virt(kernel_space.pml4);
+    for (int i = KERNEL_PML4_START; i < PAGE_TABLE_ENTRIES; i++) {
+        dst[i] = src[i];
+    }
+
+    spinlock_init(&as->lock);
+    return as;
+}
+
+// Free a user table subtree, dropping references on mapped frames
+static void free_user_table(uint64_t table_phys, int level) {
+    uint64_t *table = phys_to_virt(table_phys);
+
+    for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        uint64_t entry = table[i];
+        if (!(entry & PTE_PRESENT)) {
+            continue;
+        }
+
+        if (level == 1) {
+            page_put(entry & PTE_ADDR_MASK, 0);
+        } else if (level == 2 && (entry & PTE_HUGE)) {
+            page_put(entry & PTE_ADDR_MASK, HUGE_PAGE_ORDER);
+        } else {
+            free_user_table(entry & PTE_ADDR_MASK, level - 1);
+        }
+    }
+
+    pmm_free_pages((void*)table_phys, 1);
+}
+
+// A VMA now refers to its object
+static void vma_open(vm_area_t *vma) {
+    if (vma->ops && vma->ops->open) {
+        vma->ops->open(vma->object);
+    }
+}
+
+// Free a VMA, dropping its object reference. Not under the address space
+// lock: close may sleep.
+static void vma_free(vm_area_t *vma) {
+    if (vma->ops && vma->ops->close) {
+        vma->ops->close(vma->object);
+    }
+    kmem_cache_free(vma_cache, vma);
+}
+
+// Tear down an address space
+void vmm_destroy_address_space(address_space_t *as) {
+    uint64_t *pml4 = phys_to_virt(as->pml4);
+    for (int i = 0; i < KERNEL_PML4_START; i++) {
+        if (pml4[i] & PTE_PRESENT) {
+            free_user_table(pml4[i] & PTE_ADDR_MASK, 3);
+        }
+    }
+    pmm_free_pages((void*)as->pml4, 1);
+
+    vm_area_t *vma = as->vmas;
+    while (vma) {
+        vm_area_t *next = vma->next;
+        vma_free(vma);
+        vma = next;
+    }
+
+    kmem_cache_free(address_space_cache, as);
+}
+
+// Load an address space on this CPU
+// Kernel-only address space, for tasks that have dropped their own
+address_space_t* vmm_kernel_space(void) {
+    return &kernel_space;
+}
+
+// Load an address space. Its cpu_mask bit is set before CR3 can cache
+// any of its translations, and the previous one's cleared after the
+// reload has dropped them.
+void vmm_switch(address_space_t *as) {
+    uint64_t flags = local_irq_save();
+    uint32_t cpu = smp_processor_id();
+    address_space_t *prev = cpu_active_as[cpu];
+
+    __atomic_fetch_or(&as->cpu_mask, 1ULL << cpu, __ATOMIC_SEQ_CST);
+    asm volatile("mov %0, %%cr3" : : "r"(as->pml4) : "memory");
+    if (prev && prev != as) {
+        __atomic_fetch_and(&prev->cpu_mask, ~(1ULL << cpu), __ATOMIC_RELEASE);
+    }
+    cpu_active_as[cpu] = as;
+
+    local_irq_restore(flags);
+}
+
+// Map one 4KB page
+int vmm_map_page(address_space_t *as, uint64_t virt, uint64_t phys, uint64_t flags) {
+    uint64_t *pte = vmm_walk(as->pml4, virt, 1, true);
+    if (!pte) {
+        return -ENOMEM;
+    }
+
+    *pte = (phys & PTE_ADDR_MASK) | flags | PTE_PRESENT;
+    vmm_flush_tlb(virt);
+    return 0;
+}
+
+// Map one 2MB page with a PS=1 directory entry
+int vmm_map_huge_page(address_space_t *as, uint64_t virt, uint64_t phys, uint64_t flags) {
+    if ((virt | phys) & (HUGE_PAGE_SIZE - 1)) {
+        return -EINVAL;
+    }
+
+    uint64_t *pde = vmm_walk(as->pml4, virt, 2, true);
+    if (!pde) {
+        return -ENOMEM;
+    }
+    if ((*pde & PTE_PRESENT) && !(*pde & PTE_HUGE)) {
+        return -EEXIST;        // Already split into 4KB pages
+    }
+
+    *pde = (phys & PTE_ADDR_MASK) | flags | PTE_PRESENT | PTE_HUGE;
+    vmm_flush_tlb(virt);
+    return 0;
+}
+
+// Unmap a range, dropping references on the frames behind it
+void vmm_unmap(address_space_t *as, uint64_t virt, size_t length) {
+    uint64_t end = virt + length;
+
+    while (virt < end) {
+        uint64_t next_pd = (virt + HUGE_PAGE_SIZE) & ~((uint64_t)HUGE_PAGE_SIZE - 1);
+        uint64_t *pde = vmm_walk(as->pml4, virt, 2, false);
+
+        if (!pde || !(*pde & PTE_PRESENT)) {
+            virt = next_pd;
+            continue;
+        }
+
+        if (*pde & PTE_HUGE) {
+            // Callers only unmap whole huge pages
+            page_put(*pde & PTE_ADDR_MASK, HUGE_PAGE_ORDER);
+            *pde = 0;
+            vmm_flush_tlb(virt);
+            as->huge_pages--;
+            virt = next_pd;
+            continue;
+        }
+
+        uint64_t limit = next_pd < end ? next_pd : end;
+        for (; virt < limit; virt += PAGE_SIZE) {
+            uint64_t *pte = vmm_walk(as->pml4, virt, 1, false);
+            if (pte && (*pte & PTE_PRESENT)) {
+                page_put(*pte & PTE_ADDR_MASK, 0);
+                *pte = 0;
+                vmm_flush_tlb(virt);
+                as->resident_pages--;
+            }
+        }
+    }
+}
+
+// Translate a virtual address, 0 if unmapped
+uint64_t vmm_translate(address_space_t *as, uint64_t virt) {
+    uint64_t *pde = vmm_walk(as->pml4, virt, 2, false);
+    if (!pde || !(*pde & PTE_PRESENT)) {
+        return 0;
+    }
+    if (*pde & PTE_HUGE) {
+        return (*pde & PTE_ADDR_MASK) + (virt & (HUGE_PAGE_SIZE - 1));
+    }
+
+    uint64_t *pte = vmm_walk(as->pml4, virt, 1, false);
+    if (!pte || !(*pte & PTE_PRESENT)) {
+        return 0;
+    }
+    return (*pte & PTE_ADDR_MASK) + (virt & (PAGE_SIZE - 1));
+}
+
+// VMA lookup
+vm_area_t* vmm_find_vma(address_space_t *as, uint64_t addr) {
+    for (vm_area_t *vma = as->vmas; vma && vma->start <= addr; vma = vma->next) {
+        if (addr < vma->end) {
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+static void vma_insert(address_space_t *as, vm_area_t *vma) {
+    vm_area_t **link = &as->vmas;
+    while (*link && (*link)->start < vma->start) {
+        link = &(*link)->next;
+    }
+    vma->next = *link;
+    *link = vma;
+}
+
+// First gap of length bytes at the given alignment
+static uint64_t find_unmapped_area(address_space_t *as, size_t length, uint64_t align) {
+    uint64_t candidate = USER_MMAP_BASE;
+
+    for (vm_area_t *vma = as->vmas; vma; vma = vma->next) {
+        if (vma->end <= candidate) {
+            continue;
+        }
+        if (candidate + length <= vma->start) {
+            break;
+        }
+        candidate = (vma->end + align - 1) & ~(align - 1);
+    }
+
+    return candidate + length <= USER_SPACE_END ? candidate : 0;
+}
+
+// Map kernel-owned frames into user space, e.g. the clock page or an I/O
+// ring. virt 0 picks a free range. The VMA keeps mmap away from them; the
+// extra references keep teardown from freeing the frames. Returns the user
+// address, 0 on failure.
+uint64_t vmm_install_special_pages(address_space_t *as, uint64_t virt, const uint64_t *phys,
+                                   size_t count, uint64_t flags) {
+    vm_area_t *vma = kmem_cache_alloc(vma_cache);
+    if (!vma) {
+        return 0;
+    }
+
+    spinlock_acquire(&as->lock);
+    if (!virt) {
+        virt = find_unmapped_area(as, count * PAGE_SIZE, PAGE_SIZE);
+    }
+
+    for (size_t i = 0; virt && i < count; i++) {
+        if (vmm_map_page(as, virt + i * PAGE_SIZE, phys[i], flags) < 0) {
+            vmm_unmap(as, virt, i * PAGE_SIZE);
+            virt = 0;
+            break;
+        }
+        page_get(phys[i]);
+    }
+    if (!virt) {
+        spinlock_release(&as->lock);
+        kmem_cache_free(vma_cache, vma);
+        return 0;
+    }
+
+    vma->start = virt;
+    vma->end = virt + count * PAGE_SIZE;
+    vma->flags = VMA_USER | VMA_READ | VMA_SHARED;
+    vma->ops = NULL;
+    vma->object = NULL;
+    vma->pgoff = 0;
+    if (flags & PTE_WRITABLE) {
+        vma->flags |= VMA_WRITE;
+    }
+    vma_insert(as, vma);
+    spinlock_release(&as->lock);
+
+    return virt;
+}
+
+int vmm_install_special_page(address_space_t *as, uint64_t virt, uint64_t phys,
+                             uint64_t flags) {
+    return vmm_install_special_pages(as, virt, &phys, 1, flags) ? 0 : -ENOMEM;
+}
+
+// Drop the kernel's own reference on a special page
+void vmm_release_special_page(uint64_t phys) {
+    page_put(phys, 0);
+}
+
+// Reserve a lazily populated range. Anonymous memory when ops is NULL,
+// otherwise pages of object from pgoff on.
+static void* mmap_region(address_space_t *as, void *addr, size_t length, int prot, int flags,
+                         const vm_ops_t *ops, void *object, uint64_t pgoff) {
+    if (length == 0) {
+        return MAP_FAILED;
+    }
+
+    length = (length + PAGE_SIZE - 1) & ~((uint64_t)PAGE_SIZE - 1);
+
+    // Large anonymous regions get 2MB alignment so faults can use huge pages
+    bool huge = !ops && length >= HUGE_PAGE_SIZE;
+    uint64_t align = huge ? HUGE_PAGE_SIZE : PAGE_SIZE;
+    uint64_t start = (uint64_t)addr;
+
+    if (flags & MAP_FIXED) {
+        if (start & (PAGE_SIZE - 1) || start + length > USER_SPACE_END) {
+            return MAP_FAILED;
+        }
+        if (vmm_munmap(as, addr, length) < 0) {
+            return MAP_FAILED;
+        }
+    }
+
+    vm_area_t *vma = kmem_cache_alloc(vma_cache);
+    if (!vma) {
+        return MAP_FAILED;
+    }
+
+    spinlock_acquire(&as->lock);
+
+    if (!(flags & MAP_FIXED)) {
+        start = find_unmapped_area(as, length, align);
+        if (!start) {
+            spinlock_release(&as->lock);
+            kmem_cache_free(vma_cache, vma);
+            return MAP_FAILED;
+        }
+    }
+
+    vma->start = start;
+    vma->end = start + length;
+    vma->flags = VMA_USER | (ops ? 0 : VMA_ANON);
+    vma->ops = ops;
+    vma->object = object;
+    vma->pgoff = pgoff;
+    if (prot & PROT_READ) vma->flags |= VMA_READ;
+    if (prot & PROT_WRITE) vma->flags |= VMA_WRITE;
+    if (prot & PROT_EXEC) vma->flags |= VMA_EXEC;
+    if (flags & MAP_SHARED) vma->flags |= VMA_SHARED;
+    if (huge) vma->flags |= VMA_HUGE;
+    vma_insert(as, vma);
+    vma_open(vma);
+
+    spinlock_release(&as->lock);
+    return (void*)start;
+}
+
+// Create a lazily populated anonymous mapping
+void* vmm_mmap(address_space_t *as, void *addr, size_t length, int prot, int flags) {
+    if (!(flags & MAP_ANONYMOUS)) {
+        return MAP_FAILED;
+    }
+    return mmap_region(as, addr, length, prot, flags, NULL, NULL, 0);
+}
+
+// Map pages of an object, filled by ops->fault on first touch. With
+// MAP_SHARED every mapping writes the object's own frames; with
+// MAP_PRIVATE they are shared read-only and copied on the first write.
+void* vmm_mmap_object(address_space_t *as, void *addr, size_t length, int prot, int flags,
+                      const vm_ops_t *ops, void *object, uint64_t pgoff) {
+    if (!ops || (flags & MAP_ANONYMOUS) ||
+        !(flags & MAP_SHARED) == !(flags & MAP_PRIVATE)) {
+        return MAP_FAILED;
+    }
+    return mmap_region(as, addr, length, prot, flags, ops, object, pgoff);
+}
+
+// Remove mappings in [addr, addr + length), splitting VMAs as needed
+int vmm_munmap(address_space_t *as, void *addr, size_t length) {
+    uint64_t start = (uint64_t)addr;
+    uint64_t end = start + ((length + PAGE_SIZE - 1) & ~((uint64_t)PAGE_SIZE - 1));
+
+    if (start & (PAGE_SIZE - 1) || end > USER_SPACE_END) {
+        return -EINVAL;
+    }
+
+    spinlock_acquire(&as->lock);
+
+    // Huge mappings are only torn down whole
+    for (vm_area_t *vma = as->vmas; vma && vma->start < end; vma = vma->next) {
+        if (vma->end > start && (vma->flags & VMA_HUGE) &&
+            (vma->start < start || vma->end > end)) {
+            spinlock_release(&as->lock);
+            return -EINVAL;
+        }
+    }
+
+    // Removed VMAs are freed once the lock is dropped
+    vm_area_t *removed = NULL;
+    vm_area_t **link = &as->vmas;
+    while (*link && (*link)->start < end) {
+        vm_area_t *vma = *link;
+
+        if (vma->end <= start) {
+            link = &vma->next;
+            continue;
+        }
+
+        if (vma->start >= start && vma->end <= end) {
+            // Fully covered
+            *link = vma->next;
+            vma->next = removed;
+            removed = vma;
+            continue;
+        }
+
+        if (vma->start < start && vma->end > end) {
+            // Hole in the middle: split off the tail
+            vm_area_t *tail = kmem_cache_alloc(vma_cache);
+            if (!tail) {
+                spinlock_release(&as->lock);
+                return -ENOMEM;
+            }
+            *tail = *vma;
+            tail->start = end;
+            tail->pgoff += (end - vma->start) >> PAGE_SHIFT;
+            vma->end = start;
+            vma->next = tail;
+            vma_open(tail);
+            break;
+        }
+
+        if (vma->start < start) {
+            vma->end = start;
+        } else {
+            vma->pgoff += (end - vma->start) >> PAGE_SHIFT;
+            vma->start = end;
+        }
+        link = &vma->next;
+    }
+
+    vmm_unmap(as, start, end - start);
+
+    spinlock_release(&as->lock);
+
+    while (removed) {
+        vm_area_t *next = removed->next;
+        vma_free(removed);
+        removed = next;
+    }
+    return 0;
+}
+
+// Copy a user table subtree for fork, write-protecting private pages
+static int fork_table(vm_area_t *vmas, uint64_t *src, uint64_t *dst,
+                      int level, uint64_t base) {
+    for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        uint64_t entry = src[i];
+        if (!(entry & PTE_PRESENT)) {
+            continue;
+        }
+
+        uint64_t virt = base + ((uint64_t)i << level_shift[level]);
+        bool leaf = level == 1 || (level == 2 && (entry & PTE_HUGE));
+
+        if (!leaf) {
+            uint64_t table = alloc_table();
+            if (!table) {
+                return -ENOMEM;
+            }
+            dst[i] = table | (entry & ~PTE_ADDR_MASK);
+            int result = fork_table(vmas, phys_to_virt(entry & PTE_ADDR_MASK),
+                                    phys_to_virt(table), level - 1, virt);
+            if (result < 0) {
+                return result;
+            }
+            continue;
+        }
+
+        // Private writable pages become copy-on-write in both processes
+        if (entry & (PTE_WRITABLE | PTE_COW)) {
+            vm_area_t *vma = vmas;
+            while (vma && !(virt >= vma->start && virt < vma->end)) {
+                vma = vma->next;
+            }
+            if (!vma || !(vma->flags & VMA_SHARED)) {
+                entry = (entry & ~PTE_WRITABLE) | PTE_COW;
+                src[i] = entry;
+            }
+        }
+
+        page_get(entry & PTE_ADDR_MASK);
+        dst[i] = entry;
+    }
+
+    return 0;
+}
+
+// Duplicate an address space for fork
+address_space_t* vmm_fork(address_space_t *parent) {
+    address_space_t *child = vmm_create_address_space();
+    if (!child) {
+        return NULL;
+    }
+
+    spinlock_acquire(&parent->lock);
+
+    // Copy the VMA list
+    vm_area_t **tail = &child->vmas;
+    for (vm_area_t *vma = parent->vmas; vma; vma = vma->next) {
+        vm_area_t *copy = kmem_cache_alloc(vma_cache);
+        if (!copy) {
+            spinlock_release(&parent->lock);
+            vmm_destroy_address_space(child);
+            return NULL;
+        }
+        *copy = *vma;
+        copy->next = NULL;
+        vma_open(copy);
+        *tail = copy;
+        tail = &copy->next;
+    }
+
+    // Share frames, write-protecting private ones
+    uint64_t *src = phys_to_virt(parent->pml4);
+    uint64_t *dst = phys_to_virt(child->pml4);
+    int result = 0;
+    for (int i = 0; i < KERNEL_PML4_START && result == 0; i++) {
+        if (!(src[i] & PTE_PRESENT)) {
+            continue;
+        }
+        uint64_t table = alloc_table();
+        if (!table) {
+            result = -ENOMEM;
+            break;
+        }
+        dst[i] = table | (src[i] & ~PTE_ADDR_MASK);
+        result = fork_table(parent->vmas, phys_to_virt(src[i] & PTE_ADDR_MASK),
+                            phys_to_virt(table), 3, (uint64_t)i << 39);
+    }
+
+    child->resident_pages = parent->resident_pages;
+    child->huge_pages = parent->huge_pages;
+
+    // The TLB may still hold writable translations of the parent, but
+    // only if it is the address space loaded here. Anything else keeps
+    // its CR3; loading the parent's could leave this CPU on a table that
+    // its owner then frees.
+    uint64_t flags = local_irq_save();
+    if (cpu_active_as[smp_processor_id()] == parent) {
+        asm volatile("mov %0, %%cr3" : : "r"(parent->pml4) : "memory");
+    }
+    local_irq_restore(flags);
+
+    spinlock_release(&parent->lock);
+
+    if (result < 0) {
+        vmm_destroy_address_space(child);
+        return NULL;
+    }
+    return child;
+}
+
+// Populate a not-present page in an anonymous VMA with zeroes
+static bool demand_fault(address_space_t *as, vm_area_t *vma, uint64_t addr) {
+    if (!(vma->flags & VMA_ANON)) {
+        return false;
+    }
+
+    uint64_t flags = vma_pte_flags(vma);
+    uint64_t huge_base = addr & ~((uint64_t)HUGE_PAGE_SIZE - 1);
+
+    // A 2MB page already covers addr: raced with another fault on the block
+    uint64_t *pde = vmm_walk(as->pml4, huge_base, 2, false);
+    if (pde && (*pde & PTE_PRESENT) && (*pde & PTE_HUGE)) {
+        return true;
+    }
+
+    // Use a 2MB page when the whole aligned block lies inside the VMA and
+    // nothing below it has been split into 4KB pages yet
+    if ((vma->flags & VMA_HUGE) && huge_base >= vma->start &&
+        huge_base + HUGE_PAGE_SIZE <= vma->end) {
+        pde = vmm_walk(as->pml4, huge_base, 2, true);
+        if (pde && !(*pde & PTE_PRESENT)) {
+            void *frame = pmm_alloc_pages(1U << HUGE_PAGE_ORDER);
+            if (frame) {
+                memset(phys_to_virt((uint64_t)frame), 0, HUGE_PAGE_SIZE);
+                *pde = (uint64_t)frame | flags | PTE_HUGE;
+                as->huge_pages++;
+                as->demand_faults++;
+                return true;
+            }
+        }
+    }
+
+    uint64_t virt = addr & ~((uint64_t)PAGE_SIZE - 1);
+    uint64_t *pte = vmm_walk(as->pml4, virt, 1, false);
+    if (pte && (*pte & PTE_PRESENT)) {
+        return true;           // Raced with a migration or another fault
+    }
+
+    void *frame = pmm_alloc_pages(1);
+    if (!frame) {
+        return false;
+    }
+    memset(phys_to_virt((uint64_t)frame), 0, PAGE_SIZE);
+
+    if (vmm_map_page(as, virt, (uint64_t)frame, flags) < 0) {
+        pmm_free_pages(frame, 1);
+        return false;
+    }
+
+    page_set_movable((uint64_t)frame, as, virt);
+    as->resident_pages++;
+    as->demand_faults++;
+    return true;
+}
+
+// Break copy-on-write sharing on a write fault
+static bool cow_fault(address_space_t *as, uint64_t addr) {
+    uint64_t *entry = vmm_walk(as->pml4, addr, 2, false);
+    uint32_t order = HUGE_PAGE_ORDER;
+    uint64_t size = HUGE_PAGE_SIZE;
+
+    if (!entry || !(*entry & PTE_HUGE)) {
+        entry = vmm_walk(as->pml4, addr, 1, false);
+        order = 0;
+        size = PAGE_SIZE;
+    }
+
+    if (!entry || !(*entry & PTE_COW)) {
+        return false;
+    }
+
+    uint64_t virt = addr & ~(size - 1);
+    uint64_t old_phys = *entry & PTE_ADDR_MASK;
+    uint64_t flags = (*entry & ~PTE_ADDR_MASK & ~PTE_COW) | PTE_WRITABLE;
+    page_t *page = phys_to_page(old_phys);
+
+    uint64_t new_phys = old_phys;
+    if (page && __atomic_load_n(&page->refcount, __ATOMIC_ACQUIRE) == 1) {
+        // Last user: take the frame over in place
+        *entry = old_phys | flags;
+    } else {
+        void *frame = pmm_alloc_pages(1U << order);
+        if (!frame) {
+            return false;
+        }
+        memcpy(phys_to_virt((uint64_t)frame), phys_to_virt(old_phys), size);
+        new_phys = (uint64_t)frame;
+        *entry = new_phys | flags;
+        page_put(old_phys, order);
+    }
+
+    if (order == 0) {
+        page_set_movable(new_phys, as, virt);
+    }
+
+    vmm_flush_tlb(virt);
+    as->cow_faults++;
+    return true;
+}
+
+// Fault in a page of an object mapping. Filling the page may read a file,
+// so as->lock is dropped around the callbacks and the VMA checked again
+// afterwards. Called and returns with as->lock held.
+static bool object_fault(address_space_t *as, vm_area_t *vma, uint64_t addr,
+                         uint64_t error_code) {
+    uint64_t virt = addr & ~((uint64_t)PAGE_SIZE - 1);
+    bool write = error_code & PF_WRITE;
+    bool shared = vma->flags & VMA_SHARED;
+    const vm_ops_t *ops = vma->ops;
+    void *object = vma->object;
+    uint64_t pgoff = vma->pgoff + ((virt - vma->start) >> PAGE_SHIFT);
+    uint64_t *pte;
+
+    if (error_code & PF_PRESENT) {
+        // First write to a shared page mapped read-only
+        if (!write || !shared) {
+            return false;
+        }
+        spinlock_release(&as->lock);
+        int result = ops->page_mkwrite ? ops->page_mkwrite(object, pgoff) : 0;
+        spinlock_acquire(&as->lock);
+        if (result < 0) {
+            return false;
+        }
+
+        pte = vmm_walk(as->pml4, virt, 1, false);
+        if (pte && (*pte & PTE_PRESENT)) {
+            *pte |= PTE_WRITABLE;
+            vmm_flush_tlb(virt);
+        }
+        return true;
+    }
+
+    spinlock_release(&as->lock);
+    uint64_t phys = ops->fault(object, pgoff);
+    if (phys && shared && write && ops->page_mkwrite &&
+        ops->page_mkwrite(object, pgoff) < 0) {
+        page_put(phys, 0);
+        phys = 0;
+    }
+    spinlock_acquire(&as->lock);
+    if (!phys) {
+        return false;
+    }
+
+    // Unmapped, remapped or faulted in by another thread meanwhile: let
+    // the access retry against whatever is there now
+    vma = vmm_find_vma(as, addr);
+    pte = vmm_walk(as->pml4, virt, 1, false);
+    if (!vma || vma->ops != ops || vma->object != object ||
+        vma->pgoff + ((virt - vma->start) >> PAGE_SHIFT) != pgoff ||
+        (pte && (*pte & PTE_PRESENT))) {
+        page_put(phys, 0);
+        return vma != NULL;
+    }
+
+    // Shared pages become writable on their first write, so the object
+    // learns which ones were dirtied. Private ones are copied then.
+    uint64_t flags = vma_pte_flags(vma);
+    if (!shared || !write) {
+        flags &= ~PTE_WRITABLE;
+    }
+    if (!shared && (vma->flags & VMA_WRITE)) {
+        flags |= PTE_COW;
+    }
+
+    if (vmm_map_page(as, virt, phys, flags) < 0) {
+        page_put(phys, 0);
+        return false;
+    }
+    as->resident_pages++;
+    as->file_faults++;
+
+    if (!shared && write) {
+        return cow_fault(as, addr);
+    }
+    return true;
+}
+
+// Resolve a page fault in an address space, false if it is a real fault
+bool vmm_handle_fault(address_space_t *as, uint64_t addr, uint64_t error_code) {
+    spinlock_acquire(&as->lock);
+
+    vm_area_t *vma = vmm_find_vma(as, addr);
+    bool handled = false;
+
+    if (vma &&
+        !((error_code & PF_WRITE) && !(vma->flags & VMA_WRITE)) &&
+        !((error_code & PF_USER) && !(vma->flags & VMA_USER))) {
+        if (vma->ops && (!(error_code & PF_PRESENT) || (vma->flags & VMA_SHARED))) {
+            handled = object_fault(as, vma, addr, error_code);
+        } else if (!(error_code & PF_PRESENT)) {
+            handled = demand_fault(as, vma, addr);
+        } else if (error_code & PF_WRITE) {
+            handled = cow_fault(as, addr);
+        }
+    }
+
+    spinlock_release(&as->lock);
+    return handled;
+}
+
+void vmm_unpin_user_pages(vm_pin_t *pin) {
+    for (uint32_t i = 0; i < pin->nr_pins; i++) {
+        page_put(pin->heads[i], pin->orders[i]);
+    }
+    pin->nr_pins = 0;
+    pin->nr_pages = 0;
+}
+
+// Fault in the user pages under [addr, addr + length) and take a reference
+// on each frame, so a device can be given their physical addresses and an
+// munmap meanwhile cannot free them. write means the device writes the
+// buffer, which then needs writable, unshared pages. Returns 0, -EINVAL if
+// the range is too long or not user space, or -EFAULT; nothing stays
+// pinned on failure.
+int vmm_pin_user_pages(address_space_t *as, uint64_t addr, size_t length, bool write,
+                       vm_pin_t *pin) {
+    pin->nr_pages = 0;
+    pin->nr_pins = 0;
+    if (!length || addr + length < addr || addr + length > USER_SPACE_END) {
+        return -EINVAL;
+    }
+
+    uint64_t first = addr & ~((uint64_t)PAGE_SIZE - 1);
+    uint64_t last = (addr + length - 1) & ~((uint64_t)PAGE_SIZE - 1);
+    if ((last - first) / PAGE_SIZE >= VMM_PIN_MAX_PAGES) {
+        return -EINVAL;
+    }
+
+    uint64_t error_code = PF_USER | (write ? PF_WRITE : 0);
+    for (uint64_t virt = first; virt <= last; virt += PAGE_SIZE) {
+        // A fault may be undone by a racing unmap or migration, so retry a
+        // few times before giving up
+        for (int tries = 0; ; tries++) {
+            spinlock_acquire(&as->lock);
+
+            vm_area_t *vma = vmm_find_vma(as, virt);
+            if (!vma || !(vma->flags & VMA_USER) || (write && !(vma->flags & VMA_WRITE))) {
+                spinlock_release(&as->lock);
+                vmm_unpin_user_pages(pin);
+                return -EFAULT;
+            }
+
+            uint64_t *entry = vmm_walk(as->pml4, virt, 2, false);
+            uint32_t order = HUGE_PAGE_ORDER;
+            uint64_t size = HUGE_PAGE_SIZE;
+            if (entry && (*entry & PTE_PRESENT) && !(*entry & PTE_HUGE)) {
+                entry = vmm_walk(as->pml4, virt, 1, false);
+                order = 0;
+                size = PAGE_SIZE;
+            }
+
+            bool present = entry && (*entry & PTE_PRESENT);
+            if (present && (!write || (*entry & PTE_WRITABLE))) {
+                uint64_t head = *entry & PTE_ADDR_MASK;
+                pin->phys[pin->nr_pages++] = head + (virt & (size - 1));
+                if (!pin->nr_pins || pin->heads[pin->nr_pins - 1] != head) {
+                    page_get(head);
+                    pin->heads[pin->nr_pins] = head;
+                    pin->orders[pin->nr_pins++] = order;
+                }
+                spinlock_release(&as->lock);
+                break;
+            }
+            spinlock_release(&as->lock);
+
+            if (tries == 3 ||
+                !vmm_handle_fault(as, virt, error_code | (present ? PF_PRESENT : 0))) {
+                vmm_unpin_user_pages(pin);
+                return -EFAULT;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Move the single mapping of a movable page to new_phys for compaction.
+// Fails if the page was unmapped, shared or remapped since it was marked.
+bool vmm_migrate_page(page_t *page, uint64_t old_phys, uint64_t new_phys) {
+    address_space_t *as = page->private;
+    uint64_t virt = page->index;
+    // Checked again under the lock; this one keeps us off the lock of an
+    // address space our own caller may be holding
+    if (!as || __atomic_load_n(&as->cpu_mask, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    spinlock_acquire(&as->lock);
+
+    uint64_t *pte = vmm_walk(as->pml4, virt, 1, false);
+    if (!(page->flags & PAGE_FLAG_MOVABLE) || page->private != as || !pte ||
+        (*pte & (PTE_PRESENT | PTE_ADDR_MASK)) != (old_phys | PTE_PRESENT)) {
+        spinlock_release(&as->lock);
+        return false;
+    }
+
+    // Faults on this address wait on the lock and find the new frame.
+    // There is no TLB shootdown, so leave the page alone while any CPU
+    // has the address space loaded: its TLB could keep writing the old
+    // frame during and after the copy. A CPU loading it after the check
+    // walks the cleared entry instead. That includes this CPU, so direct
+    // compaction from an allocation made under the running address
+    // space's lock never comes back for that lock.
+    uint64_t entry = *pte;
+    *pte = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&as->cpu_mask, __ATOMIC_RELAXED)) {
+        *pte = entry;
+        spinlock_release(&as->lock);
+        return false;
+    }
+    vmm_flush_tlb(virt);
+
+    memcpy(phys_to_virt(new_phys), phys_to_virt(old_phys), PAGE_SIZE);
+    *pte = new_phys | (entry & ~PTE_ADDR_MASK);
+    vmm_flush_tlb(virt);
+
+    page->flags &= ~PAGE_FLAG_MOVABLE;
+    page->private = NULL;
+    page_set_movable(new_phys, as, virt);
+
+    spinlock_release(&as->lock);
+    return true;
+}
+
+// Page fault entry from the exception handler
+bool handle_page_fault(uint64_t addr, uint64_t error_code) {
+    if (addr >= USER_SPACE_END || !current_process || !current_process->memory.mm) {
+        return false;
+    }
+    return vmm_handle_fault(current_process->memory.mm, addr, error_code);
+}
+
+// Allocate a kernel buffer backed by 2MB pages (e.g. interpreter arenas)
+void* vmm_alloc_huge(size_t size) {
+    size_t count = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE;
+
+    spinlock_acquire(&huge_arena_lock);
+    uint64_t base = huge_arena_next;
+    if (base + count * HUGE_PAGE_SIZE > KERNEL_HUGE_BASE + KERNEL_HUGE_SIZE) {
+        spinlock_release(&huge_arena_lock);
+        return NULL;
+    }
+    huge_arena_next += count * HUGE_PAGE_SIZE;
+    spinlock_release(&huge_arena_lock);
+
+    for (size_t i = 0; i < count; i++) {
+        void *frame = pmm_alloc_pages(1U << HUGE_PAGE_ORDER);
+        if (!frame ||
+            vmm_map_huge_page(&kernel_space, base + i * HUGE_PAGE_SIZE, (uint64_t)frame,
+                              PTE_WRITABLE | PTE_GLOBAL | PTE_NX) < 0) {
+            if (frame) {
+                pmm_free_pages(frame, 1U << HUGE_PAGE_ORDER);
+            }
+            vmm_free_huge((void*)base, i * HUGE_PAGE_SIZE);
+            return NULL;
+        }
+    }
+
+    return (void*)base;
+}
+
+// Release a buffer from vmm_alloc_huge (the virtual range is not reused)
+void vmm_free_huge(void *addr, size_t size) {
+    size_t count = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE;
+    uint64_t base = (uint64_t)addr;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t virt = base + i * HUGE_PAGE_SIZE;
+        uint64_t *pde = vmm_walk(kernel_space.pml4, virt, 2, false);
+        if (pde && (*pde & PTE_HUGE)) {
+            pmm_free_pages((void*)(*pde & PTE_ADDR_MASK), 1U << HUGE_PAGE_ORDER);
+            *pde = 0;
+            vmm_flush_tlb(virt);
+        }
+    }
+}
+
+// Clear count vmap entries from base, dropping the frame references
+// when put is set
+static void vmap_clear(uint64_t base, size_t count, bool put) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t virt = base + i * PAGE_SIZE;
+        uint64_t *pte = vmm_walk(kernel_space.pml4, virt, 1, false);
+        if (!pte || !(*pte & PTE_PRESENT)) {
+            continue;
+        }
+        uint64_t phys = *pte & PTE_ADDR_MASK;
+        *pte = 0;
+        vmm_flush_tlb(virt);
+        if (put) {
+            page_put(phys, 0);
+        }
+    }
+}
+
+// Map existing frames, e.g. file pages from the page cache, at consecutive
+// kernel addresses. The mapping takes over one reference on each frame
+// from the caller; on failure the caller keeps them. Returns NULL when the
+// range or page table memory runs out.
+void* vmm_vmap(const uint64_t *phys, size_t count, uint64_t flags) {
+    if (count == 0) {
+        return NULL;
+    }
+
+    spinlock_acquire(&vmap_lock);
+    uint64_t base = vmap_next;
+    if (count > (KERNEL_VMAP_BASE + KERNEL_VMAP_SIZE - base) / PAGE_SIZE) {
+        spinlock_release(&vmap_lock);
+        return NULL;
+    }
+    vmap_next += count * PAGE_SIZE;
+
+    for (size_t i = 0; i < count; i++) {
+        if (vmm_map_page(&kernel_space, base + i * PAGE_SIZE, phys[i],
+                         flags | PTE_GLOBAL | PTE_NX) < 0) {
+            vmap_clear(base, i, false);
+            spinlock_release(&vmap_lock);
+            return NULL;
+        }
+    }
+    spinlock_release(&vmap_lock);
+
+    return (void*)base;
+}
+
+// Release a range from vmm_vmap and its frame references (the virtual
+// range is not reused)
+void vmm_vunmap(void *addr, size_t count) {
+    spinlock_acquire(&vmap_lock);
+    vmap_clear((uint64_t)addr, count, true);
+    spinlock_release(&vmap_lock);
+}
+
+// System call: anonymous mmap
+uint64_t sys_mmap(void *addr, size_t length, int prot) {
+    if (!current_process || !current_process->memory.mm) {
+        return (uint64_t)-EINVAL;
+    }
+    void *result = vmm_mmap(current_process->memory.mm, addr, length, prot,
+                            MAP_PRIVATE | MAP_ANONYMOUS);
+    return (uint64_t)result;
+}
+
+// System call: munmap
+int sys_munmap(void *addr, size_t length) {
+    if (!current_process || !current_process->memory.mm) {
+        return -EINVAL;
+    }
+    return vmm_munmap(current_process->memory.mm, addr, length);
+}
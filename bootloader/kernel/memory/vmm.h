@@ -0,0 +1,164 @@
+#ifndef VMM_H
+#define VMM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "memory.h"
+
+// Page sizes
+#define HUGE_PAGE_SIZE 0x200000          // 2MB
+#define HUGE_PAGE_ORDER 9                // 512 base pages
+#define PAGE_TABLE_ENTRIES 512
+
+// Page table entry flags
+#define PTE_PRESENT   (1ULL << 0)
+#define PTE_WRITABLE  (1ULL << 1)
+#define PTE_USER      (1ULL << 2)
+#define PTE_PWT       (1ULL << 3)
+#define PTE_PCD       (1ULL << 4)
+#define PTE_ACCESSED  (1ULL << 5)
+#define PTE_DIRTY     (1ULL << 6)
+#define PTE_HUGE      (1ULL << 7)        // PS bit in a PDE: 2MB mapping
+#define PTE_GLOBAL    (1ULL << 8)
+#define PTE_COW       (1ULL << 9)        // Software: copy on write
+#define PTE_NX        (1ULL << 63)
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000ULL
+
+// Page fault error code bits
+#define PF_PRESENT 0x1
+#define PF_WRITE   0x2
+#define PF_USER    0x4
+
+// Virtual address layout
+#define USER_MMAP_BASE      0x0000100000000000ULL
+#define USER_SPACE_END      0x0000800000000000ULL
+#define KERNEL_HUGE_BASE    0xFFFFC90000000000ULL   // Kernel huge-page arenas
+#define KERNEL_HUGE_SIZE    0x0000008000000000ULL   // One PML4 slot (512GB)
+#define KERNEL_VMAP_BASE    0xFFFFC98000000000ULL   // Kernel views of existing frames
+#define KERNEL_VMAP_SIZE    0x0000008000000000ULL   // One PML4 slot (512GB)
+#define KERNEL_PML4_START   256                      // Upper half shared by all
+
+// Protection / mapping flags for vmm_mmap
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_FIXED     0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED ((void*)-1)
+
+// VMA flags
+#define VMA_READ   0x01
+#define VMA_WRITE  0x02
+#define VMA_EXEC   0x04
+#define VMA_USER   0x08
+#define VMA_ANON   0x10
+#define VMA_HUGE   0x20     // Back with 2MB pages where alignment allows
+#define VMA_SHARED 0x40
+
+// Backing object of a non-anonymous mapping, e.g. a file in the page
+// cache. fault, page_mkwrite and close run without the address space
+// lock held and may sleep.
+typedef struct {
+    // Frame holding page pgoff of the object, with a reference taken for
+    // the new mapping; 0 if there is none
+    uint64_t (*fault)(void *object, uint64_t pgoff);
+    // A shared mapping is about to write page pgoff
+    int (*page_mkwrite)(void *object, uint64_t pgoff);
+    // A new VMA refers to object: mmap, fork or a split by munmap. Takes
+    // a reference that keeps object alive; called under the address
+    // space lock, so it must not sleep. Optional.
+    void (*open)(void *object);
+    // A VMA referring to object went away: drops open's reference.
+    // Optional.
+    void (*close)(void *object);
+} vm_ops_t;
+
+// Virtual memory area
+typedef struct vm_area {
+    uint64_t start;
+    uint64_t end;
+    uint32_t flags;
+    const vm_ops_t *ops;      // NULL for anonymous memory
+    void *object;
+    uint64_t pgoff;           // Object page mapped at start
+    struct vm_area *next;     // Sorted by start address
+} vm_area_t;
+
+// Address space
+typedef struct {
+    uint64_t pml4;            // Physical address of the top-level table
+    vm_area_t *vmas;
+    spinlock_t lock;
+    uint64_t cpu_mask;        // CPUs with this loaded in CR3
+
+    // Statistics
+    uint64_t resident_pages;
+    uint64_t huge_pages;
+    uint64_t demand_faults;
+    uint64_t cow_faults;
+    uint64_t file_faults;
+} address_space_t;
+
+// Most pages of a user buffer pinned for one device transfer
+#define VMM_PIN_MAX_PAGES 64
+
+// A user buffer held in memory while a device accesses it. phys is each
+// 4 KiB page of the buffer in order; the frames behind them (4 KiB or
+// 2 MiB) hold a reference each until vmm_unpin_user_pages.
+typedef struct {
+    uint64_t phys[VMM_PIN_MAX_PAGES];
+    uint64_t heads[VMM_PIN_MAX_PAGES];
+    uint8_t orders[VMM_PIN_MAX_PAGES];
+    uint32_t nr_pages;
+    uint32_t nr_pins;
+} vm_pin_t;
+
+// Identity-mapped physical memory (the kernel runs with phys == virt)
+static inline void* phys_to_virt(uint64_t phys) {
+    return (void*)phys;
+}
+
+static inline void vmm_flush_tlb(uint64_t virt) {
+    asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+// Function prototypes
+void vmm_init(void);
+address_space_t* vmm_create_address_space(void);
+void vmm_destroy_address_space(address_space_t *as);
+address_space_t* vmm_fork(address_space_t *parent);
+address_space_t* vmm_kernel_space(void);
+int vmm_install_special_page(address_space_t *as, uint64_t virt, uint64_t phys,
+                             uint64_t flags);
+uint64_t vmm_install_special_pages(address_space_t *as, uint64_t virt, const uint64_t *phys,
+                                   size_t count, uint64_t flags);
+void vmm_release_special_page(uint64_t phys);
+void vmm_switch(address_space_t *as);
+
+int vmm_map_page(address_space_t *as, uint64_t virt, uint64_t phys, uint64_t flags);
+int vmm_map_huge_page(address_space_t *as, uint64_t virt, uint64_t phys, uint64_t flags);
+void vmm_unmap(address_space_t *as, uint64_t virt, size_t length);
+uint64_t vmm_translate(address_space_t *as, uint64_t virt);
+
+void* vmm_mmap(address_space_t *as, void *addr, size_t length, int prot, int flags);
+void* vmm_mmap_object(address_space_t *as, void *addr, size_t length, int prot, int flags,
+                      const vm_ops_t *ops, void *object, uint64_t pgoff);
+int vmm_munmap(address_space_t *as, void *addr, size_t length);
+vm_area_t* vmm_find_vma(address_space_t *as, uint64_t addr);
+bool vmm_handle_fault(address_space_t *as, uint64_t addr, uint64_t error_code);
+
+int vmm_pin_user_pages(address_space_t *as, uint64_t addr, size_t length, bool write,
+                       vm_pin_t *pin);
+void vmm_unpin_user_pages(vm_pin_t *pin);
+
+bool vmm_migrate_page(page_t *page, uint64_t old_phys, uint64_t new_phys);
+
+void* vmm_alloc_huge(size_t size);
+void vmm_free_huge(void *addr, size_t size);
+void* vmm_vmap(const uint64_t *phys, size_t count, uint64_t flags);
+void vmm_vunmap(void *addr, size_t count);
+
+#endif // VMM_H
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "../core/interrupts.h"
 
 // Network Configuration
 #define MAX_NETWORK_DEVICES 16
@@ -76,6 +77,11 @@ typedef struct network_device {
     int (*send)(struct network_device* dev, void* packet, size_t size);
     int (*receive)(struct network_device* dev, void* buffer, size_t size);
     
+    // Receive polling. A driver with an RX interrupt fills this in with a
+    // poll routine that passes up to budget frames to network_receive_packet,
+    // registers it, and calls irq_poll_schedule from its interrupt handler.
+    irq_poll_t rx_poll;
+    
     void* private_data;
 } network_device_t;
 
@@ -135,6 +141,8 @@ void tcp_handle_packet(ip_header_t* ip_hdr, void* packet, size_t size);
 void udp_handle_packet(ip_header_t* ip_hdr, void* packet, size_t size);
 
 // Socket API
+socket_t* socket_alloc(void);
+void socket_free(socket_t* sock);
 int socket_create(int domain, int type, int protocol);
 int socket_bind(int sockfd, uint32_t ip, uint16_t port);
 int socket_listen(int sockfd, int backlog);
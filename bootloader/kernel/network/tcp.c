@@ -1,4 +1,6 @@
 #include "network.h"
+#include "../memory/slab.h"
+#include "../core/printk.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -32,6 +34,13 @@ typedef struct {
 
 static tcp_connection_table_t tcp_connections = {0};
 
+// Largest frame tcp_send_packet builds: headers plus one MTU-sized chunk
+#define TCP_PACKET_MAX (sizeof(ethernet_header_t) + sizeof(ip_header_t) + \
+                        sizeof(tcp_header_t) + MTU_SIZE)
+
+static kmem_cache_t* tcp_packet_cache;
+static kmem_cache_t* socket_cache;
+
 // AI-Enhanced Congestion Control
 typedef struct {
     uint32_t cwnd;           // Congestion window
@@ -49,15 +58,35 @@ typedef struct {
 void tcp_init(void) {
     memset(&tcp_connections, 0, sizeof(tcp_connections));
     spinlock_init(&tcp_connections.lock);
+    
+    tcp_packet_cache = kmem_cache_create("tcp_packet", TCP_PACKET_MAX, 0,
+                                         SLAB_HWCACHE_ALIGN, NULL);
+    socket_cache = kmem_cache_create("socket", sizeof(socket_t), 0,
+                                     SLAB_HWCACHE_ALIGN, NULL);
+    
     kprintf("[TCP] Initialized\n");
 }
 
+socket_t* socket_alloc(void) {
+    socket_t* sock = kmem_cache_alloc(socket_cache);
+    if (sock) {
+        memset(sock, 0, sizeof(socket_t));
+    }
+    return sock;
+}
+
+void socket_free(socket_t* sock) {
+    kmem_cache_free(socket_cache, sock);
+}
+
 static void tcp_send_packet(socket_t* sock, uint8_t flags, 
                            const void* data, size_t data_len) {
     size_t total_len = sizeof(ethernet_header_t) + sizeof(ip_header_t) + 
                        sizeof(tcp_header_t) + data_len;
     
-    void* packet = kmalloc(total_len);
+    if (total_len > TCP_PACKET_MAX) return;
+    
+    void* packet = kmem_cache_alloc(tcp_packet_cache);
     if (!packet) return;
     
     // Build Ethernet header
@@ -109,7 +138,7 @@ static void tcp_send_packet(socket_t* sock, uint8_t flags,
         dev->send(dev, packet, total_len);
     }
     
-    kfree(packet);
+    kmem_cache_free(tcp_packet_cache, packet);
 }
 
 void tcp_handle_packet(ip_header_t* ip_hdr, void* packet, size_t size) {
@@ -140,7 +169,7 @@ void tcp_handle_packet(ip_header_t* ip_hdr, void* packet, size_t size) {
     spinlock_release(&tcp_connections.lock);
     
     if (!sock) {
-        kprintf("[TCP] No socket found for port %d\n", dest_port);
+        kprintf_ratelimited(KERN_DEBUG "[TCP] No socket found for port %d\n", dest_port);
         return;
     }
     
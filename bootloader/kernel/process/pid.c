@@ -0,0 +1,129 @@
+// AION OS PID Allocator and PID Hash
+#include "pid.h"
+
+static pid_allocator_t pids;
+
+void pid_init(void) {
+    memset(&pids, 0, sizeof(pids));
+
+    // Every word starts with room; PID 0 is reserved
+    memset(pids.summary, 0xFF, sizeof(pids.summary));
+    pids.used[0] = 1;
+    pids.nr_used = 1;
+    pids.cursor = 1;
+}
+
+// First free PID at or after start, -1 if none
+static int32_t pid_find_free(uint32_t start) {
+    uint32_t word = start / 64;
+    uint64_t bits = ~pids.used[word] & (~0ULL << (start % 64));
+    if (bits) {
+        return word * 64 + __builtin_ctzll(bits);
+    }
+
+    // Let the summary skip the full words
+    uint32_t next = word + 1;
+    for (uint32_t i = next / 64; i < PID_SUMMARY_WORDS; i++) {
+        uint64_t room = pids.summary[i];
+        if (i == next / 64) {
+            room &= ~0ULL << (next % 64);
+        }
+        if (room) {
+            uint32_t w = i * 64 + __builtin_ctzll(room);
+            return w * 64 + __builtin_ctzll(~pids.used[w]);
+        }
+    }
+
+    return -1;
+}
+
+// Allocate a PID, 0 if the space is exhausted. Allocation continues after
+// the last PID handed out, so a freed PID is only reused after a wrap.
+uint32_t pid_alloc(void) {
+    spinlock_acquire(&pids.lock);
+
+    int32_t pid = pid_find_free(pids.cursor);
+    if (pid < 0) {
+        pid = pid_find_free(1);
+    }
+    if (pid < 0) {
+        spinlock_release(&pids.lock);
+        return 0;
+    }
+
+    uint32_t word = pid / 64;
+    pids.used[word] |= 1ULL << (pid % 64);
+    if (pids.used[word] == ~0ULL) {
+        pids.summary[word / 64] &= ~(1ULL << (word % 64));
+    }
+    pids.nr_used++;
+    pids.cursor = pid + 1 < PID_MAX ? pid + 1 : 1;
+
+    spinlock_release(&pids.lock);
+    return pid;
+}
+
+void pid_free(uint32_t pid) {
+    if (pid == 0 || pid >= PID_MAX) {
+        return;
+    }
+
+    spinlock_acquire(&pids.lock);
+    uint32_t word = pid / 64;
+    if (pids.used[word] & (1ULL << (pid % 64))) {
+        pids.used[word] &= ~(1ULL << (pid % 64));
+        pids.summary[word / 64] |= 1ULL << (word % 64);
+        pids.nr_used--;
+    }
+    spinlock_release(&pids.lock);
+}
+
+bool pid_in_use(uint32_t pid) {
+    return pid < PID_MAX && (pids.used[pid / 64] & (1ULL << (pid % 64)));
+}
+
+// PIDs handed out, excluding the reserved PID 0
+uint32_t pid_count(void) {
+    return pids.nr_used - 1;
+}
+
+static inline uint32_t pid_hashfn(uint32_t pid) {
+    return (pid * 0x9E3779B1U) >> (32 - PID_HASH_BITS);
+}
+
+void pid_hash_add(process_t *proc) {
+    uint32_t bucket = pid_hashfn(proc->pid);
+
+    spinlock_acquire(&pids.hash_lock);
+    proc->pid_next = pids.hash[bucket];
+    pids.hash[bucket] = proc;
+    spinlock_release(&pids.hash_lock);
+}
+
+void pid_hash_remove(process_t *proc) {
+    uint32_t bucket = pid_hashfn(proc->pid);
+
+    spinlock_acquire(&pids.hash_lock);
+    process_t **link = &pids.hash[bucket];
+    while (*link && *link != proc) {
+        link = &(*link)->pid_next;
+    }
+    if (*link) {
+        *link = proc->pid_next;
+    }
+    proc->pid_next = NULL;
+    spinlock_release(&pids.hash_lock);
+}
+
+process_t* pid_lookup(uint32_t pid) {
+    uint32_t bucket = pid_hashfn(pid);
+
+    spinlock_acquire(&pids.hash_lock);
+    process_t *proc = pids.hash[bucket];
+    while (proc && proc->pid != pid) {
+        proc = proc->pid_next;
+    }
+    spinlock_release(&pids.hash_lock);
+
+    return proc;
+}
@@ -0,0 +1,42 @@
+#ifndef PID_H
+#define PID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "process.h"
+#include "../core/smp.h"
+
+// PID space. PID 0 is never handed out.
+#define PID_MAX 32768
+#define PID_WORDS (PID_MAX / 64)
+#define PID_SUMMARY_WORDS (PID_WORDS / 64)
+
+// PID to process lookup
+#define PID_HASH_BITS 8
+#define PID_HASH_SIZE (1 << PID_HASH_BITS)
+
+// Two-level bitmap: a set bit in summary means the matching word of
+// used still has a free PID, so a search touches at most
+// PID_SUMMARY_WORDS + 1 words
+typedef struct {
+    uint64_t used[PID_WORDS];
+    uint64_t summary[PID_SUMMARY_WORDS];
+    uint32_t cursor;              // Next PID to try, allocation is cyclic
+    uint32_t nr_used;
+    spinlock_t lock;
+
+    process_t *hash[PID_HASH_SIZE];   // Chained through pid_next
+    spinlock_t hash_lock;
+} pid_allocator_t;
+
+// Function prototypes
+void pid_init(void);
+uint32_t pid_alloc(void);
+void pid_free(uint32_t pid);
+bool pid_in_use(uint32_t pid);
+uint32_t pid_count(void);
+void pid_hash_add(process_t *proc);
+void pid_hash_remove(process_t *proc);
+process_t* pid_lookup(uint32_t pid);
+
+#endif // PID_H
@@ -1,28 +1,49 @@
 // AION OS Process Management with AI Scheduling
 #include "process.h"
+#include "runqueue.h"
+#include "pid.h"
+#include "../core/fpu.h"
+#include "../core/syscall.h"
+#include "../core/ioring.h"
+#include "../drivers/timer_wheel.h"
+#include "../drivers/vclock.h"
+#include "../fs/fdtable.h"
 #include "../memory/memory.h"
+#include "../memory/numa.h"
+#include "../memory/vmm.h"
 #include "../ai/predictor.h"
 
-// Process table
-process_t process_table[MAX_PROCESSES];
-uint32_t next_pid = 1;
+// Process objects come from a slab cache and are found through the PID hash
+static kmem_cache_t *process_cache;
 process_t *current_process = NULL;
-ready_queue_t ready_queue;
+
+// Exited tasks without a parent, freed by the next schedule() on their
+// CPU once nothing runs on their stack. Linked through rq_next.
+static process_t *dead_tasks[MAX_CPUS];
+
+// Where the boot code's registers go on the very first switch
+static context_t boot_context;
+
+void process_start(void);
+void process_entry_return(void);
 
 // AI scheduler
 static ai_scheduler_t *ai_scheduler;
 
+// Pick-next policy; the AI mode is kept for comparison through /proc/schedlat
+static sched_mode_t sched_mode = SCHED_MODE_BITMAP;
+
 // Initialize process management
 void process_init(void) {
     kprintf("[PROCESS] Initializing process management...\n");
     
-    // Clear process table
-    memset(process_table, 0, sizeof(process_table));
+    // Process object cache and PID space
+    process_cache = kmem_cache_create("process", sizeof(process_t), 0,
+                                      SLAB_HWCACHE_ALIGN, NULL);
+    pid_init();
     
-    // Initialize ready queue
-    ready_queue.head = NULL;
-    ready_queue.tail = NULL;
-    ready_queue.count = 0;
+    // Initialize per-CPU run queues
+    runqueue_init();
     
     // Initialize AI scheduler
     ai_scheduler = ai_scheduler_create();
@@ -36,48 +57,177 @@ void process_init(void) {
     kprintf("[PROCESS] Process management initialized\n");
 }
 
-// Create a new process with AI optimization
-process_t* process_create(const char *name, void (*entry)(void), 
-                          uint32_t priority) {
-    // Find free slot in process table
-    process_t *proc = NULL;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == PROCESS_STATE_UNUSED) {
-            proc = &process_table[i];
-            break;
+// Allocate a zeroed process object with a fresh PID
+static process_t* process_alloc(void) {
+    process_t *proc = kmem_cache_alloc(process_cache);
+    if (!proc) {
+        return NULL;
+    }
+    memset(proc, 0, sizeof(process_t));
+    proc->fpu_cpu = -1;
+    proc->migrate_cpu = -1;
+    
+    proc->pid = pid_alloc();
+    if (!proc->pid) {
+        kprintf("[PROCESS] PID space exhausted!\n");
+        kmem_cache_free(process_cache, proc);
+        return NULL;
+    }
+    
+    return proc;
+}
+
+// Link a child under its parent
+static void process_add_child(process_t *parent, process_t *child) {
+    child->parent = parent;
+    child->sibling = parent->children;
+    parent->children = child;
+}
+
+static void process_remove_child(process_t *parent, process_t *child) {
+    process_t **link = &parent->children;
+    while (*link && *link != child) {
+        link = &(*link)->sibling;
+    }
+    if (*link) {
+        *link = child->sibling;
+    }
+    child->sibling = NULL;
+    child->parent = NULL;
+}
+
+// Release everything a process holds. Must not be the running task.
+void process_destroy(process_t *proc) {
+    if (!proc || proc == current_process) {
+        return;
+    }
+    
+    // A task that just exited on another CPU may still be in schedule()
+    // on its stack; context_switch clears on_cpu once it is off it
+    while (__atomic_load_n(&proc->on_cpu, __ATOMIC_ACQUIRE)) {
+        asm volatile("pause");
+    }
+    
+    // Off whichever CPU's queue or inbox it is on before it is freed
+    if (proc->state == PROCESS_STATE_READY) {
+        remove_from_ready_queue(proc);
+    }
+    
+    if (proc->parent) {
+        process_remove_child(proc->parent, proc);
+    }
+    
+    // Children left behind are reparented to nobody; dead ones go now
+    process_t *child = proc->children;
+    while (child) {
+        process_t *next = child->sibling;
+        child->parent = NULL;
+        child->sibling = NULL;
+        if (child->state == PROCESS_STATE_ZOMBIE) {
+            process_destroy(child);
         }
+        child = next;
+    }
+    proc->children = NULL;
+    
+    if (proc->stack) {
+        pmm_free_pages(proc->stack, proc->memory.stack_size / PAGE_SIZE);
     }
+    if (proc->memory.mm) {
+        vmm_destroy_address_space(proc->memory.mm);
+    }
+    ioring_destroy(proc->ioring);
+    fdtable_destroy(proc->files);
+    
+    fpu_release(proc);
+    pid_hash_remove(proc);
+    pid_free(proc->pid);
+    kmem_cache_free(process_cache, proc);
+}
+
+// Free parentless tasks that exited on this CPU
+static void reap_dead_tasks(uint32_t cpu) {
+    process_t *proc = dead_tasks[cpu];
+    dead_tasks[cpu] = NULL;
     
+    while (proc) {
+        process_t *next = proc->rq_next;
+        if (proc == current_process) {
+            // Still on its stack: keep it for the next pass
+            proc->rq_next = dead_tasks[cpu];
+            dead_tasks[cpu] = proc;
+        } else {
+            process_destroy(proc);
+        }
+        proc = next;
+    }
+}
+
+// Look up a live process by PID
+process_t* process_find(uint32_t pid) {
+    process_t *proc = pid_lookup(pid);
+    return proc && proc->state != PROCESS_STATE_ZOMBIE ? proc : NULL;
+}
+
+// Wake a process by PID, false if there is no such process
+bool wake_up_pid(uint32_t pid) {
+    process_t *proc = process_find(pid);
+    if (!proc) {
+        return false;
+    }
+    wake_up_process(proc);
+    return true;
+}
+
+// Create a new process with AI optimization
+process_t* process_create(const char *name, void (*entry)(void), 
+                          uint32_t priority) {
+    process_t *proc = process_alloc();
     if (!proc) {
-        kprintf("[PROCESS] Process table full!\n");
         return NULL;
     }
     
     // Initialize process structure
-    proc->pid = next_pid++;
     strncpy(proc->name, name, PROCESS_NAME_MAX);
     proc->state = PROCESS_STATE_READY;
     proc->priority = priority;
     proc->quantum = DEFAULT_QUANTUM;
+    proc->ticks_left = proc->quantum;
+    proc->prio_boost = 0;
     
     // Use AI to predict resource requirements
     resource_prediction_t prediction = ai_scheduler->predict_resources(name);
     
+    // Start on the least loaded CPU of the creating node, and keep its
+    // page tables and stack on that CPU's node
+    proc->cpu = runqueue_select_cpu(numa_node_id());
+    proc->numa_node = numa_cpu_to_node(proc->cpu);
+    proc->last_ran = 0;
+    
     // Allocate memory based on prediction
-    proc->memory.page_directory = pmm_alloc_pages(1);
+    proc->memory.mm = vmm_create_address_space();
+    proc->memory.page_directory = (void*)proc->memory.mm->pml4;
+    vclock_map(proc->memory.mm);    // Forked children inherit the mapping
     proc->memory.heap_size = prediction.heap_size;
     proc->memory.stack_size = prediction.stack_size;
     
     // Allocate stack
-    proc->stack = pmm_alloc_pages(proc->memory.stack_size / PAGE_SIZE);
-    proc->context.rsp = (uint64_t)proc->stack + proc->memory.stack_size;
-    proc->context.rbp = proc->context.rsp;
+    proc->stack = pmm_alloc_pages_node(proc->memory.stack_size / PAGE_SIZE,
+                                       proc->numa_node);
     
-    // Set entry point
-    proc->context.rip = (uint64_t)entry;
+    // The first switch lands in process_start, which returns to entry as
+    // if it had been called from process_entry_return, so returning from
+    // entry exits the process
+    uint64_t *sp = (uint64_t*)((uint8_t*)proc->stack + proc->memory.stack_size);
+    *--sp = (uint64_t)process_entry_return;
+    *--sp = (uint64_t)entry;
+    proc->context.rsp = (uint64_t)sp;
+    proc->context.rbp = 0;
+    proc->context.rip = (uint64_t)process_start;
     
-    // Set up initial context
-    proc->context.rflags = 0x202;  // Interrupts enabled
+    // Set up initial context. cs/ss only matter for the return to user
+    // mode; switches between tasks stay in the kernel.
+    proc->context.rflags = 0x002;  // process_start enables interrupts
     proc->context.cs = USER_CS;
     proc->context.ss = USER_DS;
     
@@ -86,6 +236,9 @@ process_t* process_create(const char *name, void (*entry)(void),
     proc->stats.start_time = get_system_time();
     proc->stats.context_switches = 0;
     
+    // Visible to PID lookups once fully set up
+    pid_hash_add(proc);
+    
     // Add to ready queue
     add_to_ready_queue(proc);
     
@@ -96,11 +249,12 @@ process_t* process_create(const char *name, void (*entry)(void),
     return proc;
 }
 
-// AI-powered scheduler
-void schedule(void) {
-    // Get AI scheduling decision
+// Legacy path: the AI model picks the next task synchronously
+static void schedule_ai(runqueue_t *rq) {
+    uint64_t start = rdtsc();
     scheduling_decision_t decision = ai_scheduler->make_decision(
-        &ready_queue, current_process);
+        runqueue_top_queue(rq), current_process);
+    runqueue_record_decision(rq, SCHED_MODE_AI, rdtsc() - start);
     
     // Apply scheduling decision
     switch (decision.action) {
@@ -115,6 +269,7 @@ void schedule(void) {
             // Continue running current process
             if (current_process) {
                 current_process->quantum = decision.quantum;
+                current_process->ticks_left = decision.quantum;
             }
             break;
             
@@ -133,96 +288,611 @@ void schedule(void) {
     ai_scheduler->update_statistics();
 }
 
+// Whether the running task should keep the CPU over next
+static bool keep_current(runqueue_t *rq, process_t *next) {
+    process_t *curr = current_process;
+    if (!curr || curr == rq->idle || curr->state != PROCESS_STATE_RUNNING) {
+        return false;
+    }
+    if (!next) {
+        return true;
+    }
+    return curr->ticks_left > 0 &&
+           sched_effective_priority(curr) >= sched_effective_priority(next);
+}
+
+// Fast path: highest priority level, round robin within it
+static void schedule_bitmap(runqueue_t *rq) {
+    uint64_t start = rdtsc();
+    process_t *next = runqueue_pick_next(rq);
+    bool keep = keep_current(rq, next);
+    runqueue_record_decision(rq, SCHED_MODE_BITMAP, rdtsc() - start);
+    
+    if (keep) {
+        if (!current_process->ticks_left) {
+            current_process->ticks_left = current_process->quantum;
+        }
+    } else if (next) {
+        switch_to_process(next);
+    } else if (current_process != rq->idle) {
+        switch_to_idle();
+    }
+}
+
+// Pick the next task for this CPU
+void schedule(void) {
+    uint64_t flags = local_irq_save();
+    runqueue_t *rq = this_runqueue();
+    
+    if (dead_tasks[rq->cpu]) {
+        reap_dead_tasks(rq->cpu);
+    }
+    
+    // Pick up tasks other CPUs handed us and answer steal requests
+    runqueue_drain_inbox(rq);
+    runqueue_handle_steal(rq);
+    
+    // Out of work: ask the busiest sibling to push some over
+    if (!rq->bitmap) {
+        runqueue_idle_balance(rq);
+    }
+    
+    if (sched_mode == SCHED_MODE_AI) {
+        schedule_ai(rq);
+    } else {
+        schedule_bitmap(rq);
+    }
+    
+    local_irq_restore(flags);
+}
+
+// Give up the CPU voluntarily; round robin within the priority level
+void yield_cpu(void) {
+    if (current_process) {
+        current_process->ticks_left = 0;
+    }
+    schedule();
+}
+
+void sched_set_mode(sched_mode_t mode) {
+    if (mode < SCHED_MODES) {
+        sched_mode = mode;
+        kprintf("[SCHED] Mode: %s\n", mode == SCHED_MODE_AI ? "ai" : "bitmap");
+    }
+}
+
+// Timer tick: charge the running task
+void update_scheduler_quantum(void) {
+    process_t *curr = current_process;
+    if (curr && curr->ticks_left) {
+        curr->ticks_left--;
+    }
+    if (curr) {
+        curr->stats.cpu_time++;
+    }
+}
+
+// Called from the timer interrupt: preempt on an expired quantum, a
+// higher priority arrival or pending work for an idle CPU
+bool should_reschedule(void) {
+    runqueue_t *rq = this_runqueue();
+    process_t *curr = current_process;
+    
+    if (!curr || curr->state != PROCESS_STATE_RUNNING) {
+        return true;
+    }
+    if (sched_mode == SCHED_MODE_AI) {
+        return true;
+    }
+    if (rq->inbox || rq->steal_request >= 0) {
+        return true;
+    }
+    if (curr == rq->idle) {
+        return rq->bitmap != 0;
+    }
+    if (!curr->ticks_left) {
+        return true;
+    }
+    return rq->bitmap && runqueue_top_priority(rq) > sched_effective_priority(curr);
+}
+
+// Apply one piece of AI advice to a task still queued on this CPU
+static void sched_ai_apply(runqueue_t *rq, scheduling_decision_t *decision) {
+    process_t *proc = decision->next_process;
+    if (!proc || proc == rq->idle || proc->cpu != rq->cpu ||
+        proc->state != PROCESS_STATE_READY) {
+        return;
+    }
+    
+    if (decision->quantum) {
+        uint32_t quantum = decision->quantum;
+        if (quantum < SCHED_MIN_QUANTUM) {
+            quantum = SCHED_MIN_QUANTUM;
+        } else if (quantum > SCHED_MAX_QUANTUM) {
+            quantum = SCHED_MAX_QUANTUM;
+        }
+        proc->quantum = quantum;
+    }
+    
+    switch (decision->action) {
+        case SCHEDULE_SWITCH:
+            // The model wants this task sooner: bounded boost, dropped
+            // again once it gets the CPU
+            if (proc->prio_boost < SCHED_MAX_BOOST) {
+                proc->prio_boost++;
+                runqueue_requeue(rq, proc);
+            }
+            break;
+            
+        case SCHEDULE_MIGRATE:
+            migrate_process(proc, decision->target_cpu);
+            break;
+            
+        default:
+            break;
+    }
+}
+
+// Per-CPU tuner: runs the model off the switch path, at a low rate and
+// low priority, and only adjusts priorities, quanta and placement
+static void sched_ai_tuner(void) {
+    while (1) {
+        sleep_ms(SCHED_AI_PERIOD_MS);
+        
+        if (sched_mode != SCHED_MODE_BITMAP) {
+            continue;
+        }
+        
+        uint64_t flags = local_irq_save();
+        runqueue_t *rq = this_runqueue();
+        
+        // Top few levels only, one decision each
+        uint64_t levels = rq->bitmap;
+        for (uint32_t i = 0; i < SCHED_AI_LEVELS && levels; i++) {
+            uint32_t level = 63 - __builtin_clzll(levels);
+            levels &= ~(1ULL << level);
+            
+            scheduling_decision_t decision = ai_scheduler->make_decision(
+                &rq->queues[level], NULL);
+            sched_ai_apply(rq, &decision);
+        }
+        ai_scheduler->update_statistics();
+        rq->ai_tunes++;
+        
+        local_irq_restore(flags);
+    }
+}
+
+// Start one AI tuner per CPU
+void scheduler_init(void) {
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        process_t *tuner = process_create("ksched_ai", sched_ai_tuner, 1);
+        if (!tuner) {
+            kprintf("[SCHED] Failed to start AI tuner for CPU %d\n", cpu);
+            continue;
+        }
+        tuner->flags |= PROCESS_FLAG_SYSTEM;
+        migrate_process(tuner, cpu);
+        tuner->flags |= PROCESS_FLAG_PINNED;
+    }
+    
+    kprintf("[SCHED] O(1) bitmap scheduler, %d levels, AI tuning every %d ms\n",
+            SCHED_PRIORITIES, SCHED_AI_PERIOD_MS);
+}
+
+static void finish_switch(void);
+
 // Context switch implementation
 void switch_to_process(process_t *next) {
     if (current_process == next) {
-        return;  // Already running
+        // Woken after marking itself blocked but before switching out: the
+        // wakeup queued it again, so take it back off and keep running
+        remove_from_ready_queue(next);
+        next->state = PROCESS_STATE_RUNNING;
+        return;
     }
     
+    runqueue_t *rq = this_runqueue();
     process_t *prev = current_process;
     current_process = next;
     
-    // Update process states
+    // Update process states; idle tasks never sit on a run queue. A
+    // preempted task is queued by finish_switch, once its registers are
+    // saved, as the queue may be another CPU's.
     if (prev && prev->state == PROCESS_STATE_RUNNING) {
         prev->state = PROCESS_STATE_READY;
-        add_to_ready_queue(prev);
+        prev->last_ran = get_system_time();
+        if (prev != rq->idle) {
+            rq->prev_ready = prev;
+        }
     }
     
     next->state = PROCESS_STATE_RUNNING;
+    next->cpu = rq->cpu;
     remove_from_ready_queue(next);
     
+    // A boost only buys one turn; the slice starts afresh
+    next->prio_boost = 0;
+    next->ticks_left = next->quantum;
+    
     // Update statistics
     if (prev) {
         prev->stats.context_switches++;
     }
     next->stats.context_switches++;
+    rq->switches++;
+    
+    // Load the next address space unless it is already active
+    if (!prev || prev->memory.mm != next->memory.mm) {
+        vmm_switch(next->memory.mm);
+    }
+    
+    // FPU state follows lazily on first use
+    fpu_switch(prev, next);
+    
+    // SYSCALL from the new task enters on its own stack
+    syscall_set_kernel_stack((uint64_t)next->stack + next->memory.stack_size);
     
     // Perform context switch
-    context_switch(&prev->context, &next->context);
+    next->on_cpu = true;
+    context_switch(prev ? &prev->context : &boot_context, &next->context,
+                   prev ? &prev->on_cpu : NULL);
+    finish_switch();
 }
 
-// Context switch assembly implementation
-__attribute__((naked)) void context_switch(context_t *old_ctx, context_t *new_ctx) {
+// First thing a task does after being switched to, with interrupts still
+// off: queue the task this CPU just left, now that its context is saved
+__attribute__((used)) static void finish_switch(void) {
+    runqueue_t *rq = this_runqueue();
+    process_t *prev = rq->prev_ready;
+    if (prev) {
+        rq->prev_ready = NULL;
+        add_to_ready_queue(prev);
+    }
+}
+
+// Context switch: save the callee-saved registers, stack, flags and
+// resume point of the old task, then load the new one and jump to where
+// it left off. Caller-saved registers are dead across the call. A new
+// task starts at its entry point with the rflags process_create set.
+// prev_on_cpu, if given, is cleared once nothing more is written to the
+// old stack, so from then on another CPU may run or free the old task.
+__attribute__((naked)) void context_switch(context_t *old_ctx, context_t *new_ctx,
+                                           bool *prev_on_cpu) {
     asm volatile(
         // Save old context
-        "pushq %%rbp\n"
-        "pushq %%rbx\n"
-        "pushq %%r12\n"
-        "pushq %%r13\n"
-        "pushq %%r14\n"
-        "pushq %%r15\n"
-        "movq %%rsp, (%%rdi)\n"  // Save RSP to old context
+        "movq %%rbx, %c[rbx](%%rdi)\n"
+        "movq %%rbp, %c[rbp](%%rdi)\n"
+        "movq %%r12, %c[r12](%%rdi)\n"
+        "movq %%r13, %c[r13](%%rdi)\n"
+        "movq %%r14, %c[r14](%%rdi)\n"
+        "movq %%r15, %c[r15](%%rdi)\n"
+        "movq %%rsp, %c[rsp](%%rdi)\n"
+        "pushfq\n"
+        "popq %c[rflags](%%rdi)\n"
+        "leaq 1f(%%rip), %%rax\n"
+        "movq %%rax, %c[rip](%%rdi)\n"
+        
+        // Off the old stack: stores are not reordered on x86, so
+        // whoever sees the flag clear also sees the saved context
+        "testq %%rdx, %%rdx\n"
+        "jz 2f\n"
+        "movb $0, (%%rdx)\n"
+        "2:\n"
         
         // Load new context
-        "movq (%%rsi), %%rsp\n"  // Load RSP from new context
-        "popq %%r15\n"
-        "popq %%r14\n"
-        "popq %%r13\n"
-        "popq %%r12\n"
-        "popq %%rbx\n"
-        "popq %%rbp\n"
+        "movq %c[rbx](%%rsi), %%rbx\n"
+        "movq %c[rbp](%%rsi), %%rbp\n"
+        "movq %c[r12](%%rsi), %%r12\n"
+        "movq %c[r13](%%rsi), %%r13\n"
+        "movq %c[r14](%%rsi), %%r14\n"
+        "movq %c[r15](%%rsi), %%r15\n"
+        "movq %c[rsp](%%rsi), %%rsp\n"
+        "pushq %c[rflags](%%rsi)\n"
+        "popfq\n"
+        "jmpq *%c[rip](%%rsi)\n"
+        
+        // Resumed tasks continue here and return to switch_to_process
+        "1:\n"
         "ret\n"
         :
-        : "D"(old_ctx), "S"(new_ctx)
+        : [rbx] "i"(offsetof(context_t, rbx)),
+          [rbp] "i"(offsetof(context_t, rbp)),
+          [r12] "i"(offsetof(context_t, r12)),
+          [r13] "i"(offsetof(context_t, r13)),
+          [r14] "i"(offsetof(context_t, r14)),
+          [r15] "i"(offsetof(context_t, r15)),
+          [rsp] "i"(offsetof(context_t, rsp)),
+          [rflags] "i"(offsetof(context_t, rflags)),
+          [rip] "i"(offsetof(context_t, rip))
         : "memory"
     );
 }
 
-// Create idle process
+// A new task's first switch lands here, with entry on top of the stack
+__attribute__((naked)) void process_start(void) {
+    asm volatile(
+        "call finish_switch\n"
+        "sti\n"
+        "ret\n"
+        : : : "memory"
+    );
+}
+
+// A process entry point that returns lands here with the stack 16-byte
+// aligned; realign for the call as the ABI expects
+__attribute__((naked)) void process_entry_return(void) {
+    asm volatile(
+        "andq $-16, %%rsp\n"
+        "xorl %%edi, %%edi\n"
+        "call process_exit\n"
+        "ud2\n"
+        : : : "memory"
+    );
+}
+
+// Create one idle process per CPU. At boot every run queue is empty, so
+// process_create queues each on this CPU and we can take it back off.
 void create_idle_process(void) {
-    process_t *idle = process_create("idle", idle_process_entry, 0);
-    idle->flags |= PROCESS_FLAG_SYSTEM;
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        process_t *idle = process_create("idle", idle_process_entry, 0);
+        remove_from_ready_queue(idle);
+        idle->flags |= PROCESS_FLAG_SYSTEM | PROCESS_FLAG_PINNED;
+        idle->cpu = cpu;
+        idle->numa_node = numa_cpu_to_node(cpu);
+        cpu_runqueue(cpu)->idle = idle;
+    }
 }
 
-// Idle process entry point
+// Run this CPU's idle process
+void switch_to_idle(void) {
+    switch_to_process(this_runqueue()->idle);
+}
+
+// Idle process entry point. With nothing to run the tick is stopped
+// until the next timer, so an idle CPU only wakes for real work.
 void idle_process_entry(void) {
     while (1) {
         // AI-powered CPU power management
         ai_scheduler->optimize_idle_state();
         
-        // Enter low power state
-        asm volatile("hlt");
+        // Check and halt with interrupts off so a wakeup in between
+        // cannot be missed; sti takes effect only after hlt
+        asm volatile("cli");
+        if (!runqueue_has_work(this_runqueue())) {
+            tick_nohz_idle_enter();
+            asm volatile("sti; hlt");
+            tick_nohz_idle_exit();
+        }
+        asm volatile("sti");
+        
+        // Woken by something other than the tick: run it now
+        if (runqueue_has_work(this_runqueue())) {
+            schedule();
+        }
     }
 }
 
-// Process termination
+// Process termination. The process object and its stack stay around
+// until the parent reaps it, or until we are off its stack if it has none.
 void process_exit(int exit_code) {
-    current_process->state = PROCESS_STATE_ZOMBIE;
-    current_process->exit_code = exit_code;
+    process_t *proc = current_process;
     
-    // Free process resources
-    pmm_free_pages(current_process->stack, 
-                   current_process->memory.stack_size / PAGE_SIZE);
-    pmm_free_pages(current_process->memory.page_directory, 1);
+    // The address space is not needed to finish running in the kernel
+    vmm_switch(vmm_kernel_space());
+    vmm_destroy_address_space(proc->memory.mm);
+    proc->memory.mm = NULL;
+    proc->memory.page_directory = NULL;
+    
+    // Files close now, not when the parent gets around to reaping us
+    fdtable_destroy(proc->files);
+    proc->files = NULL;
     
     // Notify AI scheduler
-    ai_scheduler->record_process_exit(current_process);
+    ai_scheduler->record_process_exit(proc);
+    
+    uint64_t flags = local_irq_save();
+    proc->exit_code = exit_code;
+    __atomic_store_n(&proc->state, PROCESS_STATE_ZOMBIE, __ATOMIC_RELEASE);
     
-    // Wake up parent if waiting
-    if (current_process->parent) {
-        wake_up_process(current_process->parent);
+    if (proc->parent) {
+        // Wake up parent if waiting
+        wake_up_process(proc->parent);
+    } else {
+        uint32_t cpu = smp_processor_id();
+        proc->rq_next = dead_tasks[cpu];
+        dead_tasks[cpu] = proc;
     }
+    local_irq_restore(flags);
     
     // Schedule next process
     schedule();
-}
\ No newline at end of file
+}
+
+// Wait for a child to exit and reap it. Returns the PID or -ECHILD.
+int process_wait(uint32_t pid, int *exit_code) {
+    process_t *child = pid_lookup(pid);
+    if (!child || child->parent != current_process) {
+        return -ECHILD;
+    }
+    
+    // Block before checking, so an exit in between still wakes us
+    while (1) {
+        uint64_t flags = local_irq_save();
+        current_process->state = PROCESS_STATE_BLOCKED;
+        if (__atomic_load_n(&child->state, __ATOMIC_ACQUIRE) == PROCESS_STATE_ZOMBIE) {
+            current_process->state = PROCESS_STATE_RUNNING;
+            local_irq_restore(flags);
+            break;
+        }
+        local_irq_restore(flags);
+        schedule();
+    }
+    
+    if (exit_code) {
+        *exit_code = child->exit_code;
+    }
+    
+    // Waits for the child's CPU to switch off its stack if need be
+    process_destroy(child);
+    return pid;
+}
+
+// System call: getpid
+int sys_getpid(void) {
+    return current_process ? current_process->pid : 0;
+}
+
+// What sys_fork pushes: its caller's callee-saved registers, lowest
+// address first, under the return address
+typedef struct {
+    uint64_t r15, r14, r13, r12, rbx, rbp;
+    uint64_t rip;
+} fork_frame_t;
+
+// A value pointing into the parent's kernel stack, moved onto the child's
+static inline uint64_t fork_rebase(process_t *parent, int64_t delta, uint64_t value) {
+    uint64_t base = (uint64_t)parent->stack;
+    if (value >= base && value < base + parent->memory.stack_size) {
+        return value + delta;
+    }
+    return value;
+}
+
+// The child's first switch lands here on its copy of the fork frame:
+// finish the switch, then restore the caller's registers and return 0
+__attribute__((naked)) static void fork_child_return(void) {
+    asm volatile(
+        "subq $8, %%rsp\n"        // Realign for the call
+        "call finish_switch\n"
+        "addq $8, %%rsp\n"
+        "sti\n"
+        "popq %%r15\n"
+        "popq %%r14\n"
+        "popq %%r13\n"
+        "popq %%r12\n"
+        "popq %%rbx\n"
+        "popq %%rbp\n"
+        "xorl %%eax, %%eax\n"
+        "ret\n"
+        : : : "memory"
+    );
+}
+
+// Copy the current process. frame is the parent's fork frame; the child
+// is given a copy of the kernel stack and resumes at the copy of frame.
+__attribute__((used)) static int fork_process(fork_frame_t *frame) {
+    process_t *parent = current_process;
+    process_t *child = process_alloc();
+    if (!child) {
+        return -EAGAIN;
+    }
+    
+    // Share user pages copy-on-write instead of copying them
+    address_space_t *mm = vmm_fork(parent->memory.mm);
+    if (!mm) {
+        process_destroy(child);
+        return -ENOMEM;
+    }
+    
+    // Same fds, sharing their open file descriptions with ours
+    fd_table_t *files = NULL;
+    if (parent->files) {
+        files = fdtable_dup(parent->files);
+        if (!files) {
+            vmm_destroy_address_space(mm);
+            process_destroy(child);
+            return -ENOMEM;
+        }
+    }
+    
+    uint32_t pid = child->pid;
+    *child = *parent;
+    child->pid = pid;
+    child->state = PROCESS_STATE_READY;
+    child->next = child->prev = child->rq_next = NULL;
+    child->pid_next = NULL;
+    child->children = child->sibling = NULL;
+    child->ioring = NULL;      // The ring stays with the parent
+    child->files = files;
+    child->fpu_state = NULL;   // Nothing of the parent's to free on failure
+    child->fpu_cpu = -1;
+    child->stack = NULL;
+    child->on_cpu = false;     // Copied from the running parent
+    child->migrate_cpu = -1;
+    process_add_child(parent, child);
+    child->memory.mm = mm;
+    child->memory.page_directory = (void*)mm->pml4;
+    
+    // The kernel stack is not part of the user address space
+    child->stack = pmm_alloc_pages_node(parent->memory.stack_size / PAGE_SIZE,
+                                        child->numa_node);
+    if (!child->stack || fpu_copy(child, parent) < 0) {
+        process_destroy(child);
+        return -ENOMEM;
+    }
+    memcpy(child->stack, parent->stack, parent->memory.stack_size);
+    
+    // Rebase the copied frame, and the frame pointer chain above it, onto
+    // the child's stack. Saved registers that point into the parent's
+    // stack are moved with it.
+    int64_t delta = (uint8_t*)child->stack - (uint8_t*)parent->stack;
+    fork_frame_t *child_frame = (fork_frame_t*)((uint8_t*)frame + delta);
+    child_frame->r15 = fork_rebase(parent, delta, child_frame->r15);
+    child_frame->r14 = fork_rebase(parent, delta, child_frame->r14);
+    child_frame->r13 = fork_rebase(parent, delta, child_frame->r13);
+    child_frame->r12 = fork_rebase(parent, delta, child_frame->r12);
+    child_frame->rbx = fork_rebase(parent, delta, child_frame->rbx);
+    child_frame->rbp = fork_rebase(parent, delta, child_frame->rbp);
+    
+    uint64_t *fp = (uint64_t*)child_frame->rbp;
+    uint64_t stack_end = (uint64_t)child->stack + parent->memory.stack_size;
+    while ((uint64_t)fp > (uint64_t)child_frame && (uint64_t)fp < stack_end) {
+        uint64_t next = fork_rebase(parent, delta, *fp);
+        if (next == *fp || next <= (uint64_t)fp) {
+            break;
+        }
+        *fp = next;
+        fp = (uint64_t*)next;
+    }
+    
+    child->context.rsp = (uint64_t)child_frame;
+    child->context.rbp = child_frame->rbp;
+    child->context.rip = (uint64_t)fork_child_return;
+    child->context.rflags = 0x002;  // fork_child_return enables interrupts
+    
+    child->stats.cpu_time = 0;
+    child->stats.start_time = get_system_time();
+    child->stats.context_switches = 0;
+    
+    pid_hash_add(child);
+    add_to_ready_queue(child);
+    ai_scheduler->record_process_creation(child);
+    
+    return child->pid;
+}
+
+// System call: fork with a copy-on-write address space. Both tasks return
+// from this call, the parent with the child's PID and the child with 0.
+__attribute__((naked)) int sys_fork(void) {
+    asm volatile(
+        "pushq %%rbp\n"
+        "pushq %%rbx\n"
+        "pushq %%r12\n"
+        "pushq %%r13\n"
+        "pushq %%r14\n"
+        "pushq %%r15\n"
+        "movq %%rsp, %%rdi\n"
+        "subq $8, %%rsp\n"        // Realign for the call
+        "call fork_process\n"
+        "addq $8, %%rsp\n"
+        "popq %%r15\n"
+        "popq %%r14\n"
+        "popq %%r13\n"
+        "popq %%r12\n"
+        "popq %%rbx\n"
+        "popq %%rbp\n"
+        "ret\n"
+        : : : "memory"
+    );
+}
@@ -0,0 +1,413 @@
+// AION OS Per-CPU Run Queues with Work Stealing
+#include "runqueue.h"
+#include "../memory/numa.h"
+#include "../fs/procfs.h"
+
+static runqueue_t runqueues[MAX_CPUS];
+
+void runqueue_init(void) {
+    memset(runqueues, 0, sizeof(runqueues));
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        runqueues[cpu].cpu = cpu;
+        runqueues[cpu].steal_request = -1;
+        spinlock_init(&runqueues[cpu].lock);
+    }
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        runqueues[cpu].node = numa_cpu_to_node(cpu);
+    }
+
+    procfs_register("schedstat", runqueue_show);
+    procfs_register("schedlat", runqueue_latency_show);
+}
+
+runqueue_t* cpu_runqueue(uint32_t cpu) {
+    return &runqueues[cpu];
+}
+
+runqueue_t* this_runqueue(void) {
+    return &runqueues[smp_processor_id()];
+}
+
+uint32_t sched_effective_priority(process_t *proc) {
+    uint32_t prio = proc->priority + proc->prio_boost;
+    return prio < SCHED_PRIORITIES ? prio : SCHED_PRIORITIES - 1;
+}
+
+// List operations, with interrupts off and rq->lock held. The level is
+// recorded so a later boost cannot strand the task on the wrong list.
+static void queue_append(runqueue_t *rq, process_t *proc) {
+    uint32_t level = sched_effective_priority(proc);
+    ready_queue_t *queue = &rq->queues[level];
+
+    proc->rq_prio = level;
+    proc->next = NULL;
+    proc->prev = queue->tail;
+    if (queue->tail) {
+        queue->tail->next = proc;
+    } else {
+        queue->head = proc;
+    }
+    queue->tail = proc;
+    queue->count++;
+
+    rq->bitmap |= 1ULL << level;
+}
+
+static void queue_remove(runqueue_t *rq, process_t *proc) {
+    ready_queue_t *queue = &rq->queues[proc->rq_prio];
+    if (proc->prev) {
+        proc->prev->next = proc->next;
+    } else {
+        queue->head = proc->next;
+    }
+    if (proc->next) {
+        proc->next->prev = proc->prev;
+    } else {
+        queue->tail = proc->prev;
+    }
+    proc->next = NULL;
+    proc->prev = NULL;
+    queue->count--;
+
+    if (!queue->count) {
+        rq->bitmap &= ~(1ULL << proc->rq_prio);
+    }
+}
+
+static inline bool queued_on(runqueue_t *rq, process_t *proc) {
+    return proc->prev || rq->queues[proc->rq_prio].head == proc;
+}
+
+// Highest priority level with a runnable task
+uint32_t runqueue_top_priority(runqueue_t *rq) {
+    return 63 - __builtin_clzll(rq->bitmap);
+}
+
+// O(1) pick: head of the highest non-empty level, NULL if none
+process_t* runqueue_pick_next(runqueue_t *rq) {
+    if (!rq->bitmap) {
+        return NULL;
+    }
+    return rq->queues[runqueue_top_priority(rq)].head;
+}
+
+// Highest non-empty level as a queue, for the AI scheduler interface
+ready_queue_t* runqueue_top_queue(runqueue_t *rq) {
+    return rq->bitmap ? &rq->queues[runqueue_top_priority(rq)] : &rq->queues[0];
+}
+
+// Move a queued task to the level its current priority maps to
+void runqueue_requeue(runqueue_t *rq, process_t *proc) {
+    spinlock_acquire(&rq->lock);
+    if (queued_on(rq, proc)) {
+        queue_remove(rq, proc);
+        queue_append(rq, proc);
+    }
+    spinlock_release(&rq->lock);
+}
+
+void runqueue_record_decision(runqueue_t *rq, sched_mode_t mode, uint64_t cycles) {
+    uint32_t bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+    if (bucket >= SCHED_HIST_BUCKETS) {
+        bucket = SCHED_HIST_BUCKETS - 1;
+    }
+    rq->decision_hist[mode][bucket]++;
+    rq->decisions[mode]++;
+}
+
+// Hand a task to another CPU without taking any lock
+static void inbox_push(runqueue_t *rq, process_t *proc) {
+    process_t *head = __atomic_load_n(&rq->inbox, __ATOMIC_RELAXED);
+    do {
+        proc->rq_next = head;
+    } while (!__atomic_compare_exchange_n(&rq->inbox, &head, proc, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&rq->nr_running, 1, __ATOMIC_RELAXED);
+}
+
+// Move tasks handed to rq onto its queue, oldest first. rq->lock held.
+static void drain_inbox_locked(runqueue_t *rq) {
+    process_t *list = __atomic_exchange_n(&rq->inbox, NULL, __ATOMIC_ACQUIRE);
+    process_t *reversed = NULL;
+
+    while (list) {
+        process_t *next = list->rq_next;
+        list->rq_next = reversed;
+        reversed = list;
+        list = next;
+    }
+
+    while (reversed) {
+        process_t *next = reversed->rq_next;
+        reversed->rq_next = NULL;
+        queue_append(rq, reversed);
+        rq->tasks_received++;
+        reversed = next;
+    }
+}
+
+// Move tasks other CPUs handed us onto the local queue
+void runqueue_drain_inbox(runqueue_t *rq) {
+    spinlock_acquire(&rq->lock);
+    drain_inbox_locked(rq);
+    spinlock_release(&rq->lock);
+}
+
+// Take a task off the queue it is on, whichever CPU that belongs to. A
+// task still in that CPU's inbox is moved onto its queue first. Returns
+// whether it was queued. Interrupts off.
+static bool runqueue_unlink(process_t *proc) {
+    while (1) {
+        uint32_t cpu = __atomic_load_n(&proc->cpu, __ATOMIC_RELAXED);
+        runqueue_t *rq = &runqueues[cpu];
+        
+        spinlock_acquire(&rq->lock);
+        if (proc->cpu != cpu) {
+            // Handed to another CPU meanwhile
+            spinlock_release(&rq->lock);
+            continue;
+        }
+        if (!queued_on(rq, proc) && __atomic_load_n(&rq->inbox, __ATOMIC_RELAXED)) {
+            drain_inbox_locked(rq);
+        }
+        
+        bool queued = queued_on(rq, proc);
+        if (queued) {
+            queue_remove(rq, proc);
+            __atomic_sub_fetch(&rq->nr_running, 1, __ATOMIC_RELAXED);
+        }
+        spinlock_release(&rq->lock);
+        return queued;
+    }
+}
+
+// Queue a runnable task on the CPU it last ran on
+void add_to_ready_queue(process_t *proc) {
+    uint64_t flags = local_irq_save();
+
+    // A move asked for while it was on a CPU happens once it is off
+    int32_t target = __atomic_load_n(&proc->migrate_cpu, __ATOMIC_RELAXED);
+    if (target >= 0 && !__atomic_load_n(&proc->on_cpu, __ATOMIC_ACQUIRE)) {
+        proc->cpu = target;
+        proc->migrate_cpu = -1;
+    }
+    runqueue_t *rq = &runqueues[proc->cpu];
+
+    if (proc->cpu == smp_processor_id()) {
+        spinlock_acquire(&rq->lock);
+        queue_append(rq, proc);
+        __atomic_add_fetch(&rq->nr_running, 1, __ATOMIC_RELAXED);
+        spinlock_release(&rq->lock);
+    } else {
+        inbox_push(rq, proc);
+    }
+
+    local_irq_restore(flags);
+}
+
+// Take a task off its run queue, on this CPU or another
+void remove_from_ready_queue(process_t *proc) {
+    uint64_t flags = local_irq_save();
+    runqueue_unlink(proc);
+    local_irq_restore(flags);
+}
+
+// Make a blocked task runnable. Only the waker that moves it out of
+// BLOCKED queues it. A task still switching away on its CPU goes to that
+// CPU, which takes it back if it picks it before switching.
+void wake_up_process(process_t *proc) {
+    __typeof__(proc->state) blocked = PROCESS_STATE_BLOCKED;
+    if (__atomic_compare_exchange_n(&proc->state, &blocked, PROCESS_STATE_READY, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        add_to_ready_queue(proc);
+    }
+}
+
+// Move a task to another CPU. A queued task is taken off its queue,
+// whichever CPU's that is, and handed over. A task on a CPU, or one not
+// yet on a queue it can be taken off, is moved the next time it is
+// queued after switching off, so proc->cpu keeps naming the CPU whose
+// stack or queue it may be on.
+void migrate_process(process_t *proc, uint32_t target_cpu) {
+    if (!proc || target_cpu >= num_cpus || (proc->flags & PROCESS_FLAG_PINNED)) {
+        return;
+    }
+
+    uint64_t flags = local_irq_save();
+
+    if (__atomic_load_n(&proc->on_cpu, __ATOMIC_ACQUIRE)) {
+        proc->migrate_cpu = target_cpu;
+    } else if (proc->state == PROCESS_STATE_READY) {
+        if (runqueue_unlink(proc)) {
+            proc->cpu = target_cpu;
+            inbox_push(&runqueues[target_cpu], proc);
+        } else {
+            proc->migrate_cpu = target_cpu;
+        }
+    } else {
+        proc->cpu = target_cpu;
+    }
+
+    local_irq_restore(flags);
+}
+
+static bool cache_hot(process_t *proc, uint64_t now) {
+    return now - proc->last_ran < RQ_MIGRATION_COST_MS;
+}
+
+// Answer a pending steal request by pushing surplus tasks to the thief.
+// Runs on the victim, which owns its queue.
+void runqueue_handle_steal(runqueue_t *rq) {
+    int32_t thief_cpu = __atomic_exchange_n(&rq->steal_request, -1, __ATOMIC_ACQUIRE);
+    if (thief_cpu < 0) {
+        return;
+    }
+
+    runqueue_t *thief = &runqueues[thief_cpu];
+    int32_t imbalance = (int32_t)rq->nr_running - (int32_t)thief->nr_running;
+    if (imbalance < 2) {
+        return;
+    }
+
+    uint32_t to_move = imbalance / 2;
+    bool allow_hot = imbalance > RQ_HOT_IMBALANCE;
+    uint64_t now = get_system_time();
+
+    spinlock_acquire(&rq->lock);
+
+    // Give away low priority work first; within a level the tail ran
+    // least recently, so its cache footprint is coldest
+    for (uint32_t level = 0; level < SCHED_PRIORITIES && to_move; level++) {
+        if (!(rq->bitmap & (1ULL << level))) {
+            continue;
+        }
+
+        process_t *proc = rq->queues[level].tail;
+        while (proc && to_move) {
+            process_t *prev = proc->prev;
+
+            // A task woken before it switched off is still on our stack
+            if (!(proc->flags & PROCESS_FLAG_PINNED) && proc != rq->idle &&
+                !proc->on_cpu && (allow_hot || !cache_hot(proc, now))) {
+                queue_remove(rq, proc);
+                __atomic_sub_fetch(&rq->nr_running, 1, __ATOMIC_RELAXED);
+                proc->cpu = thief_cpu;
+                inbox_push(thief, proc);
+                rq->tasks_pushed++;
+                to_move--;
+            }
+
+            proc = prev;
+        }
+    }
+
+    spinlock_release(&rq->lock);
+}
+
+// Out of work: ask the busiest CPU to push us some, preferring our own
+// node. Returns true if a request was posted.
+bool runqueue_idle_balance(runqueue_t *rq) {
+    runqueue_t *busiest = NULL;
+    uint32_t busiest_load = 0;
+
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        runqueue_t *other = &runqueues[cpu];
+        if (other == rq) {
+            continue;
+        }
+
+        // Crossing nodes loses memory locality, so demand more imbalance
+        uint32_t load = __atomic_load_n(&other->nr_running, __ATOMIC_RELAXED);
+        uint32_t needed = 2 + (other->node != rq->node ? RQ_NUMA_IMBALANCE : 0);
+        if (load < needed) {
+            continue;
+        }
+
+        uint32_t weighted = other->node == rq->node ? load * 2 : load;
+        if (weighted > busiest_load) {
+            busiest = other;
+            busiest_load = weighted;
+        }
+    }
+
+    if (!busiest) {
+        return false;
+    }
+
+    int32_t expected = -1;
+    if (!__atomic_compare_exchange_n(&busiest->steal_request, &expected, (int32_t)rq->cpu,
+                                     false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        return false;    // Someone else is already stealing from it
+    }
+
+    rq->steal_requests++;
+    return true;
+}
+
+// Least loaded CPU on a node for a new task, this CPU if none is idler
+uint32_t runqueue_select_cpu(uint32_t node) {
+    uint32_t best = smp_processor_id();
+    uint32_t best_load = runqueues[best].nr_running;
+
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        if (runqueues[cpu].node == node && runqueues[cpu].nr_running < best_load) {
+            best = cpu;
+            best_load = runqueues[cpu].nr_running;
+        }
+    }
+
+    return best;
+}
+
+uint64_t runqueue_total_switches(void) {
+    uint64_t total = 0;
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        total += runqueues[cpu].switches;
+    }
+    return total;
+}
+
+// procfs: /proc/schedstat
+size_t runqueue_show(char *buf, size_t size) {
+    size_t len = snprintf(buf, size,
+                          "cpu node running switches steal_req pushed received ai_tunes\n");
+
+    for (uint32_t cpu = 0; cpu < num_cpus && len < size; cpu++) {
+        runqueue_t *rq = &runqueues[cpu];
+        len += snprintf(buf + len, size - len, "%3d %4d %7d %8llu %9llu %6llu %8llu %8llu\n",
+                        cpu, rq->node, rq->nr_running, rq->switches,
+                        rq->steal_requests, rq->tasks_pushed, rq->tasks_received,
+                        rq->ai_tunes);
+    }
+
+    return len < size ? len : size;
+}
+
+// procfs: /proc/schedlat, decision latency histograms per mode
+size_t runqueue_latency_show(char *buf, size_t size) {
+    static const char *mode_names[SCHED_MODES] = {"bitmap", "ai"};
+    size_t len = 0;
+
+    for (uint32_t mode = 0; mode < SCHED_MODES && len < size; mode++) {
+        uint64_t total = 0;
+        uint64_t hist[SCHED_HIST_BUCKETS] = {0};
+        for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+            total += runqueues[cpu].decisions[mode];
+            for (uint32_t b = 0; b < SCHED_HIST_BUCKETS; b++) {
+                hist[b] += runqueues[cpu].decision_hist[mode][b];
+            }
+        }
+
+        len += snprintf(buf + len, size - len, "%s: %llu decisions\n",
+                        mode_names[mode], total);
+        for (uint32_t b = 0; b < SCHED_HIST_BUCKETS && len < size; b++) {
+            if (hist[b]) {
+                len += snprintf(buf + len, size - len, "  %10llu-%llu cycles: %llu\n",
+                                1ULL << b, (2ULL << b) - 1, hist[b]);
+            }
+        }
+    }
+
+    return len < size ? len : size;
+}
@@ -0,0 +1,93 @@
+#ifndef RUNQUEUE_H
+#define RUNQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "process.h"
+#include "../core/smp.h"
+
+// Priority levels: higher runs first, the bitmap finds the top in O(1)
+#define SCHED_PRIORITIES 64
+#define SCHED_MAX_BOOST 4         // Levels the AI tuner may add on top
+
+// Asynchronous AI tuning
+#define SCHED_AI_PERIOD_MS 100    // Tuner wakeup interval
+#define SCHED_AI_LEVELS 4         // Priority levels consulted per wakeup
+#define SCHED_MIN_QUANTUM 1       // Clamp for model-suggested quanta, in ticks
+#define SCHED_MAX_QUANTUM 100
+
+// Decision latency histogram: bucket n counts decisions of 2^n..2^(n+1)-1 cycles
+#define SCHED_HIST_BUCKETS 32
+
+// Scheduling modes, switchable at run time to compare them
+typedef enum {
+    SCHED_MODE_BITMAP,        // O(1) pick-next, AI tunes asynchronously
+    SCHED_MODE_AI,            // AI decides on every schedule() call
+    SCHED_MODES
+} sched_mode_t;
+
+// Load balancing
+#define RQ_MIGRATION_COST_MS 5    // Ran this recently: cache hot, don't move
+#define RQ_HOT_IMBALANCE 4        // Move cache-hot tasks only beyond this
+#define RQ_NUMA_IMBALANCE 2       // Extra imbalance needed to steal off-node
+
+// Per-CPU run queue. Tasks are handed over through the lock-free inbox
+// and work is asked for through steal_request, so the queue is edited
+// almost only by its owner CPU, with interrupts disabled. lock is held
+// for every edit all the same, for the rare dequeue from another CPU.
+typedef struct {
+    ready_queue_t queues[SCHED_PRIORITIES];
+    uint64_t bitmap;                  // Bit n set while queues[n] is non-empty
+    spinlock_t lock;                  // Guards queues and bitmap
+    process_t *idle;
+    process_t *prev_ready;            // Switched out, queued once its context is saved
+    process_t *inbox;                 // Treiber stack linked by rq_next
+    volatile uint32_t nr_running;     // Queued + inbox, read by stealers
+    volatile int32_t steal_request;   // CPU waiting for work, -1 if none
+    uint32_t cpu;
+    uint32_t node;
+
+    // Statistics
+    uint64_t switches;
+    uint64_t steal_requests;
+    uint64_t tasks_pushed;            // Given away to stealers
+    uint64_t tasks_received;          // Arrived through the inbox
+    uint64_t ai_tunes;
+    uint64_t decisions[SCHED_MODES];
+    uint64_t decision_hist[SCHED_MODES][SCHED_HIST_BUCKETS];
+} __attribute__((aligned(64))) runqueue_t;
+
+// Whether anything is waiting to run here, including handed-over tasks
+static inline bool runqueue_has_work(runqueue_t *rq) {
+    return rq->bitmap || __atomic_load_n(&rq->inbox, __ATOMIC_RELAXED);
+}
+
+// Function prototypes
+void runqueue_init(void);
+runqueue_t* cpu_runqueue(uint32_t cpu);
+runqueue_t* this_runqueue(void);
+void runqueue_drain_inbox(runqueue_t *rq);
+process_t* runqueue_pick_next(runqueue_t *rq);
+ready_queue_t* runqueue_top_queue(runqueue_t *rq);
+uint32_t runqueue_top_priority(runqueue_t *rq);
+uint32_t sched_effective_priority(process_t *proc);
+void runqueue_requeue(runqueue_t *rq, process_t *proc);
+void runqueue_record_decision(runqueue_t *rq, sched_mode_t mode, uint64_t cycles);
+size_t runqueue_latency_show(char *buf, size_t size);
+void runqueue_handle_steal(runqueue_t *rq);
+bool runqueue_idle_balance(runqueue_t *rq);
+uint32_t runqueue_select_cpu(uint32_t node);
+uint64_t runqueue_total_switches(void);
+size_t runqueue_show(char *buf, size_t size);
+
+void sched_set_mode(sched_mode_t mode);
+bool should_reschedule(void);
+void update_scheduler_quantum(void);
+void scheduler_init(void);
+
+void add_to_ready_queue(process_t *proc);
+void remove_from_ready_queue(process_t *proc);
+void migrate_process(process_t *proc, uint32_t target_cpu);
+void wake_up_process(process_t *proc);
+
+#endif // RUNQUEUE_H
@@ -179,7 +179,7 @@
      gpu_cleanup(&gpu);
      model_repo_cleanup(&repo);
      
-     if (model_data) free(model_data);
+     model_repo_unload(model_data, model_size);
      
      printf("\n✓ All systems cleaned up\n");
  }
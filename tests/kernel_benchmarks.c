@@ -0,0 +1,321 @@
+#include "test_framework.h"
+
+// Scheduler: context switches per second as cores are added
+#define CTXSW_THREADS_PER_CPU 2
+#define CTXSW_WINDOW_MS 1000
+
+static volatile bool ctxsw_stop;
+
+static void ctxsw_yielder(void) {
+    while (!ctxsw_stop) {
+        yield_cpu();
+    }
+    process_exit(0);
+}
+
+void bench_context_switch_scaling(void) {
+    kprintf("[BENCH] Context switch scaling (%d yielders per core)\n",
+            CTXSW_THREADS_PER_CPU);
+    kprintf("[BENCH] cores  switches/s  per-core/s\n");
+    
+    for (uint32_t cores = 1; cores <= num_cpus; cores++) {
+        ctxsw_stop = false;
+        
+        for (uint32_t i = 0; i < cores * CTXSW_THREADS_PER_CPU; i++) {
+            process_t* proc = process_create("ctxsw", ctxsw_yielder, 10);
+            migrate_process(proc, i % cores);
+            proc->flags |= PROCESS_FLAG_PINNED;
+        }
+        
+        uint64_t start_switches = runqueue_total_switches();
+        uint64_t start = get_system_time();
+        sleep_ms(CTXSW_WINDOW_MS);
+        uint64_t elapsed = get_system_time() - start;
+        uint64_t switches = runqueue_total_switches() - start_switches;
+        
+        ctxsw_stop = true;
+        sleep_ms(100);   // Let the yielders exit
+        
+        if (elapsed == 0) {
+            elapsed = 1;
+        }
+        uint64_t rate = switches * 1000 / elapsed;
+        kprintf("[BENCH] %5d  %10llu  %10llu\n", cores, rate, rate / cores);
+    }
+}
+
+// Context switch cost with and without live FPU state: two tasks pinned
+// to one CPU yield to each other, so each round trip is two switches
+#define SWITCH_COST_ROUNDS 10000
+
+static volatile uint64_t switch_cost_cycles;
+static volatile uint32_t switch_cost_done;
+
+static void switch_cost_integer(void) {
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < SWITCH_COST_ROUNDS; i++) {
+        yield_cpu();
+    }
+    __atomic_add_fetch(&switch_cost_cycles, rdtsc() - start, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&switch_cost_done, 1, __ATOMIC_RELEASE);
+}
+
+// Dirties the SSE registers every slice, so each switch saves and the
+// first use after it traps and restores
+__attribute__((target("sse2")))
+static void switch_cost_simd(void) {
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < SWITCH_COST_ROUNDS; i++) {
+        asm volatile("pxor %%xmm0, %%xmm0\n"
+                     "paddq %%xmm0, %%xmm1" : : : "xmm0", "xmm1");
+        yield_cpu();
+    }
+    __atomic_add_fetch(&switch_cost_cycles, rdtsc() - start, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&switch_cost_done, 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t measure_switch_cost(void (*task)(void)) {
+    switch_cost_cycles = 0;
+    switch_cost_done = 0;
+    
+    for (int i = 0; i < 2; i++) {
+        process_t* proc = process_create("swcost", task, 10);
+        migrate_process(proc, 0);
+        proc->flags |= PROCESS_FLAG_PINNED;
+    }
+    while (__atomic_load_n(&switch_cost_done, __ATOMIC_ACQUIRE) < 2) {
+        sleep_ms(10);
+    }
+    
+    // Each task's time covers its own round trips: two switches apiece
+    return switch_cost_cycles / (2 * 2 * SWITCH_COST_ROUNDS);
+}
+
+void bench_switch_cost(void) {
+    fpu_stats_t before, after;
+    
+    uint64_t integer = measure_switch_cost(switch_cost_integer);
+    fpu_get_stats(0, &before);
+    uint64_t simd = measure_switch_cost(switch_cost_simd);
+    fpu_get_stats(0, &after);
+    
+    kprintf("[BENCH] Context switch: %llu cycles integer-only, %llu cycles with SIMD state\n",
+            integer, simd);
+    kprintf("[BENCH] FPU: %llu #NM, %llu saves, %llu restores, %llu cached\n",
+            after.nm_faults - before.nm_faults, after.saves - before.saves,
+            after.restores - before.restores, after.cached - before.cached);
+}
+
+// Clock reads: kernel get_system_time and the lock-free clock page path
+// user space takes through its read-only mapping
+#define CLOCK_READ_CALLS 1000000
+
+static void bench_clock_loop(const char *name, uint64_t (*read)(void)) {
+    volatile uint64_t sink = 0;
+    uint64_t start = get_time_ns();
+    for (uint32_t i = 0; i < CLOCK_READ_CALLS; i++) {
+        sink += read();
+    }
+    uint64_t elapsed = get_time_ns() - start;
+    (void)sink;
+    
+    kprintf("[BENCH] %-16s %llu.%03llu ns/call\n", name,
+            elapsed / CLOCK_READ_CALLS,
+            (elapsed % CLOCK_READ_CALLS) * 1000 / CLOCK_READ_CALLS);
+}
+
+static uint64_t clock_page_read(void) {
+    return vclock_read_ns(vclock);
+}
+
+void bench_clock_read(void) {
+    bench_clock_loop("get_system_time", get_system_time);
+    bench_clock_loop("get_time_ns", get_time_ns);
+    bench_clock_loop("clock page", clock_page_read);
+}
+
+// Process lifecycle: fork, exit and reap, cycles per round trip
+#define FORK_EXIT_ITERATIONS 10000
+
+void bench_fork_exit(void) {
+    uint32_t pids_before = pid_count();
+    uint64_t start = rdtsc();
+    
+    for (uint32_t i = 0; i < FORK_EXIT_ITERATIONS; i++) {
+        int pid = sys_fork();
+        if (pid == 0) {
+            process_exit(0);
+        }
+        if (pid < 0) {
+            kprintf("[BENCH] fork failed after %d iterations: %d\n", i, pid);
+            return;
+        }
+        process_wait(pid, NULL);
+    }
+    
+    uint64_t cycles = rdtsc() - start;
+    kprintf("[BENCH] fork/exit/wait: %llu cycles per iteration, %d PIDs leaked\n",
+            cycles / FORK_EXIT_ITERATIONS, pid_count() - pids_before);
+}
+
+// Null system call through each entry path, made from ring 3 as user
+// programs make it. A task maps a code page and a result page into its
+// address space and drops to user mode, where the code below times
+// SYS_NULL through SYSCALL and then through int $0x80, stores the total
+// cycles of each loop in the result page and exits.
+#define NULL_SYSCALL_CALLS 1000000
+#define NULL_SYSCALL_CODE_ADDR 0x400000ULL
+#define NULL_SYSCALL_DATA_ADDR 0x401000ULL
+#define NULL_SYSCALL_TIMEOUT_MS 10000
+
+#define BENCH_STR(x) #x
+#define BENCH_XSTR(x) BENCH_STR(x)
+
+// User code, rdi = calls, rsi = result page. Position independent, as it
+// runs from a copy.
+extern const uint8_t null_syscall_user[], null_syscall_user_end[];
+asm(".pushsection .text\n"
+    "null_syscall_user:\n"
+    "    movq %rdi, %r12\n"
+    "    movq %rsi, %r13\n"
+    "    rdtsc\n"
+    "    shlq $32, %rdx\n"
+    "    orq %rdx, %rax\n"
+    "    movq %rax, %r14\n"
+    "    movq %r12, %r15\n"
+    "1:  movl $" BENCH_XSTR(SYS_NULL) ", %eax\n"
+    "    syscall\n"
+    "    decq %r15\n"
+    "    jnz 1b\n"
+    "    rdtsc\n"
+    "    shlq $32, %rdx\n"
+    "    orq %rdx, %rax\n"
+    "    subq %r14, %rax\n"
+    "    movq %rax, 0(%r13)\n"
+    "    rdtsc\n"
+    "    shlq $32, %rdx\n"
+    "    orq %rdx, %rax\n"
+    "    movq %rax, %r14\n"
+    "    movq %r12, %r15\n"
+    "2:  movl $" BENCH_XSTR(SYS_NULL) ", %eax\n"
+    "    int $0x80\n"
+    "    decq %r15\n"
+    "    jnz 2b\n"
+    "    rdtsc\n"
+    "    shlq $32, %rdx\n"
+    "    orq %rdx, %rax\n"
+    "    subq %r14, %rax\n"
+    "    movq %rax, 8(%r13)\n"
+    "    movl $" BENCH_XSTR(SYS_EXIT) ", %eax\n"
+    "    xorl %edi, %edi\n"
+    "    syscall\n"
+    "    ud2\n"
+    "null_syscall_user_end:\n"
+    ".popsection\n");
+
+static uint64_t null_syscall_results;     // Frame of the result page
+
+static void null_syscall_task(void) {
+    address_space_t *as = current_process->memory.mm;
+    uint64_t code = (uint64_t)pmm_alloc_pages(1);
+    memcpy(phys_to_virt(code), null_syscall_user,
+           null_syscall_user_end - null_syscall_user);
+    
+    int result = vmm_install_special_page(as, NULL_SYSCALL_CODE_ADDR, code, PTE_USER);
+    vmm_release_special_page(code);    // The mapping holds it from here
+    if (result < 0 ||
+        vmm_install_special_page(as, NULL_SYSCALL_DATA_ADDR, null_syscall_results,
+                                 PTE_USER | PTE_WRITABLE | PTE_NX) < 0) {
+        kprintf("[BENCH] Null syscall: could not map the user pages\n");
+        process_exit(-1);
+    }
+    
+    // Into ring 3 with interrupts on and the user GS, as on every return
+    // to user mode; the result page doubles as stack
+    asm volatile(
+        "cli\n"
+        "swapgs\n"
+        "pushq %[ss]\n"
+        "pushq %[rsp]\n"
+        "pushq $0x202\n"
+        "pushq %[cs]\n"
+        "pushq %[rip]\n"
+        "iretq\n"
+        :
+        : [ss] "i"(USER_DS | 3), [cs] "i"(USER_CS | 3),
+          [rsp] "r"(NULL_SYSCALL_DATA_ADDR + PAGE_SIZE),
+          [rip] "r"(NULL_SYSCALL_CODE_ADDR),
+          "D"((uint64_t)NULL_SYSCALL_CALLS), "S"(NULL_SYSCALL_DATA_ADDR)
+        : "memory"
+    );
+    __builtin_unreachable();
+}
+
+void bench_null_syscall(void) {
+    null_syscall_results = (uint64_t)pmm_alloc_pages(1);
+    volatile uint64_t *cycles = phys_to_virt(null_syscall_results);
+    memset((void*)cycles, 0, PAGE_SIZE);
+    
+    if (!process_create("nullsys", null_syscall_task, 10)) {
+        kprintf("[BENCH] Null syscall: could not create the user task\n");
+        vmm_release_special_page(null_syscall_results);
+        return;
+    }
+    
+    // The int $0x80 total is stored last
+    uint64_t waited = 0;
+    while (!cycles[1] && waited < NULL_SYSCALL_TIMEOUT_MS) {
+        sleep_ms(10);
+        waited += 10;
+    }
+    
+    if (cycles[1]) {
+        kprintf("[BENCH] Null syscall from ring 3: %llu cycles via syscall, %llu cycles via int $0x80\n",
+                cycles[0] / NULL_SYSCALL_CALLS, cycles[1] / NULL_SYSCALL_CALLS);
+    } else {
+        kprintf("[BENCH] Null syscall: user task did not finish\n");
+    }
+    vmm_release_special_page(null_syscall_results);
+}
+
+// Open/close round trips with many files already open, where each open
+// used to scan the whole descriptor table
+#define OPEN_CLOSE_HELD 4096
+#define OPEN_CLOSE_ITERATIONS 100000
+
+void bench_open_close(void) {
+    static int held[OPEN_CLOSE_HELD];
+    for (uint32_t i = 0; i < OPEN_CLOSE_HELD; i++) {
+        held[i] = vfs_open("/tmp/bench_fds", O_CREAT | O_RDONLY, 0644);
+        if (held[i] < 0) {
+            kprintf("[BENCH] open failed after %d files: %d\n", i, held[i]);
+            while (i--) {
+                vfs_close(held[i]);
+            }
+            return;
+        }
+    }
+    
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < OPEN_CLOSE_ITERATIONS; i++) {
+        vfs_close(vfs_open("/tmp/bench_fds", O_RDONLY, 0));
+    }
+    uint64_t cycles = rdtsc() - start;
+    
+    for (uint32_t i = 0; i < OPEN_CLOSE_HELD; i++) {
+        vfs_close(held[i]);
+    }
+    
+    kprintf("[BENCH] open/close with %d files open: %llu cycles per pair\n",
+            OPEN_CLOSE_HELD, cycles / OPEN_CLOSE_ITERATIONS);
+}
+
+// Run all benchmarks
+void run_kernel_benchmarks(void) {
+    bench_context_switch_scaling();
+    bench_switch_cost();
+    bench_clock_read();
+    bench_fork_exit();
+    bench_null_syscall();
+    bench_open_close();
+}
@@ -21,6 +21,198 @@ void test_memory_alignment(void) {
     kfree(ptr);
 }
 
+void test_buddy_coalescing(void) {
+    void* a = pmm_alloc_pages(1);
+    void* b = pmm_alloc_pages(1);
+    ASSERT(a != NULL);
+    ASSERT(b != NULL);
+    
+    memory_zone_t* zone = zone_for_address((uint64_t)a);
+    ASSERT(zone != NULL);
+    uint32_t free_before = zone->free_pages;
+    
+    pmm_free_pages(a, 1);
+    pmm_free_pages(b, 1);
+    
+    // Frees land on the per-CPU cache until it is drained
+    pcp_drain_cpu(smp_processor_id());
+    ASSERT(zone->free_pages >= free_before + 2);
+    
+    // A 3-page request rounds up to an order-2 block
+    void* c = pmm_alloc_pages(3);
+    ASSERT(c != NULL);
+    ASSERT_EQ(((uint64_t)c / PAGE_SIZE) & 3, 0);
+    ASSERT_EQ(phys_to_page((uint64_t)c)->order, 2);
+    pmm_free_pages(c, 3);
+}
+
+void test_pcp_fast_path(void) {
+    pcp_stats_t before, after;
+    uint32_t cpu = smp_processor_id();
+    
+    pcp_get_stats(cpu, &before);
+    void* page = pmm_alloc_pages(1);
+    ASSERT(page != NULL);
+    pmm_free_pages(page, 1);
+    
+    // The page just freed is hot and comes straight back
+    void* again = pmm_alloc_pages(1);
+    ASSERT_EQ(again, page);
+    pmm_free_pages(again, 1);
+    
+    pcp_get_stats(cpu, &after);
+    ASSERT(after.alloc_hits >= before.alloc_hits + 1);
+    ASSERT_EQ(after.frees, before.frees + 2);
+    
+    // Pages parked in the cache still count as free
+    uint64_t free_cached = pmm_free_bytes();
+    pcp_drain_cpu(cpu);
+    ASSERT_EQ(pmm_free_bytes(), free_cached);
+}
+
+void test_numa_placement(void) {
+    ASSERT(num_numa_nodes >= 1);
+
+    // Zones never straddle an SRAT range and carry its node
+    for (uint32_t z = 0; z < num_memory_zones; z++) {
+        memory_zone_t* zone = &memory_zones[z];
+        ASSERT_EQ(zone->node, numa_node_of_address(zone->start_addr));
+        ASSERT(numa_range_end(zone->start_addr) >= zone->end_addr);
+    }
+
+    for (uint32_t n = 0; n < num_numa_nodes; n++) {
+        numa_node_t* node = numa_get_node(n);
+        ASSERT(node != NULL);
+        ASSERT_EQ(numa_distance(n, n), NUMA_LOCAL_DISTANCE);
+
+        // Fallback order is nearest-first by SLIT distance
+        for (uint32_t i = 1; i < node->zonelist_len; i++) {
+            uint32_t prev = memory_zones[node->zonelist[i - 1]].node;
+            uint32_t next = memory_zones[node->zonelist[i]].node;
+            ASSERT(numa_distance(n, prev) <= numa_distance(n, next));
+        }
+
+        // A node with memory serves itself first, and a block too large
+        // for the per-CPU cache is counted as a local allocation
+        if (!node->zonelist_len || memory_zones[node->zonelist[0]].node != n) {
+            continue;
+        }
+        uint64_t local_before = node->local_allocs;
+        void* block = pmm_alloc_pages_node(1U << (PCP_MAX_ORDER + 1), n);
+        ASSERT(block != NULL);
+        ASSERT_EQ(zone_for_address((uint64_t)block)->node, n);
+        ASSERT_EQ(node->local_allocs, local_before + 1);
+        pmm_free_pages(block, 1U << (PCP_MAX_ORDER + 1));
+    }
+
+    ASSERT(numa_get_node(num_numa_nodes) == NULL);
+}
+
+static int ctor_calls = 0;
+
+static void test_object_ctor(void* obj) {
+    *(uint32_t*)obj = 0xC0FFEE;
+    ctor_calls++;
+}
+
+void test_slab_cache(void) {
+    kmem_cache_t* cache = kmem_cache_create("test_obj", 24, 0, 0, test_object_ctor);
+    ASSERT(cache != NULL);
+    ASSERT(cache->objects_per_slab >= SLAB_MIN_OBJECTS);
+    
+    uint32_t* a = kmem_cache_alloc(cache);
+    uint32_t* b = kmem_cache_alloc(cache);
+    ASSERT(a != NULL);
+    ASSERT(b != NULL);
+    ASSERT(a != b);
+    ASSERT_EQ(*a, 0xC0FFEE);
+    ASSERT(ctor_calls >= (int)cache->objects_per_slab);
+    
+    // Freed objects keep their constructed state and are reused LIFO
+    kmem_cache_free(cache, b);
+    uint32_t* c = kmem_cache_alloc(cache);
+    ASSERT_EQ(c, b);
+    ASSERT_EQ(*c, 0xC0FFEE);
+    
+    kmem_cache_free(cache, a);
+    kmem_cache_free(cache, c);
+    kmem_cache_destroy(cache);
+}
+
+void test_vmm_demand_cow(void) {
+    address_space_t* as = vmm_create_address_space();
+    ASSERT(as != NULL);
+    
+    // Mappings are lazy until faulted
+    uint8_t* small = vmm_mmap(as, NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS);
+    ASSERT(small != MAP_FAILED);
+    ASSERT_EQ(vmm_translate(as, (uint64_t)small), 0);
+    ASSERT(vmm_handle_fault(as, (uint64_t)small, PF_WRITE | PF_USER));
+    ASSERT(vmm_translate(as, (uint64_t)small) != 0);
+    
+    // Large anonymous regions fault in 2MB at a time
+    uint8_t* big = vmm_mmap(as, NULL, 4 * HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS);
+    ASSERT(big != MAP_FAILED);
+    ASSERT_EQ((uint64_t)big & (HUGE_PAGE_SIZE - 1), 0);
+    ASSERT(vmm_handle_fault(as, (uint64_t)big + 12345, PF_USER));
+    ASSERT_EQ(as->huge_pages, 1);
+    
+    // Fork shares the frame until one side writes
+    address_space_t* child = vmm_fork(as);
+    ASSERT(child != NULL);
+    uint64_t shared = vmm_translate(as, (uint64_t)small);
+    ASSERT_EQ(vmm_translate(child, (uint64_t)small), shared);
+    ASSERT(vmm_handle_fault(child, (uint64_t)small, PF_PRESENT | PF_WRITE | PF_USER));
+    ASSERT(vmm_translate(child, (uint64_t)small) != shared);
+    ASSERT_EQ(child->cow_faults, 1);
+    
+    vmm_destroy_address_space(child);
+    vmm_destroy_address_space(as);
+}
+
+void test_kcompactd(void) {
+    const uint32_t count = 64;
+    address_space_t* as = vmm_create_address_space();
+    ASSERT(as != NULL);
+    
+    // Movable anonymous pages, tagged through the frame so a migration
+    // that loses or mixes up contents shows
+    uint8_t* region = vmm_mmap(as, NULL, count * PAGE_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS);
+    ASSERT(region != MAP_FAILED);
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t virt = (uint64_t)region + i * PAGE_SIZE;
+        ASSERT(vmm_handle_fault(as, virt, PF_WRITE | PF_USER));
+        *(uint32_t*)phys_to_virt(vmm_translate(as, virt)) = 0xC0DE0000 | i;
+    }
+    
+    // A failed allocation forces a pass whatever the watermark says
+    kcompactd_stats_t before, after;
+    kcompactd_get_stats(&before);
+    kcompactd_wakeup(true);
+    after = before;
+    for (int i = 0; i < 100 && after.passes == before.passes; i++) {
+        sleep_ms(10);
+        kcompactd_get_stats(&after);
+    }
+    ASSERT(after.wakeups > before.wakeups);
+    ASSERT(after.passes > before.passes);
+    ASSERT(after.pages_scanned > before.pages_scanned);
+    
+    // The no-fail allocation path runs the same scanner synchronously
+    compact_direct();
+    
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t phys = vmm_translate(as, (uint64_t)region + i * PAGE_SIZE);
+        ASSERT(phys != 0);
+        ASSERT_EQ(*(uint32_t*)phys_to_virt(phys), 0xC0DE0000 | i);
+    }
+    
+    vmm_destroy_address_space(as);
+}
+
 // Process Tests
 void test_process_creation(void) {
     process_t* proc = process_create("test_process", NULL);
@@ -31,9 +223,118 @@ void test_process_creation(void) {
     process_destroy(proc);
 }
 
+void test_pid_allocator(void) {
+    uint32_t count = pid_count();
+    uint32_t a = pid_alloc();
+    uint32_t b = pid_alloc();
+    ASSERT(a > 0);
+    ASSERT(b > 0);
+    ASSERT(a != b);
+    ASSERT(pid_in_use(a));
+    ASSERT_EQ(pid_count(), count + 2);
+    
+    // Freed PIDs are not reused until the allocator wraps
+    pid_free(a);
+    ASSERT(!pid_in_use(a));
+    uint32_t c = pid_alloc();
+    ASSERT(c != a);
+    
+    // Drain the rest of the space: a must come back
+    bool reused = false;
+    uint32_t taken[64];
+    uint32_t n = 0;
+    uint32_t pid;
+    while ((pid = pid_alloc()) != 0) {
+        if (pid == a) {
+            reused = true;
+        }
+        if (n < 64) {
+            taken[n++] = pid;
+        } else {
+            pid_free(pid);
+            if (reused) {
+                break;
+            }
+        }
+    }
+    ASSERT(reused);
+    
+    pid_free(a);
+    for (uint32_t i = 0; i < n; i++) {
+        if (taken[i] != a) {
+            pid_free(taken[i]);
+        }
+    }
+    pid_free(b);
+    pid_free(c);
+    ASSERT_EQ(pid_count(), count);
+    
+    // Created processes are found through the PID hash
+    process_t* proc = process_create("pid_test", NULL, 1);
+    ASSERT(proc != NULL);
+    ASSERT_EQ(pid_lookup(proc->pid), proc);
+    uint32_t proc_pid = proc->pid;
+    process_destroy(proc);
+    ASSERT(pid_lookup(proc_pid) == NULL);
+}
+
+// Timer Tests
+static uint32_t wheel_fired;
+
+static void wheel_test_fn(void *data) {
+    wheel_fired++;
+    *(uint64_t*)data = 1;
+}
+
+void test_timer_wheel(void) {
+    static timer_wheel_t wheel;
+    uint64_t near = 0, mid = 0, far = 0;
+    timer_entry_t t_near, t_mid, t_far;
+    
+    timer_wheel_init(&wheel, 1000);
+    wheel_fired = 0;
+    ASSERT_EQ(timer_wheel_next_expiry(&wheel), TIMER_NO_EXPIRY);
+    
+    // One timer per level: tick resolution, first and second cascade
+    timer_entry_init(&t_near, wheel_test_fn, &near);
+    timer_entry_init(&t_mid, wheel_test_fn, &mid);
+    timer_entry_init(&t_far, wheel_test_fn, &far);
+    t_near.expires = 1010;
+    t_mid.expires = 1000 + 300;
+    t_far.expires = 1000 + 20000;
+    timer_wheel_add(&wheel, &t_near);
+    timer_wheel_add(&wheel, &t_mid);
+    timer_wheel_add(&wheel, &t_far);
+    ASSERT_EQ(timer_wheel_next_expiry(&wheel), 1010);
+    
+    // Nothing fires early, everything fires on time, including after a
+    // long jump like a tickless idle period
+    timer_wheel_run(&wheel, 1009);
+    ASSERT_EQ(wheel_fired, 0);
+    timer_wheel_run(&wheel, 1010);
+    ASSERT(near && !mid);
+    timer_wheel_run(&wheel, 1299);
+    ASSERT(!mid);
+    timer_wheel_run(&wheel, 1300);
+    ASSERT(mid && !far);
+    ASSERT(timer_wheel_next_expiry(&wheel) <= 21000);
+    timer_wheel_run(&wheel, 50000);
+    ASSERT(far);
+    ASSERT_EQ(wheel_fired, 3);
+    
+    // Deleted timers never fire
+    timer_entry_init(&t_near, wheel_test_fn, &near);
+    t_near.expires = 50005;
+    timer_wheel_add(&wheel, &t_near);
+    ASSERT(timer_wheel_del(&wheel, &t_near));
+    timer_wheel_run(&wheel, 60000);
+    ASSERT_EQ(wheel_fired, 3);
+    ASSERT_EQ(wheel.pending, 0);
+}
+
 // File System Tests
 void test_vfs_open(void) {
-    int fd = vfs_open("/tmp/test.txt", O_CREAT | O_RDWR);
+    int fd = vfs_open("/tmp/test.txt", O_CREAT | O_RDWR, 0644);
     ASSERT(fd >= 0);
     
     const char* data = "Hello, AION OS!";
@@ -43,6 +344,215 @@ void test_vfs_open(void) {
     vfs_close(fd);
 }
 
+void test_vfs_vectored_io(void) {
+    char head[6] = "AION ", tail[4] = "OS!";
+    iovec_t out[2] = {{head, 5}, {tail, 3}};
+    
+    int fd = vfs_open("/tmp/vectored.txt", O_CREAT | O_RDWR, 0644);
+    ASSERT(fd >= 0);
+    ASSERT_EQ(vfs_writev(fd, out, 2), 8);
+    vfs_close(fd);
+    
+    char a[4] = {0}, b[8] = {0};
+    iovec_t in[2] = {{a, 3}, {b, sizeof(b)}};
+    fd = vfs_open("/tmp/vectored.txt", O_RDONLY, 0);
+    ASSERT(fd >= 0);
+    ASSERT_EQ(vfs_readv(fd, in, 2), 8);
+    ASSERT(memcmp(a, "AIO", 3) == 0);
+    ASSERT(memcmp(b, "N OS!", 5) == 0);
+    
+    // The same read through the ring, batched with no-ops. The ring maps
+    // into the caller's address space, which a kernel thread lacks.
+    ioring_params_t params;
+    int64_t base = ioring_setup(8, &params);
+    if (!current_process || !current_process->memory.mm) {
+        ASSERT_EQ(base, current_process ? -EINVAL : -ESRCH);
+        vfs_close(fd);
+        return;
+    }
+    ASSERT(base > 0);
+    ioring_shared_t *sh = (ioring_shared_t*)base;
+    ioring_sqe_t *sqes = (ioring_sqe_t*)(base + params.sqes_off);
+    ioring_cqe_t *cqes = (ioring_cqe_t*)(base + params.cqes_off);
+    
+    vfs_close(fd);
+    fd = vfs_open("/tmp/vectored.txt", O_RDONLY, 0);
+    char c[8] = {0};
+    memset(sqes, 0, 3 * sizeof(ioring_sqe_t));
+    sqes[0].opcode = IORING_OP_NOP;
+    sqes[0].user_data = 1;
+    sqes[1].opcode = IORING_OP_READ;
+    sqes[1].fd = fd;
+    sqes[1].addr = (uint64_t)c;
+    sqes[1].len = 8;
+    sqes[1].user_data = 2;
+    sqes[2].opcode = IORING_OP_LAST;
+    sqes[2].user_data = 3;
+    __atomic_store_n(&sh->sq_tail, 3, __ATOMIC_RELEASE);
+    
+    ASSERT_EQ(ioring_enter(3), 3);
+    ASSERT_EQ(sh->sq_head, 3);
+    ASSERT_EQ(sh->cq_tail, 3);
+    ASSERT_EQ(cqes[0].user_data, 1);
+    ASSERT_EQ(cqes[0].res, 0);
+    ASSERT_EQ(cqes[1].user_data, 2);
+    ASSERT_EQ(cqes[1].res, 8);
+    ASSERT(memcmp(c, "AION OS!", 8) == 0);
+    ASSERT_EQ(cqes[2].res, -EINVAL);
+    ASSERT_EQ(sh->sq_dropped, 1);
+    
+    // Nothing left to submit
+    ASSERT_EQ(ioring_enter(8), 0);
+    vfs_close(fd);
+}
+
+void test_vfs_path_lookup(void) {
+    // A missing name is cached as negative, then created over
+    ASSERT(vfs_lookup_path("/tmp/lookup/leaf") == NULL);
+    ASSERT_EQ(vfs_mkdir("/tmp/lookup", 0755), 0);
+    ASSERT(vfs_lookup_path("/tmp/lookup") != NULL);
+    ASSERT(vfs_lookup_path("/tmp/lookup/leaf") == NULL);
+    
+    int fd = vfs_open("/tmp/lookup/leaf", O_CREAT | O_RDWR, 0644);
+    ASSERT(fd >= 0);
+    vfs_close(fd);
+    vfs_node_t *leaf = vfs_lookup_path("/tmp/lookup/leaf");
+    ASSERT(leaf != NULL);
+    
+    // Dot components, repeated slashes and the root's parent
+    ASSERT(vfs_lookup_path("/tmp/./lookup/../lookup//leaf") == leaf);
+    ASSERT(vfs_lookup_path("/..") == vfs_lookup_path("/"));
+    
+    // Relative to the working directory
+    if (current_process) {
+        vfs_node_t *saved = current_process->cwd;
+        ASSERT_EQ(vfs_chdir("/tmp/lookup"), 0);
+        ASSERT(vfs_lookup_path("leaf") == leaf);
+        ASSERT(vfs_lookup_path("../lookup/leaf") == leaf);
+        ASSERT_EQ(vfs_chdir("leaf"), -ENOTDIR);
+        current_process->cwd = saved;
+    }
+}
+
+void test_vfs_page_cache(void) {
+    static char out[PAGE_SIZE * 2 + 100], in[PAGE_SIZE * 2 + 100];
+    for (size_t i = 0; i < sizeof(out); i++) {
+        out[i] = (char)(i * 7);
+    }
+    
+    // Spans three pages, the last one partial
+    int fd = vfs_open("/tmp/cached.bin", O_CREAT | O_RDWR, 0644);
+    ASSERT(fd >= 0);
+    ASSERT_EQ(vfs_write(fd, out, sizeof(out)), sizeof(out));
+    vfs_close(fd);
+    
+    fd = vfs_open("/tmp/cached.bin", O_RDONLY, 0);
+    ASSERT_EQ(vfs_read(fd, in, sizeof(in)), sizeof(in));
+    ASSERT(memcmp(in, out, sizeof(out)) == 0);
+    vfs_close(fd);
+    
+    // A partial overwrite keeps the rest of the page
+    fd = vfs_open("/tmp/cached.bin", O_RDWR, 0);
+    memset(out + 10, 'x', 20);
+    ASSERT_EQ(vfs_read(fd, in, 10), 10);
+    ASSERT_EQ(vfs_write(fd, out + 10, 20), 20);
+    ASSERT_EQ(vfs_sync(fd), 0);
+    vfs_close(fd);
+    
+    // O_DIRECT sees what writeback stored
+    fd = vfs_open("/tmp/cached.bin", O_RDONLY | O_DIRECT, 0);
+    memset(in, 0, sizeof(in));
+    ASSERT_EQ(vfs_read(fd, in, sizeof(in)), sizeof(in));
+    ASSERT(memcmp(in, out, sizeof(out)) == 0);
+    vfs_close(fd);
+}
+
+void test_vfs_readahead(void) {
+    static uint32_t out[64 * PAGE_SIZE / 4], in[3000];
+    for (size_t i = 0; i < sizeof(out) / 4; i++) {
+        out[i] = i;
+    }
+    
+    int fd = vfs_open("/tmp/stream.bin", O_CREAT | O_RDWR, 0644);
+    ASSERT(fd >= 0);
+    ASSERT_EQ(vfs_write(fd, out, sizeof(out)), sizeof(out));
+    ASSERT_EQ(vfs_sync(fd), 0);
+    vfs_close(fd);
+    
+    // Odd-sized sequential reads cross window and page boundaries
+    fd = vfs_open("/tmp/stream.bin", O_RDONLY, 0);
+    size_t pos = 0;
+    while (pos < sizeof(out)) {
+        ssize_t n = vfs_read(fd, in, sizeof(in));
+        ASSERT(n > 0);
+        ASSERT(memcmp(in, (uint8_t*)out + pos, n) == 0);
+        pos += n;
+    }
+    ASSERT_EQ(vfs_read(fd, in, sizeof(in)), 0);
+    vfs_close(fd);
+}
+
+void test_vfs_mmap(void) {
+    if (!current_process) {
+        return;
+    }
+    
+    static uint8_t out[3 * PAGE_SIZE], in[3 * PAGE_SIZE];
+    for (size_t i = 0; i < sizeof(out); i++) {
+        out[i] = i * 7;
+    }
+    
+    int fd = vfs_open("/tmp/mapped.bin", O_CREAT | O_RDWR, 0644);
+    ASSERT(fd >= 0);
+    ASSERT_EQ(vfs_write(fd, out, sizeof(out)), sizeof(out));
+    
+    // A shared mapping sees the file and writes back into it
+    uint8_t *map = vfs_mmap(fd, 0, sizeof(out), PROT_READ | PROT_WRITE, MAP_SHARED);
+    ASSERT(map != MAP_FAILED);
+    ASSERT(memcmp(map, out, sizeof(out)) == 0);
+    map[PAGE_SIZE + 1] = out[PAGE_SIZE + 1] = 0xA5;
+    ASSERT_EQ(vfs_munmap(map, sizeof(out)), 0);
+    ASSERT_EQ(vfs_sync(fd), 0);
+    vfs_close(fd);
+    
+    // A private mapping keeps its writes to itself, and keeps the file
+    // open on its own after the descriptor is closed
+    fd = vfs_open("/tmp/mapped.bin", O_RDONLY, 0);
+    map = vfs_mmap(fd, PAGE_SIZE, 2 * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE);
+    ASSERT(map != MAP_FAILED);
+    vfs_close(fd);
+    ASSERT_EQ(map[1], 0xA5);
+    map[1] = 0;
+    ASSERT_EQ(vfs_munmap(map, 2 * PAGE_SIZE), 0);
+    
+    fd = vfs_open("/tmp/mapped.bin", O_RDONLY, 0);
+    ASSERT_EQ(vfs_read(fd, in, sizeof(in)), sizeof(in));
+    ASSERT(memcmp(in, out, sizeof(out)) == 0);
+    vfs_close(fd);
+}
+
+void test_vfs_fd_table(void) {
+    static int fds[200];
+    
+    // Past the first table size, so the table grows on the way
+    for (int i = 0; i < 200; i++) {
+        fds[i] = vfs_open("/tmp/fds.txt", O_CREAT | O_RDWR, 0644);
+        ASSERT(fds[i] >= 0);
+    }
+    
+    // Freed fds come back lowest first
+    ASSERT_EQ(vfs_close(fds[150]), 0);
+    ASSERT_EQ(vfs_close(fds[10]), 0);
+    ASSERT_EQ(vfs_close(fds[10]), -EBADF);
+    ASSERT_EQ(vfs_open("/tmp/fds.txt", O_RDWR, 0), fds[10]);
+    ASSERT_EQ(vfs_open("/tmp/fds.txt", O_RDWR, 0), fds[150]);
+    
+    for (int i = 0; i < 200; i++) {
+        ASSERT_EQ(vfs_close(fds[i]), 0);
+    }
+    ASSERT_EQ(vfs_write(fds[0], "x", 1), -EBADF);
+}
+
 // AI Tests
 void test_ai_memory_prediction(void) {
     process_t* proc = process_create("test", NULL);
@@ -71,8 +581,22 @@ void run_kernel_tests(void) {
     
     test_add_test(suite, "Memory Allocation", test_memory_allocation);
     test_add_test(suite, "Memory Alignment", test_memory_alignment);
+    test_add_test(suite, "Buddy Coalescing", test_buddy_coalescing);
+    test_add_test(suite, "Per-CPU Page Cache", test_pcp_fast_path);
+    test_add_test(suite, "NUMA Placement", test_numa_placement);
+    test_add_test(suite, "Slab Cache", test_slab_cache);
+    test_add_test(suite, "VMM Demand Paging/CoW", test_vmm_demand_cow);
+    test_add_test(suite, "Background Compaction", test_kcompactd);
     test_add_test(suite, "Process Creation", test_process_creation);
+    test_add_test(suite, "PID Allocator", test_pid_allocator);
+    test_add_test(suite, "Timer Wheel", test_timer_wheel);
     test_add_test(suite, "VFS Open/Write", test_vfs_open);
+    test_add_test(suite, "VFS Vectored I/O and Ring", test_vfs_vectored_io);
+    test_add_test(suite, "VFS Path Lookup", test_vfs_path_lookup);
+    test_add_test(suite, "VFS Page Cache", test_vfs_page_cache);
+    test_add_test(suite, "VFS Readahead", test_vfs_readahead);
+    test_add_test(suite, "VFS Memory Map", test_vfs_mmap);
+    test_add_test(suite, "VFS Descriptor Table", test_vfs_fd_table);
     test_add_test(suite, "AI Memory Prediction", test_ai_memory_prediction);
     test_add_test(suite, "TCP Socket", test_tcp_connection);
     
@@ -1,6 +1,7 @@
 #include "ai_ide.h"
 #include "../../kernel/ai/nlp/nlp_engine.h"
 #include "../../kernel/ai/ml/tflite.h"
+#include "../../kernel/memory/vmm.h"
 #include <string.h>
 #include <ctype.h>
 
@@ -65,46 +66,49 @@ code_buffer_t* ai_ide_open_file(const char* filename) {
         
         kprintf("[AI IDE] New file: %s\n", filename);
     } else {
-        // Existing file
+        // Existing file, mapped rather than read; lines are copied out
         struct stat st;
         vfs_fstat(fd, &st);
         
-        char* file_data = kmalloc(st.st_size + 1);
-        vfs_read(fd, file_data, st.st_size);
-        file_data[st.st_size] = '\0';
+        size_t size = st.st_size;
+        const char* file_data = size ? vfs_mmap(fd, 0, size, PROT_READ, MAP_PRIVATE)
+                                     : NULL;
         vfs_close(fd);
+        if (file_data == MAP_FAILED) {
+            file_data = NULL;
+            size = 0;
+        }
         
         // Split into lines
         buffer->capacity = 16;
         buffer->lines = kmalloc(buffer->capacity * sizeof(char*));
         buffer->num_lines = 0;
         
-        char* line_start = file_data;
-        char* line_end;
+        const char* line_start = file_data;
+        const char* file_end = file_data + size;
         
-        while ((line_end = strchr(line_start, '\n')) != NULL) {
-            *line_end = '\0';
+        while (line_start < file_end) {
+            const char* line_end = memchr(line_start, '\n', file_end - line_start);
+            size_t len = (line_end ? line_end : file_end) - line_start;
             
             if (buffer->num_lines >= buffer->capacity) {
                 buffer->capacity *= 2;
                 buffer->lines = krealloc(buffer->lines, buffer->capacity * sizeof(char*));
             }
             
-            buffer->lines[buffer->num_lines++] = strdup(line_start);
-            line_start = line_end + 1;
+            char* line = kmalloc(len + 1);
+            memcpy(line, line_start, len);
+            line[len] = '\0';
+            buffer->lines[buffer->num_lines++] = line;
+            
+            // The last line may have no trailing newline
+            line_start += len + 1;
         }
         
-        // Last line (if no trailing newline)
-        if (*line_start) {
-            if (buffer->num_lines >= buffer->capacity) {
-                buffer->capacity *= 2;
-                buffer->lines = krealloc(buffer->lines, buffer->capacity * sizeof(char*));
-            }
-            buffer->lines[buffer->num_lines++] = strdup(line_start);
+        if (file_data) {
+            vfs_munmap((void*)file_data, size);
         }
         
-        kfree(file_data);
-        
         kprintf("[AI IDE] Opened: %s (%d lines)\n", filename, buffer->num_lines);
     }
     